@@ -10,17 +10,44 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
 #include <driver/gpio.h>
 #include <nvs_flash.h>
 #include <nvs.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
 #include <string.h> // For memset, memcpy, memcmp
 #include <stdio.h>  // For snprintf
+#include <math.h>   // For lroundf
 
 #include "sdkconfig.h"
 #include "buttons.h"
 #include "matrix.h"
+#include "sr_bus.h"
 #include "gui.h"
+#include "hw_profile.h"
+#include "led.h"
+#include "link.h"
+#include "link_proto.h"
+#include "patch_settings.h"
+#include "tap_tempo.h"
+#include "tuner.h"
+#include "pitch.h"
+#include "meter.h"
+#include "loop_watch.h"
+#include "panic_bypass.h"
+#include "expander.h"
+#include "sr_input.h"
+#include "debounce.h"
+#include "control.h"
+#include "power.h"
+#include "deadline.h"
+#include "health.h"
+#include "preset_predict.h"
+#include "show.h"
+#include "usb_midi.h"
 
 #define NVS_NAMESPACE "patch_bay"       /**< NVS namespace for storing patch data */
 #define NVS_KEY_LIVE_CONFIG "live_cfg"  /**< NVS key for the live configuration */
@@ -39,26 +66,61 @@ static const char *TAG = "Buttons";
 /** @brief Current system mode (live, programming, recall, save) */
 static patch_bay_system_mode_t current_system_mode = MODE_LIVE;
 /** @brief Current active patch configuration */
-static uint8_t live_patch_data[NUM_PEDALS_MAX] = {0};
+static uint8_t live_patch_data[CHAIN_LEN_MAX] = {0};
 /** @brief Length of the current active patch */
 static uint8_t live_patch_len = 0;
 /** @brief Index of the preset the current patch was loaded from (-1 if custom) */
 static int8_t loaded_from_preset_slot = -1; // 0-7 if live_patch_data matches a preset, -1 otherwise
+/** @brief Settings of the current active patch (tap tempo, ...) */
+static patch_settings_t live_settings;
+/** @brief Control outputs before MODE_CONTROL_EDIT was entered, restored on cancel */
+static uint8_t ctl_mask_backup = 0;
+/** @brief Outputs fed before MODE_CONTROL_EDIT was entered, restored on cancel */
+static uint8_t outputs_backup = MATRIX_OUTPUTS_DEFAULT;
+/** @brief Names of the outputs in status messages, by MATRIX_OUTPUT_* */
+static const char *const output_names[MATRIX_NUM_OUTPUTS] = {"Amp A", "Amp B", "Tuner Out"};
+/** @brief Scenes before MODE_SCENE_EDIT was entered, restored on cancel */
+static patch_settings_t scene_backup;
+/** @brief Tick at which a tapped tempo or scene change is written to the live settings (0 if none pending) */
+static TickType_t settings_save_tick = 0;
+#ifdef CONFIG_TUNER_ENABLE
+/** @brief Both mode buttons were let go since MODE_TUNER was entered */
+static bool tuner_released = false;
+#endif
 
-// --- Button Hardware Definitions ---
-/** @brief GPIO pins for pedal buttons */
-static const gpio_num_t PEDAL_BUTTON_PINS[NUM_PEDALS_MAX] = {
-    CONFIG_PEDAL_BUTTON_1_PIN, CONFIG_PEDAL_BUTTON_2_PIN, CONFIG_PEDAL_BUTTON_3_PIN, CONFIG_PEDAL_BUTTON_4_PIN,
-    CONFIG_PEDAL_BUTTON_5_PIN, CONFIG_PEDAL_BUTTON_6_PIN, CONFIG_PEDAL_BUTTON_7_PIN, CONFIG_PEDAL_BUTTON_8_PIN};
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+/**
+ * @brief A preset kept compiled for the next recall
+ */
+typedef struct
+{
+    int8_t slot;                  /**< Preset slot, -1 if unused */
+    uint8_t chain[CHAIN_LEN_MAX]; /**< Preset chain */
+    uint8_t len;                  /**< Length of chain */
+    patch_settings_t settings;    /**< Preset settings */
+    matrix_prepared_t route;      /**< Route compiled from chain and settings */
+} preloaded_preset_t;
 
-#ifdef CONFIG_ENABLE_LEDS
-// We'll define a shift register-based LED implementation
-// The LEDs are controlled by a shift register with a single data pin
-static const gpio_num_t LED_SR_DATA_PIN = CONFIG_LED_SR_DATA_PIN;
-static const gpio_num_t LED_SR_CLOCK_PIN = CONFIG_SR_CLOCK_PIN; // Reusing main shift register clock
-static const gpio_num_t LED_SR_LATCH_PIN = CONFIG_SR_LATCH_PIN; // Reusing main shift register latch
+#define PRELOAD_STALE -2 /**< preloaded_for value that makes new candidates be picked */
+
+/** @brief Likely next presets, most likely first */
+static preloaded_preset_t preloaded[CONFIG_PRESET_PREDICT_CANDIDATES];
+/** @brief Preset the candidates were picked for (loaded_from_preset_slot), or PRELOAD_STALE */
+static int8_t preloaded_for = PRELOAD_STALE;
 #endif
 
+#ifdef CONFIG_SHOW_ENABLE
+/** @brief Song of the show playing, -1 if no show is running */
+static int show_at = -1;
+/** @brief Song held in show_next, -1 if none */
+static int show_next_song = -1;
+/** @brief Next song of the show, filled from the image and kept preshifted */
+static matrix_prepared_t show_next;
+#endif
+
+// --- Button Hardware Definitions ---
+// Button pins come from the hardware profile (hw_tables), see hw_profile.h
+
 // --- Button State Tracking for Press Types ---
 /**
  * @brief Structure for tracking button state and press types
@@ -79,11 +141,59 @@ typedef struct
 static button_state_t edit_save_btn_state;
 /** @brief State tracking for preset button */
 static button_state_t preset_btn_state;
-/** @brief State tracking for pedal buttons */
-static button_state_t pedal_btn_states[NUM_PEDALS_MAX];
+/** @brief State tracking for pedal buttons, slave unit pedals follow the local ones */
+static button_state_t pedal_btn_states[CHAIN_LEN_MAX];
+
+#ifdef CONFIG_LINK_ROLE_MASTER
+/**
+ * @brief Button event received from the linked slave unit
+ */
+typedef struct
+{
+    uint8_t button; /**< link_button_t or slave pedal index */
+    uint8_t event;  /**< link_event_t */
+} remote_event_t;
+
+/** @brief Events from the link task, applied by buttons_task */
+static QueueHandle_t remote_event_queue;
+#endif
 
 #define DEBOUNCE_TIME_MS 50         /**< Button debounce time in milliseconds */
+#define SETTINGS_SAVE_DELAY_MS 3000 /**< Store a tapped tempo or scene once it has been left alone this long */
 #define LONG_PRESS_DURATION_MS 1500 /**< Duration in milliseconds to detect a long press */
+#define FAILOVER_BLINK_MS 250       /**< LED of a failed-over loop toggles this often */
+
+#ifdef CONFIG_CONTROL_ENABLE
+#define LOCAL_BUTTONS_MAX (2 + NUM_PEDALS_MAX) /**< Program, preset and pedal buttons, bits 0, 1 and 2 + N */
+#define LONG_PRESS_TICKS (LONG_PRESS_DURATION_MS * CONFIG_CONTROL_RATE_HZ / 1000) /**< Long press in control ticks */
+#define STAGE_SAMPLE_US 10   /**< Budget of the input sampling stage */
+#define STAGE_DEBOUNCE_US 5  /**< Budget of the debounce stage */
+#define STAGE_GESTURE_US 20  /**< Budget of the gesture stage */
+#define STAGE_DISPATCH_US 30 /**< Budget of the dispatch stage */
+
+/** @brief Buttons task, woken by the dispatch stage */
+static TaskHandle_t buttons_task_handle;
+/** @brief Raw button levels of this cycle, pressed = 1 */
+static uint32_t button_sample;
+/** @brief Buttons whose debounced state changed in this cycle */
+static uint32_t button_changed;
+/** @brief Debouncer of the local buttons */
+static debounce_t button_db;
+/** @brief Cycle in which each button was pressed */
+static uint32_t button_press_tick[LOCAL_BUTTONS_MAX];
+/** @brief Buttons held long, as of the last cycle */
+static uint32_t button_long;
+/** @brief Set by the gesture stage when the buttons task has something new */
+static bool gesture_wake;
+/** @brief Protects the gestures handed to the buttons task */
+static portMUX_TYPE gesture_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Gestures not yet taken by the buttons task */
+static uint32_t gesture_pressed, gesture_released, gesture_long;
+/** @brief Debounced levels as of the last staged gesture, pressed = 1 */
+static uint32_t gesture_state;
+/** @brief Time the first gesture not yet taken was debounced, 0 if none */
+static int64_t gesture_input_us;
+#endif
 
 // --- NVS Helper Functions ---
 /**
@@ -105,16 +215,17 @@ static esp_err_t _save_patch_to_nvs(const char *key, const uint8_t *data, uint8_
     }
 
     // Store length + data
-    uint8_t nvs_buffer[NUM_PEDALS_MAX + 1];
+    uint8_t nvs_buffer[CHAIN_LEN_MAX + 1];
     nvs_buffer[0] = len;
     memcpy(&nvs_buffer[1], data, len);
     // Zero out remaining part of the buffer to ensure consistent blob size if needed
-    if (len < NUM_PEDALS_MAX)
+    if (len < CHAIN_LEN_MAX)
     {
-        memset(&nvs_buffer[1 + len], 0, NUM_PEDALS_MAX - len);
+        memset(&nvs_buffer[1 + len], 0, CHAIN_LEN_MAX - len);
     }
 
-    err = nvs_set_blob(nvs_handle, key, nvs_buffer, NUM_PEDALS_MAX + 1);
+    power_lock(POWER_LOCK_PERSIST);
+    err = nvs_set_blob(nvs_handle, key, nvs_buffer, CHAIN_LEN_MAX + 1);
     if (err == ESP_OK)
     {
         err = nvs_commit(nvs_handle);
@@ -127,6 +238,7 @@ static esp_err_t _save_patch_to_nvs(const char *key, const uint8_t *data, uint8_
     {
         ESP_LOGE(TAG, "NVS set_blob failed for key %s! Error: %s", key, esp_err_to_name(err));
     }
+    power_unlock(POWER_LOCK_PERSIST);
     nvs_close(nvs_handle);
     return err;
 }
@@ -147,40 +259,41 @@ static esp_err_t _load_patch_from_nvs(const char *key, uint8_t *data_buf, uint8_
     {
         ESP_LOGE(TAG, "Error (%s) opening NVS R/O handle for key %s", esp_err_to_name(err), key);
         *len_buf = 0; // Ensure length is zero on error
-        memset(data_buf, 0, NUM_PEDALS_MAX);
+        memset(data_buf, 0, CHAIN_LEN_MAX);
         return err;
     }
 
-    uint8_t nvs_buffer[NUM_PEDALS_MAX + 1];
+    uint8_t nvs_buffer[CHAIN_LEN_MAX + 1];
     size_t required_size = sizeof(nvs_buffer);
 
     err = nvs_get_blob(nvs_handle, key, nvs_buffer, &required_size);
     if (err == ESP_OK)
     {
-        if (required_size == (NUM_PEDALS_MAX + 1))
+        // Blobs written by a single unit hold NUM_PEDALS_MAX entries, linked masters CHAIN_LEN_MAX
+        if (required_size == (NUM_PEDALS_MAX + 1) || required_size == (CHAIN_LEN_MAX + 1))
         {
             *len_buf = nvs_buffer[0];
-            if (*len_buf > NUM_PEDALS_MAX)
-                *len_buf = NUM_PEDALS_MAX; // Sanity check
+            if (*len_buf > required_size - 1)
+                *len_buf = required_size - 1; // Sanity check
             memcpy(data_buf, &nvs_buffer[1], *len_buf);
-            if (*len_buf < NUM_PEDALS_MAX)
+            if (*len_buf < CHAIN_LEN_MAX)
             { // Zero out rest of buffer if loaded patch is shorter
-                memset(data_buf + *len_buf, 0, NUM_PEDALS_MAX - *len_buf);
+                memset(data_buf + *len_buf, 0, CHAIN_LEN_MAX - *len_buf);
             }
         }
         else
         {
-            ESP_LOGE(TAG, "NVS blob size mismatch for key %s. Expected %d, got %d", key, NUM_PEDALS_MAX + 1, required_size);
+            ESP_LOGE(TAG, "NVS blob size mismatch for key %s. Expected %d, got %d", key, CHAIN_LEN_MAX + 1, required_size);
             err = ESP_FAIL; // Treat as error
             *len_buf = 0;
-            memset(data_buf, 0, NUM_PEDALS_MAX);
+            memset(data_buf, 0, CHAIN_LEN_MAX);
         }
     }
     else if (err == ESP_ERR_NVS_NOT_FOUND)
     {
         ESP_LOGI(TAG, "NVS key %s not found, initializing to empty.", key);
         *len_buf = 0;
-        memset(data_buf, 0, NUM_PEDALS_MAX);
+        memset(data_buf, 0, CHAIN_LEN_MAX);
         // Don't return error for not_found, treat as empty patch
         err = ESP_OK;
     }
@@ -188,7 +301,7 @@ static esp_err_t _load_patch_from_nvs(const char *key, uint8_t *data_buf, uint8_
     {
         ESP_LOGE(TAG, "NVS get_blob failed for key %s! Error: %s", key, esp_err_to_name(err));
         *len_buf = 0;
-        memset(data_buf, 0, NUM_PEDALS_MAX);
+        memset(data_buf, 0, CHAIN_LEN_MAX);
     }
     nvs_close(nvs_handle);
     return err;
@@ -205,7 +318,7 @@ static esp_err_t _load_patch_from_nvs(const char *key, uint8_t *data_buf, uint8_
  */
 static bool _is_live_patch_same_as_preset(uint8_t preset_slot_index)
 {
-    uint8_t preset_data[NUM_PEDALS_MAX];
+    uint8_t preset_data[CHAIN_LEN_MAX];
     uint8_t preset_len;
     char key[20];
     snprintf(key, sizeof(key), "%s%d", NVS_KEY_PRESET_PREFIX, preset_slot_index);
@@ -238,81 +351,176 @@ static void _update_loaded_from_preset_slot_status()
     }
 }
 
-// --- LED Control Functions ---
-#ifdef CONFIG_ENABLE_LEDS
+/**
+ * @brief Store the live settings under a patch key
+ *
+ * Picks up the current tap tempo first, so a tapped tempo is saved with the
+ * patch. Control outputs are already kept in live_settings.
+ *
+ * @param key NVS key of the patch
+ * @return esp_err_t ESP_OK on success, or an error code
+ */
+static esp_err_t _save_settings(const char *key)
+{
+    live_settings.tap_period_us = tap_tempo_get_period();
+    return patch_settings_save(key, &live_settings);
+}
+
+/**
+ * @brief Load the settings of a patch and make them live
+ *
+ * @param key NVS key of the patch
+ */
+static void _load_settings(const char *key)
+{
+    patch_settings_load(key, &live_settings);
+    tap_tempo_set_period(live_settings.tap_period_us);
+    settings_save_tick = 0;
+}
+
+/**
+ * @brief Outputs the pedal buttons toggle in MODE_CONTROL_EDIT
+ *
+ * None on a board that only wires amp output A, since turning it off would
+ * only silence the unit.
+ *
+ * @return Output mask, MATRIX_OUTPUT_BIT() of each output
+ */
+static uint8_t _edit_outputs(void)
+{
+    return hw_tables.output_mask == MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_AMP_A) ? 0 : hw_tables.output_mask;
+}
 
 /**
- * @brief Updates the LED status using a shift register
+ * @brief Number of pedal buttons in use in MODE_CONTROL_EDIT
  *
- * Shifts out the current LED status to the LED shift register
+ * The control outputs come first, then the outputs, as far as there are
+ * pedal buttons.
  *
- * @param led_status An 8-bit value representing the on/off state of each LED
+ * @return Buttons in use
  */
-static void update_led_shift_register(uint8_t led_status)
+static int _edit_count(void)
 {
-    // Set latch low to begin data transfer
-    gpio_set_level(LED_SR_LATCH_PIN, 0);
+    int count = hw_tables.ctl_count + __builtin_popcount(_edit_outputs());
+    return count < hw_tables.num_pedals ? count : hw_tables.num_pedals;
+}
 
-    // Shift out the data
-    for (int i = 7; i >= 0; i--)
+/**
+ * @brief Output a pedal button toggles in MODE_CONTROL_EDIT
+ *
+ * @param button Pedal button index, at least hw_tables.ctl_count and below _edit_count()
+ * @return Output, MATRIX_OUTPUT_*
+ */
+static int _edit_output(int button)
+{
+    int n = button - hw_tables.ctl_count;
+    uint8_t outputs = _edit_outputs();
+    for (int o = 0; o < MATRIX_NUM_OUTPUTS; o++)
     {
-        gpio_set_level(LED_SR_DATA_PIN, (led_status >> i) & 0x01);
-        gpio_set_level(LED_SR_CLOCK_PIN, 1);
-        gpio_set_level(LED_SR_CLOCK_PIN, 0);
+        if ((outputs & MATRIX_OUTPUT_BIT(o)) && n-- == 0)
+        {
+            return o;
+        }
     }
+    return MATRIX_OUTPUT_AMP_A; // Not reached for buttons below _edit_count()
+}
+
+/**
+ * @brief Pedals playing in the active scene
+ *
+ * @return Bit N set if pedal N+1 plays, all bits set if the patch has no scenes
+ */
+static uint16_t _scene_active_mask(void)
+{
+    return live_settings.scene_count ? live_settings.scene_mask[live_settings.scene] : 0xFFFF;
+}
 
-    // Set latch high to latch the data
-    gpio_set_level(LED_SR_LATCH_PIN, 1);
+/**
+ * @brief Check whether a pedal is part of the live chain
+ *
+ * @param pedal Pedal number (1-based)
+ */
+static bool _pedal_in_chain(uint8_t pedal)
+{
+    for (int i = 0; i < live_patch_len; i++)
+    {
+        if (live_patch_data[i] == pedal)
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
+// --- LED Control Functions ---
+#ifdef CONFIG_ENABLE_LEDS
+
 /**
  * @brief Set the state of a pedal LED
  *
- * Controls the LED associated with a specific pedal using the shift register
+ * Controls the LED associated with a specific pedal through the LED driver,
+ * which maps it to the board's LED chain
  *
  * @param pedal_index Index of the pedal (0-7)
  * @param on true to turn the LED on, false to turn it off
  */
 static void _set_pedal_led(uint8_t pedal_index, bool on)
 {
-    static uint8_t led_status = 0; // Keep track of LED states
-    
-    if (pedal_index < NUM_PEDALS_MAX)
+    led_set_pedal(pedal_index, on);
+}
+
+/**
+ * @brief Pedal LEDs of the current chain: pedals playing in the active scene
+ *
+ * @return Bit N set lights the LED of pedal N+1; failed-over loops stay dark
+ */
+static uint8_t _active_chain_led_mask(void)
+{
+    uint8_t pedal_mask = 0;
+    uint16_t scene_mask = _scene_active_mask() & ~matrix_get_failover();
+    for (int i = 0; i < live_patch_len; i++)
     {
-        if (on) {
-            led_status |= (1 << pedal_index);  // Set the bit
-        } else {
-            led_status &= ~(1 << pedal_index); // Clear the bit
+        if (live_patch_data[i] > 0 && live_patch_data[i] <= NUM_PEDALS_MAX && (scene_mask & (1 << (live_patch_data[i] - 1))))
+        {
+            pedal_mask |= 1 << (live_patch_data[i] - 1);
         }
-        update_led_shift_register(led_status);
     }
+    return pedal_mask;
 }
 
 static void _update_active_chain_leds()
 {
-    for (int i = 0; i < NUM_PEDALS_MAX; i++)
-    { // Turn all off first
-        _set_pedal_led(i, false);
-    }
-    for (int i = 0; i < live_patch_len; i++)
+    led_show_pedals(_active_chain_led_mask()); // One shift register update for all pedal LEDs, bypassed pedals dark
+}
+
+#ifdef CONFIG_FAILOVER_ENABLE
+/**
+ * @brief Blink the LEDs of failed-over loops on top of the chain LEDs
+ *
+ * Called every pass of the buttons loop in MODE_LIVE; the LEDs are only
+ * shifted out when the blink phase changes.
+ */
+static void _blink_failover_leds(void)
+{
+    static bool lit;
+    uint8_t failed = matrix_get_failover() & 0xFF;
+    bool phase = failed && (xTaskGetTickCount() / pdMS_TO_TICKS(FAILOVER_BLINK_MS)) & 1;
+    if (phase != lit)
     {
-        if (live_patch_data[i] > 0 && live_patch_data[i] <= NUM_PEDALS_MAX)
-        {
-            _set_pedal_led(live_patch_data[i] - 1, true);
-        }
+        lit = phase;
+        led_show_pedals(_active_chain_led_mask() | (lit ? failed : 0));
     }
 }
+#endif
 
 static void _flash_all_pedal_leds(int count, int duration_ms_on, int duration_ms_off)
 {
     ESP_LOGI(TAG, "LEDs: Flashing %d times.", count);
     for (int c = 0; c < count; c++)
     {
-        for (int i = 0; i < NUM_PEDALS_MAX; i++)
-            _set_pedal_led(i, true);
+        led_show_pedals(0xFF);
         vTaskDelay(pdMS_TO_TICKS(duration_ms_on));
-        for (int i = 0; i < NUM_PEDALS_MAX; i++)
-            _set_pedal_led(i, false);
+        led_show_pedals(0x00);
         if (c < count - 1)
             vTaskDelay(pdMS_TO_TICKS(duration_ms_off));
     }
@@ -338,14 +546,16 @@ static void _blink_all_pedal_leds_start(bool start_blinking)
     {
         // In a real implementation, a timer would toggle LEDs
         // For simplicity here, just turn them on if starting, off if stopping
-        for (int i = 0; i < NUM_PEDALS_MAX; i++)
-            _set_pedal_led(i, start_blinking);
+        led_show_pedals(start_blinking ? 0xFF : 0x00);
     }
 }
 #else
 // No-op versions if LEDs are disabled
 static void _set_pedal_led(uint8_t pedal_index, bool on) {}
 static void _update_active_chain_leds() {}
+#ifdef CONFIG_FAILOVER_ENABLE
+static void _blink_failover_leds(void) {}
+#endif
 static void _flash_all_pedal_leds(int count, int duration_ms_on, int duration_ms_off)
 {
     ESP_LOGI(TAG, "LEDs disabled, flash requested.");
@@ -356,6 +566,48 @@ static void _blink_all_pedal_leds_start(bool start_blinking)
 }
 #endif
 
+/**
+ * @brief Check whether the buttons task has nothing to do until the next press
+ *
+ * Live mode with no button held and no settings save pending. The meters
+ * need the normal poll to stay current.
+ *
+ * @return true if the task can wait for a footswitch edge
+ */
+static bool _idle(void)
+{
+#ifdef CONFIG_METER_ENABLE
+    return false;
+#else
+    if (current_system_mode != MODE_LIVE || settings_save_tick || edit_save_btn_state.current_state ||
+        preset_btn_state.current_state)
+    {
+        return false;
+    }
+    for (int i = 0; i < hw_tables.num_pedals; i++)
+    {
+        if (pedal_btn_states[i].current_state)
+        {
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+/**
+ * @brief Check whether a long press of a button means something in the current mode
+ *
+ * @param btn Button held long
+ * @return true if the long press is taken
+ */
+static bool _long_press_allowed(const button_state_t *btn)
+{
+    // Preset and program buttons change mode, pedal buttons enter scene edit
+    return btn->pin == hw_tables.pin_preset_btn || btn->pin == hw_tables.pin_program_btn ||
+           current_system_mode == MODE_LIVE || current_system_mode == MODE_SCENE_EDIT;
+}
+
 // --- Button Processing Function ---
 /**
  * @brief Process a button's state to detect presses and releases
@@ -381,6 +633,8 @@ static void _process_button(button_state_t *btn)
         if (raw_state != btn->current_state)
         { // Debounced state change
             btn->current_state = raw_state;
+            power_input_seen(); // Full speed from here to the route it causes
+            deadline_input();
             if (btn->current_state)
             { // Pressed
                 btn->press_time_ms = current_time_ms;
@@ -410,8 +664,8 @@ static void _process_button(button_state_t *btn)
             // This is a "long press fire" event, usually action is taken on release or specific need
             // For this design, we trigger save mode selection on long press *detection*
             // and then action (pedal button press) confirms
-            if (btn->pin == CONFIG_PRESET_BUTTON_PIN)
-            {                                   // Only preset button uses this ongoing detection for mode change
+            if (_long_press_allowed(btn))
+            {
                 btn->ongoing_long_press = true; // Mark that a long press has been achieved
                 // The mode change will happen in the main task loop based on this flag
             }
@@ -419,139 +673,1116 @@ static void _process_button(button_state_t *btn)
     }
 }
 
+#ifdef CONFIG_CONTROL_ENABLE
 /**
- * @brief Initialize the buttons subsystem
+ * @brief Get a local button by its bit in the control stages
  *
- * Configures GPIO pins for buttons, sets up internal state, and loads the last
- * saved configuration from NVS. Also initializes LED outputs if enabled.
+ * @param bit 0 program, 1 preset, 2 + N pedal N
+ * @return Button state
  */
-void buttons_init(void)
+static button_state_t *_local_button(int bit)
 {
-    // Configure Edit/Save Button and Preset Button
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << CONFIG_PROGRAM_BUTTON_PIN) | (1ULL << CONFIG_PRESET_BUTTON_PIN),
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLUP_ENABLE,
-        .intr_type = GPIO_INTR_DISABLE,
-    };
-    gpio_config(&io_conf);
+    if (bit == 0)
+        return &edit_save_btn_state;
+    if (bit == 1)
+        return &preset_btn_state;
+    return &pedal_btn_states[bit - 2];
+}
 
-    // Configure Pedal Buttons
-    uint64_t pedal_pin_mask = 0;
-    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+/**
+ * @brief Read the levels of every local button
+ *
+ * @return Pressed buttons, bit N = _local_button(N)
+ */
+static uint32_t _read_local_buttons(void)
+{
+    uint64_t in = REG_READ(GPIO_IN_REG) | (uint64_t)REG_READ(GPIO_IN1_REG) << 32; // Both banks in two loads
+    uint32_t pressed = 0;
+    for (int b = 0; b < 2 + hw_tables.num_pedals; b++)
     {
-        pedal_pin_mask |= (1ULL << PEDAL_BUTTON_PINS[i]);
+        if (!(in & (1ULL << _local_button(b)->pin))) // Active low
+        {
+            pressed |= 1UL << b;
+        }
     }
-    io_conf.pin_bit_mask = pedal_pin_mask;
-    gpio_config(&io_conf);
+    return pressed;
+}
 
-#ifdef CONFIG_ENABLE_LEDS
-    // Configure LED shift register pins
-    gpio_config_t led_conf = {
-        .pin_bit_mask = (1ULL << LED_SR_DATA_PIN) |
-                         (1ULL << LED_SR_CLOCK_PIN) |
-                         (1ULL << LED_SR_LATCH_PIN),
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE,
-    };
-    gpio_config(&led_conf);
-    
-    // Initialize all LEDs to off
-    update_led_shift_register(0);
-#endif
+/**
+ * @brief Control stage: sample the local buttons
+ *
+ * @param tick Control cycle
+ */
+static void _stage_sample(uint32_t tick)
+{
+    button_sample = _read_local_buttons();
+}
 
-    // Initialize button states
-    edit_save_btn_state.pin = CONFIG_PROGRAM_BUTTON_PIN;
-    preset_btn_state.pin = CONFIG_PRESET_BUTTON_PIN;
-    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+/**
+ * @brief Control stage: debounce the sample
+ *
+ * @param tick Control cycle
+ */
+static void _stage_debounce(uint32_t tick)
+{
+    button_changed = debounce_update(&button_db, button_sample);
+}
+
+/**
+ * @brief Control stage: turn debounced changes into presses, releases and long holds
+ *
+ * Presses and releases add up until the buttons task takes them, so none
+ * are lost while it is busy. A long hold is a level, like the state. The
+ * levels and the time the first of them was debounced go with them.
+ *
+ * @param tick Control cycle
+ */
+static void _stage_gesture(uint32_t tick)
+{
+    uint32_t pressed = button_changed & button_db.state;
+    uint32_t released = button_changed & ~button_db.state;
+    for (uint32_t p = pressed; p; p &= p - 1)
     {
-        pedal_btn_states[i].pin = PEDAL_BUTTON_PINS[i];
+        button_press_tick[__builtin_ctz(p)] = tick;
+    }
+    uint32_t held_long = 0;
+    for (uint32_t h = button_db.state & ~pressed; h; h &= h - 1)
+    {
+        int b = __builtin_ctz(h);
+        if (tick - button_press_tick[b] >= LONG_PRESS_TICKS)
+        {
+            held_long |= 1UL << b;
+        }
     }
 
-    // Load live_config on startup
-    esp_err_t err = _load_patch_from_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, &live_patch_len);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
-    { // NOT_FOUND is handled as empty, other errors are more serious
-        gui_set_status("NVS Load Err!");
-        // Initialize to a known safe state (bypass)
-        live_patch_len = 0;
-        memset(live_patch_data, 0, NUM_PEDALS_MAX);
+    gesture_wake = pressed || released || (held_long & ~button_long);
+    button_long = held_long;
+    if (gesture_wake)
+    {
+        int64_t now = (pressed | released) ? esp_timer_get_time() : 0;
+        portENTER_CRITICAL(&gesture_lock);
+        gesture_pressed |= pressed;
+        gesture_released |= released;
+        gesture_long = held_long;
+        gesture_state = button_db.state;
+        if (!gesture_input_us)
+        {
+            gesture_input_us = now;
+        }
+        portEXIT_CRITICAL(&gesture_lock);
     }
-    _update_loaded_from_preset_slot_status(); // Check if it matches any preset
-    _update_active_chain_leds();
-    matrix_update(); // Update matrix with loaded/default config
-    gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
-    gui_set_status(loaded_from_preset_slot != -1 ? "P%d Loaded" : "Live Config", loaded_from_preset_slot != -1 ? loaded_from_preset_slot + 1 : 0);
-    
-    // Now that we have better I2C settings, we can try a controlled refresh
-    gui_force_refresh();
-    vTaskDelay(pdMS_TO_TICKS(1500)); // Show initial status
-    gui_set_status("");
+}
 
-    current_system_mode = MODE_LIVE;
+/**
+ * @brief Control stage: wake the buttons task if there is a new gesture
+ *
+ * @param tick Control cycle
+ */
+static void _stage_dispatch(uint32_t tick)
+{
+    if (gesture_wake && buttons_task_handle)
+    {
+        xTaskNotifyGive(buttons_task_handle);
+    }
 }
 
 /**
- * @brief Main task for handling button presses and system state
+ * @brief Release a button taken from the gestures
  *
- * This task continuously monitors button inputs, handles debouncing, detects
- * short and long presses, and manages the system state machine. It controls
- * the effects chain configuration based on user input and manages preset saving and loading.
+ * @param btn Button
+ * @param time_ms Current time
+ */
+static void _gesture_release(button_state_t *btn, uint32_t time_ms)
+{
+    btn->current_state = false;
+    btn->release_time_ms = time_ms;
+    if (btn->ongoing_long_press)
+    {
+        btn->long_press_event = true; // Long press completed on release
+        btn->ongoing_long_press = false;
+    }
+    else
+    {
+        btn->short_press_event = true;
+    }
+}
+
+/**
+ * @brief Apply the gestures since the last pass to the button states
  *
- * @param pvParameters FreeRTOS task parameters (unused)
+ * Does what _process_button() does for every local button, with the
+ * sampling, debouncing and long hold timing already done by the control
+ * stages. A button both pressed and released since the last pass is
+ * released first if it is down now, so a hold that started while the task
+ * was busy is kept. The input is stamped with the time the control stage
+ * debounced it, so the hand-over to this task is measured too.
  */
-void buttons_task(void *pvParameters)
+static void _take_gestures(void)
 {
-    char key_name_buffer[20]; // For NVS key construction
+    portENTER_CRITICAL(&gesture_lock);
+    uint32_t pressed = gesture_pressed, released = gesture_released, held_long = gesture_long;
+    uint32_t state = gesture_state;
+    int64_t input_us = gesture_input_us;
+    gesture_pressed = gesture_released = 0;
+    gesture_input_us = 0;
+    portEXIT_CRITICAL(&gesture_lock);
+    uint32_t current_time_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
 
-    while (1)
+    if (input_us)
     {
-        // Process all buttons to update their event flags
-        _process_button(&edit_save_btn_state);
-        _process_button(&preset_btn_state);
-        for (int i = 0; i < NUM_PEDALS_MAX; i++)
+        power_input_seen(); // Full speed from here to the route it causes
+        deadline_input_at(input_us);
+    }
+    for (int b = 0; b < 2 + hw_tables.num_pedals; b++)
+    {
+        button_state_t *btn = _local_button(b);
+        uint32_t bit = 1UL << b;
+        btn->short_press_event = false;
+        btn->long_press_event = false;
+
+        bool release_first = (pressed & released & state & bit) != 0; // Released, then pressed again
+        if (release_first)
         {
-            _process_button(&pedal_btn_states[i]);
+            _gesture_release(btn, current_time_ms);
         }
-
-        // --- Main State Machine ---
-        switch (current_system_mode)
+        if (pressed & bit)
         {
-        case MODE_LIVE:
-            if (edit_save_btn_state.short_press_event)
-            {
-                current_system_mode = MODE_PROGRAM_CHAIN;
-                loaded_from_preset_slot = -1;
-                live_patch_len = 0;
-                memset(live_patch_data, 0, sizeof(live_patch_data));
-                gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
-                gui_set_status("Program Chain");
-                _flash_all_pedal_leds(1, 50, 0);
-                _update_active_chain_leds(); // Should show no LEDs as chain is empty
-            }
-            else if (preset_btn_state.short_press_event)
-            {
-                current_system_mode = MODE_RECALL_SLOT_SELECT;
-                gui_set_status("Recall: Select Slot");
-                _blink_all_pedal_leds_start(true);
-            }
-            else if (preset_btn_state.ongoing_long_press)
-            {                                                // Detected long press initiation
-                preset_btn_state.ongoing_long_press = false; // Consume this event for mode change
-                current_system_mode = MODE_SAVE_SLOT_SELECT;
-                gui_set_status("Save To: Select Slot");
-                _blink_all_pedal_leds_start(true); // Use blinking for save select too
-            }
-            break;
-
-        case MODE_PROGRAM_CHAIN:
-            if (edit_save_btn_state.short_press_event)
-            { // Finalize programming
-                // live_patch_data is already updated by pedal presses
+            btn->current_state = true;
+            btn->press_time_ms = current_time_ms;
+            btn->ongoing_long_press = false;
+        }
+        if ((released & bit) && !release_first)
+        {
+            _gesture_release(btn, current_time_ms);
+        }
+        if (btn->current_state && !btn->ongoing_long_press && (held_long & bit) && _long_press_allowed(btn))
+        {
+            btn->ongoing_long_press = true;
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Wait for the next pass of the buttons task
+ *
+ * With the control executive a new gesture wakes the task at once. USB
+ * MIDI commands and expander presses wake it either way.
+ *
+ * @param poll Normal poll period
+ * @param idle true if the caller has nothing to do until the next press
+ */
+static void _wait_next_pass(TickType_t poll, bool idle)
+{
+#ifdef CONFIG_CONTROL_ENABLE
+    ulTaskNotifyTake(pdTRUE, poll);
+#else
+    power_wait(poll, idle);
+#endif
+}
+
+#ifdef CONFIG_LINK_ROLE_MASTER
+/**
+ * @brief Apply button events received from the slave unit
+ *
+ * Must run after the local buttons were processed, since processing clears
+ * the event flags.
+ */
+static void _apply_remote_events(void)
+{
+    remote_event_t ev;
+    while (xQueueReceive(remote_event_queue, &ev, 0) == pdTRUE)
+    {
+        button_state_t *btn;
+        if (ev.button == LINK_BUTTON_PROGRAM)
+            btn = &edit_save_btn_state;
+        else if (ev.button == LINK_BUTTON_PRESET)
+            btn = &preset_btn_state;
+        else if (ev.button < NUM_PEDALS_MAX)
+            btn = &pedal_btn_states[NUM_PEDALS_MAX + ev.button];
+        else
+            continue;
+
+        if (ev.event == LINK_EVENT_LONG)
+            btn->ongoing_long_press = true; // Same flag the local long press detection sets
+        else
+            btn->short_press_event = true;
+    }
+}
+#endif
+
+#ifdef CONFIG_LINK_ROLE_SLAVE
+/**
+ * @brief Forward the button events of this loop to the master
+ */
+static void _forward_button_events(void)
+{
+    static bool long_press_sent[2] = {false, false};
+    button_state_t *mode_btns[2] = {&edit_save_btn_state, &preset_btn_state};
+    const uint8_t mode_ids[2] = {LINK_BUTTON_PROGRAM, LINK_BUTTON_PRESET};
+
+    for (int b = 0; b < 2; b++)
+    {
+        if (mode_btns[b]->short_press_event)
+            link_send_button(mode_ids[b], LINK_EVENT_SHORT);
+        if (mode_btns[b]->ongoing_long_press && !long_press_sent[b])
+        {
+            link_send_button(mode_ids[b], LINK_EVENT_LONG);
+            long_press_sent[b] = true;
+        }
+        if (!mode_btns[b]->current_state)
+            long_press_sent[b] = false;
+    }
+    for (int i = 0; i < hw_tables.num_pedals; i++)
+    {
+        if (pedal_btn_states[i].short_press_event)
+            link_send_button(i, LINK_EVENT_SHORT);
+    }
+}
+#endif
+
+/**
+ * @brief Check whether a show is running
+ *
+ * @return true if the live patch is a song of the show
+ */
+static bool _show_running(void)
+{
+#ifdef CONFIG_SHOW_ENABLE
+    return show_at >= 0;
+#else
+    return false;
+#endif
+}
+
+#ifdef CONFIG_SHOW_ENABLE
+/**
+ * @brief Switch to a song of the show
+ *
+ * The song becomes the live patch straight from the mapped image, with no
+ * NVS access: the live config stays what it was before the show. Its route
+ * is latched as the plan for this song change says.
+ *
+ * @param song Song index, songs outside the show are refused
+ */
+static void _show_goto(int song)
+{
+    if (song < 0 || song >= show_song_count())
+    {
+        gui_set_status(song < 0 ? "Start of Show" : "End of Show");
+        return;
+    }
+    deadline_action(DEADLINE_SONG);
+    if (show_next_song != song)
+    {
+        show_prepare(song, &show_next);
+    }
+    show_get_patch(song, live_patch_data, &live_patch_len, &live_settings);
+    tap_tempo_set_period(live_settings.tap_period_us);
+    settings_save_tick = 0;
+    if (!matrix_apply(&show_next, show_plan(show_at, song), NULL))
+    {
+        matrix_update(); // Loops of this chain are failed over, compile without them
+    }
+    show_at = song;
+    show_next_song = -1;
+    loaded_from_preset_slot = -1;
+#ifdef CONFIG_USB_MIDI_ENABLE
+    uint16_t midi_len;
+    const uint8_t *midi = show_midi(song, &midi_len);
+    usb_midi_send(midi, midi_len); // After the latch, so the route never waits for the host
+#endif
+    gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
+    _update_active_chain_leds();
+    gui_set_status("%d %.16s", song + 1, show_song(song)->name);
+}
+
+/**
+ * @brief Keep the next song of the show preshifted
+ *
+ * Runs at the end of every live pass, like _preload_next().
+ */
+static void _show_preshift(void)
+{
+    int song = show_at + 1;
+    if (song >= show_song_count())
+    {
+        return;
+    }
+    if (show_next_song != song)
+    {
+        show_prepare(song, &show_next);
+        show_next_song = song;
+    }
+    matrix_preshift(&show_next);
+}
+
+/**
+ * @brief Stop the show
+ *
+ * The song playing stays live and is written to the live config, as a
+ * programmed chain would be.
+ */
+static void _show_stop(void)
+{
+    show_at = -1;
+    show_next_song = -1;
+    _save_patch_to_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, live_patch_len);
+    _save_settings(NVS_KEY_LIVE_CONFIG);
+    _update_loaded_from_preset_slot_status();
+    gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
+    gui_set_status("Show Stopped");
+}
+#endif
+
+/**
+ * @brief Initialize the buttons subsystem
+ *
+ * Configures GPIO pins for buttons, sets up internal state, and loads the last
+ * saved configuration from NVS. Also initializes LED outputs if enabled.
+ */
+void buttons_init(void)
+{
+    // Configure Edit/Save Button and Preset Button
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << hw_tables.pin_program_btn) | (1ULL << hw_tables.pin_preset_btn),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    gpio_config(&io_conf);
+
+    // Configure Pedal Buttons
+    uint64_t pedal_pin_mask = 0;
+    for (int i = 0; i < hw_tables.num_pedals; i++)
+    {
+        pedal_pin_mask |= (1ULL << hw_tables.pin_pedal_btn[i]);
+    }
+    io_conf.pin_bit_mask = pedal_pin_mask;
+    gpio_config(&io_conf);
+
+    // Initialize button states
+    edit_save_btn_state.pin = hw_tables.pin_program_btn;
+    preset_btn_state.pin = hw_tables.pin_preset_btn;
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        pedal_btn_states[i].pin = hw_tables.pin_pedal_btn[i];
+    }
+
+    // Any footswitch wakes the chip from light sleep
+    power_add_wake_pin(hw_tables.pin_program_btn);
+    power_add_wake_pin(hw_tables.pin_preset_btn);
+    for (int i = 0; i < hw_tables.num_pedals; i++)
+    {
+        power_add_wake_pin(hw_tables.pin_pedal_btn[i]);
+    }
+
+#ifdef CONFIG_CONTROL_ENABLE
+    debounce_init(&button_db, 0); // Buttons held at start-up are pressed, as when polled
+    control_add_stage("sample", _stage_sample, STAGE_SAMPLE_US);
+    control_add_stage("debounce", _stage_debounce, STAGE_DEBOUNCE_US);
+    control_add_stage("gesture", _stage_gesture, STAGE_GESTURE_US);
+    control_add_stage("dispatch", _stage_dispatch, STAGE_DISPATCH_US);
+#endif
+
+#ifdef CONFIG_LINK_ROLE_SLAVE
+    // The master owns the chain and presets, this unit only forwards its buttons
+    gui_update_chain(live_patch_data, 0, -1);
+    gui_set_status("Linked (Slave)");
+    current_system_mode = MODE_LIVE;
+    return;
+#endif
+#ifdef CONFIG_LINK_ROLE_MASTER
+    for (int i = NUM_PEDALS_MAX; i < CHAIN_LEN_MAX; i++)
+    {
+        pedal_btn_states[i].pin = GPIO_NUM_NC; // Slave pedals arrive over the link
+    }
+    remote_event_queue = xQueueCreate(8, sizeof(remote_event_t));
+#endif
+
+    // Load live_config on startup
+    esp_err_t err = _load_patch_from_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, &live_patch_len);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
+    { // NOT_FOUND is handled as empty, other errors are more serious
+        gui_set_status("NVS Load Err!");
+        // Initialize to a known safe state (bypass)
+        live_patch_len = 0;
+        memset(live_patch_data, 0, sizeof(live_patch_data));
+    }
+    _load_settings(NVS_KEY_LIVE_CONFIG); // Before matrix_update(), it carries the control outputs
+    _update_loaded_from_preset_slot_status(); // Check if it matches any preset
+    _update_active_chain_leds();
+    matrix_update(); // Update matrix with loaded/default config
+    gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
+    gui_set_status(loaded_from_preset_slot != -1 ? "P%d Loaded" : "Live Config", loaded_from_preset_slot != -1 ? loaded_from_preset_slot + 1 : 0);
+#ifdef CONFIG_SHOW_ENABLE
+    if (show_song_count() > 0)
+    { // A show image for this board is played from its first song
+        _show_goto(0);
+    }
+#endif
+    
+    // Now that we have better I2C settings, we can try a controlled refresh
+    gui_force_refresh();
+    vTaskDelay(pdMS_TO_TICKS(1500)); // Show initial status
+    gui_set_status("");
+
+    current_system_mode = MODE_LIVE;
+}
+
+#ifdef CONFIG_FAILOVER_ENABLE
+/**
+ * @brief Check a new scan of levels for dead loops and fail them over
+ *
+ * A loop whose return stays silent while its send plays for
+ * CONFIG_FAILOVER_WINDOW_MS is taken out of the route, and flagged on the
+ * status line and by its blinking LED, until a different chain is routed.
+ *
+ * @param rms_db RMS level of each source from the last scan, dBFS
+ */
+static void _watch_loops(const int8_t *rms_db)
+{
+    static loop_watch_t watch;
+    static bool started;
+    uint32_t now_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+    if (!started)
+    {
+        loop_watch_config_t cfg = {
+            .active_db = CONFIG_FAILOVER_ACTIVE_DB,
+            .drop_db = CONFIG_FAILOVER_DROP_DB,
+            .window_ms = CONFIG_FAILOVER_WINDOW_MS,
+        };
+        loop_watch_init(&watch, &cfg, now_ms);
+        started = true;
+    }
+
+    uint8_t sends[NUM_PEDALS_MAX];
+    matrix_get_sends(sends); // MATRIX_NO_SOURCE is LOOP_WATCH_NO_SEND
+#ifdef CONFIG_LINK_ROLE_MASTER
+    sends[CONFIG_LINK_TIE_LOOP - 1] = LOOP_WATCH_NO_SEND; // Returns from the slave, not a pedal
+#endif
+    uint16_t dead = loop_watch_update(&watch, sends, rms_db, now_ms);
+    if (!dead)
+    {
+        return;
+    }
+
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        if (dead & (1 << i))
+        {
+            ESP_LOGW(TAG, "Loop %d: return silent while its send plays, bypassed", i + 1);
+            gui_set_status("Loop %d dead, bypassed", i + 1);
+        }
+    }
+    matrix_set_failover(matrix_get_failover() | dead);
+    _update_active_chain_leds();
+}
+#endif
+
+#ifdef CONFIG_METER_ENABLE
+/**
+ * @brief Show the level meters once per completed scan
+ *
+ * With failover enabled each new scan is also checked for dead loops.
+ */
+static void _show_meters(void)
+{
+    static uint32_t shown_scan;
+    meter_level_t levels[MATRIX_NUM_SOURCES];
+    uint8_t count;
+    uint32_t scan = meter_get_levels(levels, &count);
+    if (scan == shown_scan)
+    {
+        return;
+    }
+    shown_scan = scan;
+
+    int8_t rms_db[MATRIX_NUM_SOURCES];
+    for (int i = 0; i < count; i++)
+    {
+        rms_db[i] = levels[i].rms_db;
+    }
+    gui_update_meters(rms_db, count);
+#ifdef CONFIG_FAILOVER_ENABLE
+    _watch_loops(rms_db);
+#endif
+}
+#endif
+
+/**
+ * @brief Show the panic bypass on the display, once
+ */
+static void _show_panic(void)
+{
+    static bool shown;
+    panic_bypass_report_t report;
+    if (shown || !panic_bypass_get_report(&report))
+    {
+        return;
+    }
+    shown = true;
+    if (report.edge_to_latch_ns)
+    {
+        gui_set_status("PANIC BYPASS %lu us", (unsigned long)((report.edge_to_latch_ns + 999) / 1000));
+    }
+    else
+    {
+        gui_set_status("PANIC BYPASS");
+    }
+}
+
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+/**
+ * @brief Make a preset kept compiled the live patch and latch its route
+ *
+ * @param slot Preset slot
+ * @param[out] path How the route got onto the outputs
+ * @return true if the preset was kept compiled
+ */
+static bool _recall_preloaded(int slot, preset_predict_path_t *path)
+{
+    for (int i = 0; i < CONFIG_PRESET_PREDICT_CANDIDATES; i++)
+    {
+        const preloaded_preset_t *p = &preloaded[i];
+        if (p->slot != slot)
+        {
+            continue;
+        }
+        memcpy(live_patch_data, p->chain, CHAIN_LEN_MAX);
+        live_patch_len = p->len;
+        live_settings = p->settings;
+        tap_tempo_set_period(live_settings.tap_period_us);
+        settings_save_tick = 0;
+        bool preshifted;
+        if (matrix_apply(&p->route, NULL, &preshifted))
+        {
+            *path = preshifted ? PRESET_PREDICT_PRESHIFTED : PRESET_PREDICT_COMPILED;
+        }
+        else
+        {
+            matrix_update(); // Loops of this chain are failed over, compile without them
+            *path = PRESET_PREDICT_MISS;
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Keep the likely next presets compiled and preshift the top one
+ *
+ * New candidates are loaded and compiled whenever the live patch comes from
+ * another preset than they were picked for, so the NVS reads and compiling
+ * of a recall happen after the route of the one before is latched. Runs at
+ * the end of every live pass, so a preshift that an LED or meter tap change
+ * shifted over is put back.
+ */
+static void _preload_next(void)
+{
+    if (preloaded_for != loaded_from_preset_slot)
+    {
+        uint8_t ranked[NUM_PRESETS];
+        preset_predict_rank(loaded_from_preset_slot, ranked);
+        for (int i = 0; i < CONFIG_PRESET_PREDICT_CANDIDATES; i++)
+        {
+            preloaded_preset_t *p = &preloaded[i];
+            char key[20];
+            snprintf(key, sizeof(key), "%s%d", NVS_KEY_PRESET_PREFIX, ranked[i]);
+            p->slot = -1;
+            if (_load_patch_from_nvs(key, p->chain, &p->len) == ESP_OK)
+            {
+                patch_settings_load(key, &p->settings);
+                matrix_prepare(p->chain, p->len, &p->settings, &p->route);
+                p->slot = ranked[i];
+            }
+        }
+        preloaded_for = loaded_from_preset_slot;
+    }
+    if (preloaded[0].slot >= 0)
+    {
+        matrix_preshift(&preloaded[0].route);
+    }
+}
+#endif
+
+/**
+ * @brief Load a preset and make it the live patch
+ *
+ * A preset kept compiled by _preload_next() is taken from RAM and latched
+ * without compiling. On a load error the live config is read back, so the
+ * live patch is left as it was.
+ *
+ * @param slot Preset slot (0 to NUM_PRESETS - 1)
+ * @return ESP_OK if the preset was loaded
+ */
+static esp_err_t _recall_preset(int slot)
+{
+    deadline_action(DEADLINE_PRESET);
+    int64_t start_us = esp_timer_get_time();
+    int8_t from = loaded_from_preset_slot;
+    char key[20];
+    snprintf(key, sizeof(key), "%s%d", NVS_KEY_PRESET_PREFIX, slot);
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+    preset_predict_path_t path = PRESET_PREDICT_MISS;
+    if (!_recall_preloaded(slot, &path))
+#endif
+    {
+        esp_err_t err = _load_patch_from_nvs(key, live_patch_data, &live_patch_len);
+        if (err != ESP_OK)
+        {
+            // live_patch_data and len might be modified by failed load, reload live_config
+            _load_patch_from_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, &live_patch_len);
+            _update_loaded_from_preset_slot_status();
+            return err;
+        }
+        _load_settings(key); // Preset tempo and control outputs
+        matrix_update();
+    }
+    loaded_from_preset_slot = slot;
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+    preset_predict_recalled(from, slot, path, (uint32_t)(esp_timer_get_time() - start_us));
+#else
+    (void)from;
+    (void)start_us;
+#endif
+    _save_patch_to_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, live_patch_len); // Update live config
+    _save_settings(NVS_KEY_LIVE_CONFIG);
+    return ESP_OK;
+}
+
+/**
+ * @brief Recall a preset, or go to a song while a show runs, in live mode
+ *
+ * @param n Preset or song index
+ */
+static void _live_recall(int n)
+{
+#ifdef CONFIG_SHOW_ENABLE
+    if (show_at >= 0)
+    {
+        _show_goto(n);
+        return;
+    }
+#endif
+    if (n >= NUM_PRESETS)
+    {
+        gui_set_status("No Preset %d", n + 1);
+    }
+    else if (_recall_preset(n) == ESP_OK)
+    {
+        gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
+        _update_active_chain_leds();
+        gui_set_status("P%d Loaded", n + 1);
+    }
+    else
+    {
+        gui_set_status("Slot P%d Load Err", n + 1);
+    }
+}
+
+/**
+ * @brief Select a scene of the live patch
+ *
+ * @param scene Scene index, scenes the patch does not have are ignored
+ */
+static void _live_scene(int scene)
+{
+    if (scene >= live_settings.scene_count)
+    {
+        return;
+    }
+    // Scene change: no compile, one XOR update of the latched frame
+    live_settings.scene = scene;
+    deadline_action(DEADLINE_SCENE);
+    matrix_select_scene(live_settings.scene);
+    _update_active_chain_leds();
+    settings_save_tick = xTaskGetTickCount() + pdMS_TO_TICKS(SETTINGS_SAVE_DELAY_MS);
+    gui_set_status("Scene %d", live_settings.scene + 1);
+}
+
+/**
+ * @brief Apply presses of the extra footswitches in live mode
+ *
+ * On every expander, and on the 74HC165 chain, switches 1-8 recall presets
+ * 1-8 (songs 1-8 while a show runs) and switches 9-16 select scenes 1-8.
+ * Unlike recall mode there is no confirmation flash or pause, so the next
+ * press is handled straight away.
+ *
+ * @param presses Pressed footswitches, from expander_take_presses() and
+ *                sr_input_take_presses()
+ */
+static void _apply_footswitches(uint32_t presses)
+{
+    for (int sw = 0; presses; sw++, presses >>= 1)
+    {
+        if (!(presses & 1))
+        {
+            continue;
+        }
+        int n = sw % EXPANDER_SWITCHES;
+        if (n < NUM_PRESETS)
+        {
+            _live_recall(n);
+        }
+        else
+        {
+            _live_scene(n - NUM_PRESETS);
+        }
+    }
+}
+
+#ifdef CONFIG_USB_MIDI_ENABLE
+/**
+ * @brief Apply the commands of a USB MIDI batch in live mode
+ *
+ * The batch holds at most one recall and the scene selected after it, in
+ * that order, however many messages it was folded from (see midi_proto.h).
+ *
+ * @param batch Commands from usb_midi_take()
+ */
+static void _apply_midi(const midi_batch_t *batch)
+{
+    if (batch->program != MIDI_NONE)
+    {
+        _live_recall(batch->program);
+    }
+    if (batch->scene != MIDI_NONE)
+    {
+        _live_scene(batch->scene);
+    }
+}
+#endif
+
+/**
+ * @brief Main task for handling button presses and system state
+ *
+ * This task continuously monitors button inputs, handles debouncing, detects
+ * short and long presses, and manages the system state machine. It controls
+ * the effects chain configuration based on user input and manages preset saving and loading.
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+void buttons_task(void *pvParameters)
+{
+    char key_name_buffer[20]; // For NVS key construction
+    int health_id = health_register("buttons", CONFIG_HEALTH_DEADLINE_MS);
+#ifdef CONFIG_CONTROL_ENABLE
+    buttons_task_handle = xTaskGetCurrentTaskHandle(); // Before the first gesture is dispatched
+#endif
+
+    while (1)
+    {
+        HEALTH_BEAT(health_id);
+        // Process all buttons to update their event flags
+#ifdef CONFIG_CONTROL_ENABLE
+        _take_gestures(); // Sampled, debounced and timed by the control executive
+#else
+        _process_button(&edit_save_btn_state);
+        _process_button(&preset_btn_state);
+        for (int i = 0; i < hw_tables.num_pedals; i++) // Pedals not fitted have no button
+        {
+            _process_button(&pedal_btn_states[i]);
+        }
+#endif
+
+#ifdef CONFIG_LINK_ROLE_SLAVE
+        _forward_button_events();
+        power_input_done();
+        deadline_done();
+        _wait_next_pass(pdMS_TO_TICKS(20), false);
+        continue;
+#endif
+#ifdef CONFIG_LINK_ROLE_MASTER
+        _apply_remote_events();
+#endif
+
+        if (sr_bus_is_frozen())
+        {
+            _show_panic(); // Routes and LEDs are held by the panic bypass until restart
+            power_input_done();
+            deadline_done();
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        if (tap_tempo_take_tapped())
+        {
+            gui_set_status("Tempo %lu BPM", (unsigned long)TAP_TEMPO_BPM(tap_tempo_get_period()));
+            settings_save_tick = xTaskGetTickCount() + pdMS_TO_TICKS(SETTINGS_SAVE_DELAY_MS);
+        }
+        else if (settings_save_tick && (int32_t)(xTaskGetTickCount() - settings_save_tick) >= 0)
+        {
+            settings_save_tick = 0;
+            if (!_show_running()) // Songs are never written, the show starts over on restart
+            {
+                _save_settings(NVS_KEY_LIVE_CONFIG); // Left alone, keep the tempo and scene over a restart
+            }
+        }
+
+#ifdef CONFIG_METER_ENABLE
+        if (current_system_mode == MODE_LIVE)
+        {
+            _show_meters();
+#ifdef CONFIG_FAILOVER_ENABLE
+            _blink_failover_leds();
+#endif
+        }
+#endif
+
+#ifdef CONFIG_USB_MIDI_ENABLE
+        midi_batch_t midi;
+        int64_t midi_us;
+        bool midi_in = usb_midi_take(&midi, &midi_us); // Taken in every mode, only used live
+        if (midi_in && current_system_mode == MODE_LIVE)
+        {
+            power_input_seen();
+            deadline_input_at(midi_us); // Measured from the USB endpoint
+        }
+#endif
+        uint32_t footswitches = expander_take_presses() | sr_input_take_presses(); // Taken in every mode, only used live
+        if (footswitches && current_system_mode == MODE_LIVE)
+        { // Stamped only when applied, a dropped press opens no deadline
+            power_input_seen();
+            deadline_input();
+        }
+
+        // --- Main State Machine ---
+        switch (current_system_mode)
+        {
+        case MODE_LIVE:
+#ifdef CONFIG_TUNER_ENABLE
+            if (edit_save_btn_state.current_state && preset_btn_state.current_state && tuner_set_active(true))
+            { // Both mode buttons down: tune with the amp muted
+                matrix_set_mute(true);
+                tuner_released = false;
+                current_system_mode = MODE_TUNER;
+                gui_show_tuner(NULL, 0);
+            }
+            else
+#endif
+#ifdef CONFIG_SHOW_ENABLE
+            if (show_at >= 0 && (edit_save_btn_state.ongoing_long_press || preset_btn_state.ongoing_long_press))
+            { // Either long press ends the show
+                edit_save_btn_state.ongoing_long_press = false;
+                preset_btn_state.ongoing_long_press = false;
+                _show_stop();
+            }
+            else if (show_at >= 0 && preset_btn_state.short_press_event)
+            {
+                _show_goto(show_at + 1);
+            }
+            else if (show_at >= 0 && edit_save_btn_state.short_press_event)
+            {
+                _show_goto(show_at - 1);
+            }
+            else
+#endif
+            if (edit_save_btn_state.short_press_event)
+            {
+                current_system_mode = MODE_PROGRAM_CHAIN;
+                loaded_from_preset_slot = -1;
+                live_patch_len = 0;
+                memset(live_patch_data, 0, sizeof(live_patch_data));
+                gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
+                gui_set_status("Program Chain");
+                _flash_all_pedal_leds(1, 50, 0);
+                _update_active_chain_leds(); // Should show no LEDs as chain is empty
+            }
+            else if (preset_btn_state.short_press_event)
+            {
+                current_system_mode = MODE_RECALL_SLOT_SELECT;
+                gui_set_status("Recall: Select Slot");
+                _blink_all_pedal_leds_start(true);
+            }
+            else if (preset_btn_state.ongoing_long_press)
+            {                                                // Detected long press initiation
+                preset_btn_state.ongoing_long_press = false; // Consume this event for mode change
+                current_system_mode = MODE_SAVE_SLOT_SELECT;
+                gui_set_status("Save To: Select Slot");
+                _blink_all_pedal_leds_start(true); // Use blinking for save select too
+            }
+            else if (edit_save_btn_state.ongoing_long_press)
+            {                                                   // Detected long press initiation
+                edit_save_btn_state.ongoing_long_press = false; // Consume this event for mode change
+                int count = _edit_count();
+                if (count == 0)
+                {
+                    gui_set_status("No Control Outputs");
+                }
+                else
+                {
+                    current_system_mode = MODE_CONTROL_EDIT;
+                    ctl_mask_backup = live_settings.ctl_mask;
+                    outputs_backup = live_settings.outputs;
+                    gui_set_status("Controls: Toggle 1-%d", count);
+                }
+            }
+            else
+            {
+                for (int i = 0; i < PATCH_SCENES_MAX; i++)
+                {
+                    if (pedal_btn_states[i].ongoing_long_press && !_show_running())
+                    { // Edit scene i, created from the active scene if it is new
+                        pedal_btn_states[i].ongoing_long_press = false;
+                        scene_backup = live_settings;
+                        uint16_t scene_mask = _scene_active_mask();
+                        while (live_settings.scene_count <= i)
+                        {
+                            live_settings.scene_mask[live_settings.scene_count++] = scene_mask;
+                        }
+                        live_settings.scene = i;
+                        matrix_update(); // New scenes need compiling
+                        _update_active_chain_leds();
+                        current_system_mode = MODE_SCENE_EDIT;
+                        gui_set_status("Scene %d: Toggle Pedals", i + 1);
+                        break;
+                    }
+                    if (pedal_btn_states[i].short_press_event && i < live_settings.scene_count)
+                    {
+                        _live_scene(i);
+                        break;
+                    }
+                }
+            }
+            if (footswitches && current_system_mode == MODE_LIVE)
+            {
+                _apply_footswitches(footswitches);
+            }
+#ifdef CONFIG_USB_MIDI_ENABLE
+            if (midi_in && current_system_mode == MODE_LIVE)
+            {
+                _apply_midi(&midi);
+            }
+#endif
+            break;
+
+        case MODE_SCENE_EDIT:
+            if (edit_save_btn_state.short_press_event)
+            { // Keep the scene for the live config
+                _save_settings(NVS_KEY_LIVE_CONFIG);
+                current_system_mode = MODE_LIVE;
+                gui_set_status("Scene %d Set Live", live_settings.scene + 1);
+                vTaskDelay(pdMS_TO_TICKS(1500));
+                gui_set_status("");
+            }
+            else if (preset_btn_state.short_press_event)
+            { // Cancel
+                live_settings = scene_backup;
+                matrix_update();
+                _update_active_chain_leds();
+                current_system_mode = MODE_LIVE;
+                gui_set_status("Scene Canceled");
+                vTaskDelay(pdMS_TO_TICKS(1500));
+                gui_set_status("");
+            }
+            else
+            {
+                for (int i = 0; i < CHAIN_LEN_MAX; i++)
+                {
+                    if (pedal_btn_states[i].short_press_event)
+                    {
+                        if (!_pedal_in_chain(i + 1))
+                        {
+                            gui_set_status("Pedal %d not in chain", i + 1);
+                            continue;
+                        }
+                        live_settings.scene_mask[live_settings.scene] ^= 1 << i;
+                        matrix_update(); // The scene delta changed, compile it again
+                        _update_active_chain_leds();
+                        gui_set_status("Pedal %d %s", i + 1, (_scene_active_mask() & (1 << i)) ? "On" : "Bypassed");
+                    }
+                }
+            }
+            break;
+
+        case MODE_TUNER:
+#ifdef CONFIG_TUNER_ENABLE
+            if (tuner_released && (edit_save_btn_state.short_press_event || preset_btn_state.short_press_event))
+            { // Either mode button leaves the tuner
+                tuner_set_active(false);
+                matrix_set_mute(false);
+                current_system_mode = MODE_LIVE;
+                gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
+                gui_set_status("");
+                break;
+            }
+            if (!edit_save_btn_state.current_state && !preset_btn_state.current_state)
+            {
+                tuner_released = true; // The presses that entered the tuner are over
+            }
+            tuner_reading_t reading;
+            if (tuner_get_reading(&reading))
+            {
+                if (reading.valid)
+                {
+                    char note[8];
+                    snprintf(note, sizeof(note), "%s%d", pitch_note_name(reading.midi), reading.midi / 12 - 1);
+                    gui_show_tuner(note, (int)lroundf(reading.cents));
+                }
+                else
+                {
+                    gui_show_tuner(NULL, 0);
+                }
+            }
+#endif
+            break;
+
+        case MODE_CONTROL_EDIT:
+            if (edit_save_btn_state.short_press_event)
+            { // Keep the control outputs for the live config
+                _save_settings(NVS_KEY_LIVE_CONFIG);
+                current_system_mode = MODE_LIVE;
+                gui_set_status("Controls Set Live");
+                vTaskDelay(pdMS_TO_TICKS(1500));
+                gui_set_status("");
+            }
+            else if (preset_btn_state.short_press_event)
+            { // Cancel
+                live_settings.ctl_mask = ctl_mask_backup;
+                live_settings.outputs = outputs_backup;
+                matrix_update();
+                current_system_mode = MODE_LIVE;
+                gui_set_status("Controls Canceled");
+                vTaskDelay(pdMS_TO_TICKS(1500));
+                gui_set_status("");
+            }
+            else
+            {
+                int count = _edit_count();
+                for (int i = 0; i < count; i++)
+                {
+                    if (!pedal_btn_states[i].short_press_event)
+                    {
+                        continue;
+                    }
+                    if (i < hw_tables.ctl_count)
+                    {
+                        live_settings.ctl_mask ^= 1 << i;
+                        matrix_update(); // Applied right away, in the same frame as the route
+                        gui_set_status("%s %s", hw_tables.ctl_name[i], (live_settings.ctl_mask & (1 << i)) ? "On" : "Off");
+                    }
+                    else
+                    { // An output: switching amps is the same single latch
+                        int output = _edit_output(i);
+                        live_settings.outputs ^= MATRIX_OUTPUT_BIT(output);
+                        matrix_update();
+                        gui_set_status("%s %s", output_names[output],
+                                       (live_settings.outputs & MATRIX_OUTPUT_BIT(output)) ? "On" : "Off");
+                    }
+                }
+            }
+            break;
+
+        case MODE_PROGRAM_CHAIN:
+            if (edit_save_btn_state.short_press_event)
+            { // Finalize programming
+                // live_patch_data is already updated by pedal presses
+                live_settings.scene_count = 0; // Scenes were made for the old chain
+                live_settings.scene = 0;
                 matrix_update();
                 _save_patch_to_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, live_patch_len);
+                _save_settings(NVS_KEY_LIVE_CONFIG);
                 loaded_from_preset_slot = -1; // It's a custom live config now
                 current_system_mode = MODE_LIVE;
                 gui_update_chain(live_patch_data, live_patch_len, loaded_from_preset_slot);
@@ -575,11 +1806,11 @@ void buttons_task(void *pvParameters)
             }
             else
             {
-                for (int i = 0; i < NUM_PEDALS_MAX; i++)
+                for (int i = 0; i < CHAIN_LEN_MAX; i++)
                 {
                     if (pedal_btn_states[i].short_press_event)
                     {
-                        if (live_patch_len < NUM_PEDALS_MAX)
+                        if (live_patch_len < CHAIN_LEN_MAX)
                         {
                             // Check if pedal already in chain to prevent duplicates (optional)
                             bool found = false;
@@ -640,20 +1871,13 @@ void buttons_task(void *pvParameters)
                 { // NUM_PRESETS is 8
                     if (pedal_btn_states[i].short_press_event)
                     {
-                        snprintf(key_name_buffer, sizeof(key_name_buffer), "%s%d", NVS_KEY_PRESET_PREFIX, i);
-                        if (_load_patch_from_nvs(key_name_buffer, live_patch_data, &live_patch_len) == ESP_OK)
+                        if (_recall_preset(i) == ESP_OK)
                         {
-                            loaded_from_preset_slot = i;
-                            matrix_update();
-                            _save_patch_to_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, live_patch_len); // Update live config
                             gui_set_status("P%d Loaded & Set Live", i + 1);
                         }
                         else
                         {
                             gui_set_status("Slot P%d Load Err", i + 1);
-                            // live_patch_data and len might be modified by failed load, reload live_config
-                            _load_patch_from_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, &live_patch_len);
-                            _update_loaded_from_preset_slot_status();
                         }
                         _blink_all_pedal_leds_start(false);
                         _flash_all_pedal_leds(2, 50, 50);
@@ -688,7 +1912,12 @@ void buttons_task(void *pvParameters)
                         if (_save_patch_to_nvs(key_name_buffer, live_patch_data, live_patch_len) == ESP_OK)
                         {
                             loaded_from_preset_slot = i;                                              // Live data now matches this preset
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+                            preloaded_for = PRELOAD_STALE; // The slot may be kept compiled with its old chain
+#endif
+                            _save_settings(key_name_buffer);                                          // Current tempo goes with the preset
                             _save_patch_to_nvs(NVS_KEY_LIVE_CONFIG, live_patch_data, live_patch_len); // Also update live config
+                            _save_settings(NVS_KEY_LIVE_CONFIG);
                             gui_set_status("Saved to P%d", i + 1);
                         }
                         else
@@ -714,13 +1943,27 @@ void buttons_task(void *pvParameters)
         preset_btn_state.short_press_event = false;
         preset_btn_state.long_press_event = false;
         // preset_btn_state.ongoing_long_press is handled carefully for mode entry
-        for (int i = 0; i < NUM_PEDALS_MAX; i++)
+        for (int i = 0; i < CHAIN_LEN_MAX; i++)
         {
             pedal_btn_states[i].short_press_event = false;
             pedal_btn_states[i].long_press_event = false;
         }
 
-        vTaskDelay(pdMS_TO_TICKS(20)); // Main task loop delay
+        if (current_system_mode == MODE_LIVE && _show_running())
+        {
+#ifdef CONFIG_SHOW_ENABLE
+            _show_preshift(); // The next song, instead of the likely next presets
+#endif
+        }
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+        else if (current_system_mode == MODE_LIVE)
+        {
+            _preload_next(); // After the LEDs of this pass, so the preshift carries them
+        }
+#endif
+        power_input_done();
+        deadline_done();
+        _wait_next_pass(pdMS_TO_TICKS(20), _idle()); // Main task loop delay, longer while idle
     }
 }
 
@@ -739,9 +1982,62 @@ void buttons_get_current_patch_for_matrix(uint8_t *patch_buffer, uint8_t *length
 {
     memcpy(patch_buffer, live_patch_data, live_patch_len);
     *length_buffer = live_patch_len;
-    // Ensure rest of buffer is zero if live_patch_len < NUM_PEDALS_MAX
-    if (live_patch_len < NUM_PEDALS_MAX)
+    // Ensure rest of buffer is zero if live_patch_len < CHAIN_LEN_MAX
+    if (live_patch_len < CHAIN_LEN_MAX)
     {
-        memset(patch_buffer + live_patch_len, 0, NUM_PEDALS_MAX - live_patch_len);
+        memset(patch_buffer + live_patch_len, 0, CHAIN_LEN_MAX - live_patch_len);
     }
+}
+
+/**
+ * @brief Provides the control output states of the current patch to the matrix driver
+ *
+ * @return Control mask, bit N set turns control output N on
+ */
+uint8_t buttons_get_current_controls(void)
+{
+    return live_settings.ctl_mask;
+}
+
+/**
+ * @brief Provides the outputs fed by the current patch to the matrix driver
+ *
+ * @return Output mask, MATRIX_OUTPUT_BIT() of each output fed
+ */
+uint8_t buttons_get_current_outputs(void)
+{
+    return live_settings.outputs;
+}
+
+/**
+ * @brief Provides the scenes of the current patch to the matrix driver
+ *
+ * @param[out] masks Pedals playing in each scene (bit N = pedal N+1), PATCH_SCENES_MAX entries
+ * @param[out] count Number of scenes, 0 if every pedal in the chain always plays
+ * @param[out] active Active scene
+ */
+void buttons_get_current_scenes(uint16_t *masks, uint8_t *count, uint8_t *active)
+{
+    memcpy(masks, live_settings.scene_mask, sizeof(live_settings.scene_mask));
+    *count = live_settings.scene_count;
+    *active = live_settings.scene;
+}
+
+/**
+ * @brief Queue a button event received from a linked slave unit
+ *
+ * Called from the link task.
+ *
+ * @param button link_button_t or slave pedal index (0-7)
+ * @param event link_event_t
+ */
+void buttons_post_remote_event(uint8_t button, uint8_t event)
+{
+#ifdef CONFIG_LINK_ROLE_MASTER
+    remote_event_t ev = {.button = button, .event = event};
+    if (remote_event_queue == NULL || xQueueSend(remote_event_queue, &ev, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Remote button event dropped");
+    }
+#endif
 }
\ No newline at end of file
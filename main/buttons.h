@@ -13,10 +13,17 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "sdkconfig.h"
 
 #define NUM_PEDALS_MAX 8 // Max number of pedals physical interface supports
 #define NUM_PRESETS 8    // Number of storable user presets
 
+#ifdef CONFIG_LINK_ROLE_MASTER
+#define CHAIN_LEN_MAX (NUM_PEDALS_MAX * 2) // Pedals 9-16 are on the linked slave unit
+#else
+#define CHAIN_LEN_MAX NUM_PEDALS_MAX // Max number of pedals in a chain
+#endif
+
 /**
  * @brief System operation modes for the patch bay
  */
@@ -25,7 +32,10 @@ typedef enum
     MODE_LIVE,               /**< Normal operation, current live chain is active */
     MODE_PROGRAM_CHAIN,      /**< Programming the live chain */
     MODE_RECALL_SLOT_SELECT, /**< PRESET_BUTTON short-pressed, waiting for pedal button (1-8) to load */
-    MODE_SAVE_SLOT_SELECT    /**< PRESET_BUTTON long-pressed, waiting for pedal button (1-8) to save */
+    MODE_SAVE_SLOT_SELECT,   /**< PRESET_BUTTON long-pressed, waiting for pedal button (1-8) to save */
+    MODE_CONTROL_EDIT,       /**< PROGRAM_BUTTON long-pressed, pedal buttons (1-8) toggle control outputs, then outputs */
+    MODE_SCENE_EDIT,         /**< Pedal button long-pressed, pedal buttons toggle pedals in that scene */
+    MODE_TUNER               /**< PROGRAM_BUTTON and PRESET_BUTTON held together, amp muted while tuning */
 } patch_bay_system_mode_t;
 
 /**
@@ -50,9 +60,43 @@ void buttons_task(void *pvParameters);
 /**
  * @brief Provides the current patch configuration to the matrix driver
  * 
- * @param[out] patch_buffer Buffer to receive the current patch data
+ * @param[out] patch_buffer Buffer to receive the current patch data, CHAIN_LEN_MAX entries
  * @param[out] length_buffer Pointer to receive the length of the current patch
  */
 void buttons_get_current_patch_for_matrix(uint8_t *patch_buffer, uint8_t *length_buffer);
 
+/**
+ * @brief Provides the control output states of the current patch to the matrix driver
+ *
+ * @return Control mask, bit N set turns control output N on
+ */
+uint8_t buttons_get_current_controls(void);
+
+/**
+ * @brief Provides the outputs fed by the current patch to the matrix driver
+ *
+ * @return Output mask, MATRIX_OUTPUT_BIT() of each output fed
+ */
+uint8_t buttons_get_current_outputs(void);
+
+/**
+ * @brief Provides the scenes of the current patch to the matrix driver
+ *
+ * @param[out] masks Pedals playing in each scene (bit N = pedal N+1), PATCH_SCENES_MAX entries
+ * @param[out] count Number of scenes, 0 if every pedal in the chain always plays
+ * @param[out] active Active scene
+ */
+void buttons_get_current_scenes(uint16_t *masks, uint8_t *count, uint8_t *active);
+
+/**
+ * @brief Queue a button event received from a linked slave unit
+ *
+ * Handled by buttons_task as if it came from a local button; slave pedal
+ * buttons act as pedals 9-16.
+ *
+ * @param button link_button_t or slave pedal index (0-7)
+ * @param event link_event_t
+ */
+void buttons_post_remote_event(uint8_t button, uint8_t event);
+
 #endif
\ No newline at end of file
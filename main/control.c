@@ -0,0 +1,241 @@
+/**
+ * @file control.c
+ * @brief Implementation of the fixed-rate control executive
+ *
+ * The timer reloads at every alarm, so its count read at the start of a
+ * cycle is the time since the tick that woke the task. The notification
+ * count tells how many ticks went by since the last cycle; more than one
+ * means the last cycle overran.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/gptimer.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "control.h"
+#include "health.h"
+#include "power.h"
+
+#ifdef CONFIG_CONTROL_ENABLE
+
+#define CONTROL_TIMER_RESOLUTION_HZ 1000000                   /**< Timer counts in microseconds */
+#define CONTROL_PERIOD_US (1000000 / CONFIG_CONTROL_RATE_HZ) /**< Tick period */
+
+static const char *TAG = "Control";
+
+/**
+ * @brief One registered stage and its statistics of the current report window
+ */
+typedef struct
+{
+    const char *name;         /**< Stage name */
+    control_stage_fn_t fn;    /**< Stage function */
+    uint32_t budget_us;       /**< Longest time the stage should take */
+    uint32_t time_sum_us;     /**< Total time in this window */
+    uint32_t time_max_us;     /**< Longest run in this window */
+    uint32_t over_budget;     /**< Runs over the budget in this window */
+} control_stage_t;
+
+static control_stage_t stages[CONTROL_STAGES_MAX];
+static int stage_count;
+/** @brief Executive task, woken by the timer */
+static TaskHandle_t control_task_handle;
+/** @brief Tick timer */
+static gptimer_handle_t control_timer;
+/** @brief Protects the statistics */
+static portMUX_TYPE control_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Statistics since boot */
+static control_stats_t totals;
+/** @brief Statistics of the current report window */
+static uint32_t stat_cycles, stat_overruns, stat_latency_min_us = UINT32_MAX, stat_latency_max_us;
+
+/**
+ * @brief Timer alarm: wake the executive task
+ *
+ * @return true if a higher priority task was woken
+ */
+static bool IRAM_ATTR _on_tick(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(control_task_handle, &woken);
+    return woken == pdTRUE;
+}
+
+/**
+ * @brief Executive task: run every stage once per tick and time them
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _control_task(void *pvParameters)
+{
+    uint32_t stage_us[CONTROL_STAGES_MAX];
+    uint32_t tick = 0;
+    int health_id = health_register("control", CONFIG_HEALTH_DEADLINE_MS);
+
+    while (1)
+    {
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint64_t since_tick;
+        gptimer_get_raw_count(control_timer, &since_tick);
+        tick += ticks;
+        HEALTH_BEAT(health_id);
+
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < stage_count; i++)
+        {
+            stages[i].fn(tick);
+            int64_t end = esp_timer_get_time();
+            stage_us[i] = (uint32_t)(end - start);
+            start = end;
+        }
+
+        uint32_t latency = (uint32_t)since_tick;
+        portENTER_CRITICAL(&control_lock);
+        stat_cycles++;
+        stat_overruns += ticks - 1;
+        totals.cycles++;
+        totals.overruns += ticks - 1;
+        if (latency < stat_latency_min_us)
+            stat_latency_min_us = latency;
+        if (latency > stat_latency_max_us)
+            stat_latency_max_us = latency;
+        for (int i = 0; i < stage_count; i++)
+        {
+            control_stage_t *s = &stages[i];
+            s->time_sum_us += stage_us[i];
+            if (stage_us[i] > s->time_max_us)
+                s->time_max_us = stage_us[i];
+            if (stage_us[i] > s->budget_us)
+            {
+                s->over_budget++;
+                totals.over_budget++;
+            }
+        }
+        portEXIT_CRITICAL(&control_lock);
+    }
+}
+
+/**
+ * @brief Report task: log the cycle timing and the time of every stage
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _report_task(void *pvParameters)
+{
+    control_stage_t window[CONTROL_STAGES_MAX];
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(CONTROL_REPORT_MS));
+        portENTER_CRITICAL(&control_lock);
+        uint32_t cycles = stat_cycles, overruns = stat_overruns;
+        uint32_t latency_min = stat_latency_min_us, latency_max = stat_latency_max_us;
+        uint32_t jitter = cycles ? latency_max - latency_min : 0;
+        if (jitter > totals.jitter_max_us)
+            totals.jitter_max_us = jitter;
+        memcpy(window, stages, sizeof(window));
+        for (int i = 0; i < stage_count; i++)
+        {
+            stages[i].time_sum_us = stages[i].time_max_us = stages[i].over_budget = 0;
+        }
+        stat_cycles = stat_overruns = stat_latency_max_us = 0;
+        stat_latency_min_us = UINT32_MAX;
+        portEXIT_CRITICAL(&control_lock);
+
+        ESP_LOGI(TAG, "%lu cycles, %lu ticks overrun; tick to start %lu-%lu us, jitter %lu us", (unsigned long)cycles,
+                 (unsigned long)overruns, (unsigned long)(cycles ? latency_min : 0), (unsigned long)latency_max,
+                 (unsigned long)jitter);
+        for (int i = 0; i < stage_count; i++)
+        {
+            control_stage_t *s = &window[i];
+            ESP_LOGI(TAG, "  %-10s %lu us mean, %lu us max, %lu over its %lu us budget", s->name,
+                     (unsigned long)(cycles ? s->time_sum_us / cycles : 0), (unsigned long)s->time_max_us,
+                     (unsigned long)s->over_budget, (unsigned long)s->budget_us);
+        }
+    }
+}
+
+/**
+ * @brief Add a stage to the end of the cycle
+ *
+ * @param name Stage name for the log, a string literal
+ * @param fn Stage function
+ * @param budget_us Longest time the stage should take
+ */
+void control_add_stage(const char *name, control_stage_fn_t fn, uint32_t budget_us)
+{
+    if (stage_count >= CONTROL_STAGES_MAX)
+    {
+        ESP_LOGE(TAG, "No room for stage '%s'", name);
+        return;
+    }
+    stages[stage_count++] = (control_stage_t){
+        .name = name,
+        .fn = fn,
+        .budget_us = budget_us,
+    };
+}
+
+/**
+ * @brief Start the executive task and its timer
+ */
+void control_start(void)
+{
+    if (stage_count == 0)
+    {
+        return;
+    }
+    uint32_t budget_us = 0;
+    for (int i = 0; i < stage_count; i++)
+    {
+        budget_us += stages[i].budget_us;
+    }
+    if (budget_us > CONTROL_PERIOD_US / 2)
+    {
+        ESP_LOGW(TAG, "Stage budgets add up to %lu us of a %d us period", (unsigned long)budget_us, CONTROL_PERIOD_US);
+    }
+
+    xTaskCreate(_control_task, "control_task", 3072, NULL, configMAX_PRIORITIES - 3, &control_task_handle);
+    xTaskCreate(_report_task, "control_report", 3072, NULL, 1, NULL);
+
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = CONTROL_TIMER_RESOLUTION_HZ,
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &control_timer));
+    gptimer_event_callbacks_t cbs = {
+        .on_alarm = _on_tick,
+    };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(control_timer, &cbs, NULL));
+    gptimer_alarm_config_t alarm = {
+        .alarm_count = CONTROL_PERIOD_US,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ESP_ERROR_CHECK(gptimer_set_alarm_action(control_timer, &alarm));
+    ESP_ERROR_CHECK(gptimer_enable(control_timer));
+    ESP_ERROR_CHECK(gptimer_start(control_timer));
+    power_stay_awake("the control executive timer");
+
+    ESP_LOGI(TAG, "%d stages every %d us, %lu us budgeted", stage_count, CONTROL_PERIOD_US, (unsigned long)budget_us);
+}
+
+/**
+ * @brief Get the executive statistics since boot
+ *
+ * @param[out] out Statistics
+ */
+void control_get_stats(control_stats_t *out)
+{
+    portENTER_CRITICAL(&control_lock);
+    *out = totals;
+    portEXIT_CRITICAL(&control_lock);
+}
+
+#endif /* CONFIG_CONTROL_ENABLE */
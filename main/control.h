@@ -0,0 +1,73 @@
+/**
+ * @file control.h
+ * @brief Fixed-rate control executive driven by a hardware timer
+ *
+ * With CONFIG_CONTROL_ENABLE a gptimer ticks at CONFIG_CONTROL_RATE_HZ and
+ * wakes one high priority task, which runs the registered stages in the
+ * order they were added, once per tick. Each stage has a time budget; a
+ * stage that takes longer is counted against it. The buttons module
+ * registers input sampling, debounce, gesture recognition and dispatch to
+ * the buttons task as four stages.
+ *
+ * The period is set by the timer, not by the work done in it, so it does
+ * not drift. The time from each tick to the start of its cycle is measured
+ * on the timer itself; its spread is the period jitter. A cycle that runs
+ * past the next tick is an overrun, and the ticks it swallowed are skipped
+ * rather than run late. Cycles, overruns, start latency and jitter and the
+ * time of every stage are logged every CONTROL_REPORT_MS.
+ *
+ * The timer keeps the chip out of light sleep while the executive runs.
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdint.h>
+
+#define CONTROL_STAGES_MAX 8     /**< Stages the executive runs */
+#define CONTROL_REPORT_MS 10000  /**< Statistics report interval */
+
+/**
+ * @brief One stage of a control cycle
+ *
+ * @param tick Cycle number, counting every tick of the timer including skipped ones
+ */
+typedef void (*control_stage_fn_t)(uint32_t tick);
+
+/**
+ * @brief Executive statistics since boot
+ */
+typedef struct
+{
+    uint32_t cycles;         /**< Cycles run */
+    uint32_t overruns;       /**< Ticks skipped because a cycle ran past them */
+    uint32_t over_budget;    /**< Stage runs longer than their budget */
+    uint32_t jitter_max_us;  /**< Largest spread of the tick to cycle start time in a report window */
+} control_stats_t;
+
+/**
+ * @brief Add a stage to the end of the cycle
+ *
+ * Must be called before control_start().
+ *
+ * @param name Stage name for the log, a string literal
+ * @param fn Stage function
+ * @param budget_us Longest time the stage should take
+ */
+void control_add_stage(const char *name, control_stage_fn_t fn, uint32_t budget_us);
+
+/**
+ * @brief Start the executive task and its timer
+ *
+ * Does nothing if no stage was added.
+ */
+void control_start(void);
+
+/**
+ * @brief Get the executive statistics since boot
+ *
+ * @param[out] out Statistics
+ */
+void control_get_stats(control_stats_t *out);
+
+#endif /* CONTROL_H */
@@ -0,0 +1,405 @@
+/**
+ * @file deadline.c
+ * @brief Implementation of the deadline monitor
+ *
+ * The rings are written under a spinlock, one entry per event. The stamp is
+ * owned by the task that took it, which is the only one that ever arms or
+ * drops it, so the check reads it without the lock.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "deadline.h"
+
+static const char *TAG = "Deadline";
+
+#ifdef CONFIG_ZC_SYNC_ENABLE
+#define DEADLINE_ZC_WAIT_US CONFIG_ZC_MAX_WAIT_US /**< Latches wait for a zero crossing by design */
+#else
+#define DEADLINE_ZC_WAIT_US 0
+#endif
+
+/** @brief Budget of each action type, press to latch */
+static const uint32_t budget_us[DEADLINE_ACTIONS] = {
+    [DEADLINE_EDIT] = CONFIG_DEADLINE_EDIT_US + DEADLINE_ZC_WAIT_US,
+    [DEADLINE_PRESET] = CONFIG_DEADLINE_PRESET_US + DEADLINE_ZC_WAIT_US,
+    [DEADLINE_SCENE] = CONFIG_DEADLINE_SCENE_US + DEADLINE_ZC_WAIT_US,
+    [DEADLINE_SONG] = CONFIG_DEADLINE_SONG_US + DEADLINE_ZC_WAIT_US,
+};
+
+/** @brief Protects the rings, the snapshot and the counters */
+static portMUX_TYPE deadline_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/** @brief Task that stamped the press, NULL if there is no stamp */
+static TaskHandle_t owner;
+/** @brief Time of the press */
+static int64_t input_us;
+/** @brief Action the next latch answers */
+static deadline_action_t armed_action;
+/** @brief The next latch from the owner is checked */
+static bool armed;
+
+/** @brief Trace ring and the number of events written to it */
+static deadline_trace_t trace[DEADLINE_TRACE_LEN];
+static uint32_t trace_head;
+/** @brief Metrics ring and the number of actions written to it */
+static deadline_metric_t metrics[DEADLINE_METRICS_LEN];
+static uint32_t metrics_head;
+
+/** @brief Rings frozen at the first miss */
+static deadline_snapshot_t frozen;
+/** @brief frozen holds a snapshot */
+static bool is_frozen;
+/** @brief The report task has logged the snapshot */
+static bool frozen_logged;
+
+/** @brief Counters since boot */
+static deadline_stats_t stats;
+/** @brief Actions checked and longest press to latch of the current report window, per action type */
+static uint32_t stat_checked[DEADLINE_ACTIONS], stat_max_us[DEADLINE_ACTIONS];
+
+/**
+ * @brief Write a trace entry, under the lock
+ */
+static inline void _trace(uint32_t t_us, deadline_event_t event, uint16_t arg)
+{
+    deadline_trace_t *e = &trace[trace_head++ & (DEADLINE_TRACE_LEN - 1)];
+    e->t_us = t_us;
+    e->event = event;
+    e->action = armed_action;
+    e->arg = arg;
+}
+
+/**
+ * @brief Histogram bucket of a press to latch time
+ */
+static inline int _bucket(uint32_t elapsed_us)
+{
+    uint32_t scaled = elapsed_us >> 7;
+    if (scaled == 0)
+    {
+        return 0;
+    }
+    int bucket = 32 - __builtin_clz(scaled);
+    return bucket < DEADLINE_HIST_BUCKETS ? bucket : DEADLINE_HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief Copy both rings into the snapshot, oldest first, under the lock
+ */
+static void _freeze(uint32_t now, uint32_t elapsed)
+{
+    frozen.miss_us = now;
+    frozen.elapsed_us = elapsed;
+    frozen.action = armed_action;
+    frozen.budget_us = budget_us[armed_action];
+    frozen.trace_count = trace_head < DEADLINE_TRACE_LEN ? trace_head : DEADLINE_TRACE_LEN;
+    for (uint32_t i = 0; i < frozen.trace_count; i++)
+    {
+        frozen.trace[i] = trace[(trace_head - frozen.trace_count + i) & (DEADLINE_TRACE_LEN - 1)];
+    }
+    frozen.metrics_count = metrics_head < DEADLINE_METRICS_LEN ? metrics_head : DEADLINE_METRICS_LEN;
+    for (uint32_t i = 0; i < frozen.metrics_count; i++)
+    {
+        frozen.metrics[i] = metrics[(metrics_head - frozen.metrics_count + i) & (DEADLINE_METRICS_LEN - 1)];
+    }
+    is_frozen = true;
+    frozen_logged = false;
+}
+
+/**
+ * @brief Log the frozen snapshot, one line per entry
+ *
+ * @param s Snapshot
+ */
+static void _log_snapshot(const deadline_snapshot_t *s)
+{
+    static const char *const event_name[] = {"input", "action", "staged", "latched", "miss"};
+    ESP_LOGW(TAG, "Snapshot of the miss at %lu us: action %d, %lu us of %lu us, %d events, %d actions",
+             (unsigned long)s->miss_us, s->action, (unsigned long)s->elapsed_us, (unsigned long)s->budget_us,
+             s->trace_count, s->metrics_count);
+    for (int i = 0; i < s->trace_count; i++)
+    {
+        const deadline_trace_t *e = &s->trace[i];
+        ESP_LOGW(TAG, "T %lu %s %d %d", (unsigned long)e->t_us,
+                 e->event < sizeof(event_name) / sizeof(event_name[0]) ? event_name[e->event] : "?", e->action,
+                 e->arg);
+    }
+    for (int i = 0; i < s->metrics_count; i++)
+    {
+        const deadline_metric_t *m = &s->metrics[i];
+        ESP_LOGW(TAG, "M %lu %d %lu%s%s", (unsigned long)m->t_us, m->action, (unsigned long)m->elapsed_us,
+                 m->preshifted ? " preshifted" : "", m->missed ? " missed" : "");
+    }
+}
+
+/**
+ * @brief Report task: log the misses and a newly frozen snapshot
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _report_task(void *pvParameters)
+{
+    static const char *const action_name[DEADLINE_ACTIONS] = {"edit", "preset", "scene", "song"};
+    static deadline_snapshot_t copy;
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(DEADLINE_REPORT_MS));
+        uint32_t checked[DEADLINE_ACTIONS], max_us[DEADLINE_ACTIONS], missed[DEADLINE_ACTIONS];
+        portENTER_CRITICAL(&deadline_lock);
+        memcpy(checked, stat_checked, sizeof(checked));
+        memcpy(max_us, stat_max_us, sizeof(max_us));
+        memcpy(missed, stats.misses, sizeof(missed));
+        memset(stat_checked, 0, sizeof(stat_checked));
+        memset(stat_max_us, 0, sizeof(stat_max_us));
+        bool log_frozen = is_frozen && !frozen_logged;
+        frozen_logged |= log_frozen;
+        portEXIT_CRITICAL(&deadline_lock);
+
+        for (int a = 0; a < DEADLINE_ACTIONS; a++)
+        {
+            if (checked[a])
+            {
+                ESP_LOGI(TAG, "%s: %lu actions, %lu us max of %lu us, %lu misses since boot", action_name[a],
+                         (unsigned long)checked[a], (unsigned long)max_us[a], (unsigned long)budget_us[a],
+                         (unsigned long)missed[a]);
+            }
+        }
+        if (log_frozen && deadline_snapshot(&copy))
+        {
+            _log_snapshot(&copy);
+        }
+    }
+}
+
+/**
+ * @brief Start the report task
+ */
+void deadline_init(void)
+{
+    xTaskCreate(_report_task, "deadline_task", 3072, NULL, 1, NULL);
+}
+
+/**
+ * @brief Stamp a debounced press
+ */
+void deadline_input(void)
+{
+    deadline_input_at(esp_timer_get_time());
+}
+
+/**
+ * @brief Stamp an input that arrived before the pass handling it
+ *
+ * @param t_us Arrival time, from esp_timer_get_time()
+ */
+void deadline_input_at(int64_t t_us)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (owner == self)
+    {
+        return; // Later presses of the same pass carry the first stamp
+    }
+    portENTER_CRITICAL(&deadline_lock);
+    if (owner == NULL)
+    {
+        owner = self;
+        input_us = t_us;
+        armed_action = DEADLINE_EDIT;
+        armed = true;
+        _trace((uint32_t)t_us, DEADLINE_EV_INPUT, 0);
+    }
+    portEXIT_CRITICAL(&deadline_lock);
+}
+
+/**
+ * @brief Tag the action about to change the route
+ *
+ * @param action Kind of action
+ */
+void deadline_action(deadline_action_t action)
+{
+    if (owner != xTaskGetCurrentTaskHandle())
+    {
+        return;
+    }
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    portENTER_CRITICAL(&deadline_lock);
+    armed_action = action;
+    armed = true;
+    _trace(now, DEADLINE_EV_ACTION, 0);
+    portEXIT_CRITICAL(&deadline_lock);
+}
+
+/**
+ * @brief Add an event to the trace ring
+ *
+ * @param event Event
+ * @param arg Event argument
+ */
+void deadline_trace(deadline_event_t event, uint16_t arg)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    portENTER_CRITICAL(&deadline_lock);
+    _trace(now, event, arg);
+    portEXIT_CRITICAL(&deadline_lock);
+}
+
+/**
+ * @brief Check the armed action against its budget, now that its route is latched
+ *
+ * @param preshifted The frame was preshifted
+ */
+void deadline_latched(bool preshifted)
+{
+    if (!armed || owner != xTaskGetCurrentTaskHandle())
+    {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    uint32_t elapsed = (uint32_t)(now - input_us);
+    bool missed = elapsed > budget_us[armed_action];
+    armed = false;
+
+    portENTER_CRITICAL(&deadline_lock);
+    _trace((uint32_t)now, DEADLINE_EV_LATCHED, elapsed > UINT16_MAX ? UINT16_MAX : elapsed);
+    deadline_metric_t *m = &metrics[metrics_head++ & (DEADLINE_METRICS_LEN - 1)];
+    m->t_us = (uint32_t)now;
+    m->elapsed_us = elapsed;
+    m->action = armed_action;
+    m->preshifted = preshifted;
+    m->missed = missed;
+    stats.checked[armed_action]++;
+    stats.hist[_bucket(elapsed)]++;
+    stat_checked[armed_action]++;
+    if (elapsed > stat_max_us[armed_action])
+    {
+        stat_max_us[armed_action] = elapsed;
+    }
+    if (missed)
+    {
+        uint32_t over = elapsed - budget_us[armed_action];
+        _trace((uint32_t)now, DEADLINE_EV_MISS, over > UINT16_MAX ? UINT16_MAX : over);
+        stats.misses[armed_action]++;
+        if (!is_frozen)
+        {
+            _freeze((uint32_t)now, elapsed);
+        }
+    }
+    portEXIT_CRITICAL(&deadline_lock);
+}
+
+/**
+ * @brief Drop the stamp at the end of a pass of the buttons task
+ */
+void deadline_done(void)
+{
+    if (owner != xTaskGetCurrentTaskHandle())
+    {
+        return;
+    }
+    portENTER_CRITICAL(&deadline_lock);
+    owner = NULL;
+    armed = false;
+    portEXIT_CRITICAL(&deadline_lock);
+}
+
+/**
+ * @brief Get the number of misses since boot
+ *
+ * @param action Kind of action, DEADLINE_ACTIONS for all of them
+ * @return Misses
+ */
+uint32_t deadline_misses(deadline_action_t action)
+{
+    uint32_t n = 0;
+    portENTER_CRITICAL(&deadline_lock);
+    for (int a = 0; a < DEADLINE_ACTIONS; a++)
+    {
+        if (action == DEADLINE_ACTIONS || action == a)
+        {
+            n += stats.misses[a];
+        }
+    }
+    portEXIT_CRITICAL(&deadline_lock);
+    return n;
+}
+
+/**
+ * @brief Get the counters since boot
+ *
+ * @param[out] out Counters
+ */
+void deadline_get_stats(deadline_stats_t *out)
+{
+    portENTER_CRITICAL(&deadline_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&deadline_lock);
+}
+
+/**
+ * @brief Read the trace events written since a cursor
+ *
+ * @param[in,out] cursor Events read so far, 0 to start; advanced past the events returned
+ * @param[out] out Events, oldest first
+ * @param max Room in @p out
+ * @param[out] lost Events skipped
+ * @return Number of events returned
+ */
+int deadline_trace_read(uint32_t *cursor, deadline_trace_t *out, int max, uint32_t *lost)
+{
+    portENTER_CRITICAL(&deadline_lock);
+    uint32_t behind = trace_head - *cursor;
+    *lost = 0;
+    if (behind > DEADLINE_TRACE_LEN)
+    {
+        *lost = behind - DEADLINE_TRACE_LEN;
+        *cursor += *lost;
+        behind = DEADLINE_TRACE_LEN;
+    }
+    int n = behind < (uint32_t)max ? (int)behind : max;
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = trace[(*cursor + i) & (DEADLINE_TRACE_LEN - 1)];
+    }
+    *cursor += n;
+    portEXIT_CRITICAL(&deadline_lock);
+    return n;
+}
+
+/**
+ * @brief Get the frozen snapshot
+ *
+ * The snapshot does not change while it is frozen, so it is copied without
+ * the lock.
+ *
+ * @param[out] out Copy of the snapshot
+ * @return true if a miss froze one, false if there is none
+ */
+bool deadline_snapshot(deadline_snapshot_t *out)
+{
+    portENTER_CRITICAL(&deadline_lock);
+    bool have = is_frozen;
+    portEXIT_CRITICAL(&deadline_lock);
+    if (have)
+    {
+        *out = frozen;
+    }
+    return have;
+}
+
+/**
+ * @brief Drop the frozen snapshot, so the next miss freezes a new one
+ */
+void deadline_release(void)
+{
+    portENTER_CRITICAL(&deadline_lock);
+    is_frozen = false;
+    portEXIT_CRITICAL(&deadline_lock);
+}
@@ -0,0 +1,212 @@
+/**
+ * @file deadline.h
+ * @brief Deadline monitor: press to latch time of every action against a budget
+ *
+ * Means and maxima per minute hide the one slow switch in a song. The
+ * buttons task stamps every debounced press with deadline_input() and tags
+ * the action it leads to with deadline_action(); the matrix calls
+ * deadline_latched() once the route is on the outputs. The time from the
+ * stamp to the latch is checked against the budget of the action type
+ * (CONFIG_DEADLINE_*_US, plus CONFIG_ZC_MAX_WAIT_US with zero-crossing
+ * switching). The check is a subtraction and a compare with a table entry;
+ * only a miss does more.
+ *
+ * Two rings run all the time: a trace of the last DEADLINE_TRACE_LEN events
+ * (inputs, actions, staged frames, latches) and the metrics of the last
+ * DEADLINE_METRICS_LEN actions. The first miss freezes a copy of both, which
+ * stays as it is until deadline_release(), so a miss in the middle of a set
+ * can still be looked at after it. The copy is logged once by the report
+ * task; misses are counted per action type.
+ *
+ * Only latches from the task that stamped the input are matched to it, so a
+ * route changed meanwhile by another task (failover, link) is not taken for
+ * the answer to a press.
+ */
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DEADLINE_TRACE_LEN 64     /**< Events in the trace ring, a power of two */
+#define DEADLINE_METRICS_LEN 32   /**< Actions in the metrics ring, a power of two */
+#define DEADLINE_REPORT_MS 60000  /**< Miss report interval */
+#define DEADLINE_HIST_BUCKETS 12  /**< Latency histogram buckets: below 128 us, then one per doubling */
+
+/**
+ * @brief Kinds of action, each with its own budget
+ */
+typedef enum
+{
+    DEADLINE_EDIT = 0, /**< Anything else that changes the route: pedal toggles, mute, edits */
+    DEADLINE_PRESET,   /**< Preset recall */
+    DEADLINE_SCENE,    /**< Scene change */
+    DEADLINE_SONG,     /**< Song change of a show */
+    DEADLINE_ACTIONS
+} deadline_action_t;
+
+/**
+ * @brief Events in the trace ring
+ */
+typedef enum
+{
+    DEADLINE_EV_INPUT = 0, /**< Debounced press stamped */
+    DEADLINE_EV_ACTION,    /**< Action tagged, arg unused */
+    DEADLINE_EV_STAGED,    /**< Routing frame in the registers, arg 1 if it was preshifted */
+    DEADLINE_EV_LATCHED,   /**< Route of an action latched, arg microseconds since the press (saturated) */
+    DEADLINE_EV_MISS,      /**< The latch was over budget, arg microseconds over (saturated) */
+} deadline_event_t;
+
+/**
+ * @brief One trace ring entry
+ */
+typedef struct
+{
+    uint32_t t_us;  /**< Time of the event, low 32 bits of esp_timer_get_time() */
+    uint8_t event;  /**< deadline_event_t */
+    uint8_t action; /**< deadline_action_t in effect */
+    uint16_t arg;   /**< Event argument */
+} deadline_trace_t;
+
+/**
+ * @brief One metrics ring entry: an action that reached its latch
+ */
+typedef struct
+{
+    uint32_t t_us;       /**< Time of the latch */
+    uint32_t elapsed_us; /**< Press to latch */
+    uint8_t action;      /**< deadline_action_t */
+    uint8_t preshifted;  /**< The frame was preshifted and only needed the latch */
+    uint8_t missed;      /**< Over budget */
+    uint8_t reserved;
+} deadline_metric_t;
+
+/**
+ * @brief Copy of both rings frozen at the first miss, oldest entries first
+ */
+typedef struct
+{
+    uint32_t miss_us;     /**< Time of the miss */
+    uint32_t elapsed_us;  /**< Press to latch of the action that missed */
+    uint32_t budget_us;   /**< Its budget */
+    uint8_t action;       /**< Its deadline_action_t */
+    uint8_t reserved;
+    uint16_t trace_count;   /**< Valid entries in trace */
+    uint16_t metrics_count; /**< Valid entries in metrics */
+    uint16_t reserved2;
+    deadline_trace_t trace[DEADLINE_TRACE_LEN];
+    deadline_metric_t metrics[DEADLINE_METRICS_LEN];
+} deadline_snapshot_t;
+
+/**
+ * @brief Counters since boot
+ */
+typedef struct
+{
+    uint32_t checked[DEADLINE_ACTIONS];    /**< Actions that reached their latch */
+    uint32_t misses[DEADLINE_ACTIONS];     /**< Of those, over budget */
+    uint32_t hist[DEADLINE_HIST_BUCKETS];  /**< Press to latch of every action: bucket 0 below 128 us,
+                                                bucket i from 64 << i up to 128 << i us, the last one open */
+} deadline_stats_t;
+
+/**
+ * @brief Start the report task
+ */
+void deadline_init(void);
+
+/**
+ * @brief Stamp a debounced press
+ *
+ * The first press of a pass of the calling task sets the stamp; it is
+ * carried by every action of that pass until deadline_done(). The press is
+ * tagged DEADLINE_EDIT until deadline_action() says otherwise.
+ */
+void deadline_input(void);
+
+/**
+ * @brief Stamp an input that arrived before the pass handling it
+ *
+ * As deadline_input(), but the time to the latch starts at @p t_us, so the
+ * wait for the pass is counted too (USB MIDI: endpoint to latch).
+ *
+ * @param t_us Arrival time, from esp_timer_get_time()
+ */
+void deadline_input_at(int64_t t_us);
+
+/**
+ * @brief Tag the action about to change the route
+ *
+ * Arms the check for the next latch. Does nothing if no press was stamped
+ * in this pass.
+ *
+ * @param action Kind of action
+ */
+void deadline_action(deadline_action_t action);
+
+/**
+ * @brief Add an event to the trace ring
+ *
+ * @param event Event
+ * @param arg Event argument
+ */
+void deadline_trace(deadline_event_t event, uint16_t arg);
+
+/**
+ * @brief Check the armed action against its budget, now that its route is latched
+ *
+ * Called by the matrix after every routing latch. Only the first latch after
+ * deadline_input() or deadline_action(), from the task that stamped the
+ * press, is checked.
+ *
+ * @param preshifted The frame was preshifted
+ */
+void deadline_latched(bool preshifted);
+
+/**
+ * @brief Drop the stamp at the end of a pass of the buttons task
+ */
+void deadline_done(void);
+
+/**
+ * @brief Get the number of misses since boot
+ *
+ * @param action Kind of action, DEADLINE_ACTIONS for all of them
+ * @return Misses
+ */
+uint32_t deadline_misses(deadline_action_t action);
+
+/**
+ * @brief Get the counters since boot
+ *
+ * @param[out] out Counters
+ */
+void deadline_get_stats(deadline_stats_t *out);
+
+/**
+ * @brief Read the trace events written since a cursor
+ *
+ * Events the ring overwrote before they were read are skipped and counted.
+ *
+ * @param[in,out] cursor Events read so far, 0 to start; advanced past the events returned
+ * @param[out] out Events, oldest first
+ * @param max Room in @p out
+ * @param[out] lost Events skipped
+ * @return Number of events returned
+ */
+int deadline_trace_read(uint32_t *cursor, deadline_trace_t *out, int max, uint32_t *lost);
+
+/**
+ * @brief Get the frozen snapshot
+ *
+ * @param[out] out Copy of the snapshot
+ * @return true if a miss froze one, false if there is none
+ */
+bool deadline_snapshot(deadline_snapshot_t *out);
+
+/**
+ * @brief Drop the frozen snapshot, so the next miss freezes a new one
+ */
+void deadline_release(void);
+
+#endif /* DEADLINE_H */
@@ -0,0 +1,40 @@
+/**
+ * @file debounce.c
+ * @brief Implementation of the vertical counter debouncer
+ */
+
+#include "debounce.h"
+
+/**
+ * @brief Initialize a debouncer
+ *
+ * @param db Debouncer
+ * @param state Initial debounced state, so switches held at start-up are not reported
+ */
+void debounce_init(debounce_t *db, uint32_t state)
+{
+    db->state = state;
+    db->cnt0 = 0;
+    db->cnt1 = 0;
+}
+
+/**
+ * @brief Add one scan of samples
+ *
+ * The counters of switches that differ from their state are incremented and
+ * the others are cleared. A counter at 3 that is incremented again wraps to
+ * 0 as its switch toggles.
+ *
+ * @param db Debouncer
+ * @param sample Raw switch levels, bit N = switch N
+ * @return Switches whose debounced state changed in this scan
+ */
+uint32_t debounce_update(debounce_t *db, uint32_t sample)
+{
+    uint32_t delta = sample ^ db->state;
+    uint32_t toggle = delta & db->cnt0 & db->cnt1;
+    db->cnt1 = (db->cnt1 ^ db->cnt0) & delta;
+    db->cnt0 = ~db->cnt0 & delta;
+    db->state ^= toggle;
+    return toggle;
+}
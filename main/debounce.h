@@ -0,0 +1,51 @@
+/**
+ * @file debounce.h
+ * @brief Debouncing of up to 32 switches at once with vertical counters
+ *
+ * Each switch has a 2-bit counter whose bits are spread over two words
+ * (a vertical counter), so one update runs the same few logic operations
+ * on all 32 switches at once. A switch whose sample differs from its
+ * debounced state counts up on every scan and toggles after
+ * DEBOUNCE_SAMPLES different samples in a row; a sample equal to the state
+ * clears the counter. Contact bounce therefore never reaches the state, and
+ * a press is reported DEBOUNCE_SAMPLES - 1 scans after the contact settles.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host, see
+ * tools/debounce_sim.c.
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+
+#define DEBOUNCE_SAMPLES 4 /**< Equal samples in a row that change the state (fixed by the 2-bit counter) */
+
+/**
+ * @brief Debouncer state for 32 switches
+ */
+typedef struct
+{
+    uint32_t state; /**< Debounced state, bit N = switch N */
+    uint32_t cnt0;  /**< Counter bit 0 of every switch */
+    uint32_t cnt1;  /**< Counter bit 1 of every switch */
+} debounce_t;
+
+/**
+ * @brief Initialize a debouncer
+ *
+ * @param db Debouncer
+ * @param state Initial debounced state, so switches held at start-up are not reported
+ */
+void debounce_init(debounce_t *db, uint32_t state);
+
+/**
+ * @brief Add one scan of samples
+ *
+ * @param db Debouncer
+ * @param sample Raw switch levels, bit N = switch N
+ * @return Switches whose debounced state changed in this scan
+ */
+uint32_t debounce_update(debounce_t *db, uint32_t sample);
+
+#endif /* DEBOUNCE_H */
@@ -0,0 +1,380 @@
+/**
+ * @file expander.c
+ * @brief Implementation of the MCP23017 footswitch expanders
+ *
+ * The expanders run with IOCON.BANK = 0, so the A and B registers of each
+ * function are adjacent and one sequential read returns GPIOA and GPIOB.
+ * IPOL inverts every input, so a pressed (grounded) switch reads as 1.
+ * Interrupt-on-change compares against the previous value, so INT fires on
+ * press and release and is cleared by the GPIO read.
+ *
+ * The INT line is wired-OR: an expander that changes again after it was
+ * read but while another is still being read keeps the line low, and no
+ * new edge follows. The task therefore reads again until the line is high.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "expander.h"
+#include "i2c_sched.h"
+#include "power.h"
+#include "hw_profile.h"
+
+#define MCP_IODIR 0x00   /**< Direction, 1 = input */
+#define MCP_IPOL 0x02    /**< Input polarity, 1 = inverted */
+#define MCP_GPINTEN 0x04 /**< Interrupt-on-change enable */
+#define MCP_INTCON 0x08  /**< Interrupt compare, 0 = against the previous value */
+#define MCP_IOCON 0x0A   /**< Configuration */
+#define MCP_GPPU 0x0C    /**< Pull-ups */
+#define MCP_GPIO 0x12    /**< Port values */
+
+#define MCP_IOCON_MIRROR 0x40 /**< INTA and INTB both report either port */
+#define MCP_IOCON_ODR 0x04    /**< INT is open-drain */
+
+#define EXPANDER_SCL_HZ 400000   /**< I2C clock of the expanders */
+#define EXPANDER_REREADS 4       /**< Reads per wake while the INT line stays low */
+#define EXPANDER_REPORT_MS 10000 /**< Latency report interval, also a fallback read */
+
+static const char *TAG = "Expander";
+
+/** @brief Protects the presses and the pending edge */
+static portMUX_TYPE exp_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Handle of the expander task */
+static TaskHandle_t exp_task_handle;
+/** @brief Task woken when a press is collected */
+static TaskHandle_t waiter;
+/** @brief Device handle of each expander that answered */
+static i2c_master_dev_handle_t exp_dev[HW_EXPANDERS_MAX];
+/** @brief Expanders that answered */
+static uint8_t exp_count;
+/** @brief Time of the first INT edge not yet read, 0 if none */
+static volatile int64_t edge_us;
+/** @brief Presses not yet taken by the buttons task */
+static uint32_t presses;
+/** @brief INT edge of the oldest of them, or its read if there was no edge */
+static int64_t presses_edge_us;
+
+/** @brief Debounced switch state, bit N = switch N pressed */
+static uint32_t stable;
+/** @brief End of the lockout of each switch */
+static int64_t lockout_until_us[EXPANDER_SWITCHES_MAX];
+
+/** @brief Press latency statistics of the current report window */
+static uint32_t stat_presses, stat_latency_sum_us, stat_latency_max_us;
+/** @brief INT edge to expander_take_presses() statistics, under exp_lock */
+static uint32_t stat_taken, stat_take_sum_us, stat_take_max_us;
+
+/**
+ * @brief INT line edge interrupt: wake the expander task
+ *
+ * @param arg Unused
+ */
+static void IRAM_ATTR _int_isr(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&exp_lock);
+    if (!edge_us)
+    {
+        edge_us = now;
+    }
+    portEXIT_CRITICAL_ISR(&exp_lock);
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(exp_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * @brief Read the switches of every expander
+ *
+ * @param[out] raw Switch state, bit N = switch N pressed
+ * @return true if every expander was read
+ */
+static bool _read_all(uint32_t *raw)
+{
+    bool ok = true;
+    *raw = 0;
+    for (int e = 0; e < exp_count; e++)
+    {
+        uint8_t port[2];
+        if (i2c_sched_input_read(exp_dev[e], MCP_GPIO, port, sizeof(port)) != ESP_OK)
+        {
+            ok = false;
+            continue;
+        }
+        *raw |= (uint32_t)(port[0] | (port[1] << 8)) << (e * EXPANDER_SWITCHES);
+    }
+    return ok;
+}
+
+/**
+ * @brief Debounce a read and collect new presses
+ *
+ * @param raw Switch state just read
+ * @param now Time of the read
+ * @return Switches newly pressed
+ */
+static uint32_t _debounce(uint32_t raw, int64_t now)
+{
+    uint32_t changed = raw ^ stable;
+    uint32_t pressed = 0;
+    for (int i = 0; changed; i++, changed >>= 1)
+    {
+        if (!(changed & 1) || lockout_until_us[i] > now)
+        {
+            continue; // Unchanged, or bouncing
+        }
+        stable ^= 1UL << i;
+        lockout_until_us[i] = now + EXPANDER_LOCKOUT_MS * 1000;
+        if (stable & (1UL << i))
+        {
+            pressed |= 1UL << i;
+        }
+    }
+    return pressed;
+}
+
+/**
+ * @brief Time until the earliest lockout ends
+ *
+ * @param now Current time
+ * @return Ticks to wait, or the report interval if no switch is locked out
+ */
+static TickType_t _next_wake(int64_t now)
+{
+    int64_t next = 0;
+    for (int i = 0; i < exp_count * EXPANDER_SWITCHES; i++)
+    {
+        if (lockout_until_us[i] > now && (!next || lockout_until_us[i] < next))
+        {
+            next = lockout_until_us[i];
+        }
+    }
+    if (!next)
+    {
+        return pdMS_TO_TICKS(EXPANDER_REPORT_MS);
+    }
+    TickType_t ticks = pdMS_TO_TICKS((next - now + 999) / 1000);
+    return ticks ? ticks : 1;
+}
+
+/**
+ * @brief Expander task: burst-read the expanders on every INT edge
+ *
+ * Also wakes when a lockout ends, to pick up a change that happened during
+ * it, and every EXPANDER_REPORT_MS to log the press latency.
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _expander_task(void *pvParameters)
+{
+    TickType_t wait = pdMS_TO_TICKS(EXPANDER_REPORT_MS);
+    TickType_t last_report = xTaskGetTickCount();
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        portENTER_CRITICAL(&exp_lock);
+        int64_t edge = edge_us;
+        edge_us = 0;
+        portEXIT_CRITICAL(&exp_lock);
+
+        uint32_t pressed = 0;
+        int64_t now = 0;
+        for (int n = 0; n < EXPANDER_REREADS; n++)
+        {
+            uint32_t raw;
+            bool ok = _read_all(&raw);
+            now = esp_timer_get_time();
+            if (ok)
+            {
+                pressed |= _debounce(raw, now);
+            }
+            if (gpio_get_level(hw_tables.pin_exp_int))
+            {
+                break; // Every expander is cleared
+            }
+        }
+
+        if (pressed)
+        {
+            portENTER_CRITICAL(&exp_lock);
+            if (!presses)
+            {
+                presses_edge_us = edge ? edge : now;
+            }
+            presses |= pressed;
+            portEXIT_CRITICAL(&exp_lock);
+            xTaskNotifyGive(waiter); // Handled now, not on the next poll of the buttons task
+            if (edge)
+            {
+                uint32_t latency = (uint32_t)(now - edge);
+                stat_presses++;
+                stat_latency_sum_us += latency;
+                if (latency > stat_latency_max_us)
+                {
+                    stat_latency_max_us = latency;
+                }
+            }
+        }
+        wait = _next_wake(now);
+
+        if (xTaskGetTickCount() - last_report >= pdMS_TO_TICKS(EXPANDER_REPORT_MS))
+        {
+            last_report = xTaskGetTickCount();
+            i2c_sched_stats_t bus;
+            i2c_sched_get_stats(&bus, true);
+            portENTER_CRITICAL(&exp_lock);
+            uint32_t taken = stat_taken, take_sum = stat_take_sum_us, take_max = stat_take_max_us;
+            stat_taken = stat_take_sum_us = stat_take_max_us = 0;
+            portEXIT_CRITICAL(&exp_lock);
+            if (stat_presses && taken)
+            {
+                ESP_LOGI(TAG, "%lu presses, INT edge to read %lu us mean, %lu us max, to buttons task %lu us mean, "
+                              "%lu us max; bus wait max %lu us, display yielded %lu of %lu chunks",
+                         (unsigned long)stat_presses, (unsigned long)(stat_latency_sum_us / stat_presses),
+                         (unsigned long)stat_latency_max_us, (unsigned long)(take_sum / taken),
+                         (unsigned long)take_max, (unsigned long)bus.input_wait_max_us,
+                         (unsigned long)bus.display_yields, (unsigned long)bus.display_chunks);
+            }
+            else if (stat_presses)
+            { // Read but none taken by the buttons task in this period
+                ESP_LOGI(TAG, "%lu presses, INT edge to read %lu us mean, %lu us max; bus wait max %lu us, "
+                              "display yielded %lu of %lu chunks",
+                         (unsigned long)stat_presses, (unsigned long)(stat_latency_sum_us / stat_presses),
+                         (unsigned long)stat_latency_max_us, (unsigned long)bus.input_wait_max_us,
+                         (unsigned long)bus.display_yields, (unsigned long)bus.display_chunks);
+            }
+            stat_presses = stat_latency_sum_us = stat_latency_max_us = 0;
+        }
+    }
+}
+
+/**
+ * @brief Configure one expander
+ *
+ * @param dev Expander
+ * @return ESP_OK, or the I2C error if the expander does not answer
+ */
+static esp_err_t _setup(i2c_master_dev_handle_t dev)
+{
+    static const struct
+    {
+        uint8_t reg;
+        uint8_t a, b;
+    } init[] = {
+        {MCP_IOCON, MCP_IOCON_MIRROR | MCP_IOCON_ODR, MCP_IOCON_MIRROR | MCP_IOCON_ODR},
+        {MCP_IODIR, 0xFF, 0xFF},
+        {MCP_GPPU, 0xFF, 0xFF},
+        {MCP_IPOL, 0xFF, 0xFF},
+        {MCP_INTCON, 0x00, 0x00},
+        {MCP_GPINTEN, 0xFF, 0xFF},
+    };
+    for (size_t i = 0; i < sizeof(init) / sizeof(init[0]); i++)
+    {
+        uint8_t val[2] = {init[i].a, init[i].b};
+        esp_err_t err = i2c_sched_input_write(dev, init[i].reg, val, sizeof(val));
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Set up the expanders and start the expander task
+ *
+ * @param bus I2C bus the expanders are on
+ * @param notify Task woken when a press is collected, the buttons task
+ */
+void expander_init(i2c_master_bus_handle_t bus, TaskHandle_t notify)
+{
+    if (hw_tables.exp_count == 0)
+    {
+        return;
+    }
+    waiter = notify;
+
+    for (int e = 0; e < hw_tables.exp_count; e++)
+    {
+        i2c_device_config_t dev_conf = {
+            .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+            .device_address = hw_tables.exp_addr[e],
+            .scl_speed_hz = EXPANDER_SCL_HZ,
+        };
+        i2c_master_dev_handle_t dev;
+        if (i2c_master_bus_add_device(bus, &dev_conf, &dev) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Cannot add expander 0x%02X", hw_tables.exp_addr[e]);
+            break;
+        }
+        esp_err_t err = _setup(dev);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Expander 0x%02X does not answer: %s", hw_tables.exp_addr[e], esp_err_to_name(err));
+            break; // Switch numbers are by position, so later expanders would move
+        }
+        exp_dev[exp_count++] = dev;
+    }
+    if (exp_count == 0)
+    {
+        return;
+    }
+
+    _read_all(&stable); // Switches held at start-up are not presses; this also clears INT
+
+    xTaskCreate(_expander_task, "expander_task", 3072, NULL, 6, &exp_task_handle);
+
+    gpio_config_t int_conf = {
+        .pin_bit_mask = 1ULL << hw_tables.pin_exp_int,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE, // Open-drain INT; an external pull-up is still advised
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    gpio_config(&int_conf);
+    esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) // Already installed is fine
+    {
+        ESP_LOGE(TAG, "GPIO ISR service install failed: %s", esp_err_to_name(err));
+    }
+    gpio_isr_handler_add(hw_tables.pin_exp_int, _int_isr, NULL);
+    xTaskNotifyGive(exp_task_handle); // Read once in case INT went low before the handler was added
+    power_stay_awake("the expander INT edge");
+
+    ESP_LOGI(TAG, "%d expander(s), %d footswitches, INT on GPIO %d", exp_count, exp_count * EXPANDER_SWITCHES,
+             hw_tables.pin_exp_int);
+}
+
+/**
+ * @brief Take the footswitch presses since the last call
+ *
+ * @return Pressed footswitches, bit N = switch N (expander N / 16, pin N % 16)
+ */
+uint32_t expander_take_presses(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&exp_lock);
+    uint32_t taken = presses;
+    presses = 0;
+    if (taken)
+    {
+        uint32_t latency = (uint32_t)(now - presses_edge_us);
+        stat_taken++;
+        stat_take_sum_us += latency;
+        if (latency > stat_take_max_us)
+        {
+            stat_take_max_us = latency;
+        }
+    }
+    portEXIT_CRITICAL(&exp_lock);
+    return taken;
+}
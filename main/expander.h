@@ -0,0 +1,55 @@
+/**
+ * @file expander.h
+ * @brief Footswitches on MCP23017 I2C port expanders
+ *
+ * Up to HW_EXPANDERS_MAX expanders with 16 footswitches each share the
+ * display I2C bus. Their INT outputs are mirrored and open-drain, so they
+ * share one interrupt line. A falling edge on it wakes the expander task,
+ * which reads GPIOA and GPIOB of every expander in one burst each; the read
+ * also clears the interrupt. The reads go through the I2C scheduler
+ * (i2c_sched.h), so a display flush in progress holds them up by one chunk
+ * at most.
+ *
+ * Debouncing is leading edge: the first change of a switch counts at once
+ * and further changes are ignored for EXPANDER_LOCKOUT_MS, after which the
+ * switch is read again. Presses are collected for the buttons task, which
+ * is notified at once and takes them with expander_take_presses(), so a
+ * press does not wait for its next poll. The time from the INT edge to the
+ * end of the read, and to the buttons task taking the press, is measured
+ * for every press and logged.
+ */
+
+#ifndef EXPANDER_H
+#define EXPANDER_H
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/i2c_master.h>
+#include "hw_profile.h"
+
+#define EXPANDER_SWITCHES 16                                         /**< Footswitches on each expander */
+#define EXPANDER_SWITCHES_MAX (HW_EXPANDERS_MAX * EXPANDER_SWITCHES) /**< Footswitches on all expanders */
+#define EXPANDER_LOCKOUT_MS 30                                       /**< Changes ignored after a switch changed */
+
+/**
+ * @brief Set up the expanders and start the expander task
+ *
+ * Does nothing if the board has no expanders (see hw_profile.h). An
+ * expander that does not answer is logged and left out, with the ones after
+ * it so the switch numbers do not move. Must be called after
+ * i2c_sched_init().
+ *
+ * @param bus I2C bus the expanders are on
+ * @param notify Task woken when a press is collected, the buttons task
+ */
+void expander_init(i2c_master_bus_handle_t bus, TaskHandle_t notify);
+
+/**
+ * @brief Take the footswitch presses since the last call
+ *
+ * @return Pressed footswitches, bit N = switch N (expander N / 16, pin N % 16)
+ */
+uint32_t expander_take_presses(void);
+
+#endif /* EXPANDER_H */
@@ -5,6 +5,17 @@
  * This file implements the graphical user interface for the patch bay system,
  * displaying the current effects chain, preset information, and system status
  * messages using LVGL.
+ *
+ * The gui_*() calls come from other tasks and never touch LVGL. They only
+ * write what should be on screen into a state snapshot: the text of each
+ * label with a hash of it, and the value of each meter bar. A call that
+ * leaves a field as it was does nothing; any other bumps the snapshot
+ * version. A render timer in the LVGL task compares the version with the
+ * one last drawn and, if it moved, copies the snapshot and sets only the
+ * widgets whose hash or value differs from what is on screen. A recall that
+ * calls gui_update_chain() and gui_set_status() several times in one pass
+ * therefore costs at most one label update each, at the next render, and
+ * none for a text that ends up unchanged.
  */
 
 #include <lvgl.h>
@@ -12,22 +23,169 @@
 #include <string.h>
 #include <stdarg.h> // For variadic functions
 #include <esp_log.h>
-#include <esp_task_wdt.h>
+#include <freertos/FreeRTOS.h>
 #include "gui.h"
 
 static const char *TAG = "GUI";
 static lv_obj_t *chain_label;         /**< LVGL label for displaying the effects chain */
 static lv_obj_t *status_label;        /**< LVGL label for displaying status messages */
 static bool display_available = true; /**< Flag indicating if display is working */
+static lv_obj_t *meter_bars[GUI_METERS_MAX]; /**< Level meter bars, created on first use */
 
 #define CHAIN_BUFFER_SIZE 96 // Increased buffer size for prefixes and longer chains
 #define STATUS_BUFFER_SIZE 64
+#define GUI_RENDER_MS 20      /**< Render timer period, below the LVGL refresh period */
+#define TUNER_SCALE_CELLS 17  /**< Cells of the tuner needle scale, odd so one sits in the middle */
+#define TUNER_IN_TUNE_CENTS 2 /**< Deviation shown as in tune */
+#define METER_BAR_WIDTH 8      /**< Level meter bar width, pixels */
+#define METER_BAR_HEIGHT 14    /**< Level meter bar height, pixels */
+#define METER_BAR_PITCH 13     /**< Distance between level meter bars, pixels */
+#define METER_RANGE_DB 60      /**< Levels shown, from -METER_RANGE_DB to 0 dBFS */
+#define METER_MIN_HEIGHT 64    /**< Smaller displays have no room between the labels */
+#define METER_NO_BAR (-1)      /**< Meter value of a tap with no bar */
+
+/**
+ * @brief Text fields of the snapshot, one per label
+ */
+enum
+{
+    GUI_FIELD_CHAIN = 0, /**< Chain line, or the tuner note */
+    GUI_FIELD_STATUS,    /**< Status line, or the tuner scale */
+    GUI_FIELDS
+};
+
+/**
+ * @brief What should be on screen
+ */
+typedef struct
+{
+    uint32_t version;                         /**< Bumped by every change */
+    uint32_t hash[GUI_FIELDS];                /**< Hash of each text */
+    char text[GUI_FIELDS][CHAIN_BUFFER_SIZE]; /**< Text of each label */
+    int8_t meter[GUI_METERS_MAX];             /**< Value of each meter bar, METER_NO_BAR for none */
+    bool redraw;                              /**< Redraw the labels even if unchanged */
+} gui_state_t;
+
+/** @brief Protects the snapshot */
+static portMUX_TYPE gui_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Snapshot written by the gui_*() calls */
+static gui_state_t state;
+/** @brief Version, text hashes and meter values on screen, only used by the render timer */
+static uint32_t drawn_version;
+static uint32_t drawn_hash[GUI_FIELDS];
+static int8_t drawn_meter[GUI_METERS_MAX];
+
+/**
+ * @brief FNV-1a hash of a text
+ */
+static uint32_t _hash(const char *text)
+{
+    uint32_t h = 2166136261u;
+    while (*text)
+    {
+        h = (h ^ (uint8_t)*text++) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Put a text in the snapshot, if it differs from the one there
+ *
+ * @param field GUI_FIELD_*
+ * @param text Text, cut to the field size
+ */
+static void _set_field(int field, const char *text)
+{
+    uint32_t hash = _hash(text);
+    size_t len = strnlen(text, CHAIN_BUFFER_SIZE - 1);
+    portENTER_CRITICAL(&gui_lock);
+    if (state.hash[field] != hash)
+    {
+        memcpy(state.text[field], text, len);
+        state.text[field][len] = '\0';
+        state.hash[field] = hash;
+        state.version++;
+    }
+    portEXIT_CRITICAL(&gui_lock);
+}
+
+/**
+ * @brief Render timer: bring the widgets in line with the snapshot
+ *
+ * Runs in the LVGL task with the LVGL lock held. Setting a label or a bar
+ * invalidates only that widget, which the next refresh redraws.
+ *
+ * @param timer LVGL timer (unused)
+ */
+static void _render(lv_timer_t *timer)
+{
+    if (state.version == drawn_version)
+    {
+        return; // Nothing changed since the last render
+    }
+    static gui_state_t now;
+    portENTER_CRITICAL(&gui_lock);
+    now = state;
+    state.redraw = false;
+    portEXIT_CRITICAL(&gui_lock);
+    drawn_version = now.version;
+
+    lv_obj_t *const labels[GUI_FIELDS] = {chain_label, status_label};
+    for (int f = 0; f < GUI_FIELDS; f++)
+    {
+        if (now.hash[f] != drawn_hash[f])
+        {
+            lv_label_set_text(labels[f], now.text[f]);
+            drawn_hash[f] = now.hash[f];
+        }
+        else if (now.redraw)
+        {
+            lv_obj_invalidate(labels[f]);
+        }
+    }
+
+    lv_disp_t *disp = lv_disp_get_default();
+    if (!disp || lv_disp_get_ver_res(disp) < METER_MIN_HEIGHT)
+    {
+        return;
+    }
+    int count = 0;
+    while (count < GUI_METERS_MAX && now.meter[count] != METER_NO_BAR)
+    {
+        count++;
+    }
+    if (lv_disp_get_hor_res(disp) < count * METER_BAR_PITCH)
+    {
+        return;
+    }
+    int left = -(count - 1) * METER_BAR_PITCH / 2;
+    for (int i = 0; i < count; i++)
+    {
+        if (!meter_bars[i])
+        {
+            meter_bars[i] = lv_bar_create(lv_scr_act());
+            if (!meter_bars[i])
+            {
+                break;
+            }
+            lv_obj_set_size(meter_bars[i], METER_BAR_WIDTH, METER_BAR_HEIGHT); // Taller than wide: fills upwards
+            lv_obj_align(meter_bars[i], LV_ALIGN_CENTER, left + i * METER_BAR_PITCH, 0);
+            lv_bar_set_range(meter_bars[i], 0, METER_RANGE_DB);
+            drawn_meter[i] = 0;
+        }
+        if (drawn_meter[i] != now.meter[i])
+        {
+            lv_bar_set_value(meter_bars[i], now.meter[i], LV_ANIM_OFF);
+            drawn_meter[i] = now.meter[i];
+        }
+    }
+}
 
 /**
- * @brief Initialize the GUI subsystem with watchdog protection
+ * @brief Initialize the GUI subsystem
  *
  * Sets up the LVGL UI components and prepares the display for showing
- * the patch bay interface. Includes protection against watchdog timeouts.
+ * the patch bay interface.
  */
 void gui_init(void)
 {
@@ -89,6 +247,14 @@ void gui_init(void)
     lv_label_set_long_mode(status_label, LV_LABEL_LONG_CLIP);
     lv_obj_set_width(status_label, 126);
 
+    _set_field(GUI_FIELD_CHAIN, "Patch Bay"); // As drawn, so the first render leaves them alone
+    _set_field(GUI_FIELD_STATUS, "Ready");
+    memset(state.meter, METER_NO_BAR, sizeof(state.meter));
+    memset(drawn_meter, METER_NO_BAR, sizeof(drawn_meter));
+    memcpy(drawn_hash, state.hash, sizeof(drawn_hash));
+    drawn_version = state.version;
+    lv_timer_create(_render, GUI_RENDER_MS, NULL);
+
     ESP_LOGI(TAG, "All objects created, re-enabling screen invalidation"); // Re-enable invalidation - but DON'T manually invalidate to avoid I2C timeout
     if (disp)
     {
@@ -124,11 +290,11 @@ void gui_init_fallback(void)
 }
 
 /**
- * @brief Update the chain display in the GUI with watchdog protection
+ * @brief Update the chain display in the GUI
  *
  * Formats and displays the current effects chain configuration with
- * an indication of whether it's a custom chain or a loaded preset.
- * Includes protection against watchdog timeouts.
+ * an indication of whether it's a custom chain or a loaded preset. The
+ * label is redrawn only if the text differs from the one on screen.
  *
  * @param patch Array containing the current patch configuration
  * @param len Length of the patch array
@@ -143,13 +309,6 @@ void gui_update_chain(const uint8_t *patch, uint8_t len, int8_t loaded_slot_inde
         return;
     }
 
-    // Reset watchdog if accessible
-    TaskHandle_t current_task = xTaskGetCurrentTaskHandle();
-    if (esp_task_wdt_status(current_task) == ESP_OK)
-    {
-        esp_task_wdt_reset();
-    }
-
     char buf[CHAIN_BUFFER_SIZE];
     char temp_chain_buf[CHAIN_BUFFER_SIZE - 20] = {0}; // Buffer for the chain part
 
@@ -187,37 +346,16 @@ void gui_update_chain(const uint8_t *patch, uint8_t len, int8_t loaded_slot_inde
         snprintf(buf, sizeof(buf), "Live: %s", temp_chain_buf);
     }
 
-    // Temporarily disable invalidation during text update to prevent I2C timeout
-    lv_disp_t *disp = lv_disp_get_default();
-    bool invalidation_was_enabled = true;
-    if (disp)
-    {
-        invalidation_was_enabled = lv_disp_is_invalidation_enabled(disp);
-        if (invalidation_was_enabled)
-        {
-            lv_disp_enable_invalidation(disp, false);
-        }
-    }
-
-    // Apply the text update without triggering immediate invalidation
-    lv_label_set_text(chain_label, buf);
-    lv_label_set_long_mode(chain_label, LV_LABEL_LONG_CLIP);
-
-    // Re-enable invalidation if it was previously enabled
-    if (disp && invalidation_was_enabled)
-    {
-        lv_disp_enable_invalidation(disp, true);
-    }
-
+    _set_field(GUI_FIELD_CHAIN, buf); // Drawn by the next render, if it changed
     ESP_LOGD(TAG, "Chain updated: %s", buf);
 }
 
 /**
- * @brief Set or update the status message in the GUI with watchdog protection
+ * @brief Set or update the status message in the GUI
  *
  * Formats and displays a status message in the designated area of the display.
- * Supports variable arguments for formatting the message.
- * Includes protection against watchdog timeouts.
+ * Supports variable arguments for formatting the message. Only the last of
+ * several messages set between two renders is drawn.
  *
  * @param status_fmt Format string for the status message
  * @param ... Variable arguments for formatting the status message
@@ -231,13 +369,6 @@ void gui_set_status(const char *status_fmt, ...)
         return;
     }
 
-    // Reset watchdog if accessible
-    TaskHandle_t current_task = xTaskGetCurrentTaskHandle();
-    if (esp_task_wdt_status(current_task) == ESP_OK)
-    {
-        esp_task_wdt_reset();
-    }
-
     // Keep messages short for faster processing
     char buf[STATUS_BUFFER_SIZE];
 
@@ -255,34 +386,59 @@ void gui_set_status(const char *status_fmt, ...)
     vsnprintf(buf, sizeof(buf), truncated_fmt, args);
     va_end(args);
 
-    // Temporarily disable invalidation during text update to prevent I2C timeout
-    lv_disp_t *disp = lv_disp_get_default();
-    bool invalidation_was_enabled = true;
-    if (disp)
+    _set_field(GUI_FIELD_STATUS, buf);
+}
+
+/**
+ * @brief Show a tuner reading
+ *
+ * The chain line shows the note and the deviation in cents; the status line
+ * shows the deviation as a needle on a scale from -50 to +50 cents. A
+ * reading that gives the same text as the last one redraws nothing, so a
+ * steady note costs no refresh.
+ *
+ * @param note Note name with octave, e.g. "E2", or NULL if no note is heard
+ * @param cents Deviation from the note, -50 to +50
+ */
+void gui_show_tuner(const char *note, int cents)
+{
+    if (!display_available || !chain_label || !status_label)
     {
-        invalidation_was_enabled = lv_disp_is_invalidation_enabled(disp);
-        if (invalidation_was_enabled)
-        {
-            lv_disp_enable_invalidation(disp, false);
-        }
+        return;
     }
 
-    // Apply the text update without triggering immediate invalidation
-    lv_label_set_text(status_label, buf);
-    lv_label_set_long_mode(status_label, LV_LABEL_LONG_CLIP);
-
-    // Re-enable invalidation if it was previously enabled
-    if (disp && invalidation_was_enabled)
+    char line[CHAIN_BUFFER_SIZE];
+    char scale[TUNER_SCALE_CELLS + 3];
+    memset(scale, '-', sizeof(scale) - 1);
+    scale[0] = '[';
+    scale[TUNER_SCALE_CELLS + 1] = ']';
+    scale[TUNER_SCALE_CELLS + 2] = '\0';
+    scale[1 + TUNER_SCALE_CELLS / 2] = '|';
+    if (note)
     {
-        lv_disp_enable_invalidation(disp, true);
+        if (cents < -50)
+            cents = -50;
+        if (cents > 50)
+            cents = 50;
+        int cell = (cents + 50) * (TUNER_SCALE_CELLS - 1) / 100;
+        scale[1 + cell] = (cents >= -TUNER_IN_TUNE_CENTS && cents <= TUNER_IN_TUNE_CENTS) ? 'O' : '#';
+        snprintf(line, sizeof(line), "Tuner  %s  %+dc", note, cents);
     }
+    else
+    {
+        snprintf(line, sizeof(line), "Tuner  --");
+    }
+
+    _set_field(GUI_FIELD_CHAIN, line);
+    _set_field(GUI_FIELD_STATUS, scale);
 }
 
 /**
  * @brief Safely trigger a manual display refresh
  * 
  * This function provides a controlled way to update the display that's safe
- * against I2C timeouts by using partial refresh and watchdog protection.
+ * against I2C timeouts by using partial refresh. The labels are invalidated
+ * by the next render, in the LVGL task.
  */
 void gui_force_refresh(void)
 {
@@ -292,19 +448,46 @@ void gui_force_refresh(void)
         return;
     }
 
-    ESP_LOGD(TAG, "Triggering controlled display refresh with watchdog protection");
-    
-    // Reset watchdog before potentially slow operation
-    esp_task_wdt_reset();
-    
-    // Use a gentler invalidation approach - only invalidate specific objects
-    if (chain_label) {
-        lv_obj_invalidate(chain_label);
+    ESP_LOGD(TAG, "Triggering controlled display refresh");
+
+    // Use a gentler invalidation approach - only the labels, and only at the next render
+    portENTER_CRITICAL(&gui_lock);
+    state.redraw = true;
+    state.version++;
+    portEXIT_CRITICAL(&gui_lock);
+}
+/**
+ * @brief Show the level meters as a row of bars between the chain and status
+ *
+ * The bars are created on the first call, so boards without meters never
+ * get them, and only on displays big enough to fit them between the two
+ * labels. Only bars whose level changed are redrawn.
+ *
+ * @param rms_db RMS level of each tap in dBFS, INT8_MIN if not measured
+ * @param count Number of taps, at most GUI_METERS_MAX
+ */
+void gui_update_meters(const int8_t *rms_db, uint8_t count)
+{
+    if (!display_available || !chain_label)
+    {
+        return;
     }
-    if (status_label) {
-        lv_obj_invalidate(status_label);
+    if (count > GUI_METERS_MAX)
+    {
+        count = GUI_METERS_MAX;
+    }
+    int8_t value[GUI_METERS_MAX];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        int v = rms_db[i] == INT8_MIN ? 0 : rms_db[i] + METER_RANGE_DB;
+        value[i] = v < 0 ? 0 : (v > METER_RANGE_DB ? METER_RANGE_DB : v);
     }
-    
-    // Don't force immediate refresh - let LVGL handle it on its timer
-    ESP_LOGD(TAG, "Objects invalidated for next LVGL refresh cycle");
-}
\ No newline at end of file
+
+    portENTER_CRITICAL(&gui_lock);
+    if (memcmp(state.meter, value, count) != 0)
+    {
+        memcpy(state.meter, value, count);
+        state.version++;
+    }
+    portEXIT_CRITICAL(&gui_lock);
+}
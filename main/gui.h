@@ -55,4 +55,26 @@ void gui_update_chain(const uint8_t *patch, uint8_t len, int8_t loaded_slot_inde
  */
 void gui_set_status(const char *status_fmt, ...); // Variadic for easier formatting
 
+/**
+ * @brief Show a tuner reading in place of the chain and status lines
+ *
+ * Call gui_update_chain() and gui_set_status() to go back to the patch view.
+ *
+ * @param note Note name with octave, e.g. "E2", or NULL if no note is heard
+ * @param cents Deviation from the note, -50 to +50
+ */
+void gui_show_tuner(const char *note, int cents);
+
+#define GUI_METERS_MAX 9 /**< Level meter bars: the guitar input and eight returns */
+
+/**
+ * @brief Show the level meters as a row of bars between the chain and status
+ *
+ * Does nothing on displays with no room for the bars between the labels.
+ *
+ * @param rms_db RMS level of each tap in dBFS, INT8_MIN if not measured
+ * @param count Number of taps, at most GUI_METERS_MAX
+ */
+void gui_update_meters(const int8_t *rms_db, uint8_t count);
+
 #endif
\ No newline at end of file
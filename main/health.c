@@ -0,0 +1,153 @@
+/**
+ * @file health.c
+ * @brief Implementation of the task health monitor
+ *
+ * The supervisor runs above every application task, so a task spinning at
+ * its own priority cannot starve it; it still gets to log the stall and
+ * restart the chip.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_task_wdt.h>
+#include <esp_system.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "health.h"
+
+#define HEALTH_STALL_MAGIC 0x4C415453 /**< Marks a valid stall record */
+#define HEALTH_NAME_LEN 16            /**< Task name kept over a reset */
+
+static const char *TAG = "Health";
+
+/**
+ * @brief One watched task, as the supervisor sees it
+ */
+typedef struct
+{
+    const char *name;     /**< Task name */
+    TickType_t deadline;  /**< Longest time without a beat */
+    uint32_t seen;        /**< Counter at the last change */
+    TickType_t changed;   /**< Time of the last change */
+} health_task_t;
+
+/**
+ * @brief Stall record kept over the reset
+ */
+typedef struct
+{
+    uint32_t magic;              /**< HEALTH_STALL_MAGIC if valid */
+    uint32_t silent_ms;          /**< Time without a beat when it was logged */
+    char name[HEALTH_NAME_LEN];  /**< Task that stalled */
+} health_stall_t;
+
+volatile uint32_t health_beats[HEALTH_TASKS_MAX + 1];
+
+static health_task_t watched[HEALTH_TASKS_MAX];
+/** @brief Watched tasks, published after the entry is filled */
+static volatile int watched_count;
+/** @brief Protects registration */
+static portMUX_TYPE health_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Last stall, survives a software reset */
+static RTC_NOINIT_ATTR health_stall_t last_stall;
+
+/**
+ * @brief Supervisor task: check every heartbeat, restart on a stall and feed the watchdog
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _supervisor_task(void *pvParameters)
+{
+    esp_err_t err = esp_task_wdt_add(NULL);
+    bool subscribed = err == ESP_OK;
+    if (!subscribed)
+    {
+        ESP_LOGW(TAG, "Task watchdog not available (%s), the supervisor itself is not watched", esp_err_to_name(err));
+    }
+
+    TickType_t wake = xTaskGetTickCount();
+    while (1)
+    {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(HEALTH_CHECK_MS));
+        TickType_t now = xTaskGetTickCount();
+        int count = watched_count;
+        for (int i = 0; i < count; i++)
+        {
+            health_task_t *t = &watched[i];
+            uint32_t beats = health_beats[i];
+            if (beats != t->seen)
+            {
+                t->seen = beats;
+                t->changed = now;
+            }
+            else if (now - t->changed > t->deadline)
+            {
+                uint32_t silent_ms = (now - t->changed) * portTICK_PERIOD_MS;
+                last_stall.silent_ms = silent_ms;
+                strlcpy(last_stall.name, t->name, sizeof(last_stall.name));
+                last_stall.magic = HEALTH_STALL_MAGIC;
+                ESP_LOGE(TAG, "Task '%s' stalled: no heartbeat for %lu ms (deadline %lu ms), restarting", t->name,
+                         (unsigned long)silent_ms, (unsigned long)(t->deadline * portTICK_PERIOD_MS));
+                vTaskDelay(pdMS_TO_TICKS(HEALTH_RESTART_DELAY_MS)); // Let the log drain
+                esp_restart();
+            }
+        }
+        if (subscribed)
+        {
+            esp_task_wdt_reset();
+        }
+    }
+}
+
+/**
+ * @brief Report a stall that caused the last reset and start the supervisor
+ */
+void health_init(void)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (last_stall.magic == HEALTH_STALL_MAGIC &&
+        (reason == ESP_RST_SW || reason == ESP_RST_TASK_WDT || reason == ESP_RST_PANIC))
+    {
+        last_stall.name[HEALTH_NAME_LEN - 1] = '\0';
+        ESP_LOGE(TAG, "Last reset after a stall: task '%s' had stalled for %lu ms", last_stall.name,
+                 (unsigned long)last_stall.silent_ms);
+    }
+    last_stall.magic = 0;
+
+    xTaskCreate(_supervisor_task, "health_task", 2560, NULL, configMAX_PRIORITIES - 2, NULL);
+}
+
+/**
+ * @brief Watch the calling task
+ *
+ * @param name Task name for the log, a string literal
+ * @param deadline_ms Longest time the task may go without a beat
+ * @return Id to pass to HEALTH_BEAT()
+ */
+int health_register(const char *name, uint32_t deadline_ms)
+{
+    portENTER_CRITICAL(&health_lock);
+    int id = watched_count;
+    if (id < HEALTH_TASKS_MAX)
+    {
+        watched[id] = (health_task_t){
+            .name = name,
+            .deadline = pdMS_TO_TICKS(deadline_ms),
+            .seen = health_beats[id],
+            .changed = xTaskGetTickCount(),
+        };
+        watched_count = id + 1;
+    }
+    portEXIT_CRITICAL(&health_lock);
+
+    if (id >= HEALTH_TASKS_MAX)
+    {
+        ESP_LOGE(TAG, "No room to watch task '%s'", name);
+        return HEALTH_TASKS_MAX; // The spare counter, never checked
+    }
+    ESP_LOGI(TAG, "Watching task '%s', deadline %lu ms", name, (unsigned long)deadline_ms);
+    return id;
+}
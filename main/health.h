@@ -0,0 +1,51 @@
+/**
+ * @file health.h
+ * @brief Task health monitor: heartbeats checked by one supervisor that feeds the watchdog
+ *
+ * Each watched task registers once with health_register() and then calls
+ * HEALTH_BEAT() every time round its loop. A beat is one increment of the
+ * task's own counter, with no call into FreeRTOS or the watchdog.
+ *
+ * A single supervisor task looks at every counter each HEALTH_CHECK_MS. A
+ * task whose counter has not moved for longer than its deadline is logged
+ * by name and the supervisor restarts the chip with esp_restart(). The name
+ * is kept in memory that survives the reset and logged at the next boot.
+ *
+ * The supervisor is the only subscriber of the task watchdog and feeds it
+ * every check, so the watchdog covers the supervisor itself being starved.
+ * It only resets the chip for that if CONFIG_ESP_TASK_WDT_PANIC is set; the
+ * stall record is then reported the same way.
+ */
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <stdint.h>
+
+#define HEALTH_TASKS_MAX 8    /**< Watched tasks */
+#define HEALTH_CHECK_MS 250   /**< Supervisor period */
+#define HEALTH_RESTART_DELAY_MS 100 /**< Time given to the stall log before the restart */
+
+/** @brief Tell the supervisor the task with id @p id (from health_register()) is alive */
+#define HEALTH_BEAT(id) (health_beats[(id)]++)
+
+/** @brief Heartbeat counter of each watched task, and a spare one beaten by tasks that did not fit */
+extern volatile uint32_t health_beats[HEALTH_TASKS_MAX + 1];
+
+/**
+ * @brief Report a stall that caused the last reset and start the supervisor
+ *
+ * Must be called before any task registers.
+ */
+void health_init(void);
+
+/**
+ * @brief Watch the calling task
+ *
+ * @param name Task name for the log, a string literal
+ * @param deadline_ms Longest time the task may go without a beat
+ * @return Id to pass to HEALTH_BEAT()
+ */
+int health_register(const char *name, uint32_t deadline_ms);
+
+#endif /* HEALTH_H */
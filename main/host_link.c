@@ -0,0 +1,275 @@
+/**
+ * @file host_link.c
+ * @brief Implementation of the host commands
+ *
+ * uart_write_bytes() writes a whole frame under the driver's lock, so the
+ * frames of this task never interleave with those of the telemetry task.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/uart.h>
+#include <esp_system.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "host_link.h"
+#include "telemetry.h"
+#include "telemetry_proto.h"
+#include "link_proto.h"
+#include "snapshot.h"
+
+#ifdef CONFIG_TELEMETRY_ENABLE
+
+#define HOST_LINK_FRAME_MAX (HOST_LINK_CHUNK + 16)                   /**< Largest frame before COBS */
+#define HOST_LINK_WIRE_MAX (HOST_LINK_FRAME_MAX + HOST_LINK_FRAME_MAX / 254 + 2) /**< Largest frame on the wire */
+
+static const char *TAG = "HostLink";
+
+/**
+ * @brief Image bytes waiting to go out in the next data frame
+ */
+typedef struct
+{
+    uint32_t offset;                  /**< Image offset of data[0] */
+    size_t len;                       /**< Bytes in data */
+    uint8_t data[HOST_LINK_CHUNK];    /**< Image bytes */
+} host_link_chunk_t;
+
+/** @brief Image offset the restore expects next */
+static uint32_t restore_at;
+/** @brief Status of the restore so far */
+static esp_err_t restore_err = ESP_ERR_INVALID_STATE;
+
+/**
+ * @brief Read a varint
+ *
+ * @param in Bytes
+ * @param len Number of bytes
+ * @param[in,out] pos Read position
+ * @param[out] v Value
+ * @return false if the bytes end inside the varint
+ */
+static bool _get_varint(const uint8_t *in, size_t len, size_t *pos, uint32_t *v)
+{
+    *v = 0;
+    for (int shift = 0; *pos < len && shift < 35; shift += 7)
+    {
+        uint8_t b = in[(*pos)++];
+        *v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Send one frame to the host
+ *
+ * @param kind Frame kind
+ * @param payload Payload
+ * @param len Payload length, at most HOST_LINK_FRAME_MAX - 3
+ */
+static void _send(uint8_t kind, const uint8_t *payload, size_t len)
+{
+    uint8_t frame[HOST_LINK_FRAME_MAX];
+    uint8_t out[HOST_LINK_WIRE_MAX];
+    size_t n = 0;
+    frame[n++] = kind;
+    memcpy(&frame[n], payload, len);
+    n += len;
+    uint16_t crc = link_crc16(0xFFFF, frame, n);
+    frame[n++] = crc & 0xFF;
+    frame[n++] = crc >> 8;
+    uart_write_bytes(TELEMETRY_UART, out, telemetry_cobs(frame, n, out));
+}
+
+/**
+ * @brief Send a frame of two varints: an offset or length and a status
+ */
+static void _send_status(uint8_t kind, uint32_t at, esp_err_t err)
+{
+    uint8_t payload[10];
+    size_t n = telemetry_put_varint(payload, at);
+    n += telemetry_put_varint(&payload[n], (uint32_t)err);
+    _send(kind, payload, n);
+}
+
+/**
+ * @brief Send the buffered image bytes as one data frame
+ */
+static void _flush_chunk(host_link_chunk_t *chunk)
+{
+    uint8_t payload[5 + HOST_LINK_CHUNK];
+    size_t n = telemetry_put_varint(payload, chunk->offset);
+    memcpy(&payload[n], chunk->data, chunk->len);
+    _send(HOST_LINK_KIND_DATA, payload, n + chunk->len);
+    chunk->offset += chunk->len;
+    chunk->len = 0;
+}
+
+/**
+ * @brief Snapshot write function: fill data frames and send the full ones
+ */
+static esp_err_t _export_write(const uint8_t *data, size_t len, void *ctx)
+{
+    host_link_chunk_t *chunk = ctx;
+    while (len)
+    {
+        size_t take = HOST_LINK_CHUNK - chunk->len;
+        if (take > len)
+        {
+            take = len;
+        }
+        memcpy(&chunk->data[chunk->len], data, take);
+        chunk->len += take;
+        data += take;
+        len -= take;
+        if (chunk->len == HOST_LINK_CHUNK)
+        {
+            _flush_chunk(chunk);
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Handle one restore frame
+ *
+ * A frame that ends where the restore already is was sent again because
+ * its acknowledge was lost, and is only acknowledged again.
+ */
+static void _restore(const uint8_t *payload, size_t len)
+{
+    size_t pos = 0;
+    uint32_t offset;
+    if (!_get_varint(payload, len, &pos, &offset))
+    {
+        return;
+    }
+    size_t bytes = len - pos;
+    if (offset == 0)
+    {
+        restore_at = 0;
+        restore_err = snapshot_restore_begin();
+    }
+    if (restore_err == ESP_OK && offset == restore_at)
+    {
+        restore_err = snapshot_restore_feed(&payload[pos], bytes);
+        restore_at += bytes;
+    }
+    else if (restore_err == ESP_OK && offset + bytes != restore_at)
+    {
+        _send_status(HOST_LINK_KIND_ACK, restore_at, ESP_ERR_INVALID_STATE); // Out of order, host resends from here
+        return;
+    }
+    _send_status(HOST_LINK_KIND_ACK, restore_at, restore_err);
+}
+
+/**
+ * @brief Handle one frame from the host
+ *
+ * @param raw COBS encoded frame without its delimiter
+ * @param len Encoded length
+ */
+static void _handle(const uint8_t *raw, size_t len)
+{
+    uint8_t frame[HOST_LINK_WIRE_MAX];
+    size_t n = telemetry_uncobs(raw, len, frame);
+    if (n < 3 || link_crc16(0xFFFF, frame, n - 2) != (frame[n - 2] | frame[n - 1] << 8))
+    {
+        ESP_LOGW(TAG, "Dropped a damaged frame");
+        return;
+    }
+    n -= 2;
+
+    switch (frame[0])
+    {
+    case HOST_LINK_KIND_EXPORT:
+    {
+        host_link_chunk_t chunk = {0};
+        esp_err_t err = snapshot_export(_export_write, &chunk);
+        if (chunk.len)
+        {
+            _flush_chunk(&chunk);
+        }
+        _send_status(HOST_LINK_KIND_END, chunk.offset, err);
+        break;
+    }
+    case HOST_LINK_KIND_RESTORE:
+        _restore(&frame[1], n - 1);
+        break;
+    case HOST_LINK_KIND_COMMIT:
+    {
+        esp_err_t err = restore_err == ESP_OK ? snapshot_restore_commit() : restore_err;
+        _send_status(HOST_LINK_KIND_ACK, restore_at, err);
+        restore_err = ESP_ERR_INVALID_STATE;
+        if (err == ESP_OK)
+        {
+            ESP_LOGW(TAG, "Snapshot restored, restarting");
+            uart_wait_tx_done(TELEMETRY_UART, pdMS_TO_TICKS(100));
+            esp_restart();
+        }
+        ESP_LOGE(TAG, "Snapshot not restored: %s", esp_err_to_name(err));
+        break;
+    }
+    default:
+        break; // Not for us
+    }
+}
+
+/**
+ * @brief Host link task: split the received bytes into frames and handle them
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _host_link_task(void *pvParameters)
+{
+    static uint8_t raw[HOST_LINK_WIRE_MAX];
+    size_t raw_len = 0;
+    bool overflow = false;
+    uint8_t buf[64];
+
+    while (1)
+    {
+        int n = uart_read_bytes(TELEMETRY_UART, buf, sizeof(buf), pdMS_TO_TICKS(100));
+        for (int i = 0; i < n; i++)
+        {
+            if (buf[i] == 0)
+            {
+                if (raw_len && !overflow)
+                {
+                    _handle(raw, raw_len);
+                }
+                raw_len = 0;
+                overflow = false;
+            }
+            else if (raw_len < sizeof(raw))
+            {
+                raw[raw_len++] = buf[i];
+            }
+            else
+            {
+                overflow = true; // Dropped at the next delimiter
+            }
+        }
+    }
+}
+
+/**
+ * @brief Start the host link task
+ */
+void host_link_init(void)
+{
+    if (CONFIG_TELEMETRY_RX_PIN < 0)
+    {
+        return;
+    }
+    xTaskCreate(_host_link_task, "host_link_task", 4096, NULL, 1, NULL);
+    ESP_LOGI(TAG, "Host commands on UART%d RX GPIO %d", CONFIG_TELEMETRY_UART_NUM, CONFIG_TELEMETRY_RX_PIN);
+}
+
+#endif /* CONFIG_TELEMETRY_ENABLE */
@@ -0,0 +1,43 @@
+/**
+ * @file host_link.h
+ * @brief Commands from a host on the telemetry UART
+ *
+ * With CONFIG_TELEMETRY_RX_PIN set, the telemetry UART also receives, and
+ * a host can export the stored configuration as a snapshot (snapshot.h) or
+ * restore one. tools/snapshot.py does both.
+ *
+ * Frames in both directions use the telemetry framing: a kind byte, the
+ * payload, a link_crc16() and COBS with a zero delimiter (see
+ * telemetry_proto.h), so they can share the line with the stream. Offsets
+ * and lengths in the payload are varints; a status is an esp_err_t as a
+ * varint, 0 for ESP_OK.
+ *
+ * - Export: the host sends HOST_LINK_KIND_EXPORT; the unit answers with
+ *   HOST_LINK_KIND_DATA frames carrying the image in order, then
+ *   HOST_LINK_KIND_END.
+ * - Restore: the host sends the image in HOST_LINK_KIND_RESTORE frames,
+ *   each once the one before is acknowledged; offset 0 starts over. Then
+ *   HOST_LINK_KIND_COMMIT replaces the configuration, and the unit
+ *   restarts once it has acknowledged it.
+ */
+
+#ifndef HOST_LINK_H
+#define HOST_LINK_H
+
+#define HOST_LINK_KIND_EXPORT 'E'  /**< Host: send a snapshot */
+#define HOST_LINK_KIND_RESTORE 'R' /**< Host: offset | image bytes */
+#define HOST_LINK_KIND_COMMIT 'C'  /**< Host: replace the configuration with the image sent and restart */
+#define HOST_LINK_KIND_DATA 'S'    /**< Unit: offset | image bytes */
+#define HOST_LINK_KIND_END 'F'     /**< Unit: image length | status */
+#define HOST_LINK_KIND_ACK 'A'     /**< Unit: offset expected next | status */
+#define HOST_LINK_CHUNK 192        /**< Most image bytes in one frame */
+
+/**
+ * @brief Start the host link task
+ *
+ * Does nothing without CONFIG_TELEMETRY_RX_PIN. Must be called after
+ * telemetry_init().
+ */
+void host_link_init(void);
+
+#endif /* HOST_LINK_H */
@@ -0,0 +1,832 @@
+/**
+ * @file hw_profile.c
+ * @brief Implementation of the runtime hardware profile
+ *
+ * Loads the board profile record from NVS, validates it and compiles it into
+ * the flat hw_tables used by the shift register, button, LED and display code.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <nvs.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+
+#include "sdkconfig.h"
+#include "hw_profile.h"
+#include "led.h"
+#include "power.h"
+#include "usb_midi.h"
+
+static const char *TAG = "HwProfile";
+
+hw_tables_t hw_tables;
+
+/**
+ * @brief Fill a profile with the Kconfig defaults
+ *
+ * The default lane layout matches the original board: sink N select nibble at
+ * matrix chain bits 4N..4N+3, sink N inhibit at inhibit chain bit N, and the
+ * LED mapping from led.h. The original board only has amp output A.
+ *
+ * @param[out] profile Profile to fill
+ */
+void hw_profile_get_default(hw_profile_t *profile)
+{
+    static const uint8_t pedal_pins[NUM_PEDALS_MAX] = {
+        CONFIG_PEDAL_BUTTON_1_PIN, CONFIG_PEDAL_BUTTON_2_PIN, CONFIG_PEDAL_BUTTON_3_PIN, CONFIG_PEDAL_BUTTON_4_PIN,
+        CONFIG_PEDAL_BUTTON_5_PIN, CONFIG_PEDAL_BUTTON_6_PIN, CONFIG_PEDAL_BUTTON_7_PIN, CONFIG_PEDAL_BUTTON_8_PIN};
+    static const uint8_t led_bits[NUM_PEDALS_MAX] = {
+        LED_PEDAL_1, HW_LANE_NONE, LED_PEDAL_3, LED_PEDAL_4,
+        LED_PEDAL_5, LED_PEDAL_6, LED_PEDAL_7, LED_PEDAL_8};
+
+    memset(profile, 0, sizeof(*profile));
+    strncpy(profile->name, "kconfig", sizeof(profile->name));
+    profile->num_pedals = NUM_PEDALS_MAX;
+#if CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
+    profile->display_type = HW_DISPLAY_SH1107_64X128;
+#elif CONFIG_EXAMPLE_SSD1306_HEIGHT == 32
+    profile->display_type = HW_DISPLAY_SSD1306_128X32;
+#else
+    profile->display_type = HW_DISPLAY_SSD1306_128X64;
+#endif
+    profile->display_i2c_addr = 0x3D;
+    profile->led_active_low = 1;
+
+    profile->pin_i2c_sda = CONFIG_I2C_SDA_PIN;
+    profile->pin_i2c_scl = CONFIG_I2C_SCL_PIN;
+    profile->pin_program_btn = CONFIG_PROGRAM_BUTTON_PIN;
+    profile->pin_preset_btn = CONFIG_PRESET_BUTTON_PIN;
+    memcpy(profile->pin_pedal_btn, pedal_pins, sizeof(pedal_pins));
+    profile->pin_sr_clock = CONFIG_SR_CLOCK_PIN;
+    profile->pin_sr_latch = CONFIG_SR_LATCH_PIN;
+    profile->pin_sr_oe = CONFIG_SR_OUTPUT_ENABLE_PIN;
+    profile->pin_led_oe = HW_PIN_NONE;
+    profile->pin_sr_data[SR_CHAIN_MATRIX] = CONFIG_MATRIX_SR_DATA_PIN;
+    profile->pin_sr_data[SR_CHAIN_INHIBIT] = CONFIG_INHIBIT_SR_DATA_PIN;
+    profile->pin_sr_data[SR_CHAIN_LED] = CONFIG_LED_SR_DATA_PIN;
+
+    for (int s = 0; s < HW_SINKS_V1; s++)
+    {
+        profile->sink_sel_lane[s] = HW_LANE(SR_CHAIN_MATRIX, s * 4);
+        profile->sink_inh_lane[s] = HW_LANE(SR_CHAIN_INHIBIT, s);
+    }
+    memset(profile->out_sel_lane, HW_LANE_NONE, sizeof(profile->out_sel_lane));
+    memset(profile->out_inh_lane, HW_LANE_NONE, sizeof(profile->out_inh_lane));
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        profile->led_pedal_lane[i] = led_bits[i] == HW_LANE_NONE ? HW_LANE_NONE : HW_LANE(SR_CHAIN_LED, led_bits[i]);
+    }
+    profile->led_status_lane = HW_LANE(SR_CHAIN_LED, LED_STATUS);
+
+    profile->pin_tap_btn = CONFIG_TAP_BUTTON_PIN < 0 ? HW_PIN_NONE : CONFIG_TAP_BUTTON_PIN;
+    profile->pin_tap_out = CONFIG_TAP_OUTPUT_PIN < 0 ? HW_PIN_NONE : CONFIG_TAP_OUTPUT_PIN;
+
+    memset(profile->ctl_lane, HW_LANE_NONE, sizeof(profile->ctl_lane)); // No control outputs on the original board
+
+    profile->pin_zc_adc = CONFIG_ZC_INPUT_PIN < 0 ? HW_PIN_NONE : CONFIG_ZC_INPUT_PIN;
+
+    // The meter tap mux follows the sink muxes in both routing chains
+    profile->pin_meter_adc = CONFIG_METER_INPUT_PIN < 0 ? HW_PIN_NONE : CONFIG_METER_INPUT_PIN;
+    profile->meter_sel_lane = CONFIG_METER_INPUT_PIN < 0 ? HW_LANE_NONE : HW_LANE(SR_CHAIN_MATRIX, HW_SINKS_V1 * 4);
+    profile->meter_inh_lane = CONFIG_METER_INPUT_PIN < 0 ? HW_LANE_NONE : HW_LANE(SR_CHAIN_INHIBIT, HW_SINKS_V1);
+
+    profile->pin_panic = CONFIG_PANIC_BYPASS_PIN < 0 ? HW_PIN_NONE : CONFIG_PANIC_BYPASS_PIN;
+
+    // Expanders are strapped to consecutive addresses from 0x20
+    profile->pin_exp_int = CONFIG_EXPANDER_INT_PIN < 0 ? HW_PIN_NONE : CONFIG_EXPANDER_INT_PIN;
+    for (int i = 0; i < CONFIG_EXPANDER_COUNT && i < HW_EXPANDERS_MAX; i++)
+    {
+        profile->exp_addr[i] = 0x20 + i;
+    }
+
+    profile->pin_sr_in = CONFIG_SR_INPUT_PIN < 0 ? HW_PIN_NONE : CONFIG_SR_INPUT_PIN;
+    profile->sr_in_regs = CONFIG_SR_INPUT_PIN < 0 ? 0 : CONFIG_SR_INPUT_REGS;
+
+    profile->pin_sr_fb[SR_CHAIN_MATRIX] = CONFIG_MATRIX_SR_FEEDBACK_PIN < 0 ? HW_PIN_NONE : CONFIG_MATRIX_SR_FEEDBACK_PIN;
+    profile->pin_sr_fb[SR_CHAIN_INHIBIT] = CONFIG_INHIBIT_SR_FEEDBACK_PIN < 0 ? HW_PIN_NONE : CONFIG_INHIBIT_SR_FEEDBACK_PIN;
+    profile->pin_sr_fb[SR_CHAIN_LED] = CONFIG_LED_SR_FEEDBACK_PIN < 0 ? HW_PIN_NONE : CONFIG_LED_SR_FEEDBACK_PIN;
+}
+
+/**
+ * @brief Select lane of a sink, from the version 1 lanes or the outputs added later
+ */
+static uint8_t _sink_sel_lane(const hw_profile_t *profile, int sink)
+{
+    return sink < HW_SINKS_V1 ? profile->sink_sel_lane[sink] : profile->out_sel_lane[sink - HW_SINKS_V1];
+}
+
+/**
+ * @brief Inhibit lane of a sink, from the version 1 lanes or the outputs added later
+ */
+static uint8_t _sink_inh_lane(const hw_profile_t *profile, int sink)
+{
+    return sink < HW_SINKS_V1 ? profile->sink_inh_lane[sink] : profile->out_inh_lane[sink - HW_SINKS_V1];
+}
+
+// --- Validation ---
+
+/**
+ * @brief Check one pin and mark it as used
+ *
+ * @param pin Pin number from the record
+ * @param what Name used in log messages
+ * @param required true if HW_PIN_NONE is not allowed
+ * @param[in,out] used Bitmap of pins already claimed
+ * @return true if the pin is acceptable
+ */
+static bool _check_pin(uint8_t pin, const char *what, bool required, uint64_t *used)
+{
+    if (pin == HW_PIN_NONE)
+    {
+        if (required)
+        {
+            ESP_LOGE(TAG, "%s pin is required", what);
+            return false;
+        }
+        return true;
+    }
+    if (!GPIO_IS_VALID_OUTPUT_GPIO(pin))
+    {
+        ESP_LOGE(TAG, "%s pin %d is not a valid GPIO", what, pin);
+        return false;
+    }
+    if (*used & (1ULL << pin))
+    {
+        ESP_LOGE(TAG, "%s pin %d is already assigned", what, pin);
+        return false;
+    }
+    *used |= (1ULL << pin);
+    return true;
+}
+
+/**
+ * @brief Check a run of lane bits and mark them as used
+ *
+ * @param lane Lane address of the first bit
+ * @param width Number of consecutive bits the lane occupies
+ * @param allowed_chains Bitmask of chains the lane may live in
+ * @param what Name used in log messages
+ * @param index Index used in log messages
+ * @param[in,out] used Bitmap of claimed bits per chain
+ * @return true if the lane is acceptable
+ */
+static bool _check_lane(uint8_t lane, uint8_t width, uint8_t allowed_chains, const char *what, int index,
+                        uint64_t used[SR_CHAIN_COUNT])
+{
+    if (lane == HW_LANE_NONE)
+    {
+        return true;
+    }
+    uint8_t chain = HW_LANE_CHAIN(lane);
+    uint8_t bit = HW_LANE_BIT(lane);
+    if (chain >= SR_CHAIN_COUNT || !(allowed_chains & (1 << chain)))
+    {
+        ESP_LOGE(TAG, "%s %d: lane 0x%02X is in the wrong chain", what, index, lane);
+        return false;
+    }
+    if (width > 1 && (bit % width) != 0)
+    {
+        ESP_LOGE(TAG, "%s %d: lane bit %d is not aligned to %d bits", what, index, bit, width);
+        return false;
+    }
+    if (bit + width > SR_CHAIN_BYTES_MAX * 8)
+    {
+        ESP_LOGE(TAG, "%s %d: lane bit %d is past the end of the chain", what, index, bit);
+        return false;
+    }
+    uint64_t bits = ((width >= 64) ? ~0ULL : ((1ULL << width) - 1)) << bit;
+    if (used[chain] & bits)
+    {
+        ESP_LOGE(TAG, "%s %d: lane 0x%02X overlaps another lane", what, index, lane);
+        return false;
+    }
+    used[chain] |= bits;
+    return true;
+}
+
+/**
+ * @brief Validate a profile
+ *
+ * Checks pin ranges and duplicates, lane ranges, lane overlaps and chain
+ * ownership. Every problem found is logged.
+ *
+ * @param profile Profile to check
+ * @return ESP_OK if the profile is usable, ESP_ERR_INVALID_ARG otherwise
+ */
+esp_err_t hw_profile_validate(const hw_profile_t *profile)
+{
+    bool ok = true;
+    uint64_t pins = 0;
+    uint64_t lanes[SR_CHAIN_COUNT] = {0};
+    const uint8_t route_chains = (1 << SR_CHAIN_MATRIX) | (1 << SR_CHAIN_INHIBIT);
+    const uint8_t led_chains = (1 << SR_CHAIN_LED);
+
+    if (profile->num_pedals == 0 || profile->num_pedals > NUM_PEDALS_MAX)
+    {
+        ESP_LOGE(TAG, "num_pedals %d out of range (1-%d)", profile->num_pedals, NUM_PEDALS_MAX);
+        ok = false;
+    }
+    if (profile->display_type >= HW_DISPLAY_TYPE_COUNT)
+    {
+        ESP_LOGE(TAG, "Unknown display type %d", profile->display_type);
+        ok = false;
+    }
+    if (profile->display_type != HW_DISPLAY_NONE && (profile->display_i2c_addr < 0x08 || profile->display_i2c_addr > 0x77))
+    {
+        ESP_LOGE(TAG, "Display I2C address 0x%02X out of range", profile->display_i2c_addr);
+        ok = false;
+    }
+
+#ifdef CONFIG_USB_MIDI_ENABLE
+    ok &= _check_pin(USB_MIDI_PIN_DM, "USB D-", true, &pins); // Claimed first, so a pin on them is reported
+    ok &= _check_pin(USB_MIDI_PIN_DP, "USB D+", true, &pins);
+#endif
+#ifdef CONFIG_LINK_ENABLE
+    ok &= _check_pin(CONFIG_LINK_TX_PIN, "Link TX", true, &pins); // Set in menuconfig, outside the profile
+    ok &= _check_pin(CONFIG_LINK_RX_PIN, "Link RX", true, &pins);
+    ok &= _check_pin(CONFIG_LINK_SYNC_PIN, "Link sync", true, &pins);
+#endif
+#ifdef CONFIG_TELEMETRY_ENABLE
+    ok &= _check_pin(CONFIG_TELEMETRY_TX_PIN, "Telemetry TX", true, &pins);
+    ok &= _check_pin(CONFIG_TELEMETRY_RX_PIN >= 0 ? CONFIG_TELEMETRY_RX_PIN : HW_PIN_NONE, "Host link RX", false, &pins);
+#endif
+    bool has_expanders = profile->exp_addr[0] != 0;
+    bool need_i2c = profile->display_type != HW_DISPLAY_NONE || has_expanders;
+    ok &= _check_pin(profile->pin_i2c_sda, "I2C SDA", need_i2c, &pins);
+    ok &= _check_pin(profile->pin_i2c_scl, "I2C SCL", need_i2c, &pins);
+    ok &= _check_pin(profile->pin_program_btn, "Program button", true, &pins);
+    ok &= _check_pin(profile->pin_preset_btn, "Preset button", true, &pins);
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        ok &= _check_pin(profile->pin_pedal_btn[i], "Pedal button", i < profile->num_pedals, &pins);
+    }
+    ok &= _check_pin(profile->pin_sr_clock, "SR clock", true, &pins);
+    ok &= _check_pin(profile->pin_sr_latch, "SR latch", true, &pins);
+    ok &= _check_pin(profile->pin_sr_oe, "SR output enable", false, &pins);
+    ok &= _check_pin(profile->pin_led_oe, "LED output enable", false, &pins);
+    ok &= _check_pin(profile->pin_sr_data[SR_CHAIN_MATRIX], "Matrix SR data", true, &pins);
+    ok &= _check_pin(profile->pin_sr_data[SR_CHAIN_INHIBIT], "Inhibit SR data", true, &pins);
+    ok &= _check_pin(profile->pin_sr_data[SR_CHAIN_LED], "LED SR data", false, &pins);
+    ok &= _check_pin(profile->pin_tap_btn, "Tap button", false, &pins);
+    ok &= _check_pin(profile->pin_tap_out, "Tap output", false, &pins);
+    ok &= _check_pin(profile->pin_zc_adc, "Input sense", false, &pins);
+    if (profile->pin_zc_adc != HW_PIN_NONE && (profile->pin_zc_adc < 1 || profile->pin_zc_adc > 10))
+    {
+        ESP_LOGE(TAG, "Input sense pin %d is not an ADC1 pin (GPIO 1-10)", profile->pin_zc_adc);
+        ok = false;
+    }
+    ok &= _check_pin(profile->pin_meter_adc, "Meter input", false, &pins);
+    if (profile->pin_meter_adc != HW_PIN_NONE && (profile->pin_meter_adc < 1 || profile->pin_meter_adc > 10))
+    {
+        ESP_LOGE(TAG, "Meter input pin %d is not an ADC1 pin (GPIO 1-10)", profile->pin_meter_adc);
+        ok = false;
+    }
+    ok &= _check_pin(profile->pin_panic, "Panic bypass", false, &pins);
+    ok &= _check_pin(profile->pin_exp_int, "Expander interrupt", has_expanders, &pins);
+    ok &= _check_pin(profile->pin_sr_in, "SR input", profile->sr_in_regs != 0, &pins);
+    if (profile->sr_in_regs > HW_SR_IN_REGS_MAX || (profile->pin_sr_in != HW_PIN_NONE && profile->sr_in_regs == 0))
+    {
+        ESP_LOGE(TAG, "SR input chain needs 1-%d registers, %d given", HW_SR_IN_REGS_MAX, profile->sr_in_regs);
+        ok = false;
+    }
+    ok &= _check_pin(profile->pin_sr_fb[SR_CHAIN_MATRIX], "Matrix SR feedback", false, &pins);
+    ok &= _check_pin(profile->pin_sr_fb[SR_CHAIN_INHIBIT], "Inhibit SR feedback", false, &pins);
+    ok &= _check_pin(profile->pin_sr_fb[SR_CHAIN_LED], "LED SR feedback", false, &pins);
+    if (profile->pin_sr_fb[SR_CHAIN_LED] != HW_PIN_NONE && profile->pin_sr_data[SR_CHAIN_LED] == HW_PIN_NONE)
+    {
+        ESP_LOGE(TAG, "LED chain has a feedback pin but no data pin");
+        ok = false;
+    }
+    for (int i = 0; i < HW_EXPANDERS_MAX; i++)
+    {
+        uint8_t addr = profile->exp_addr[i];
+        if (addr == 0)
+        {
+            continue;
+        }
+        if (i > 0 && profile->exp_addr[i - 1] == 0)
+        {
+            ESP_LOGE(TAG, "Expander %d is fitted but %d is not, fill them in order", i, i - 1);
+            ok = false;
+        }
+        if (addr < 0x20 || addr > 0x27)
+        {
+            ESP_LOGE(TAG, "Expander %d address 0x%02X is not an MCP23017 address (0x20-0x27)", i, addr);
+            ok = false;
+        }
+        if ((profile->display_type != HW_DISPLAY_NONE && addr == profile->display_i2c_addr) ||
+            (i > 0 && addr == profile->exp_addr[i - 1]))
+        {
+            ESP_LOGE(TAG, "Expander %d address 0x%02X is already in use on the bus", i, addr);
+            ok = false;
+        }
+    }
+    if ((profile->pin_meter_adc == HW_PIN_NONE) != (profile->meter_sel_lane == HW_LANE_NONE) ||
+        (profile->meter_sel_lane == HW_LANE_NONE) != (profile->meter_inh_lane == HW_LANE_NONE))
+    {
+        ESP_LOGE(TAG, "Meter tap needs its input pin, select lane and inhibit lane together");
+        ok = false;
+    }
+
+    for (int s = 0; s < MATRIX_NUM_SINKS; s++)
+    {
+        uint8_t sel = _sink_sel_lane(profile, s);
+        uint8_t inh = _sink_inh_lane(profile, s);
+        bool fitted = (s == MATRIX_SINK_AMP) || (s < profile->num_pedals);
+        if (fitted && (sel == HW_LANE_NONE || inh == HW_LANE_NONE))
+        {
+            ESP_LOGE(TAG, "Sink %d is fitted but has no select or inhibit lane", s);
+            ok = false;
+        }
+        if (s >= HW_SINKS_V1 && (sel == HW_LANE_NONE) != (inh == HW_LANE_NONE))
+        {
+            ESP_LOGE(TAG, "Output sink %d needs its select and inhibit lanes together", s);
+            ok = false;
+        }
+        ok &= _check_lane(sel, 4, route_chains, "Sink select", s, lanes);
+        ok &= _check_lane(inh, 1, route_chains, "Sink inhibit", s, lanes);
+    }
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        ok &= _check_lane(profile->led_pedal_lane[i], 1, led_chains, "Pedal LED", i, lanes);
+    }
+    ok &= _check_lane(profile->led_status_lane, 1, led_chains, "Status LED", 0, lanes);
+    for (int i = 0; i < MATRIX_NUM_CONTROLS; i++)
+    {
+        if (i > 0 && profile->ctl_lane[i] != HW_LANE_NONE && profile->ctl_lane[i - 1] == HW_LANE_NONE)
+        {
+            ESP_LOGE(TAG, "Control output %d is wired but %d is not, fill them in order", i, i - 1);
+            ok = false;
+        }
+        ok &= _check_lane(profile->ctl_lane[i], 1, route_chains, "Control output", i, lanes);
+    }
+    ok &= _check_lane(profile->meter_sel_lane, 4, route_chains, "Meter select", 0, lanes);
+    ok &= _check_lane(profile->meter_inh_lane, 1, route_chains, "Meter inhibit", 0, lanes);
+
+    if (profile->pin_sr_data[SR_CHAIN_LED] == HW_PIN_NONE && lanes[SR_CHAIN_LED] != 0)
+    {
+        ESP_LOGE(TAG, "LED lanes are assigned but the LED chain has no data pin");
+        ok = false;
+    }
+
+    return ok ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// --- Compilation ---
+
+/**
+ * @brief Add a pin to a two-bank GPIO mask
+ */
+static void _mask_add(uint32_t mask[2], uint8_t pin)
+{
+    if (pin == HW_PIN_NONE)
+    {
+        return;
+    }
+    mask[pin / 32] |= 1UL << (pin % 32);
+}
+
+/**
+ * @brief Resolve a single-bit lane to a frame byte index and mask
+ */
+static void _compile_bit(uint8_t lane, uint8_t *byte, uint8_t *mask)
+{
+    if (lane == HW_LANE_NONE)
+    {
+        *byte = SR_FRAME_SCRATCH;
+        *mask = 0;
+        return;
+    }
+    *byte = SR_FRAME_INDEX(HW_LANE_CHAIN(lane), HW_LANE_BIT(lane) / 8);
+    *mask = 1 << (HW_LANE_BIT(lane) % 8);
+}
+
+/**
+ * @brief Resolve a select nibble lane to a frame byte index and shift
+ */
+static void _compile_nibble(uint8_t lane, uint8_t *byte, uint8_t *shift)
+{
+    if (lane == HW_LANE_NONE)
+    {
+        *byte = SR_FRAME_SCRATCH;
+        *shift = 0;
+        return;
+    }
+    *byte = SR_FRAME_INDEX(HW_LANE_CHAIN(lane), HW_LANE_BIT(lane) / 8);
+    *shift = HW_LANE_BIT(lane) % 8;
+}
+
+/**
+ * @brief Grow the chain length to cover a lane
+ */
+static void _cover_lane(uint8_t lane, uint8_t width)
+{
+    if (lane == HW_LANE_NONE)
+    {
+        return;
+    }
+    uint8_t chain = HW_LANE_CHAIN(lane);
+    uint8_t regs = (HW_LANE_BIT(lane) + width + 7) / 8;
+    if (regs > hw_tables.chain_bytes[chain])
+    {
+        hw_tables.chain_bytes[chain] = regs;
+    }
+}
+
+/**
+ * @brief Set the frame length to the longest chain
+ */
+static void _size_frame(void)
+{
+    hw_tables.frame_bytes = 0;
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        if (hw_tables.chain_bytes[c] > hw_tables.frame_bytes)
+        {
+            hw_tables.frame_bytes = hw_tables.chain_bytes[c];
+        }
+    }
+    if (hw_tables.sr_in_bytes > hw_tables.frame_bytes)
+    {
+        hw_tables.frame_bytes = hw_tables.sr_in_bytes; // The input chain is read on the same clocks
+    }
+}
+
+static gpio_num_t _pin(uint8_t pin)
+{
+    return pin == HW_PIN_NONE ? GPIO_NUM_NC : (gpio_num_t)pin;
+}
+
+/**
+ * @brief Compile a validated profile into hw_tables
+ *
+ * @param profile Validated profile
+ */
+static void _compile(const hw_profile_t *profile)
+{
+    memset(&hw_tables, 0, sizeof(hw_tables));
+    memcpy(hw_tables.name, profile->name, sizeof(hw_tables.name));
+    hw_tables.name[sizeof(hw_tables.name) - 1] = '\0';
+    hw_tables.num_pedals = profile->num_pedals;
+    hw_tables.display_type = (hw_display_t)profile->display_type;
+    hw_tables.display_i2c_addr = profile->display_i2c_addr;
+    hw_tables.led_active_low = profile->led_active_low != 0;
+
+    hw_tables.pin_i2c_sda = _pin(profile->pin_i2c_sda);
+    hw_tables.pin_i2c_scl = _pin(profile->pin_i2c_scl);
+    hw_tables.pin_program_btn = _pin(profile->pin_program_btn);
+    hw_tables.pin_preset_btn = _pin(profile->pin_preset_btn);
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        hw_tables.pin_pedal_btn[i] = i < profile->num_pedals ? _pin(profile->pin_pedal_btn[i]) : GPIO_NUM_NC;
+    }
+    hw_tables.pin_sr_clock = _pin(profile->pin_sr_clock);
+    hw_tables.pin_sr_latch = _pin(profile->pin_sr_latch);
+    hw_tables.pin_sr_oe = _pin(profile->pin_sr_oe);
+    hw_tables.pin_led_oe = _pin(profile->pin_led_oe);
+
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        hw_tables.pin_sr_data[c] = _pin(profile->pin_sr_data[c]);
+        _mask_add(hw_tables.sr_data_mask[c], profile->pin_sr_data[c]);
+        _mask_add(hw_tables.sr_data_all_mask, profile->pin_sr_data[c]);
+    }
+    _mask_add(hw_tables.sr_clock_mask, profile->pin_sr_clock);
+    _mask_add(hw_tables.sr_latch_mask, profile->pin_sr_latch);
+    hw_tables.pin_tap_btn = _pin(profile->pin_tap_btn);
+    hw_tables.pin_tap_out = _pin(profile->pin_tap_out);
+    _mask_add(hw_tables.tap_out_mask, profile->pin_tap_out);
+    hw_tables.pin_zc_adc = _pin(profile->pin_zc_adc);
+    hw_tables.pin_meter_adc = _pin(profile->pin_meter_adc);
+    hw_tables.pin_panic = _pin(profile->pin_panic);
+    for (int i = 0; i < HW_EXPANDERS_MAX && profile->exp_addr[i] != 0; i++)
+    {
+        hw_tables.exp_addr[hw_tables.exp_count++] = profile->exp_addr[i];
+    }
+    hw_tables.pin_exp_int = hw_tables.exp_count ? _pin(profile->pin_exp_int) : GPIO_NUM_NC;
+    hw_tables.pin_sr_in = _pin(profile->pin_sr_in);
+    hw_tables.sr_in_bytes = hw_tables.pin_sr_in == GPIO_NUM_NC ? 0 : profile->sr_in_regs;
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        hw_tables.pin_sr_fb[c] = _pin(profile->pin_sr_fb[c]);
+    }
+
+    for (int s = 0; s < MATRIX_NUM_SINKS; s++)
+    {
+        uint8_t sel = _sink_sel_lane(profile, s);
+        uint8_t inh = _sink_inh_lane(profile, s);
+        _compile_nibble(sel, &hw_tables.sink_sel_byte[s], &hw_tables.sink_sel_shift[s]);
+        _compile_bit(inh, &hw_tables.sink_inh_byte[s], &hw_tables.sink_inh_mask[s]);
+        _cover_lane(sel, 4);
+        _cover_lane(inh, 1);
+        if (s >= MATRIX_SINK_OUTPUT(0) && sel != HW_LANE_NONE)
+        {
+            hw_tables.output_mask |= MATRIX_OUTPUT_BIT(s - MATRIX_SINK_OUTPUT(0));
+        }
+    }
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        uint8_t lane = profile->led_pedal_lane[i];
+        hw_tables.led_pedal_bit[i] = lane == HW_LANE_NONE ? HW_LANE_NONE : HW_LANE_BIT(lane);
+        _cover_lane(lane, 1);
+    }
+    hw_tables.led_status_bit = profile->led_status_lane == HW_LANE_NONE ? HW_LANE_NONE : HW_LANE_BIT(profile->led_status_lane);
+    _cover_lane(profile->led_status_lane, 1);
+
+    for (int i = 0; i < MATRIX_NUM_CONTROLS; i++)
+    {
+        _compile_bit(profile->ctl_lane[i], &hw_tables.ctl_byte[i], &hw_tables.ctl_mask[i]);
+        _cover_lane(profile->ctl_lane[i], 1);
+        if (profile->ctl_lane[i] != HW_LANE_NONE)
+        {
+            hw_tables.ctl_count = i + 1;
+        }
+        memcpy(hw_tables.ctl_name[i], profile->ctl_name[i], HW_CTL_NAME_LEN);
+        hw_tables.ctl_name[i][HW_CTL_NAME_LEN - 1] = '\0';
+        if (hw_tables.ctl_name[i][0] == '\0')
+        {
+            snprintf(hw_tables.ctl_name[i], HW_CTL_NAME_LEN, "Ctl %d", i + 1);
+        }
+    }
+
+    _compile_nibble(profile->meter_sel_lane, &hw_tables.meter_sel_byte, &hw_tables.meter_sel_shift);
+    _compile_bit(profile->meter_inh_lane, &hw_tables.meter_inh_byte, &hw_tables.meter_inh_mask);
+    _cover_lane(profile->meter_sel_lane, 4);
+    _cover_lane(profile->meter_inh_lane, 1);
+
+    _size_frame();
+}
+
+// --- Chain probe ---
+
+/**
+ * @brief Check whether a compiled lane is past the registers found
+ *
+ * @param byte Frame byte of the lane
+ * @param chain Chain probed
+ * @param found Registers found in that chain
+ */
+static bool _lost(uint8_t byte, int chain, uint8_t found)
+{
+    return byte != SR_FRAME_SCRATCH && byte / SR_CHAIN_BYTES_MAX == chain && byte % SR_CHAIN_BYTES_MAX >= found;
+}
+
+/**
+ * @brief Log every output the profile puts past the end of a short chain
+ *
+ * @param chain Chain probed
+ * @param found Registers found in that chain
+ */
+static void _report_lost(int chain, uint8_t found)
+{
+    static const char *const outputs[MATRIX_NUM_OUTPUTS] = {"amp output A", "amp output B", "tuner output"};
+    for (int s = 0; s < MATRIX_NUM_SINKS; s++)
+    {
+        bool fitted = (s >= MATRIX_SINK_OUTPUT(0)) || (s < hw_tables.num_pedals); // Unwired outputs are never lost
+        if (fitted && (_lost(hw_tables.sink_sel_byte[s], chain, found) || _lost(hw_tables.sink_inh_byte[s], chain, found)))
+        {
+            if (s >= MATRIX_SINK_OUTPUT(0))
+            {
+                ESP_LOGE(TAG, "  the %s is on a missing register", outputs[s - MATRIX_SINK_OUTPUT(0)]);
+            }
+            else
+            {
+                ESP_LOGE(TAG, "  the send of pedal %d is on a missing register", s + 1);
+            }
+        }
+    }
+    for (int i = 0; i < hw_tables.ctl_count; i++)
+    {
+        if (_lost(hw_tables.ctl_byte[i], chain, found))
+        {
+            ESP_LOGE(TAG, "  control output '%s' is on a missing register", hw_tables.ctl_name[i]);
+        }
+    }
+    if (_lost(hw_tables.meter_sel_byte, chain, found) || _lost(hw_tables.meter_inh_byte, chain, found))
+    {
+        ESP_LOGE(TAG, "  the meter tap is on a missing register");
+    }
+    if (chain == SR_CHAIN_LED)
+    {
+        for (int i = 0; i < hw_tables.num_pedals; i++)
+        {
+            if (hw_tables.led_pedal_bit[i] != HW_LANE_NONE && hw_tables.led_pedal_bit[i] / 8 >= found)
+            {
+                ESP_LOGE(TAG, "  the LED of pedal %d is on a missing register", i + 1);
+            }
+        }
+        if (hw_tables.led_status_bit != HW_LANE_NONE && hw_tables.led_status_bit / 8 >= found)
+        {
+            ESP_LOGE(TAG, "  the status LED is on a missing register");
+        }
+    }
+}
+
+/**
+ * @brief Size the chains to the registers actually fitted
+ *
+ * A chain longer than the profile needs is shifted in full, so its spare
+ * registers are cleared rather than left with whatever the previous frame
+ * pushed into them. A shorter one is shifted with what is there; the lanes
+ * past its end fall off and are reported.
+ *
+ * @param found Registers found in each chain, 0 for a chain that was not probed
+ */
+void hw_profile_fit_chains(const uint8_t found[SR_CHAIN_COUNT])
+{
+    static const char *const names[SR_CHAIN_COUNT] = {"Matrix", "Inhibit", "LED"};
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        hw_tables.chain_found[c] = found[c];
+        if (found[c] == 0)
+        {
+            continue;
+        }
+        uint8_t used = hw_tables.chain_bytes[c];
+        if (found[c] < used)
+        {
+            ESP_LOGE(TAG, "%s chain has %d registers, but the profile (%d pedals) needs %d:", names[c], found[c],
+                     hw_tables.num_pedals, used);
+            _report_lost(c, found[c]);
+        }
+        else if (found[c] > used)
+        {
+            ESP_LOGW(TAG, "%s chain has %d registers, but the profile (%d pedals) only uses %d; is num_pedals too low?",
+                     names[c], found[c], hw_tables.num_pedals, used);
+        }
+        hw_tables.chain_bytes[c] = found[c];
+    }
+    _size_frame();
+}
+
+// --- Storage ---
+
+/**
+ * @brief Payload length of each layout version, indexed by version
+ *
+ * Each version ends where the first field appended by the next one starts.
+ */
+static const uint16_t payload_length[HW_PROFILE_VERSION + 1] = {
+    [1] = offsetof(hw_profile_t, pin_tap_btn),
+    [2] = offsetof(hw_profile_t, ctl_lane),
+    [3] = offsetof(hw_profile_t, pin_zc_adc),
+    [4] = offsetof(hw_profile_t, meter_sel_lane),
+    [5] = offsetof(hw_profile_t, pin_panic),
+    [6] = offsetof(hw_profile_t, pin_exp_int),
+    [7] = offsetof(hw_profile_t, pin_sr_in),
+    [8] = offsetof(hw_profile_t, pin_sr_fb),
+    [9] = offsetof(hw_profile_t, out_sel_lane),
+    [10] = sizeof(hw_profile_t),
+};
+_Static_assert(HW_PROFILE_VERSION == 10, "Add the new layout version to payload_length");
+
+/**
+ * @brief Read the profile record from NVS
+ *
+ * Starts from the Kconfig defaults so that fields added after the record was
+ * written keep sensible values.
+ *
+ * @param[out] profile Loaded profile
+ * @return ESP_OK if a record was found and its header, length and CRC are valid
+ */
+static esp_err_t _load_from_nvs(hw_profile_t *profile)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(HW_PROFILE_NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    uint8_t record[sizeof(hw_profile_header_t) + sizeof(hw_profile_t)];
+    size_t size = sizeof(record);
+    err = nvs_get_blob(nvs_handle, HW_PROFILE_NVS_KEY, record, &size);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    hw_profile_header_t header;
+    if (size < sizeof(header))
+    {
+        ESP_LOGE(TAG, "Profile record too short (%d bytes)", size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&header, record, sizeof(header));
+    if (header.magic != HW_PROFILE_MAGIC || header.version == 0 || header.version > HW_PROFILE_VERSION)
+    {
+        ESP_LOGE(TAG, "Profile record has bad magic 0x%04X or version %d", header.magic, header.version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (header.length != size - sizeof(header))
+    {
+        ESP_LOGE(TAG, "Profile record length %d does not match blob size %d", header.length, size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (header.length != payload_length[header.version])
+    {
+        ESP_LOGE(TAG, "Profile record length %d does not match version %d (%d bytes)", header.length,
+                 header.version, payload_length[header.version]);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (esp_rom_crc32_le(0, record + sizeof(header), header.length) != header.crc32)
+    {
+        ESP_LOGE(TAG, "Profile record CRC mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    hw_profile_get_default(profile);
+    memcpy(profile, record + sizeof(header), header.length);
+    return ESP_OK;
+}
+
+/**
+ * @brief Store a profile record in NVS
+ *
+ * The profile is validated first. It takes effect on the next boot.
+ *
+ * @param profile Profile to store
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t hw_profile_save(const hw_profile_t *profile)
+{
+    esp_err_t err = hw_profile_validate(profile);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    uint8_t record[sizeof(hw_profile_header_t) + sizeof(hw_profile_t)];
+    hw_profile_header_t header = {
+        .magic = HW_PROFILE_MAGIC,
+        .version = HW_PROFILE_VERSION,
+        .length = sizeof(hw_profile_t),
+        .crc32 = esp_rom_crc32_le(0, (const uint8_t *)profile, sizeof(hw_profile_t)),
+    };
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), profile, sizeof(hw_profile_t));
+
+    nvs_handle_t nvs_handle;
+    err = nvs_open(HW_PROFILE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        return err;
+    }
+    power_lock(POWER_LOCK_PERSIST);
+    err = nvs_set_blob(nvs_handle, HW_PROFILE_NVS_KEY, record, sizeof(record));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    power_unlock(POWER_LOCK_PERSIST);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Saving profile failed: %s", esp_err_to_name(err));
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+/**
+ * @brief Load, validate and compile the hardware profile
+ *
+ * Reads the profile record from NVS. If it is missing or fails validation the
+ * Kconfig defaults are used instead.
+ */
+void hw_profile_init(void)
+{
+    hw_profile_t profile;
+    esp_err_t err = _load_from_nvs(&profile);
+    if (err == ESP_OK)
+    {
+        err = hw_profile_validate(&profile);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Stored profile is invalid, falling back to Kconfig defaults");
+        }
+    }
+    else if (err != ESP_ERR_NVS_NOT_FOUND)
+    {
+        ESP_LOGE(TAG, "Stored profile unreadable (%s), falling back to Kconfig defaults", esp_err_to_name(err));
+    }
+
+    if (err != ESP_OK)
+    {
+        hw_profile_get_default(&profile);
+        if (hw_profile_validate(&profile) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Kconfig pin configuration is invalid, review menuconfig");
+        }
+    }
+
+    _compile(&profile);
+    hw_tables.profile_crc = esp_rom_crc32_le(0, (const uint8_t *)&profile, sizeof(profile)); // Show images are checked against it
+    ESP_LOGI(TAG, "Board '%s': %d pedals, display %d, chains %d/%d/%d registers, profile CRC %08lx", hw_tables.name,
+             hw_tables.num_pedals, hw_tables.display_type, hw_tables.chain_bytes[SR_CHAIN_MATRIX],
+             hw_tables.chain_bytes[SR_CHAIN_INHIBIT], hw_tables.chain_bytes[SR_CHAIN_LED],
+             (unsigned long)hw_tables.profile_crc);
+}
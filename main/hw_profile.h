@@ -0,0 +1,249 @@
+/**
+ * @file hw_profile.h
+ * @brief Runtime hardware profile for the ESP32 Patch Bay board revisions
+ *
+ * Board revisions differ in pin assignment, shift register wiring, LED mapping,
+ * number of pedal loops and display type. Instead of rebuilding the firmware
+ * for each revision, the board description is stored as a profile record in
+ * NVS. At boot the record is validated once and compiled into flat lookup
+ * tables (hw_tables) that the drivers index directly.
+ *
+ * If no record is stored, or the stored record is invalid, the profile is
+ * built from the Kconfig pin settings so that existing boards keep working.
+ */
+
+#ifndef HW_PROFILE_H
+#define HW_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <driver/gpio.h>
+#include <esp_err.h>
+
+#include "buttons.h"
+#include "matrix.h"
+#include "sr_bus.h"
+
+#define HW_PROFILE_NVS_NAMESPACE "hw_profile" /**< NVS namespace holding the profile record */
+#define HW_PROFILE_NVS_KEY "profile"          /**< NVS key of the profile record */
+
+#define HW_PROFILE_MAGIC 0x4250 /**< "PB" little endian */
+#define HW_PROFILE_VERSION 10   /**< Current record layout version */
+
+#define HW_PIN_NONE 0xFF  /**< Pin is not wired on this board */
+#define HW_LANE_NONE 0xFF /**< Shift register lane is not wired on this board */
+#define HW_CTL_NAME_LEN 8 /**< Control output name length, including the NUL */
+#define HW_EXPANDERS_MAX 2 /**< I2C footswitch expanders, 16 inputs each */
+#define HW_SR_IN_REGS_MAX 4 /**< 74HC165 footswitch input registers, 8 inputs each */
+#define HW_SINKS_V1 (NUM_PEDALS_MAX + 1) /**< Sinks with lanes in the version 1 layout: pedal sends and amp output A */
+
+/**
+ * @brief Build a lane address from a chain and a bit position in that chain
+ *
+ * Bit positions count from QA of register 0 (closest to the ESP32), so bit 9
+ * is QB of the second register in the chain.
+ */
+#define HW_LANE(chain, bit) ((uint8_t)(((chain) << 6) | ((bit) & 0x3F)))
+#define HW_LANE_CHAIN(lane) ((lane) >> 6)  /**< Chain part of a lane address */
+#define HW_LANE_BIT(lane) ((lane) & 0x3F)  /**< Bit part of a lane address */
+
+/**
+ * @brief Display fitted to the board
+ */
+typedef enum
+{
+    HW_DISPLAY_NONE = 0,         /**< No display, run headless */
+    HW_DISPLAY_SSD1306_128X64,   /**< SSD1306 128x64 */
+    HW_DISPLAY_SSD1306_128X32,   /**< SSD1306 128x32 */
+    HW_DISPLAY_SH1107_64X128,    /**< SH1107 64x128 (needs the SH1107 driver built in) */
+    HW_DISPLAY_TYPE_COUNT
+} hw_display_t;
+
+/**
+ * @brief Header in front of the stored profile record
+ */
+typedef struct __attribute__((packed))
+{
+    uint16_t magic;   /**< HW_PROFILE_MAGIC */
+    uint8_t version;  /**< Layout version of the payload */
+    uint8_t reserved; /**< Must be zero */
+    uint16_t length;  /**< Payload length in bytes */
+    uint32_t crc32;   /**< CRC-32 (IEEE) of the payload */
+} hw_profile_header_t;
+
+/**
+ * @brief Stored board description (record payload)
+ *
+ * New fields are only ever appended. A shorter record from an older layout is
+ * accepted and the missing fields keep their Kconfig defaults.
+ */
+typedef struct __attribute__((packed))
+{
+    char name[16];                           /**< Board revision name, NUL padded */
+    uint8_t num_pedals;                      /**< Number of pedal loops fitted (1-NUM_PEDALS_MAX) */
+    uint8_t display_type;                    /**< hw_display_t */
+    uint8_t display_i2c_addr;                /**< 7-bit I2C address of the display */
+    uint8_t led_active_low;                  /**< 1 if a cleared LED bit turns the LED on */
+    uint8_t pin_i2c_sda;                     /**< I2C SDA */
+    uint8_t pin_i2c_scl;                     /**< I2C SCL */
+    uint8_t pin_program_btn;                 /**< Program button */
+    uint8_t pin_preset_btn;                  /**< Preset button */
+    uint8_t pin_pedal_btn[NUM_PEDALS_MAX];   /**< Pedal buttons, HW_PIN_NONE past num_pedals */
+    uint8_t pin_sr_clock;                    /**< Shared shift clock (SHCP) */
+    uint8_t pin_sr_latch;                    /**< Shared latch (STCP) */
+    uint8_t pin_sr_oe;                       /**< Shared output enable (OE, active low) */
+    uint8_t pin_led_oe;                      /**< Separate LED output enable used for dimming */
+    uint8_t pin_sr_data[SR_CHAIN_COUNT];     /**< Data pin of each chain, indexed by sr_chain_t */
+    uint8_t sink_sel_lane[HW_SINKS_V1];      /**< Lane of select bit 0 of each sink, nibble aligned */
+    uint8_t sink_inh_lane[HW_SINKS_V1];      /**< Lane of the inhibit bit of each sink */
+    uint8_t led_pedal_lane[NUM_PEDALS_MAX];  /**< Lane of each pedal LED */
+    uint8_t led_status_lane;                 /**< Lane of the status LED */
+    /* Version 2 */
+    uint8_t pin_tap_btn;                     /**< Tap tempo footswitch */
+    uint8_t pin_tap_out;                     /**< Tap tempo output to downstream pedals */
+    /* Version 3 */
+    uint8_t ctl_lane[MATRIX_NUM_CONTROLS];                  /**< Lane of each control output (matrix or inhibit chain) */
+    char ctl_name[MATRIX_NUM_CONTROLS][HW_CTL_NAME_LEN];    /**< Name of each control output, NUL padded */
+    /* Version 4 */
+    uint8_t pin_zc_adc;                      /**< ADC1 pin sensing the guitar input for zero-crossing switching */
+    /* Version 5 */
+    uint8_t meter_sel_lane;                  /**< Lane of select bit 0 of the meter tap mux, nibble aligned */
+    uint8_t meter_inh_lane;                  /**< Lane of the inhibit bit of the meter tap mux */
+    uint8_t pin_meter_adc;                   /**< ADC1 pin sampling the meter tap */
+    /* Version 6 */
+    uint8_t pin_panic;                       /**< Panic bypass footswitch */
+    /* Version 7 */
+    uint8_t pin_exp_int;                     /**< Shared interrupt line of the footswitch expanders */
+    uint8_t exp_addr[HW_EXPANDERS_MAX];      /**< 7-bit I2C address of each footswitch expander, 0 if absent */
+    /* Version 8 */
+    uint8_t pin_sr_in;                       /**< Serial output (QH) of the 74HC165 footswitch chain */
+    uint8_t sr_in_regs;                      /**< 74HC165 registers in the footswitch chain, 0 if none */
+    /* Version 9 */
+    uint8_t pin_sr_fb[SR_CHAIN_COUNT];       /**< Pin reading QH' of the last register of each chain, for the length probe */
+    /* Version 10 */
+    uint8_t out_sel_lane[MATRIX_NUM_SINKS - HW_SINKS_V1]; /**< Lane of select bit 0 of amp output B and the tuner output */
+    uint8_t out_inh_lane[MATRIX_NUM_SINKS - HW_SINKS_V1]; /**< Lane of the inhibit bit of amp output B and the tuner output */
+} hw_profile_t;
+
+/**
+ * @brief Flat lookup tables compiled from the active profile
+ *
+ * Routing lanes are stored as a frame byte index and a bit mask, so the
+ * encoders only do `frame->b[byte] |= mask`. Lanes that are not wired point
+ * at SR_FRAME_SCRATCH. LED lanes are stored as bit positions in the LED chain,
+ * which is owned by the LED driver. Pin masks are split into the two GPIO
+ * output register banks (GPIO 0-31 and 32-48).
+ */
+typedef struct
+{
+    char name[16];                              /**< Board revision name */
+    uint8_t num_pedals;                         /**< Number of pedal loops fitted */
+    hw_display_t display_type;                  /**< Display fitted */
+    uint8_t display_i2c_addr;                   /**< Display I2C address */
+    gpio_num_t pin_i2c_sda;                     /**< I2C SDA */
+    gpio_num_t pin_i2c_scl;                     /**< I2C SCL */
+    gpio_num_t pin_program_btn;                 /**< Program button */
+    gpio_num_t pin_preset_btn;                  /**< Preset button */
+    gpio_num_t pin_pedal_btn[NUM_PEDALS_MAX];   /**< Pedal buttons (GPIO_NUM_NC if absent) */
+    gpio_num_t pin_sr_clock;                    /**< Shared shift clock */
+    gpio_num_t pin_sr_latch;                    /**< Shared latch */
+    gpio_num_t pin_sr_oe;                       /**< Shared output enable (GPIO_NUM_NC if tied low) */
+    gpio_num_t pin_led_oe;                      /**< LED output enable (GPIO_NUM_NC if absent) */
+    gpio_num_t pin_sr_data[SR_CHAIN_COUNT];     /**< Data pin per chain */
+    uint32_t sr_data_mask[SR_CHAIN_COUNT][2];   /**< Data pin mask per chain, [bank] */
+    uint32_t sr_data_all_mask[2];               /**< All data pins, [bank] */
+    uint32_t sr_clock_mask[2];                  /**< Clock pin, [bank] */
+    uint32_t sr_latch_mask[2];                  /**< Latch pin, [bank] */
+    uint8_t chain_bytes[SR_CHAIN_COUNT];        /**< Registers shifted in each chain */
+    uint8_t frame_bytes;                        /**< Longest chain, input chain included, in registers */
+    uint8_t sink_sel_byte[MATRIX_NUM_SINKS];    /**< Frame byte of each sink select nibble */
+    uint8_t sink_sel_shift[MATRIX_NUM_SINKS];   /**< Shift of each sink select nibble (0 or 4) */
+    uint8_t sink_inh_byte[MATRIX_NUM_SINKS];    /**< Frame byte of each sink inhibit bit */
+    uint8_t sink_inh_mask[MATRIX_NUM_SINKS];    /**< Mask of each sink inhibit bit */
+    uint8_t output_mask;                        /**< Outputs wired, MATRIX_OUTPUT_BIT() mask */
+    uint8_t led_pedal_bit[NUM_PEDALS_MAX];      /**< LED chain bit of each pedal LED (HW_LANE_NONE if absent) */
+    uint8_t led_status_bit;                     /**< LED chain bit of the status LED (HW_LANE_NONE if absent) */
+    bool led_active_low;                        /**< LED polarity */
+    gpio_num_t pin_tap_btn;                     /**< Tap tempo footswitch (GPIO_NUM_NC if absent) */
+    gpio_num_t pin_tap_out;                     /**< Tap tempo output (GPIO_NUM_NC if absent) */
+    uint32_t tap_out_mask[2];                   /**< Tap tempo output pin, [bank] */
+    uint8_t ctl_count;                          /**< Control outputs wired (the first ctl_count entries) */
+    uint8_t ctl_byte[MATRIX_NUM_CONTROLS];      /**< Frame byte of each control output */
+    uint8_t ctl_mask[MATRIX_NUM_CONTROLS];      /**< Mask of each control output */
+    char ctl_name[MATRIX_NUM_CONTROLS][HW_CTL_NAME_LEN]; /**< Name of each control output */
+    gpio_num_t pin_zc_adc;                      /**< Input sense pin (GPIO_NUM_NC if absent) */
+    uint8_t meter_sel_byte;                     /**< Frame byte of the meter tap select nibble */
+    uint8_t meter_sel_shift;                    /**< Shift of the meter tap select nibble (0 or 4) */
+    uint8_t meter_inh_byte;                     /**< Frame byte of the meter tap inhibit bit */
+    uint8_t meter_inh_mask;                     /**< Mask of the meter tap inhibit bit */
+    gpio_num_t pin_meter_adc;                   /**< Meter tap ADC pin (GPIO_NUM_NC if there is no meter tap) */
+    gpio_num_t pin_panic;                       /**< Panic bypass footswitch (GPIO_NUM_NC if absent) */
+    gpio_num_t pin_exp_int;                     /**< Expander interrupt line (GPIO_NUM_NC if no expanders) */
+    uint8_t exp_count;                          /**< Footswitch expanders fitted (the first exp_count entries) */
+    uint8_t exp_addr[HW_EXPANDERS_MAX];         /**< I2C address of each footswitch expander */
+    gpio_num_t pin_sr_in;                       /**< 74HC165 chain input (GPIO_NUM_NC if there is no input chain) */
+    uint8_t sr_in_bytes;                        /**< 74HC165 registers read with every frame */
+    gpio_num_t pin_sr_fb[SR_CHAIN_COUNT];       /**< Chain feedback pin (GPIO_NUM_NC if the chain is not probed) */
+    uint8_t chain_found[SR_CHAIN_COUNT];        /**< Registers found by the boot probe, 0 if not probed or failed */
+    uint32_t profile_crc;                       /**< CRC-32 of the profile compiled, as tools/hw_profile.py packs it */
+} hw_tables_t;
+
+/**
+ * @brief Tables compiled from the active profile
+ *
+ * Written by hw_profile_init(), corrected once by hw_profile_fit_chains()
+ * and read-only afterwards.
+ */
+extern hw_tables_t hw_tables;
+
+/**
+ * @brief Load, validate and compile the hardware profile
+ *
+ * Reads the profile record from NVS. If it is missing or fails validation the
+ * Kconfig defaults are used instead. Must be called after NVS is initialized
+ * and before any driver that uses hw_tables.
+ */
+void hw_profile_init(void);
+
+/**
+ * @brief Size the chains to the registers actually fitted
+ *
+ * Called once by sr_bus_init() with the result of its boot probe, before the
+ * first frame is shifted. Each probed chain is shifted with exactly the
+ * number of registers found, and the frame length follows. A chain shorter
+ * than the profile needs is reported with every sink, LED and control output
+ * that is lost, and a longer one with the pedal count it would suggest.
+ *
+ * @param found Registers found in each chain, 0 for a chain that was not probed
+ */
+void hw_profile_fit_chains(const uint8_t found[SR_CHAIN_COUNT]);
+
+/**
+ * @brief Fill a profile with the Kconfig defaults
+ *
+ * @param[out] profile Profile to fill
+ */
+void hw_profile_get_default(hw_profile_t *profile);
+
+/**
+ * @brief Validate a profile
+ *
+ * Checks pin ranges and duplicates, lane ranges, lane overlaps and chain
+ * ownership. Every problem found is logged.
+ *
+ * @param profile Profile to check
+ * @return ESP_OK if the profile is usable, ESP_ERR_INVALID_ARG otherwise
+ */
+esp_err_t hw_profile_validate(const hw_profile_t *profile);
+
+/**
+ * @brief Store a profile record in NVS
+ *
+ * The profile is validated first. It takes effect on the next boot.
+ *
+ * @param profile Profile to store
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t hw_profile_save(const hw_profile_t *profile);
+
+#endif /* HW_PROFILE_H */
@@ -0,0 +1,303 @@
+/**
+ * @file i2c_sched.c
+ * @brief Implementation of the I2C bus scheduler
+ *
+ * One mutex grants the bus. Input transactions count themselves in
+ * input_waiting before they take it; the display checks the count before
+ * and after taking the bus and gives it straight back if an input is
+ * waiting. The mutex hands the bus to the highest priority waiter, and the
+ * expander task runs above the LVGL task, so a waiting read gets the bus as
+ * soon as the chunk in flight is done.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_lcd_panel_io_interface.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "i2c_sched.h"
+#include "power.h"
+
+#define I2C_SCHED_YIELD_MS 10 /**< Longest a display chunk waits for the inputs before checking again */
+
+static const char *TAG = "I2C_Sched";
+
+/**
+ * @brief Panel IO that sends color data in scheduled chunks
+ */
+typedef struct
+{
+    esp_lcd_panel_io_t base;                                    /**< Interface, must be first */
+    esp_lcd_panel_io_handle_t io;                               /**< Wrapped panel IO */
+    esp_lcd_panel_io_color_trans_done_cb_t on_color_trans_done; /**< Registered flush done callback */
+    void *user_ctx;                                             /**< Context of the callback */
+} sched_panel_io_t;
+
+/** @brief Grants the bus */
+static SemaphoreHandle_t bus_lock;
+/** @brief Given when the last waiting input transaction is done */
+static SemaphoreHandle_t input_idle;
+/** @brief Input transactions waiting for or holding the bus */
+static volatile uint32_t input_waiting;
+/** @brief Protects input_waiting and the statistics */
+static portMUX_TYPE sched_lock = portMUX_INITIALIZER_UNLOCKED;
+static i2c_sched_stats_t stats;
+
+// --- Bus grants ---
+
+/**
+ * @brief Take the bus for an input transaction
+ */
+static void _input_begin(void)
+{
+    int64_t start = esp_timer_get_time();
+    portENTER_CRITICAL(&sched_lock);
+    input_waiting++;
+    portEXIT_CRITICAL(&sched_lock);
+
+    xSemaphoreTake(bus_lock, portMAX_DELAY);
+
+    uint32_t wait = (uint32_t)(esp_timer_get_time() - start);
+    portENTER_CRITICAL(&sched_lock);
+    stats.input_xfers++;
+    if (wait > stats.input_wait_max_us)
+    {
+        stats.input_wait_max_us = wait;
+    }
+    portEXIT_CRITICAL(&sched_lock);
+}
+
+/**
+ * @brief Release the bus after an input transaction
+ */
+static void _input_end(void)
+{
+    xSemaphoreGive(bus_lock);
+    portENTER_CRITICAL(&sched_lock);
+    bool idle = --input_waiting == 0;
+    portEXIT_CRITICAL(&sched_lock);
+    if (idle)
+    {
+        xSemaphoreGive(input_idle);
+    }
+}
+
+/**
+ * @brief Take the bus for a display transaction, after any waiting input
+ */
+static void _display_begin(void)
+{
+    bool yielded = false;
+    while (1)
+    {
+        if (input_waiting)
+        {
+            yielded = true;
+            xSemaphoreTake(input_idle, pdMS_TO_TICKS(I2C_SCHED_YIELD_MS));
+            continue;
+        }
+        xSemaphoreTake(bus_lock, portMAX_DELAY);
+        if (!input_waiting)
+        {
+            break;
+        }
+        xSemaphoreGive(bus_lock); // An input arrived while we waited for the bus
+    }
+
+    portENTER_CRITICAL(&sched_lock);
+    stats.display_chunks++;
+    if (yielded)
+    {
+        stats.display_yields++;
+    }
+    portEXIT_CRITICAL(&sched_lock);
+}
+
+/**
+ * @brief Release the bus after a display transaction
+ */
+static void _display_end(void)
+{
+    xSemaphoreGive(bus_lock);
+}
+
+// --- Scheduled panel IO ---
+
+static esp_err_t _io_rx_param(esp_lcd_panel_io_t *io, int lcd_cmd, void *param, size_t param_size)
+{
+    sched_panel_io_t *sio = (sched_panel_io_t *)io;
+    _display_begin();
+    esp_err_t err = esp_lcd_panel_io_rx_param(sio->io, lcd_cmd, param, param_size);
+    _display_end();
+    return err;
+}
+
+static esp_err_t _io_tx_param(esp_lcd_panel_io_t *io, int lcd_cmd, const void *param, size_t param_size)
+{
+    sched_panel_io_t *sio = (sched_panel_io_t *)io;
+    _display_begin();
+    esp_err_t err = esp_lcd_panel_io_tx_param(sio->io, lcd_cmd, param, param_size);
+    _display_end();
+    return err;
+}
+
+/**
+ * @brief Send color data in chunks, letting input reads in between
+ *
+ * Only the first chunk carries the command. The flush done callback runs
+ * once, after the last chunk, as the I2C panel IO does for a whole transfer.
+ */
+static esp_err_t _io_tx_color(esp_lcd_panel_io_t *io, int lcd_cmd, const void *color, size_t color_size)
+{
+    sched_panel_io_t *sio = (sched_panel_io_t *)io;
+    const uint8_t *data = color;
+    esp_err_t err = ESP_OK;
+
+    power_lock(POWER_LOCK_FLUSH);
+    do
+    {
+        size_t len = color_size < I2C_SCHED_CHUNK_BYTES ? color_size : I2C_SCHED_CHUNK_BYTES;
+        _display_begin();
+        err = esp_lcd_panel_io_tx_color(sio->io, lcd_cmd, data, len);
+        _display_end();
+        lcd_cmd = -1;
+        data += len;
+        color_size -= len;
+    } while (err == ESP_OK && color_size);
+    power_unlock(POWER_LOCK_FLUSH);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Display flush failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    if (sio->on_color_trans_done)
+    {
+        sio->on_color_trans_done(&sio->base, NULL, sio->user_ctx);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t _io_del(esp_lcd_panel_io_t *io)
+{
+    sched_panel_io_t *sio = (sched_panel_io_t *)io;
+    esp_err_t err = esp_lcd_panel_io_del(sio->io);
+    free(sio);
+    return err;
+}
+
+static esp_err_t _io_register_event_callbacks(esp_lcd_panel_io_t *io, const esp_lcd_panel_io_callbacks_t *cbs,
+                                              void *user_ctx)
+{
+    sched_panel_io_t *sio = (sched_panel_io_t *)io;
+    sio->on_color_trans_done = cbs->on_color_trans_done;
+    sio->user_ctx = user_ctx;
+    return ESP_OK;
+}
+
+// --- Public API ---
+
+/**
+ * @brief Initialize the scheduler for a bus
+ *
+ * @param bus I2C bus shared by the display and the input devices
+ */
+void i2c_sched_init(i2c_master_bus_handle_t bus)
+{
+    if (bus_lock)
+    {
+        return;
+    }
+    bus_lock = xSemaphoreCreateMutex();
+    input_idle = xSemaphoreCreateBinary();
+    memset(&stats, 0, sizeof(stats));
+    ESP_LOGI(TAG, "I2C scheduler ready, display chunks of %d bytes", I2C_SCHED_CHUNK_BYTES);
+}
+
+/**
+ * @brief Wrap a display panel IO so its color flushes yield to input reads
+ *
+ * @param io Panel IO created on the scheduled bus
+ * @return Scheduled panel IO, or @p io if it could not be wrapped
+ */
+esp_lcd_panel_io_handle_t i2c_sched_wrap_panel_io(esp_lcd_panel_io_handle_t io)
+{
+    if (!bus_lock)
+    {
+        return io;
+    }
+    sched_panel_io_t *sio = calloc(1, sizeof(sched_panel_io_t));
+    if (!sio)
+    {
+        ESP_LOGE(TAG, "No memory for the scheduled panel IO, display flushes are not scheduled");
+        return io;
+    }
+    sio->io = io;
+    sio->base.rx_param = _io_rx_param;
+    sio->base.tx_param = _io_tx_param;
+    sio->base.tx_color = _io_tx_color;
+    sio->base.del = _io_del;
+    sio->base.register_event_callbacks = _io_register_event_callbacks;
+    return &sio->base;
+}
+
+/**
+ * @brief Read registers of an input device ahead of the display
+ *
+ * @param dev Device on the scheduled bus
+ * @param reg First register
+ * @param[out] data Register values
+ * @param len Number of bytes to read
+ * @return ESP_OK or the I2C driver error
+ */
+esp_err_t i2c_sched_input_read(i2c_master_dev_handle_t dev, uint8_t reg, uint8_t *data, size_t len)
+{
+    _input_begin();
+    esp_err_t err = i2c_master_transmit_receive(dev, &reg, 1, data, len, I2C_SCHED_TIMEOUT_MS);
+    _input_end();
+    return err;
+}
+
+/**
+ * @brief Write registers of an input device ahead of the display
+ *
+ * @param dev Device on the scheduled bus
+ * @param reg First register
+ * @param data Register values
+ * @param len Number of bytes to write (at most 4)
+ * @return ESP_OK or the I2C driver error
+ */
+esp_err_t i2c_sched_input_write(i2c_master_dev_handle_t dev, uint8_t reg, const uint8_t *data, size_t len)
+{
+    uint8_t buf[5];
+    if (len > sizeof(buf) - 1)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    buf[0] = reg;
+    memcpy(&buf[1], data, len);
+    _input_begin();
+    esp_err_t err = i2c_master_transmit(dev, buf, len + 1, I2C_SCHED_TIMEOUT_MS);
+    _input_end();
+    return err;
+}
+
+/**
+ * @brief Read the bus scheduling statistics
+ *
+ * @param[out] stats_out Statistics
+ * @param reset true to start a new measurement window
+ */
+void i2c_sched_get_stats(i2c_sched_stats_t *stats_out, bool reset)
+{
+    portENTER_CRITICAL(&sched_lock);
+    *stats_out = stats;
+    if (reset)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+    portEXIT_CRITICAL(&sched_lock);
+}
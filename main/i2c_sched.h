@@ -0,0 +1,92 @@
+/**
+ * @file i2c_sched.h
+ * @brief I2C bus scheduler giving footswitch reads priority over the display
+ *
+ * The footswitch expanders (expander.h) share the I2C bus with the OLED. A
+ * full frame flush of a 128x64 panel is about 1 KiB, roughly 25 ms at
+ * 400 kHz, and the I2C driver serializes transactions in call order, so a
+ * footswitch read issued just after a flush started would wait for all of
+ * it.
+ *
+ * The scheduler wraps the display panel IO. Color data is sent in chunks of
+ * I2C_SCHED_CHUNK_BYTES, and every chunk first takes the bus from the
+ * scheduler. Input transactions announce themselves before taking the bus;
+ * while one is waiting, the display steps back until all of them are done.
+ * An input read therefore waits at most for one chunk in flight (under 1 ms)
+ * and the display is only held back for the few reads after an INT edge.
+ * The panels keep their write pointer across transactions, so a chunked
+ * flush draws the same frame.
+ */
+
+#ifndef I2C_SCHED_H
+#define I2C_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <driver/i2c_master.h>
+#include <esp_lcd_panel_io.h>
+
+#define I2C_SCHED_CHUNK_BYTES 32 /**< Display color data sent per bus grant */
+#define I2C_SCHED_TIMEOUT_MS 20  /**< Timeout of a single input transaction */
+
+/**
+ * @brief Bus scheduling statistics
+ */
+typedef struct
+{
+    uint32_t input_xfers;       /**< Input transactions */
+    uint32_t input_wait_max_us; /**< Longest wait of an input transaction for the bus */
+    uint32_t display_chunks;    /**< Display chunks sent */
+    uint32_t display_yields;    /**< Times a display chunk stepped back for input */
+} i2c_sched_stats_t;
+
+/**
+ * @brief Initialize the scheduler for a bus
+ *
+ * @param bus I2C bus shared by the display and the input devices
+ */
+void i2c_sched_init(i2c_master_bus_handle_t bus);
+
+/**
+ * @brief Wrap a display panel IO so its color flushes yield to input reads
+ *
+ * The returned handle is used in place of @p io for the panel driver and
+ * LVGL. Does nothing if the scheduler is not initialized.
+ *
+ * @param io Panel IO created on the scheduled bus
+ * @return Scheduled panel IO, or @p io if it could not be wrapped
+ */
+esp_lcd_panel_io_handle_t i2c_sched_wrap_panel_io(esp_lcd_panel_io_handle_t io);
+
+/**
+ * @brief Read registers of an input device ahead of the display
+ *
+ * @param dev Device on the scheduled bus
+ * @param reg First register
+ * @param[out] data Register values
+ * @param len Number of bytes to read
+ * @return ESP_OK or the I2C driver error
+ */
+esp_err_t i2c_sched_input_read(i2c_master_dev_handle_t dev, uint8_t reg, uint8_t *data, size_t len);
+
+/**
+ * @brief Write registers of an input device ahead of the display
+ *
+ * @param dev Device on the scheduled bus
+ * @param reg First register
+ * @param data Register values
+ * @param len Number of bytes to write (at most 4)
+ * @return ESP_OK or the I2C driver error
+ */
+esp_err_t i2c_sched_input_write(i2c_master_dev_handle_t dev, uint8_t reg, const uint8_t *data, size_t len);
+
+/**
+ * @brief Read the bus scheduling statistics
+ *
+ * @param[out] stats_out Statistics
+ * @param reset true to start a new measurement window
+ */
+void i2c_sched_get_stats(i2c_sched_stats_t *stats_out, bool reset);
+
+#endif /* I2C_SCHED_H */
@@ -0,0 +1,247 @@
+/**
+ * @file input_adc.c
+ * @brief Implementation of continuous input sampling
+ *
+ * The ADC delivers frames of INPUT_ADC_FRAME_SAMPLES samples per input through
+ * DMA, with the inputs interleaved in pattern order. The conversion done
+ * interrupt timestamps each frame and the input task reads the frame, sorts
+ * the samples by channel and passes each input's block to its listeners.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_adc/adc_continuous.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "input_adc.h"
+#include "hw_profile.h"
+#include "vec.h"
+
+#ifdef CONFIG_INPUT_ADC
+
+#define INPUT_FRAME_BYTES(inputs) (INPUT_ADC_FRAME_SAMPLES * (inputs) * SOC_ADC_DIGI_RESULT_BYTES) /**< Bytes per ADC frame */
+#define INPUT_POOL_FRAMES 8 /**< Frames buffered by the ADC driver */
+
+static const char *TAG = "InputADC";
+
+/** @brief Registered listeners */
+static struct
+{
+    input_adc_input_t input;       /**< Input listened to */
+    input_adc_listener_t listener; /**< Frame callback */
+} listeners[INPUT_ADC_LISTENERS_MAX];
+/** @brief Number of registered listeners */
+static uint8_t listener_count;
+
+/** @brief Continuous ADC driver */
+static adc_continuous_handle_t adc_handle;
+/** @brief ADC1 channel of each input */
+static adc_channel_t adc_channel[INPUT_ADC_COUNT];
+/** @brief Inputs with listeners, in ADC pattern order */
+static input_adc_input_t active[INPUT_ADC_COUNT];
+/** @brief Number of sampled inputs */
+static uint8_t active_count;
+/** @brief Conversion done timestamps, one per frame */
+static QueueHandle_t frame_time_queue;
+/** @brief Set when the ADC driver dropped frames */
+static volatile bool pool_overflow;
+
+/** @brief Raw frame read from the driver */
+static uint8_t frame_buf[INPUT_FRAME_BYTES(INPUT_ADC_COUNT)];
+/** @brief Samples of each input, aligned for the vector kernels */
+static uint16_t input_samples[INPUT_ADC_COUNT][INPUT_ADC_FRAME_SAMPLES] __attribute__((aligned(VEC_ALIGN)));
+
+/**
+ * @brief ADC frame done interrupt: timestamp the frame
+ */
+static bool IRAM_ATTR _on_conv_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    int64_t now = esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(frame_time_queue, &now, &woken);
+    return woken == pdTRUE;
+}
+
+/**
+ * @brief ADC pool overflow interrupt: frames and timestamps no longer match
+ */
+static bool IRAM_ATTR _on_pool_ovf(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    pool_overflow = true;
+    return false;
+}
+
+/**
+ * @brief Input task: read ADC frames and pass them to the listeners
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _input_task(void *pvParameters)
+{
+    while (1)
+    {
+        int64_t frame_us;
+        if (xQueueReceive(frame_time_queue, &frame_us, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        if (pool_overflow)
+        {
+            // Start over so that each timestamp belongs to its frame again
+            pool_overflow = false;
+            adc_continuous_flush_pool(adc_handle);
+            xQueueReset(frame_time_queue);
+            for (uint8_t i = 0; i < listener_count; i++)
+            {
+                listeners[i].listener(NULL, 0, frame_us);
+            }
+            ESP_LOGW(TAG, "ADC frames dropped, resynchronizing");
+            continue;
+        }
+
+        uint32_t len = 0;
+        if (adc_continuous_read(adc_handle, frame_buf, INPUT_FRAME_BYTES(active_count), &len, 0) != ESP_OK)
+        {
+            continue;
+        }
+        size_t n[INPUT_ADC_COUNT] = {0};
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES)
+        {
+            const adc_digi_output_data_t *p = (const adc_digi_output_data_t *)&frame_buf[i];
+            for (uint8_t a = 0; a < active_count; a++)
+            {
+                input_adc_input_t input = active[a];
+                if (p->type2.channel == adc_channel[input] && n[input] < INPUT_ADC_FRAME_SAMPLES)
+                {
+                    input_samples[input][n[input]++] = p->type2.data;
+                    break;
+                }
+            }
+        }
+        for (uint8_t i = 0; i < listener_count; i++)
+        {
+            input_adc_input_t input = listeners[i].input;
+            listeners[i].listener(input_samples[input], n[input], frame_us);
+        }
+    }
+}
+
+/**
+ * @brief Resolve the ADC1 channel of an input's pin
+ *
+ * @return false if the board has no usable pin for the input
+ */
+static bool _resolve(input_adc_input_t input)
+{
+    gpio_num_t pin = input == INPUT_ADC_GUITAR ? hw_tables.pin_zc_adc : hw_tables.pin_meter_adc;
+    const char *what = input == INPUT_ADC_GUITAR ? "input sense" : "meter input";
+    if (pin == GPIO_NUM_NC)
+    {
+        ESP_LOGI(TAG, "No %s pin on this board", what);
+        return false;
+    }
+    adc_unit_t unit;
+    if (adc_continuous_io_to_channel(pin, &unit, &adc_channel[input]) != ESP_OK || unit != ADC_UNIT_1)
+    {
+        ESP_LOGE(TAG, "The %s pin, GPIO %d, is not an ADC1 pin", what, pin);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Add a listener to one input
+ *
+ * Listeners are added during start-up, before the input task runs them.
+ *
+ * @param input Input to listen to
+ * @param listener Frame callback
+ * @return true if the input will be sampled
+ */
+bool input_adc_add_listener(input_adc_input_t input, input_adc_listener_t listener)
+{
+    if (listener_count >= INPUT_ADC_LISTENERS_MAX)
+    {
+        ESP_LOGE(TAG, "No listener slot left");
+        return false;
+    }
+    bool known = false;
+    for (uint8_t a = 0; a < active_count; a++)
+    {
+        known |= active[a] == input;
+    }
+    if (!known)
+    {
+        if (!_resolve(input))
+        {
+            return false;
+        }
+        active[active_count++] = input;
+    }
+    listeners[listener_count].input = input;
+    listeners[listener_count].listener = listener;
+    listener_count++;
+    return true;
+}
+
+/**
+ * @brief Start sampling the inputs that have listeners
+ *
+ * The ADC converts the inputs in turn, so the conversion rate is the sample
+ * rate times the number of inputs.
+ */
+void input_adc_start(void)
+{
+    if (active_count == 0)
+    {
+        return;
+    }
+    uint32_t conv_hz = CONFIG_INPUT_SAMPLE_RATE * active_count;
+    if (conv_hz > SOC_ADC_SAMPLE_FREQ_THRES_HIGH)
+    {
+        ESP_LOGE(TAG, "%lu conversions/s for %d inputs is above the ADC limit", (unsigned long)conv_hz, active_count);
+        return;
+    }
+
+    frame_time_queue = xQueueCreate(INPUT_POOL_FRAMES, sizeof(int64_t));
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = INPUT_POOL_FRAMES * INPUT_FRAME_BYTES(active_count),
+        .conv_frame_size = INPUT_FRAME_BYTES(active_count),
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_cfg, &adc_handle));
+    adc_digi_pattern_config_t pattern[INPUT_ADC_COUNT];
+    for (uint8_t a = 0; a < active_count; a++)
+    {
+        pattern[a] = (adc_digi_pattern_config_t){
+            .atten = ADC_ATTEN_DB_12,
+            .channel = adc_channel[active[a]],
+            .unit = ADC_UNIT_1,
+            .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+        };
+    }
+    adc_continuous_config_t adc_cfg = {
+        .pattern_num = active_count,
+        .adc_pattern = pattern,
+        .sample_freq_hz = conv_hz,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc_handle, &adc_cfg));
+    adc_continuous_evt_cbs_t adc_cbs = {
+        .on_conv_done = _on_conv_done,
+        .on_pool_ovf = _on_pool_ovf,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc_handle, &adc_cbs, NULL));
+
+    xTaskCreate(_input_task, "input_task", 3072, NULL, 7, NULL);
+    ESP_ERROR_CHECK(adc_continuous_start(adc_handle));
+    ESP_LOGI(TAG, "Sampling %d input%s at %d Hz", active_count, active_count > 1 ? "s" : "",
+             CONFIG_INPUT_SAMPLE_RATE);
+}
+
+#endif /* CONFIG_INPUT_ADC */
@@ -0,0 +1,66 @@
+/**
+ * @file input_adc.h
+ * @brief Continuous (DMA) sampling of the guitar input and the meter tap
+ *
+ * The buffered guitar input on the input sense pin (hw_tables.pin_zc_adc) and
+ * the meter tap (hw_tables.pin_meter_adc) are sampled by ADC1 in continuous
+ * mode, each at CONFIG_INPUT_SAMPLE_RATE. The ADC alternates between the
+ * fitted inputs, so each frame holds INPUT_ADC_FRAME_SAMPLES samples of every
+ * input. Each input's samples are handed to the listeners registered for it,
+ * together with the esp_timer time at which the frame ended. Zero-crossing
+ * switching and the tuner both listen to the guitar input, the level meters
+ * to the meter tap.
+ */
+
+#ifndef INPUT_ADC_H
+#define INPUT_ADC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define INPUT_ADC_FRAME_SAMPLES 64 /**< Samples per frame handed to listeners */
+#define INPUT_ADC_LISTENERS_MAX 4  /**< Listeners that can be registered */
+
+/**
+ * @brief Sampled inputs
+ */
+typedef enum
+{
+    INPUT_ADC_GUITAR = 0, /**< Guitar input, on the input sense pin */
+    INPUT_ADC_METER,      /**< Meter tap, whichever source matrix_set_meter_tap() selected */
+    INPUT_ADC_COUNT
+} input_adc_input_t;
+
+/**
+ * @brief Receives each frame of input samples
+ *
+ * Called from the input task, so it must not block for long. A call with
+ * @p n == 0 means frames were dropped and the stream starts over.
+ *
+ * @param samples Unipolar 12-bit samples, VEC_ALIGN aligned
+ * @param n Number of samples
+ * @param frame_end_us esp_timer time at the end of the frame
+ */
+typedef void (*input_adc_listener_t)(const uint16_t *samples, size_t n, int64_t frame_end_us);
+
+/**
+ * @brief Add a listener to one input
+ *
+ * Listeners are added during start-up, before input_adc_start().
+ *
+ * @param input Input to listen to
+ * @param listener Frame callback
+ * @return true if the input will be sampled, false if the board has no
+ *         usable pin for it or no listener slot is left
+ */
+bool input_adc_add_listener(input_adc_input_t input, input_adc_listener_t listener);
+
+/**
+ * @brief Start sampling the inputs that have listeners
+ *
+ * Call once after all listeners were added.
+ */
+void input_adc_start(void);
+
+#endif /* INPUT_ADC_H */
@@ -13,6 +13,8 @@
 #include <driver/gpio.h>
 #include <esp_log.h>
 #include "led.h" // Include our header file
+#include "hw_profile.h"
+#include "sr_bus.h"
 
 /**
  * @file led.c
@@ -23,13 +25,6 @@
  * and brightness control using PWM on the output enable pin.
  */
 
-// Define GPIO pins for 74HC595 control (adjust as needed)
-#define SER_PIN GPIO_NUM_5   // Serial data input
-#define SRCLK_PIN GPIO_NUM_6 // Shift clock
-#define RCLK_PIN GPIO_NUM_7  // Latch clock
-#define OE_PIN GPIO_NUM_8    // Output enable (active-low)
-#define SRCLR_PIN GPIO_NUM_9 // Shift register clear (active-low)
-
 // LED mapping to shift register outputs (0-based index)
 #define LED_PEDAL_1 0 // U801 QA
 #define LED_PEDAL_3 1 // U801 QB
@@ -48,39 +43,30 @@ static TaskHandle_t pwm_task_handle = NULL;
 
 static const char *TAG = "LED_CONTROL";
 
-// Current state of LEDs (0 = on, 1 = off for active-low)
-static uint8_t led_state = 0xFF; // All LEDs off initially (all bits 1)
+// Current logical state of LEDs (1 = on), bit N = LED chain bit N; polarity is applied in led_compile()
+static uint64_t led_state = 0; // All LEDs off initially
 
-// Initialize GPIOs and shift registers
+// Initialize LED output enable and shift register state
 /**
- * Initialize GPIOs and shift registers
+ * Initialize LED output enable and shift register state
  *
- * Configures all necessary GPIO pins and initializes the shift registers
- * to a known state with all LEDs turned off.
+ * The LED chain shares clock and latch with the matrix chains (see sr_bus.h),
+ * so only the optional LED output enable pin is configured here. The shift
+ * register bus must already be initialized.
  */
 void led_init(void)
 {
-    // Configure GPIO pins
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << SER_PIN) | (1ULL << SRCLK_PIN) | (1ULL << RCLK_PIN) |
-                        (1ULL << OE_PIN) | (1ULL << SRCLR_PIN),
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE};
-    gpio_config(&io_conf);
-
-    // Initialize shift register
-    gpio_set_level(SRCLR_PIN, 1); // Clear disabled
-    gpio_set_level(OE_PIN, 0);    // Outputs enabled
-    gpio_set_level(SER_PIN, 0);
-    gpio_set_level(SRCLK_PIN, 0);
-    gpio_set_level(RCLK_PIN, 0);
-
-    // Clear shift registers
-    gpio_set_level(SRCLR_PIN, 0); // Assert clear
-    vTaskDelay(1 / portTICK_PERIOD_MS);
-    gpio_set_level(SRCLR_PIN, 1); // Release clear
+    if (hw_tables.pin_led_oe != GPIO_NUM_NC)
+    {
+        gpio_config_t io_conf = {
+            .pin_bit_mask = (1ULL << hw_tables.pin_led_oe),
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE};
+        gpio_config(&io_conf);
+        gpio_set_level(hw_tables.pin_led_oe, 0); // Outputs enabled
+    }
 
     // Update shift registers with initial state (all off)
     led_update();
@@ -90,24 +76,35 @@ void led_init(void)
 /**
  * Update shift registers with current LED state
  *
- * Shifts out the current LED state to the 74HC595 shift registers.
- * This function shifts the bits MSB first for U802, then U801.
+ * Writes the LED state into the LED chain of the current frame and commits
+ * the frame, leaving the routing chains unchanged.
  * All updates to LED states should call this function to apply changes.
  */
 void led_update(void)
 {
-    // Shift out 8 bits (MSB first for U802, then U801)
-    for (int i = 7; i >= 0; i--)
+    sr_bus_lock();
+    sr_frame_t frame = *sr_bus_current();
+    led_compile(led_state, &frame);
+    sr_bus_commit(&frame);
+    sr_bus_unlock();
+}
+
+/**
+ * Write an LED state into the LED chain of a frame
+ *
+ * Covers hw_tables.chain_bytes[SR_CHAIN_LED] registers, which the boot probe
+ * sets to the registers actually fitted when the chain has a feedback pin.
+ *
+ * @param leds LED chain bits to turn on, bit N = chain bit N
+ * @param frame Frame whose LED chain is written
+ */
+void led_compile(uint64_t leds, sr_frame_t *frame)
+{
+    for (int reg = 0; reg < hw_tables.chain_bytes[SR_CHAIN_LED]; reg++)
     {
-        gpio_set_level(SER_PIN, (led_state >> i) & 1);
-        gpio_set_level(SRCLK_PIN, 1); // Clock pulse
-        vTaskDelay(1 / portTICK_PERIOD_MS);
-        gpio_set_level(SRCLK_PIN, 0);
+        uint8_t byte = (uint8_t)(leds >> (reg * 8));
+        frame->b[SR_FRAME_INDEX(SR_CHAIN_LED, reg)] = hw_tables.led_active_low ? (uint8_t)~byte : byte;
     }
-    // Latch data to outputs
-    gpio_set_level(RCLK_PIN, 1);
-    vTaskDelay(1 / portTICK_PERIOD_MS);
-    gpio_set_level(RCLK_PIN, 0);
 }
 
 // Enable/disable a single LED
@@ -115,26 +112,24 @@ void led_update(void)
  * Enable/disable a single LED
  *
  * Sets the state of a single LED identified by its index.
- * Note that LEDs are active-low in this design (0 = on, 1 = off).
  *
  * @param led_index The LED to control (use LED_* constants from led.h)
  * @param enable true to turn the LED on, false to turn it off
  */
 void led_set(uint8_t led_index, bool enable)
 {
-    if (led_index >= 8)
+    if (led_index >= hw_tables.chain_bytes[SR_CHAIN_LED] * 8)
     {
         ESP_LOGE(TAG, "Invalid LED index: %d", led_index);
         return;
     }
-    // Active-low: 0 = on, 1 = off
     if (enable)
     {
-        led_state &= ~(1 << led_index); // Clear bit to turn on
+        led_state |= 1ULL << led_index;
     }
     else
     {
-        led_state |= (1 << led_index); // Set bit to turn off
+        led_state &= ~(1ULL << led_index);
     }
     led_update();
 }
@@ -144,7 +139,6 @@ void led_set(uint8_t led_index, bool enable)
  *
  * Sets the state of multiple LEDs at once using a bitmask.
  * This is more efficient than calling led_set() multiple times.
- * Note that LEDs are active-low in this design (0 = on, 1 = off).
  *
  * @param led_mask Bitmask of LEDs to control (set bit for each LED)
  * @param enable true to turn the LEDs on, false to turn them off
@@ -153,15 +147,61 @@ void led_set_multiple(uint8_t led_mask, bool enable)
 {
     if (enable)
     {
-        led_state &= ~led_mask; // Clear bits to turn on
+        led_state |= led_mask;
     }
     else
     {
-        led_state |= led_mask; // Set bits to turn off
+        led_state &= ~(uint64_t)led_mask;
     }
     led_update();
 }
 
+/**
+ * Set the LED of a pedal loop
+ *
+ * Looks up the pedal's LED in the hardware profile. Pedals without an LED on
+ * the current board revision are ignored.
+ *
+ * @param pedal_index Pedal index (0-based)
+ * @param enable true to turn the LED on, false to turn it off
+ */
+void led_set_pedal(uint8_t pedal_index, bool enable)
+{
+    if (pedal_index < NUM_PEDALS_MAX && hw_tables.led_pedal_bit[pedal_index] != HW_LANE_NONE)
+    {
+        led_set(hw_tables.led_pedal_bit[pedal_index], enable);
+    }
+}
+
+/**
+ * Show a set of pedals on the pedal LEDs
+ *
+ * Turns on the LEDs of the pedals in @p pedal_mask and turns off all other
+ * pedal LEDs with a single shift register update. Other LEDs keep their state.
+ *
+ * @param pedal_mask Bit N set turns on the LED of pedal N (0-based)
+ */
+void led_show_pedals(uint8_t pedal_mask)
+{
+    uint64_t all = 0;
+    uint64_t on = 0;
+    for (int i = 0; i < NUM_PEDALS_MAX; i++)
+    {
+        uint8_t bit = hw_tables.led_pedal_bit[i];
+        if (bit == HW_LANE_NONE)
+        {
+            continue;
+        }
+        all |= 1ULL << bit;
+        if (pedal_mask & (1 << i))
+        {
+            on |= 1ULL << bit;
+        }
+    }
+    led_state = (led_state & ~all) | on;
+    led_update();
+}
+
 // PWM task for dimming all LEDs
 /**
  * PWM task for dimming all LEDs
@@ -178,16 +218,16 @@ void pwm_task(void *pvParameters)
     {
         if (pwm_duty_cycle > 0)
         {
-            gpio_set_level(OE_PIN, 0); // Enable outputs
+            gpio_set_level(hw_tables.pin_led_oe, 0); // Enable outputs
             vTaskDelay((pwm_duty_cycle * PWM_PERIOD_MS / 100) / portTICK_PERIOD_MS);
         }
         if (pwm_duty_cycle < 100)
         {
-            gpio_set_level(OE_PIN, 1); // Disable outputs
+            gpio_set_level(hw_tables.pin_led_oe, 1); // Disable outputs
             vTaskDelay(((100 - pwm_duty_cycle) * PWM_PERIOD_MS / 100) / portTICK_PERIOD_MS);
         }
     }
-    gpio_set_level(OE_PIN, 0); // Ensure outputs are enabled when stopping
+    gpio_set_level(hw_tables.pin_led_oe, 0); // Ensure outputs are enabled when stopping
     vTaskDelete(NULL);
 }
 
@@ -209,6 +249,11 @@ void led_set_brightness(uint8_t duty_cycle)
         ESP_LOGE(TAG, "Invalid duty cycle: %d", duty_cycle);
         return;
     }
+    if (hw_tables.pin_led_oe == GPIO_NUM_NC)
+    {
+        ESP_LOGW(TAG, "Board has no LED output enable, brightness not supported");
+        return;
+    }
     pwm_duty_cycle = duty_cycle;
 
     // Start or stop PWM task based on duty cycle
@@ -216,13 +261,13 @@ void led_set_brightness(uint8_t duty_cycle)
     {
         pwm_running = false; // Stop PWM for full brightness
         vTaskDelete(pwm_task_handle);
-        gpio_set_level(OE_PIN, 0); // Enable outputs
+        gpio_set_level(hw_tables.pin_led_oe, 0); // Enable outputs
     }
     else if (duty_cycle == 0 && pwm_running)
     {
         pwm_running = false; // Stop PWM for fully off
         vTaskDelete(pwm_task_handle);
-        gpio_set_level(OE_PIN, 1); // Disable outputs
+        gpio_set_level(hw_tables.pin_led_oe, 1); // Disable outputs
     }
     else if (!pwm_running && duty_cycle > 0 && duty_cycle < 100)
     {
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "sr_bus.h"
+
 /**
  * @file led.h
  * @brief LED control functions for ESP32 patch bay
@@ -15,6 +17,9 @@
 
 /**
  * @brief LED identifiers mapped to shift register outputs
+ *
+ * This is the LED chain wiring of the original board and is used as the
+ * default LED map of the hardware profile (see hw_profile.h).
  */
 #define LED_PEDAL_1 0 /**< U801 QA */
 #define LED_PEDAL_3 1 /**< U801 QB */
@@ -26,10 +31,11 @@
 #define LED_PEDAL_8 7 /**< U802 QD */
 
 /**
- * @brief Initialize LEDs and shift register GPIOs
+ * @brief Initialize LEDs
  *
- * Configures the GPIO pins for controlling 74HC595 shift registers
- * and initializes them to a known state with all LEDs off.
+ * Configures the optional LED output enable pin and turns all LEDs off.
+ * The LED chain is shifted on the shared bus, so sr_bus_init() must have
+ * been called first.
  */
 void led_init(void);
 
@@ -41,10 +47,22 @@ void led_init(void);
  */
 void led_update(void);
 
+/**
+ * @brief Write an LED state into the LED chain of a frame
+ *
+ * Fills every register of the LED chain with the board's polarity, so LEDs
+ * on spare registers are off. Used by led_update() and for frames built
+ * outside the LED driver, such as the panic bypass frame.
+ *
+ * @param leds LED chain bits to turn on, bit N = chain bit N
+ * @param[in,out] frame Frame whose LED chain is written
+ */
+void led_compile(uint64_t leds, sr_frame_t *frame);
+
 /**
  * @brief Turn a single LED on or off
  *
- * @param led_index The LED to control (use LED_* constants)
+ * @param led_index The LED to control (use LED_* constants, or any bit of the LED chain)
  * @param enable true to turn the LED on, false to turn it off
  */
 void led_set(uint8_t led_index, bool enable);
@@ -57,6 +75,24 @@ void led_set(uint8_t led_index, bool enable);
  */
 void led_set_multiple(uint8_t led_mask, bool enable);
 
+/**
+ * @brief Turn the LED of a pedal loop on or off
+ *
+ * Uses the pedal LED mapping from the hardware profile.
+ *
+ * @param pedal_index Pedal index (0-based)
+ * @param enable true to turn the LED on, false to turn it off
+ */
+void led_set_pedal(uint8_t pedal_index, bool enable);
+
+/**
+ * @brief Show a set of pedals on the pedal LEDs in one update
+ *
+ * @param pedal_mask Bit N set turns on the LED of pedal N (0-based), all
+ *                   other pedal LEDs are turned off
+ */
+void led_show_pedals(uint8_t pedal_mask);
+
 /**
  * @brief Set brightness level for all LEDs
  *
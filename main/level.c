@@ -0,0 +1,79 @@
+/**
+ * @file level.c
+ * @brief Implementation of the block level meter
+ */
+
+#include <math.h>
+#include "level.h"
+#include "vec.h"
+
+/**
+ * @brief Clear an accumulator
+ *
+ * @param acc Accumulator
+ */
+void level_reset(level_acc_t *acc)
+{
+    acc->n = 0;
+    acc->sum = 0;
+    acc->sum_sq = 0;
+    acc->min = UINT16_MAX;
+    acc->max = 0;
+}
+
+/**
+ * @brief Add samples to an accumulator
+ *
+ * 12-bit samples are valid signed 16-bit values, so the sum of squares is
+ * the dot product of the block with itself.
+ *
+ * @param acc Accumulator
+ * @param samples 12-bit unipolar ADC samples
+ * @param n Number of samples
+ */
+void level_add(level_acc_t *acc, const uint16_t *samples, size_t n)
+{
+    uint32_t sum;
+    uint16_t min, max;
+    vec_sum_range_u16(samples, n, &sum, &min, &max);
+    acc->sum += sum;
+    acc->sum_sq += (uint64_t)vec_dot_s16((const int16_t *)samples, (const int16_t *)samples, n);
+    acc->min = min < acc->min ? min : acc->min;
+    acc->max = max > acc->max ? max : acc->max;
+    acc->n += n;
+}
+
+/**
+ * @brief Convert an amplitude to dBFS, clamped at the floor
+ */
+static float _db(double amplitude)
+{
+    float db = amplitude > 0 ? 20.0f * log10f((float)(amplitude / LEVEL_FULL_SCALE)) : LEVEL_DB_FLOOR;
+    return db < LEVEL_DB_FLOOR ? LEVEL_DB_FLOOR : db;
+}
+
+/**
+ * @brief Levels of the accumulated samples with the DC bias removed
+ *
+ * The variance comes from the sums as E[x^2] - E[x]^2, in double because
+ * the DC part is about 10^4 times the signal power of a quiet input.
+ *
+ * @param acc Accumulator with at least one sample
+ * @param[out] rms_db RMS level, dBFS, at least LEVEL_DB_FLOOR
+ * @param[out] peak_db Peak level, dBFS, at least LEVEL_DB_FLOOR
+ */
+void level_get(const level_acc_t *acc, float *rms_db, float *peak_db)
+{
+    if (acc->n == 0)
+    {
+        *rms_db = LEVEL_DB_FLOOR;
+        *peak_db = LEVEL_DB_FLOOR;
+        return;
+    }
+    double mean = (double)acc->sum / acc->n;
+    double var = (double)acc->sum_sq / acc->n - mean * mean;
+    double up = acc->max - mean, down = mean - acc->min;
+
+    *rms_db = _db(var > 0 ? sqrt(var) * M_SQRT2 : 0); // RMS of a sine is its peak / sqrt(2)
+    *peak_db = _db(up > down ? up : down);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file level.h
+ * @brief RMS and peak level of ADC sample blocks
+ *
+ * An accumulator takes frames of unipolar ADC samples and keeps the sum, the
+ * sum of squares and the range. The sum of squares runs on the vector dot
+ * product (vec.h) and the rest on the 8-lane block kernel, so a 64-sample
+ * frame costs a few hundred cycles. The DC bias is removed at the end from
+ * the sums, so no per-sample mean has to be known in advance.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host.
+ */
+
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LEVEL_FULL_SCALE 2048.0f /**< Peak of a full-scale sine, ADC counts */
+#define LEVEL_DB_FLOOR -80       /**< Lowest level reported, dBFS */
+
+/**
+ * @brief Running sums over the samples of one measurement
+ */
+typedef struct
+{
+    uint32_t n;      /**< Samples added */
+    uint64_t sum;    /**< Sum of the samples */
+    uint64_t sum_sq; /**< Sum of the squared samples */
+    uint16_t min;    /**< Smallest sample */
+    uint16_t max;    /**< Largest sample */
+} level_acc_t;
+
+/**
+ * @brief Clear an accumulator
+ *
+ * @param acc Accumulator
+ */
+void level_reset(level_acc_t *acc);
+
+/**
+ * @brief Add samples to an accumulator
+ *
+ * The vector kernel is used when @p samples is VEC_ALIGN aligned and @p n is
+ * a multiple of VEC_LANES.
+ *
+ * @param acc Accumulator
+ * @param samples 12-bit unipolar ADC samples
+ * @param n Number of samples
+ */
+void level_add(level_acc_t *acc, const uint16_t *samples, size_t n);
+
+/**
+ * @brief Levels of the accumulated samples with the DC bias removed
+ *
+ * Both levels are relative to a full-scale sine, so a steady sine reads the
+ * same in both. A plucked string reads higher in peak than in RMS.
+ *
+ * @param acc Accumulator with at least one sample
+ * @param[out] rms_db RMS level, dBFS, at least LEVEL_DB_FLOOR
+ * @param[out] peak_db Peak level, dBFS, at least LEVEL_DB_FLOOR
+ */
+void level_get(const level_acc_t *acc, float *rms_db, float *peak_db);
+
+#endif /* LEVEL_H */
@@ -0,0 +1,393 @@
+/**
+ * @file link.c
+ * @brief Implementation of the link between two patch bay units
+ *
+ * Packets are exchanged over a UART using the framing in link_proto.c. The
+ * link task feeds received bytes into the decoder and handles complete
+ * packets. On the slave the sync line interrupt latches the staged frame, so
+ * the slave switches on the same edge as the master.
+ *
+ * The slave holds the shift register bus from the stage of a route until it
+ * is latched, so no other writer (LED updates, the meter tap) shifts its own
+ * frame over the staged route. If no sync edge comes within
+ * LINK_SYNC_TIMEOUT_MS the slave latches the route itself and lets go of the
+ * bus.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "link.h"
+#include "link_proto.h"
+#include "power.h"
+#include "health.h"
+#include "buttons.h"
+#include "hw_profile.h"
+#include "led.h"
+#include "matrix.h"
+#include "sr_bus.h"
+
+#ifdef CONFIG_LINK_ENABLE
+
+#define LINK_UART ((uart_port_t)CONFIG_LINK_UART_NUM) /**< UART port of the link */
+#define LINK_UART_BUF_SIZE 256                         /**< UART driver RX buffer size */
+#define LINK_SYNC_TIMEOUT_MS 100                       /**< Slave: longest wait for the sync edge of a staged route */
+
+/** @brief Tag for logging */
+static const char *TAG = "Link";
+
+/** @brief Serializes packet writes from the link task and the caller tasks */
+static SemaphoreHandle_t tx_mutex;
+
+/**
+ * @brief Encode and send one packet
+ *
+ * @param type Packet type
+ * @param seq Sequence number
+ * @param payload Payload bytes
+ * @param len Payload length
+ */
+static void _send(uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t len)
+{
+    uint8_t buf[LINK_PACKET_MAX];
+    size_t n = link_encode(type, seq, payload, len, buf);
+    xSemaphoreTake(tx_mutex, portMAX_DELAY);
+    uart_write_bytes(LINK_UART, buf, n);
+    xSemaphoreGive(tx_mutex);
+}
+
+#ifdef CONFIG_LINK_ROLE_MASTER
+
+/** @brief Given by the link task when the slave reports the pending route staged */
+static SemaphoreHandle_t staged_sem;
+/** @brief Sequence number of the route waiting for STAGED (0 = none) */
+static volatile uint8_t route_seq;
+/** @brief A slave has answered since the last timeout */
+static volatile bool slave_present;
+/** @brief Last route sent to the slave, resent when the slave (re)appears */
+static uint8_t last_route[LINK_UNIT_PEDALS];
+/** @brief Length of last_route */
+static uint8_t last_route_len;
+
+/**
+ * @brief Send the slave its part of the route and wait until it is staged
+ *
+ * @param chain Slave chain (local pedal numbers 1-8)
+ * @param len Slave chain length
+ * @return true if the slave staged the route in time
+ */
+bool link_stage_remote(const uint8_t *chain, uint8_t len)
+{
+    static uint8_t seq;
+
+    if (len > LINK_UNIT_PEDALS)
+    {
+        len = LINK_UNIT_PEDALS;
+    }
+    memcpy(last_route, chain, len);
+    last_route_len = len;
+
+    seq = (seq == 0xFF) ? 1 : seq + 1; // 0 is reserved for unsolicited routes
+    xSemaphoreTake(staged_sem, 0);     // Drop a late acknowledge of an earlier route
+    route_seq = seq;
+    _send(LINK_MSG_ROUTE, seq, chain, len);
+    if (!slave_present)
+    {
+        return false; // Don't stall every switch while no slave is connected
+    }
+
+    bool staged = xSemaphoreTake(staged_sem, pdMS_TO_TICKS(CONFIG_LINK_ACK_TIMEOUT_MS)) == pdTRUE;
+    route_seq = 0;
+    if (!staged)
+    {
+        ESP_LOGW(TAG, "Slave did not stage route %d in time, switching without it", seq);
+        slave_present = false;
+    }
+    return staged;
+}
+
+/**
+ * @brief Handle a packet received from the slave
+ *
+ * @param pkt Packet
+ */
+static void _handle_packet(const link_packet_t *pkt)
+{
+    switch (pkt->type)
+    {
+    case LINK_MSG_HELLO:
+        ESP_LOGI(TAG, "Slave present, %d pedals fitted", pkt->len ? pkt->payload[0] : 0);
+        slave_present = true;
+        // Hand the slave the current route; it switches on the next latch edge
+        _send(LINK_MSG_ROUTE, 0, last_route, last_route_len);
+        break;
+    case LINK_MSG_STAGED:
+        slave_present = true;
+        if (pkt->seq != 0 && pkt->seq == route_seq)
+        {
+            xSemaphoreGive(staged_sem);
+        }
+        break;
+    case LINK_MSG_BUTTON:
+        if (pkt->len == 2)
+        {
+            buttons_post_remote_event(pkt->payload[0], pkt->payload[1]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+#endif /* CONFIG_LINK_ROLE_MASTER */
+
+#ifdef CONFIG_LINK_ROLE_SLAVE
+
+/** @brief A route is shifted in and waits for the sync edge */
+static volatile bool frame_staged;
+/** @brief Pedal LEDs to show once the staged route is latched */
+static uint8_t staged_led_mask;
+/** @brief The link task holds the bus for a staged route */
+static bool bus_held;
+/** @brief When the route holding the bus was staged */
+static TickType_t staged_at;
+/** @brief Makes the latch of a staged route happen once, from the interrupt or the link task */
+static portMUX_TYPE sync_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Sync line interrupt: latch the staged route
+ *
+ * The master pulses the sync line on every latch, including LED updates, so
+ * the edge is ignored unless a route is waiting.
+ *
+ * @param arg Unused
+ */
+static void IRAM_ATTR _sync_isr(void *arg)
+{
+    portENTER_CRITICAL_ISR(&sync_lock);
+    if (frame_staged)
+    {
+        sr_bus_latch();
+        frame_staged = false;
+    }
+    portEXIT_CRITICAL_ISR(&sync_lock);
+}
+
+/**
+ * @brief Forward a button event to the master
+ *
+ * @param button link_button_t or pedal index (0-7)
+ * @param event link_event_t
+ */
+void link_send_button(uint8_t button, uint8_t event)
+{
+    uint8_t payload[2] = {button, event};
+    _send(LINK_MSG_BUTTON, 0, payload, sizeof(payload));
+}
+
+/**
+ * @brief Announce this unit to the master
+ */
+static void _send_hello(void)
+{
+    uint8_t pedals = hw_tables.num_pedals;
+    _send(LINK_MSG_HELLO, 0, &pedals, 1);
+}
+
+/**
+ * @brief Handle a packet received from the master
+ *
+ * @param pkt Packet
+ */
+static void _handle_packet(const link_packet_t *pkt)
+{
+    switch (pkt->type)
+    {
+    case LINK_MSG_HELLO:
+        _send_hello(); // Master (re)started
+        break;
+    case LINK_MSG_ROUTE:
+    {
+        if (pkt->len > LINK_UNIT_PEDALS)
+        {
+            break;
+        }
+        sr_frame_t frame = *sr_bus_current(); // Keep the LED chain as it is
+        matrix_compile(pkt->payload, pkt->len, MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_AMP_A), &frame); // Amp output A is the line back to the master
+
+        uint8_t led_mask = 0;
+        for (int i = 0; i < pkt->len; i++)
+        {
+            if (pkt->payload[i] > 0 && pkt->payload[i] <= NUM_PEDALS_MAX)
+            {
+                led_mask |= 1 << (pkt->payload[i] - 1);
+            }
+        }
+
+        if (!bus_held)
+        {
+            sr_bus_lock(); // Held until the route is latched, see _release_bus()
+            bus_held = true;
+        }
+        frame_staged = false; // Ignore sync edges while shifting
+        sr_bus_stage(&frame);
+        staged_led_mask = led_mask;
+        staged_at = xTaskGetTickCount();
+        frame_staged = true;
+        if (pkt->seq != 0)
+        {
+            _send(LINK_MSG_STAGED, pkt->seq, NULL, 0);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Let go of the bus once the staged route is latched
+ *
+ * After LINK_SYNC_TIMEOUT_MS without a sync edge the route is latched here:
+ * the master has either switched already or is gone, and in both cases the
+ * route it sent is the right one to play.
+ */
+static void _release_bus(void)
+{
+    if (!bus_held)
+    {
+        return;
+    }
+    if (frame_staged && xTaskGetTickCount() - staged_at >= pdMS_TO_TICKS(LINK_SYNC_TIMEOUT_MS))
+    {
+        portENTER_CRITICAL(&sync_lock);
+        bool late = frame_staged; // The edge may have come in between
+        if (late)
+        {
+            sr_bus_latch();
+            frame_staged = false;
+        }
+        portEXIT_CRITICAL(&sync_lock);
+        if (late)
+        {
+            ESP_LOGW(TAG, "No sync edge within %d ms, route latched without the master", LINK_SYNC_TIMEOUT_MS);
+        }
+    }
+    if (!frame_staged)
+    {
+        bus_held = false;
+        sr_bus_unlock();
+        led_show_pedals(staged_led_mask); // Route latched, follow with the LEDs
+    }
+}
+
+#endif /* CONFIG_LINK_ROLE_SLAVE */
+
+/**
+ * @brief Link task: receive and handle packets
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _link_task(void *pvParameters)
+{
+    static link_decoder_t decoder;
+    uint8_t buf[64];
+
+    link_decoder_reset(&decoder);
+    int health_id = health_register("link", CONFIG_HEALTH_DEADLINE_MS);
+    while (1)
+    {
+        HEALTH_BEAT(health_id);
+        // Block for the first byte only, then take whatever else has arrived
+        int n = uart_read_bytes(LINK_UART, buf, 1, pdMS_TO_TICKS(10));
+        if (n > 0)
+        {
+            size_t avail = 0;
+            uart_get_buffered_data_len(LINK_UART, &avail);
+            if (avail > sizeof(buf) - 1)
+            {
+                avail = sizeof(buf) - 1;
+            }
+            if (avail)
+            {
+                n += uart_read_bytes(LINK_UART, buf + 1, avail, 0);
+            }
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            const link_packet_t *pkt = link_decoder_feed(&decoder, buf[i]);
+            if (pkt)
+            {
+                _handle_packet(pkt);
+            }
+        }
+
+#ifdef CONFIG_LINK_ROLE_SLAVE
+        _release_bus();
+#endif
+    }
+}
+
+/**
+ * @brief Initialize the link UART, the sync line and the link task
+ */
+void link_init(void)
+{
+    const uart_config_t uart_config = {
+        .baud_rate = CONFIG_LINK_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    ESP_ERROR_CHECK(uart_driver_install(LINK_UART, LINK_UART_BUF_SIZE, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(LINK_UART, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(LINK_UART, CONFIG_LINK_TX_PIN, CONFIG_LINK_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    tx_mutex = xSemaphoreCreateMutex();
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << CONFIG_LINK_SYNC_PIN,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+    };
+#ifdef CONFIG_LINK_ROLE_MASTER
+    staged_sem = xSemaphoreCreateBinary();
+    io_conf.mode = GPIO_MODE_OUTPUT;
+    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    gpio_config(&io_conf);
+    sr_bus_add_latch_pin(CONFIG_LINK_SYNC_PIN); // Sync edge comes from the same write as the latch edge
+#else
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pull_down_en = GPIO_PULLDOWN_ENABLE; // Master absent: no edges
+    io_conf.intr_type = GPIO_INTR_POSEDGE;
+    gpio_config(&io_conf);
+    esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) // Already installed is fine
+    {
+        ESP_LOGE(TAG, "GPIO ISR service install failed: %s", esp_err_to_name(err));
+    }
+    gpio_isr_handler_add(CONFIG_LINK_SYNC_PIN, _sync_isr, NULL);
+#endif
+
+    xTaskCreate(_link_task, "link_task", 4096, NULL, 6, NULL);
+    power_stay_awake("the link UART");
+
+#ifdef CONFIG_LINK_ROLE_MASTER
+    _send(LINK_MSG_HELLO, 0, NULL, 0); // Ask a slave that booted first to announce itself
+    ESP_LOGI(TAG, "Link master on UART%d, sync GPIO %d", CONFIG_LINK_UART_NUM, CONFIG_LINK_SYNC_PIN);
+#else
+    _send_hello();
+    ESP_LOGI(TAG, "Link slave on UART%d, sync GPIO %d", CONFIG_LINK_UART_NUM, CONFIG_LINK_SYNC_PIN);
+#endif
+}
+
+#endif /* CONFIG_LINK_ENABLE */
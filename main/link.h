@@ -0,0 +1,53 @@
+/**
+ * @file link.h
+ * @brief Link between two patch bay units acting as one 16-loop patch bay
+ *
+ * The master owns the buttons, presets and display. When the route changes it
+ * splits the combined chain (see link_proto.h), sends the slave its part over
+ * the link UART and waits until the slave has shifted it into its registers.
+ * The master then stages its own frame and latches it; the shared sync line is
+ * pulsed by the same register write as the master latch, and the slave
+ * latches its staged frame on that edge. Each unit compiles its own frame with
+ * its own hardware profile, so the two boards do not have to be identical.
+ *
+ * The slave forwards its button events to the master, which handles them as
+ * pedals 9-16.
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Initialize the link UART, the sync line and the link task
+ *
+ * Must be called after matrix_init(), since the sync line is added to the
+ * shift register latch, and before buttons_init().
+ */
+void link_init(void);
+
+/**
+ * @brief Send the slave its part of the route and wait until it is staged
+ *
+ * Master only. The slave switches on the next latch edge of the master.
+ *
+ * @param chain Slave chain (local pedal numbers 1-8)
+ * @param len Slave chain length
+ * @return true if the slave staged the route in time, false if the master
+ *         switches without it
+ */
+bool link_stage_remote(const uint8_t *chain, uint8_t len);
+
+/**
+ * @brief Forward a button event to the master
+ *
+ * Slave only.
+ *
+ * @param button link_button_t or pedal index (0-7)
+ * @param event link_event_t
+ */
+void link_send_button(uint8_t button, uint8_t event);
+
+#endif /* LINK_H */
@@ -0,0 +1,213 @@
+/**
+ * @file link_proto.c
+ * @brief Implementation of the linked unit wire protocol and route splitting
+ */
+
+#include <string.h>
+#include "link_proto.h"
+
+/** @brief Decoder states */
+enum
+{
+    DEC_SOF = 0,
+    DEC_TYPE,
+    DEC_SEQ,
+    DEC_LEN,
+    DEC_PAYLOAD,
+    DEC_CRC,
+};
+
+/**
+ * @brief CRC-16/CCITT-FALSE
+ *
+ * @param crc Running CRC, 0xFFFF to start
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @return Updated CRC
+ */
+uint16_t link_crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while (len--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Encode a packet
+ *
+ * @param type Packet type
+ * @param seq Sequence number
+ * @param payload Payload bytes (may be NULL if @p len is 0)
+ * @param len Payload length (at most LINK_PAYLOAD_MAX)
+ * @param[out] out Buffer of at least LINK_PACKET_MAX bytes
+ * @return Encoded length, or 0 if the payload is too long
+ */
+size_t link_encode(uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t len, uint8_t *out)
+{
+    if (len > LINK_PAYLOAD_MAX)
+    {
+        return 0;
+    }
+    out[0] = LINK_SOF;
+    out[1] = type;
+    out[2] = seq;
+    out[3] = len;
+    if (len)
+    {
+        memcpy(&out[4], payload, len);
+    }
+    uint16_t crc = link_crc16(0xFFFF, &out[1], 3 + len);
+    out[4 + len] = crc & 0xFF;
+    out[5 + len] = crc >> 8;
+    return 6 + len;
+}
+
+/**
+ * @brief Reset a decoder, keeping its error counter
+ *
+ * @param dec Decoder to reset
+ */
+void link_decoder_reset(link_decoder_t *dec)
+{
+    uint32_t crc_errors = dec->crc_errors;
+    memset(dec, 0, sizeof(*dec));
+    dec->crc_errors = crc_errors;
+}
+
+/**
+ * @brief Feed one received byte into the decoder
+ *
+ * Bytes outside a packet are skipped until the next start byte, so the
+ * decoder resynchronizes on its own after line noise or a partial packet.
+ *
+ * @param dec Decoder
+ * @param byte Received byte
+ * @return Pointer to the complete packet, or NULL
+ */
+const link_packet_t *link_decoder_feed(link_decoder_t *dec, uint8_t byte)
+{
+    switch (dec->state)
+    {
+    case DEC_SOF:
+        if (byte == LINK_SOF)
+        {
+            dec->state = DEC_TYPE;
+        }
+        break;
+    case DEC_TYPE:
+        dec->pkt.type = byte;
+        dec->state = DEC_SEQ;
+        break;
+    case DEC_SEQ:
+        dec->pkt.seq = byte;
+        dec->state = DEC_LEN;
+        break;
+    case DEC_LEN:
+        if (byte > LINK_PAYLOAD_MAX)
+        {
+            dec->state = (byte == LINK_SOF) ? DEC_TYPE : DEC_SOF; // Resynchronize
+            break;
+        }
+        dec->pkt.len = byte;
+        dec->pos = 0;
+        dec->state = byte ? DEC_PAYLOAD : DEC_CRC;
+        break;
+    case DEC_PAYLOAD:
+        dec->pkt.payload[dec->pos++] = byte;
+        if (dec->pos == dec->pkt.len)
+        {
+            dec->pos = 0;
+            dec->state = DEC_CRC;
+        }
+        break;
+    case DEC_CRC:
+        if (dec->pos == 0)
+        {
+            dec->crc = byte;
+            dec->pos = 1;
+            break;
+        }
+        dec->crc |= (uint16_t)byte << 8;
+        dec->state = DEC_SOF;
+        {
+            uint8_t head[3] = {dec->pkt.type, dec->pkt.seq, dec->pkt.len};
+            uint16_t crc = link_crc16(0xFFFF, head, sizeof(head));
+            crc = link_crc16(crc, dec->pkt.payload, dec->pkt.len);
+            if (crc == dec->crc)
+            {
+                return &dec->pkt;
+            }
+            dec->crc_errors++;
+        }
+        break;
+    default:
+        dec->state = DEC_SOF;
+        break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Split a combined chain into the chains of the two units
+ *
+ * Walks the chain once. Each run of slave pedals is one hop to the slave;
+ * with a tie loop the hop is inserted into the master chain as that loop.
+ *
+ * @param chain Combined chain (pedal numbers 1-16)
+ * @param len Combined chain length
+ * @param tie_loop Master loop used as tie line (1-8), or 0 for series wiring
+ * @param[out] master_chain Master chain
+ * @param[out] master_len Master chain length
+ * @param[out] slave_chain Slave chain (local pedal numbers)
+ * @param[out] slave_len Slave chain length
+ * @return true if the chain can be routed with the available hops
+ */
+bool link_split_route(const uint8_t *chain, uint8_t len, uint8_t tie_loop,
+                      uint8_t *master_chain, uint8_t *master_len,
+                      uint8_t *slave_chain, uint8_t *slave_len)
+{
+    uint8_t runs = 0;
+    bool in_slave_run = false;
+    bool seen_slave = false;
+
+    *master_len = 0;
+    *slave_len = 0;
+    for (int i = 0; i < len; i++)
+    {
+        uint8_t pedal = chain[i];
+        if (pedal > LINK_UNIT_PEDALS)
+        {
+            if (!in_slave_run)
+            {
+                runs++;
+                in_slave_run = true;
+                if (tie_loop)
+                {
+                    master_chain[(*master_len)++] = tie_loop; // Hop out to the slave and back
+                }
+            }
+            slave_chain[(*slave_len)++] = pedal - LINK_UNIT_PEDALS;
+            seen_slave = true;
+        }
+        else
+        {
+            in_slave_run = false;
+            if (!tie_loop && seen_slave)
+            {
+                return false; // Series wiring: the slave can only follow the master
+            }
+            if (pedal == tie_loop)
+            {
+                return false; // The tie loop has no pedal of its own
+            }
+            master_chain[(*master_len)++] = pedal;
+        }
+    }
+    return runs <= 1;
+}
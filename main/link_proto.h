@@ -0,0 +1,145 @@
+/**
+ * @file link_proto.h
+ * @brief Wire protocol and route splitting for linked patch bay units
+ *
+ * Two patch bays can be linked over a UART so that they act as one 16-loop
+ * patch bay. Pedals 1-8 are on the master, pedals 9-16 on the slave. The
+ * master splits the combined chain into one chain per unit and sends the
+ * slave its part; both units then latch on the same sync edge.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host.
+ *
+ * Packet layout:
+ * @code
+ * 0x7E | type | seq | len | payload[len] | crc16 (LE)
+ * @endcode
+ * The CRC is CRC-16/CCITT-FALSE over type, seq, len and payload.
+ */
+
+#ifndef LINK_PROTO_H
+#define LINK_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LINK_SOF 0x7E             /**< Start of packet */
+#define LINK_PAYLOAD_MAX 32       /**< Largest payload */
+#define LINK_PACKET_MAX (LINK_PAYLOAD_MAX + 6) /**< Largest encoded packet */
+#define LINK_UNIT_PEDALS 8        /**< Pedal numbers per unit (slave pedals start at 9) */
+
+/**
+ * @brief Packet types
+ */
+typedef enum
+{
+    LINK_MSG_HELLO = 1, /**< Slave -> master: present, payload = number of pedals fitted */
+    LINK_MSG_ROUTE,     /**< Master -> slave: chain for the slave, payload = local pedal numbers */
+    LINK_MSG_STAGED,    /**< Slave -> master: route shifted in and waiting for sync, seq echoed */
+    LINK_MSG_BUTTON,    /**< Slave -> master: button event, payload = {button, event} */
+} link_msg_type_t;
+
+/**
+ * @brief Button ids carried in LINK_MSG_BUTTON
+ */
+typedef enum
+{
+    LINK_BUTTON_PROGRAM = 0x80, /**< Program button */
+    LINK_BUTTON_PRESET = 0x81,  /**< Preset button */
+    /* 0-7: pedal buttons of the sending unit */
+} link_button_t;
+
+/**
+ * @brief Button events carried in LINK_MSG_BUTTON
+ */
+typedef enum
+{
+    LINK_EVENT_SHORT = 0, /**< Short press (on release) */
+    LINK_EVENT_LONG,      /**< Long press detected */
+} link_event_t;
+
+/**
+ * @brief Decoded packet
+ */
+typedef struct
+{
+    uint8_t type;                      /**< link_msg_type_t */
+    uint8_t seq;                       /**< Sequence number */
+    uint8_t len;                       /**< Payload length */
+    uint8_t payload[LINK_PAYLOAD_MAX]; /**< Payload */
+} link_packet_t;
+
+/**
+ * @brief Incremental packet decoder state
+ */
+typedef struct
+{
+    uint8_t state;      /**< Parser state */
+    uint8_t pos;        /**< Bytes of the current field received */
+    uint16_t crc;       /**< Received CRC */
+    link_packet_t pkt;  /**< Packet being assembled */
+    uint32_t crc_errors; /**< Packets dropped because of a CRC mismatch */
+} link_decoder_t;
+
+/**
+ * @brief CRC-16/CCITT-FALSE
+ *
+ * @param crc Running CRC, 0xFFFF to start
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @return Updated CRC
+ */
+uint16_t link_crc16(uint16_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Encode a packet
+ *
+ * @param type Packet type
+ * @param seq Sequence number
+ * @param payload Payload bytes (may be NULL if @p len is 0)
+ * @param len Payload length (at most LINK_PAYLOAD_MAX)
+ * @param[out] out Buffer of at least LINK_PACKET_MAX bytes
+ * @return Encoded length, or 0 if the payload is too long
+ */
+size_t link_encode(uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t len, uint8_t *out);
+
+/**
+ * @brief Reset a decoder
+ *
+ * @param dec Decoder to reset
+ */
+void link_decoder_reset(link_decoder_t *dec);
+
+/**
+ * @brief Feed one received byte into the decoder
+ *
+ * @param dec Decoder
+ * @param byte Received byte
+ * @return Pointer to the complete packet when @p byte finished a valid packet,
+ *         NULL otherwise. The packet stays valid until the next call.
+ */
+const link_packet_t *link_decoder_feed(link_decoder_t *dec, uint8_t byte);
+
+/**
+ * @brief Split a combined chain into the chains of the two units
+ *
+ * Pedals 1-8 belong to the master and 9-16 to the slave (sent to the slave
+ * as 1-8). The units are wired in series, master output into slave input,
+ * unless a tie loop is used: then the slave sits inside master loop
+ * @p tie_loop (master send -> slave input, slave output -> master return)
+ * and the slave pedals may appear anywhere in the chain as one contiguous run.
+ *
+ * @param chain Combined chain (pedal numbers 1-16)
+ * @param len Combined chain length
+ * @param tie_loop Master loop used as tie line (1-8), or 0 for series wiring
+ * @param[out] master_chain Master chain, at least len + 1 entries
+ * @param[out] master_len Master chain length
+ * @param[out] slave_chain Slave chain (local pedal numbers), at least len entries
+ * @param[out] slave_len Slave chain length
+ * @return true if the chain can be routed with the available hops
+ */
+bool link_split_route(const uint8_t *chain, uint8_t len, uint8_t tie_loop,
+                      uint8_t *master_chain, uint8_t *master_len,
+                      uint8_t *slave_chain, uint8_t *slave_len);
+
+#endif /* LINK_PROTO_H */
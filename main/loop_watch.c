@@ -0,0 +1,74 @@
+/**
+ * @file loop_watch.c
+ * @brief Implementation of the dead loop detector
+ */
+
+#include <string.h>
+#include "loop_watch.h"
+
+/**
+ * @brief Initialize a detector
+ *
+ * @param watch Detector
+ * @param cfg Settings
+ * @param now_ms Current time
+ */
+void loop_watch_init(loop_watch_t *watch, const loop_watch_config_t *cfg, uint32_t now_ms)
+{
+    memset(watch, 0, sizeof(*watch));
+    watch->cfg = *cfg;
+    watch->last_ms = now_ms;
+}
+
+/**
+ * @brief Add one scan of levels
+ *
+ * @param watch Detector
+ * @param send_source Source feeding each loop's send, LOOP_WATCH_NO_SEND if none
+ * @param level_db RMS level of each source, dBFS; source N+1 is the return of loop N
+ * @param now_ms Time of the scan
+ * @return Loops found dead in this scan, bit N = loop N
+ */
+uint16_t loop_watch_update(loop_watch_t *watch, const uint8_t *send_source, const int8_t *level_db, uint32_t now_ms)
+{
+    uint32_t step = now_ms - watch->last_ms;
+    if (step > LOOP_WATCH_MAX_STEP_MS)
+    {
+        step = LOOP_WATCH_MAX_STEP_MS; // The scans stopped for a while, do not count the gap
+    }
+    watch->last_ms = now_ms;
+
+    uint16_t found = 0;
+    for (int loop = 0; loop < LOOP_WATCH_LOOPS; loop++)
+    {
+        uint16_t bit = 1 << loop;
+        uint8_t source = send_source[loop];
+        if (source == LOOP_WATCH_NO_SEND)
+        {
+            watch->silent_ms[loop] = 0; // Not in the route, or taken out of it
+            watch->reported &= ~bit;
+            continue;
+        }
+
+        int send = level_db[source];
+        int ret = level_db[loop + 1];
+        if (send == LOOP_WATCH_NO_LEVEL || ret == LOOP_WATCH_NO_LEVEL || send < watch->cfg.active_db)
+        {
+            continue; // Nothing to compare
+        }
+        if (ret > send - watch->cfg.drop_db)
+        {
+            watch->silent_ms[loop] = 0;
+            watch->reported &= ~bit;
+            continue;
+        }
+
+        watch->silent_ms[loop] += step;
+        if (watch->silent_ms[loop] >= watch->cfg.window_ms && !(watch->reported & bit))
+        {
+            watch->reported |= bit;
+            found |= bit;
+        }
+    }
+    return found;
+}
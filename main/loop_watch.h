@@ -0,0 +1,70 @@
+/**
+ * @file loop_watch.h
+ * @brief Dead pedal loop detection from send and return levels
+ *
+ * A loop is dead when its send is playing but its return stays silent: a
+ * flat battery, a pedal switched off or a broken patch cable. After every
+ * scan of the level meters (meter.h) the detector compares the level on
+ * each loop's send, which is the level of the source feeding it, with the
+ * level of its return. Time in which the send plays and the return is at
+ * least drop_db below it adds up; a healthy reading starts over, and time
+ * in which the send does not play is not counted either way, so pauses
+ * between notes neither trigger nor clear a detection. A loop whose silent
+ * time reaches window_ms is reported once.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host, see
+ * tools/loop_watch_sim.c.
+ */
+
+#ifndef LOOP_WATCH_H
+#define LOOP_WATCH_H
+
+#include <stdint.h>
+
+#define LOOP_WATCH_LOOPS 8            /**< Loops watched, one per local pedal */
+#define LOOP_WATCH_NO_SEND 0xFF       /**< Send source of a loop that is not fed */
+#define LOOP_WATCH_NO_LEVEL INT8_MIN  /**< Level of a source that was not measured */
+#define LOOP_WATCH_MAX_STEP_MS 1000   /**< Longest gap between updates counted as silent time */
+
+/**
+ * @brief Detector settings
+ */
+typedef struct
+{
+    int8_t active_db;   /**< Send level at or above which the send counts as playing, dBFS */
+    int8_t drop_db;     /**< Return this far below its send counts as silent, dB */
+    uint32_t window_ms; /**< Silent time while playing before a loop is reported */
+} loop_watch_config_t;
+
+/**
+ * @brief Detector state
+ */
+typedef struct
+{
+    loop_watch_config_t cfg;              /**< Settings */
+    uint32_t last_ms;                     /**< Time of the last update */
+    uint32_t silent_ms[LOOP_WATCH_LOOPS]; /**< Silent time while playing, per loop */
+    uint16_t reported;                    /**< Loops reported and still fed */
+} loop_watch_t;
+
+/**
+ * @brief Initialize a detector
+ *
+ * @param watch Detector
+ * @param cfg Settings
+ * @param now_ms Current time
+ */
+void loop_watch_init(loop_watch_t *watch, const loop_watch_config_t *cfg, uint32_t now_ms);
+
+/**
+ * @brief Add one scan of levels
+ *
+ * @param watch Detector
+ * @param send_source Source feeding each loop's send, LOOP_WATCH_NO_SEND if none
+ * @param level_db RMS level of each source, dBFS; source N+1 is the return of loop N
+ * @param now_ms Time of the scan
+ * @return Loops found dead in this scan, bit N = loop N
+ */
+uint16_t loop_watch_update(loop_watch_t *watch, const uint8_t *send_source, const int8_t *level_db, uint32_t now_ms);
+
+#endif /* LOOP_WATCH_H */
@@ -19,12 +19,10 @@
 #include <esp_lcd_panel_ops.h>
 #include <esp_log.h>
 #include <stdlib.h>
-#include <esp_task_wdt.h> // For watchdog functions
 
+#include "esp_lcd_panel_vendor.h"
 #if CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
 #include "esp_lcd_sh1107.h"
-#else
-#include "esp_lcd_panel_vendor.h"
 #endif
 
 #include "sdkconfig.h"
@@ -33,6 +31,27 @@
 #include "matrix.h"
 #include "buttons.h"
 #include "led.h"
+#include "hw_profile.h"
+#include "link.h"
+#include "tap_tempo.h"
+#include "panic_bypass.h"
+#include "zc_sync.h"
+#include "tuner.h"
+#include "meter.h"
+#include "input_adc.h"
+#include "i2c_sched.h"
+#include "expander.h"
+#include "sr_input.h"
+#include "power.h"
+#include "deadline.h"
+#include "health.h"
+#include "control.h"
+#include "telemetry.h"
+#include "host_link.h"
+#include "snapshot.h"
+#include "preset_predict.h"
+#include "show.h"
+#include "usb_midi.h"
 
 //set pwm_duty_cycle to 100% by default
 extern uint8_t pwm_duty_cycle = 100; // 0-100%, default full brightness
@@ -44,20 +63,7 @@ static const char *TAG = "PatchBayMain";
 // LCD configuration - updated to match working example
 #define EXAMPLE_LCD_PIXEL_CLOCK_HZ (400 * 1000)
 #define EXAMPLE_PIN_NUM_RST -1
-#define EXAMPLE_I2C_HW_ADDR 0x3D // Default OLED I2C address, most displays use 0x3C or 0x3D
-
-// The pixel number in horizontal and vertical
-#if CONFIG_EXAMPLE_LCD_CONTROLLER_SSD1306
-#define EXAMPLE_LCD_H_RES 128
-#define EXAMPLE_LCD_V_RES CONFIG_EXAMPLE_SSD1306_HEIGHT
-#elif CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
-#define EXAMPLE_LCD_H_RES 64
-#define EXAMPLE_LCD_V_RES 128
-#else
-// Default to SSD1306 128x64
-#define EXAMPLE_LCD_H_RES 128
-#define EXAMPLE_LCD_V_RES 64
-#endif
+// The OLED I2C address and the resolution come from the hardware profile
 
 // Bit number used to represent command and parameter
 #define EXAMPLE_LCD_CMD_BITS 8
@@ -86,8 +92,8 @@ void i2c_init(void)
         .clk_source = I2C_CLK_SRC_DEFAULT,
         .glitch_ignore_cnt = 7,
         .i2c_port = I2C_BUS_PORT,
-        .sda_io_num = CONFIG_I2C_SDA_PIN,
-        .scl_io_num = CONFIG_I2C_SCL_PIN,
+        .sda_io_num = hw_tables.pin_i2c_sda,
+        .scl_io_num = hw_tables.pin_i2c_scl,
         .flags.enable_internal_pullup = true,
     };
     ESP_ERROR_CHECK(i2c_new_master_bus(&bus_config, &i2c_bus));
@@ -116,28 +122,58 @@ void nvs_app_init(void)
 
 /**
  * @brief Initialize display and LVGL - adapted from working example
+ *
+ * The controller and resolution are taken from the hardware profile. Boards
+ * without a display, or with a controller whose driver is not built in, run
+ * with the fallback (headless) GUI.
  */
 static void init_display_and_lvgl(void)
 {
+    uint32_t h_res = 128;
+    uint32_t v_res = 64;
+    bool sh1107 = false;
+    switch (hw_tables.display_type)
+    {
+    case HW_DISPLAY_SSD1306_128X64:
+        break;
+    case HW_DISPLAY_SSD1306_128X32:
+        v_res = 32;
+        break;
+    case HW_DISPLAY_SH1107_64X128:
+#if CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
+        h_res = 64;
+        v_res = 128;
+        sh1107 = true;
+        break;
+#else
+        ESP_LOGE(TAG, "Profile asks for SH1107 but its driver is not built in");
+        gui_init_fallback();
+        return;
+#endif
+    case HW_DISPLAY_NONE:
+    default:
+        ESP_LOGI(TAG, "No display on this board");
+        gui_init_fallback();
+        return;
+    }
+
     ESP_LOGI(TAG, "Install panel IO");
     esp_lcd_panel_io_handle_t io_handle = NULL;
     esp_lcd_panel_io_i2c_config_t io_config = {
-        .dev_addr = EXAMPLE_I2C_HW_ADDR, // Use the defined OLED I2C address
+        .dev_addr = hw_tables.display_i2c_addr, // OLED I2C address from the hardware profile
         .scl_speed_hz = EXAMPLE_LCD_PIXEL_CLOCK_HZ,
         .control_phase_bytes = 1,               // According to SSD1306 datasheet
         .lcd_cmd_bits = EXAMPLE_LCD_CMD_BITS,   // According to SSD1306 datasheet
         .lcd_param_bits = EXAMPLE_LCD_CMD_BITS, // According to SSD1306 datasheet
-#if CONFIG_EXAMPLE_LCD_CONTROLLER_SSD1306
-        .dc_bit_offset = 6, // According to SSD1306 datasheet
-#elif CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
-        .dc_bit_offset = 0, // According to SH1107 datasheet
-        .flags =
-            {
-                .disable_control_phase = 1,
-            }
-#endif
+        .dc_bit_offset = 6,                     // According to SSD1306 datasheet
     };
+    if (sh1107)
+    {
+        io_config.dc_bit_offset = 0; // According to SH1107 datasheet
+        io_config.flags.disable_control_phase = 1;
+    }
     ESP_ERROR_CHECK(esp_lcd_new_panel_io_i2c(i2c_bus, &io_config, &io_handle));
+    io_handle = i2c_sched_wrap_panel_io(io_handle); // Flushes step back for footswitch reads
 
     ESP_LOGI(TAG, "Install LCD panel driver");
     esp_lcd_panel_handle_t panel_handle = NULL;
@@ -145,31 +181,29 @@ static void init_display_and_lvgl(void)
         .bits_per_pixel = 1,
         .reset_gpio_num = EXAMPLE_PIN_NUM_RST,
     };
-#if CONFIG_EXAMPLE_LCD_CONTROLLER_SSD1306
-    esp_lcd_panel_ssd1306_config_t ssd1306_config = {
-        .height = EXAMPLE_LCD_V_RES,
-    };
-    panel_config.vendor_config = &ssd1306_config;
-    ESP_ERROR_CHECK(esp_lcd_new_panel_ssd1306(io_handle, &panel_config, &panel_handle));
-#elif CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
-    ESP_ERROR_CHECK(esp_lcd_new_panel_sh1107(io_handle, &panel_config, &panel_handle));
-#else
-    // Default to SSD1306 if no specific display is configured
-    ESP_LOGI(TAG, "No specific display configured, defaulting to SSD1306");
-    esp_lcd_panel_ssd1306_config_t ssd1306_config = {
-        .height = EXAMPLE_LCD_V_RES,
-    };
-    panel_config.vendor_config = &ssd1306_config;
-    ESP_ERROR_CHECK(esp_lcd_new_panel_ssd1306(io_handle, &panel_config, &panel_handle));
+#if CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
+    if (sh1107)
+    {
+        ESP_ERROR_CHECK(esp_lcd_new_panel_sh1107(io_handle, &panel_config, &panel_handle));
+    }
+    else
 #endif
+    {
+        esp_lcd_panel_ssd1306_config_t ssd1306_config = {
+            .height = v_res,
+        };
+        panel_config.vendor_config = &ssd1306_config;
+        ESP_ERROR_CHECK(esp_lcd_new_panel_ssd1306(io_handle, &panel_config, &panel_handle));
+    }
 
     ESP_ERROR_CHECK(esp_lcd_panel_reset(panel_handle));
     ESP_ERROR_CHECK(esp_lcd_panel_init(panel_handle));
     ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel_handle, true));
 
-#if CONFIG_EXAMPLE_LCD_CONTROLLER_SH1107
-    ESP_ERROR_CHECK(esp_lcd_panel_invert_color(panel_handle, true));
-#endif
+    if (sh1107)
+    {
+        ESP_ERROR_CHECK(esp_lcd_panel_invert_color(panel_handle, true));
+    }
 
     ESP_LOGI(TAG, "Initialize LVGL");
     const lvgl_port_cfg_t lvgl_cfg = ESP_LVGL_PORT_INIT_CONFIG();
@@ -178,10 +212,10 @@ static void init_display_and_lvgl(void)
     const lvgl_port_display_cfg_t disp_cfg = {
         .io_handle = io_handle,
         .panel_handle = panel_handle,
-        .buffer_size = EXAMPLE_LCD_H_RES * EXAMPLE_LCD_V_RES,
+        .buffer_size = h_res * v_res,
         .double_buffer = true,
-        .hres = EXAMPLE_LCD_H_RES,
-        .vres = EXAMPLE_LCD_V_RES,
+        .hres = h_res,
+        .vres = v_res,
         .monochrome = true,
         .rotation = {
             .swap_xy = false,
@@ -210,36 +244,84 @@ static void init_display_and_lvgl(void)
  *
  * Initializes all subsystems in the correct order:
  * 1. NVS for settings/configuration storage
- * 2. I2C bus for display
- * 3. Matrix shift registers for audio routing
- * 4. LVGL and display driver
- * 5. GUI elements
- * 6. Button interface
+ * 2. Hardware profile (pins, shift register wiring, display type)
+ * 3. Matrix shift registers for audio routing, then LEDs on the same bus
+ *    and the link to a second unit if enabled
+ * 4. I2C bus for the display and the footswitch expanders
+ * 5. LVGL and display driver
+ * 6. GUI elements
+ * 7. Footswitch expanders and the button interface
  *
  * Finally, it starts the button task which handles user input and system state.
  */
 void app_main(void)
 {
     ESP_LOGI(TAG, "Starting Patch Bay Application");
-    led_init(); // Initialize LEDs
     ESP_LOGI(TAG, "Running GPIO protection checks.");
     run_gpio_protection_checks(true);
 
-    // Initialize NVS first - crucial for loading settings
+    // Initialize NVS first - crucial for loading settings and the hardware profile
     nvs_app_init();
+    snapshot_init();   // A restore cut short by a reset is finished before anything is loaded
+    hw_profile_init(); // Board pins and wiring, used by every driver below
+    power_init();      // PM locks exist before any driver takes them
+    health_init();     // Supervisor runs before the watched tasks register
+    deadline_init();
+#ifdef CONFIG_TELEMETRY_ENABLE
+    telemetry_init();
+    host_link_init(); // Snapshot export and restore on the same UART
+#endif
 
-    // Initialize hardware (I2C needed for display, Matrix for audio path)
-    i2c_init();
-    matrix_init(); // Initializes GPIOs for matrix shift registers
+    // Initialize hardware (Matrix for audio path, I2C needed for display)
+    matrix_init(); // Initializes the shift register bus and latches bypass
+    led_init();    // LEDs share the shift register bus
+#ifdef CONFIG_LINK_ENABLE
+    link_init(); // Sync line joins the latch, so after matrix_init()
+#endif
+    tap_tempo_init();
+    panic_bypass_init(); // Bypass frame compiled before the meters move the meter tap
+    sr_input_init();     // Footswitch chain read on the shift register clock
+#ifdef CONFIG_ZC_SYNC_ENABLE
+    zc_sync_init(); // Route changes from here on wait for a zero crossing
+#endif
+#ifdef CONFIG_TUNER_ENABLE
+    tuner_init(); // Shares the input samples with zero-crossing switching
+#endif
+#ifdef CONFIG_METER_ENABLE
+    meter_init();
+#endif
+#ifdef CONFIG_INPUT_ADC
+    input_adc_start(); // After every input listener is registered
+#endif
+    if (hw_tables.display_type != HW_DISPLAY_NONE || hw_tables.exp_count)
+    {
+        i2c_init();
+        i2c_sched_init(i2c_bus); // Display and footswitch expanders share the bus
+    }
 
     // Initialize display and LVGL - using the working example method
     init_display_and_lvgl();
 
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+    preset_predict_init(); // Table loaded before the buttons compile the first candidates
+#endif
+#ifdef CONFIG_SHOW_ENABLE
+    show_init(); // Show image checked before the buttons start it
+#endif
+
     // Initialize buttons (this will load NVS and update GUI/Matrix initially)
     buttons_init();
 
     ESP_LOGI(TAG, "Creating buttons_task.");
-    xTaskCreate(buttons_task, "buttons_task", 4096 * 2, NULL, 5, NULL); // Increased stack for safety
+    TaskHandle_t buttons_handle;
+    xTaskCreate(buttons_task, "buttons_task", 4096 * 2, NULL, 5, &buttons_handle); // Increased stack for safety
+    expander_init(i2c_bus, buttons_handle); // Presses wake the buttons task
+#ifdef CONFIG_USB_MIDI_ENABLE
+    usb_midi_init(buttons_handle); // Commands wake the buttons task
+#endif
+#ifdef CONFIG_CONTROL_ENABLE
+    control_start(); // Runs the stages buttons_init() added
+#endif
 
     ESP_LOGI(TAG, "Initialization Complete. Patch Bay Running.");
 }
\ No newline at end of file
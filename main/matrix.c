@@ -7,50 +7,420 @@
  * configuration based on the current effects chain.
  */
 
-#include <driver/gpio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_rom_sys.h>
 #include "sdkconfig.h"
 #include "matrix.h"
 #include "buttons.h" // buttons_get_patch will be replaced by direct use of live_patch_data
+#include "hw_profile.h"
+#include "sr_bus.h"
+#include "link.h"
+#include "link_proto.h"
+#include "patch_settings.h"
+#include "zc_sync.h"
+#include "power.h"
+#include "deadline.h"
+#include "route_encoder.h"
+
+#if defined(CONFIG_LINK_ROLE_MASTER) || defined(CONFIG_ROUTE_ENCODER_GENERATED)
+/** @brief Tag for logging */
+static const char *TAG = "Matrix";
+#endif
+
+/** @brief Patch latched on the outputs, with its scenes */
+static matrix_prepared_t live;
+/** @brief Patch being compiled by matrix_update(), under the bus lock */
+static matrix_prepared_t next;
+
+/** @brief Amp outputs held in inhibit (tuner) */
+static bool muted;
+/** @brief Source on the meter tap, MATRIX_METER_OFF if it is inhibited */
+static uint8_t meter_tap = MATRIX_METER_OFF;
+/** @brief Loops left out of the current chain, bit N = pedal N+1 */
+static uint16_t failover;
+/** @brief Chain the failover mask applies to */
+static uint8_t failover_chain[CHAIN_LEN_MAX];
+/** @brief Length of failover_chain */
+static uint8_t failover_len;
+#ifdef CONFIG_ROUTE_ENCODER_GENERATED
+/** @brief The generated encoder fits the profile running */
+static bool generated_encoder;
+#endif
+
+/**
+ * @brief Select a source for a sink and take the sink out of inhibit
+ *
+ * @param frame Frame to write
+ * @param sink Sink index
+ * @param source Source index
+ */
+static inline void _route(sr_frame_t *frame, uint8_t sink, uint8_t source)
+{
+    frame->b[hw_tables.sink_sel_byte[sink]] |= source << hw_tables.sink_sel_shift[sink];
+    frame->b[hw_tables.sink_inh_byte[sink]] &= ~hw_tables.sink_inh_mask[sink];
+}
+
+/**
+ * @brief Write the meter tap source into a frame
+ *
+ * @param[in,out] frame Frame to write
+ */
+static void _put_meter_tap(sr_frame_t *frame)
+{
+    frame->b[hw_tables.meter_sel_byte] &= ~(0x0F << hw_tables.meter_sel_shift);
+    if (meter_tap == MATRIX_METER_OFF)
+    {
+        frame->b[hw_tables.meter_inh_byte] |= hw_tables.meter_inh_mask;
+    }
+    else
+    {
+        frame->b[hw_tables.meter_sel_byte] |= meter_tap << hw_tables.meter_sel_shift;
+        frame->b[hw_tables.meter_inh_byte] &= ~hw_tables.meter_inh_mask;
+    }
+}
+
+/**
+ * @brief Shift a routing frame in and latch it
+ *
+ * With zero-crossing switching the latch waits for the next zero crossing of
+ * the input; the frame is already in the registers by then.
+ *
+ * @param frame Frame to output
+ * @param at_zero_crossing false to latch at once, for frames that change no
+ *                         audio route
+ * @return true if the frame was preshifted and needed no clocks
+ */
+static bool _commit(const sr_frame_t *frame, bool at_zero_crossing)
+{
+    bool preshifted = sr_bus_stage(frame);
+    power_route_ready(); // The zero-crossing wait is by design and not counted
+    deadline_trace(DEADLINE_EV_STAGED, preshifted);
+#ifdef CONFIG_ZC_SYNC_ENABLE
+    if (at_zero_crossing)
+    {
+        zc_sync_latch();
+    }
+    else
+    {
+        sr_bus_latch();
+    }
+#else
+    (void)at_zero_crossing;
+    sr_bus_latch();
+#endif
+    deadline_latched(preshifted); // The deadline runs to the latch, zero-crossing wait included
+    return preshifted;
+}
+
+/**
+ * @brief Initialize the matrix hardware
+ *
+ * Sets up the shift register bus, latches the bypass route and then enables
+ * the register outputs, so the muxes never see an undefined select state.
+ */
+void matrix_init(void)
+{
+    sr_bus_init();
+#ifdef CONFIG_ROUTE_ENCODER_GENERATED
+    generated_encoder = route_encoder_profile_crc == hw_tables.profile_crc;
+    if (generated_encoder)
+    {
+        ESP_LOGI(TAG, "Routing with the encoder generated for board '%s'", route_encoder_board);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Encoder generated for board '%s' does not fit this profile, routing from the tables",
+                 route_encoder_board);
+    }
+#endif
+
+    sr_frame_t frame = *sr_bus_current();
+    matrix_compile(NULL, 0, MATRIX_OUTPUTS_DEFAULT, &frame);
+    sr_bus_commit(&frame);
+    sr_bus_output_enable(true);
+}
+
+/**
+ * @brief Compile a pedal chain into the routing part of a frame
+ *
+ * Route: Guitar -> chain[0] -> chain[1] -> ... -> Amp. Each pedal send is fed
+ * from the previous return (or the guitar input for the first pedal), and the
+ * amp outputs in @p outputs are fed from the last return. An empty chain
+ * feeds them straight from the guitar input. The tuner output, if in
+ * @p outputs, is fed from the guitar input. The meter tap keeps the source
+ * set by matrix_set_meter_tap(), so route changes never move it. With the
+ * encoder generated for this board (route_encoder.h) no table is read.
+ *
+ * @param chain Pedal numbers (1-based) in signal order
+ * @param len Number of pedals in the chain, 0 for bypass
+ * @param outputs Outputs to feed, MATRIX_OUTPUT_BIT() mask
+ * @param[in,out] frame Frame to write
+ */
+void matrix_compile(const uint8_t *chain, uint8_t len, uint8_t outputs, sr_frame_t *frame)
+{
+#ifdef CONFIG_ROUTE_ENCODER_GENERATED
+    if (generated_encoder)
+    {
+        route_encoder_compile(chain, len, outputs, meter_tap, frame->b);
+        return;
+    }
+#endif
+    memset(&frame->b[SR_FRAME_INDEX(SR_CHAIN_MATRIX, 0)], 0, SR_CHAIN_BYTES_MAX);
+    memset(&frame->b[SR_FRAME_INDEX(SR_CHAIN_INHIBIT, 0)], 0, SR_CHAIN_BYTES_MAX);
+    for (int s = 0; s < MATRIX_NUM_SINKS; s++)
+    {
+        frame->b[hw_tables.sink_inh_byte[s]] |= hw_tables.sink_inh_mask[s];
+    }
+
+    uint8_t source = MATRIX_SOURCE_GUITAR;
+    for (int i = 0; i < len; i++)
+    {
+        uint8_t pedal_index = chain[i] - 1;
+        if (pedal_index >= hw_tables.num_pedals)
+        {
+            continue; // Not fitted on this board
+        }
+        _route(frame, MATRIX_SINK_SEND(pedal_index), source);
+        source = MATRIX_SOURCE_RETURN(pedal_index);
+    }
+    if (outputs & MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_AMP_A))
+    {
+        _route(frame, MATRIX_SINK_OUTPUT(MATRIX_OUTPUT_AMP_A), source);
+    }
+    if (outputs & MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_AMP_B))
+    {
+        _route(frame, MATRIX_SINK_OUTPUT(MATRIX_OUTPUT_AMP_B), source); // In parallel with amp A if both are fed
+    }
+    if (outputs & MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_TUNER))
+    {
+        _route(frame, MATRIX_SINK_OUTPUT(MATRIX_OUTPUT_TUNER), MATRIX_SOURCE_GUITAR);
+    }
+
+    if (meter_tap == MATRIX_METER_OFF)
+    {
+        frame->b[hw_tables.meter_inh_byte] |= hw_tables.meter_inh_mask;
+    }
+    else
+    {
+        frame->b[hw_tables.meter_sel_byte] |= meter_tap << hw_tables.meter_sel_shift;
+    }
+}
 
 /**
- * @brief Shifts data out to the shift registers
+ * @brief Compile the control output states into a frame
  *
- * @param data Pointer to the data bytes to shift out
- * @param len Number of bytes to shift out
+ * @param ctl_mask Bit N set turns control output N on
+ * @param[in,out] frame Frame to write
  */
-static void shift_out(uint8_t *data, size_t len)
+void matrix_compile_controls(uint8_t ctl_mask, sr_frame_t *frame)
 {
-    gpio_set_level(CONFIG_SR_LATCH_PIN, 0);
+    for (int i = 0; i < MATRIX_NUM_CONTROLS; i++)
+    {
+        if (ctl_mask & (1 << i))
+        {
+            frame->b[hw_tables.ctl_byte[i]] |= hw_tables.ctl_mask[i];
+        }
+        else
+        {
+            frame->b[hw_tables.ctl_byte[i]] &= ~hw_tables.ctl_mask[i];
+        }
+    }
+}
+
+/**
+ * @brief Compile the part of a chain this unit routes
+ *
+ * On a linked master the chain is split between the two units first and the
+ * slave part is returned; otherwise the whole chain is local. The outputs
+ * are always on this unit.
+ *
+ * @param chain Pedal numbers (1-based) in signal order
+ * @param len Number of pedals in the chain
+ * @param outputs Outputs to feed
+ * @param[in,out] frame Frame to write
+ * @param[out] remote_chain Slave chain, CHAIN_LEN_MAX entries
+ * @param[out] remote_len Slave chain length
+ */
+static void _compile_local(const uint8_t *chain, uint8_t len, uint8_t outputs, sr_frame_t *frame,
+                           uint8_t *remote_chain, uint8_t *remote_len)
+{
+#ifdef CONFIG_LINK_ROLE_MASTER
+    uint8_t local_chain[CHAIN_LEN_MAX + 1]; // Room for the tie loop
+    uint8_t local_len;
+
+    if (!link_split_route(chain, len, CONFIG_LINK_TIE_LOOP,
+                          local_chain, &local_len, remote_chain, remote_len))
+    {
+        // Not routable with the wiring between the units: play the local pedals only
+        ESP_LOGW(TAG, "Chain needs more hops between units than wired, slave bypassed");
+        local_len = 0;
+        for (int i = 0; i < len; i++)
+        {
+            if (chain[i] <= LINK_UNIT_PEDALS && chain[i] != CONFIG_LINK_TIE_LOOP)
+            {
+                local_chain[local_len++] = chain[i];
+            }
+        }
+        *remote_len = 0;
+    }
+    matrix_compile(local_chain, local_len, outputs, frame);
+#else
+    matrix_compile(chain, len, outputs, frame);
+    *remote_len = 0;
+#endif
+}
+
+/**
+ * @brief Reduce a chain to the pedals playing in a scene
+ *
+ * @param chain Full chain
+ * @param len Full chain length
+ * @param scene_mask Pedals playing, bit N = pedal N+1
+ * @param[out] out Scene chain, at least @p len entries
+ * @return Scene chain length
+ */
+static uint8_t _scene_chain(const uint8_t *chain, uint8_t len, uint16_t scene_mask, uint8_t *out)
+{
+    uint8_t out_len = 0;
     for (int i = 0; i < len; i++)
     {
-        for (int j = 7; j >= 0; j--)
+        if (scene_mask & (1 << (chain[i] - 1)))
         {
-            gpio_set_level(CONFIG_MATRIX_SR_DATA_PIN, (data[i] >> j) & 1);
-            gpio_set_level(CONFIG_SR_CLOCK_PIN, 1);
-            gpio_set_level(CONFIG_SR_CLOCK_PIN, 0);
+            out[out_len++] = chain[i];
         }
     }
-    gpio_set_level(CONFIG_SR_LATCH_PIN, 1);
+    return out_len;
 }
 
 /**
- * @brief Initialize the matrix hardware
+ * @brief Compile a patch and its scenes
+ *
+ * Each scene is compiled as a routing delta against the full chain, so
+ * matrix_select_scene() never has to compile. On a linked master the chain
+ * is split between the two units first.
  *
- * Sets up the GPIO pins used for controlling the shift registers that
- * implement the audio signal routing matrix.
+ * @param chain Pedal numbers (1-based) in signal order
+ * @param len Number of pedals in the chain
+ * @param scene_masks Pedals playing in each scene, bit N = pedal N+1
+ * @param scene_count Number of scenes, 0 if every pedal in the chain always plays
+ * @param scene Active scene
+ * @param controls Control outputs
+ * @param outputs Outputs fed
+ * @param leave_out Failed-over loops to leave out, bit N = pedal N+1
+ * @param[out] out Compiled patch
  */
-void matrix_init(void)
+static void _prepare(const uint8_t *chain, uint8_t len, const uint16_t *scene_masks, uint8_t scene_count,
+                     uint8_t scene, uint8_t controls, uint8_t outputs, uint16_t leave_out, matrix_prepared_t *out)
+{
+    memcpy(out->chain, chain, len);
+    out->len = len;
+    out->controls = controls;
+    out->outputs = outputs;
+    out->scene_count = scene_count;
+    out->scene = scene;
+
+    uint8_t routed[CHAIN_LEN_MAX];
+    uint8_t routed_len = _scene_chain(chain, len, ~leave_out, routed);
+
+    sr_frame_t full = {0};
+    _compile_local(routed, routed_len, outputs, &full, out->remote_chain, &out->remote_len);
+    memcpy(out->route, full.b, MATRIX_ROUTE_BYTES);
+    for (int s = 0; s < scene_count; s++)
+    {
+        uint8_t scene_chain[CHAIN_LEN_MAX];
+        uint8_t scene_len = _scene_chain(routed, routed_len, scene_masks[s], scene_chain);
+        sr_frame_t scene_frame = full;
+        uint8_t scene_remote[CHAIN_LEN_MAX];
+        uint8_t scene_remote_len;
+        _compile_local(scene_chain, scene_len, outputs, &scene_frame, scene_remote, &scene_remote_len);
+
+        out->remote[s] = 0;
+        for (int i = 0; i < scene_remote_len; i++)
+        {
+            out->remote[s] |= 1 << (scene_remote[i] - 1);
+        }
+        for (int b = 0; b < MATRIX_ROUTE_BYTES; b++)
+        {
+            out->delta[s][b] = scene_frame.b[b] ^ full.b[b];
+        }
+        if (s == scene)
+        {
+            memcpy(out->route, scene_frame.b, MATRIX_ROUTE_BYTES);
+            memcpy(out->remote_chain, scene_remote, scene_remote_len);
+            out->remote_len = scene_remote_len;
+        }
+    }
+}
+
+/**
+ * @brief Build the frame of a compiled patch on top of the latched frame
+ *
+ * The LED chain is kept as it is, and the meter tap, control outputs and amp
+ * mute are filled in from the current state.
+ *
+ * @param prepared Compiled patch
+ * @param[out] frame Frame to latch
+ */
+static void _frame(const matrix_prepared_t *prepared, sr_frame_t *frame)
+{
+    *frame = *sr_bus_current();
+    memcpy(frame->b, prepared->route, MATRIX_ROUTE_BYTES);
+    _put_meter_tap(frame);
+    matrix_compile_controls(prepared->controls, frame); // Same latch as the route
+    if (muted)
+    {
+        // Scene deltas never touch the output inhibit bits, so this holds across scene changes
+        for (int o = 0; o < MATRIX_NUM_OUTPUTS; o++)
+        {
+            if (MATRIX_OUTPUTS_AMPS & MATRIX_OUTPUT_BIT(o))
+            {
+                uint8_t sink = MATRIX_SINK_OUTPUT(o);
+                frame->b[hw_tables.sink_inh_byte[sink]] |= hw_tables.sink_inh_mask[sink];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Latch a compiled patch and make it the live one
+ *
+ * On a linked master the slave part is staged on the slave before the local
+ * frame is shifted in, so the latch edge (and the sync edge sent with it)
+ * switches both units at once. The caller holds the bus.
+ *
+ * @param prepared Compiled patch
+ * @param plan How to latch it, NULL for one latch at a zero crossing
+ * @return true if the frame was preshifted and needed no clocks
+ */
+static bool _apply(const matrix_prepared_t *prepared, const matrix_plan_t *plan)
 {
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << CONFIG_MATRIX_SR_DATA_PIN) |
-        (1ULL << CONFIG_SR_CLOCK_PIN) |
-        (1ULL << CONFIG_SR_LATCH_PIN),
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE, // Good practice to define both
-        .intr_type = GPIO_INTR_DISABLE,
-    };
-    gpio_config(&io_conf);
+    uint8_t flags = plan ? plan->flags : MATRIX_PLAN_ROUTE;
+    sr_frame_t frame;
+    _frame(prepared, &frame);
+    if ((flags & MATRIX_PLAN_CONTROLS_FIRST) && !muted)
+    {
+        sr_frame_t controls = *sr_bus_current();
+        matrix_compile_controls(prepared->controls, &controls);
+        sr_bus_commit(&controls); // Relays start moving while the old route still plays
+        uint16_t settle_us = plan->settle_us;
+        if (settle_us >= 1000 * portTICK_PERIOD_MS)
+        {
+            vTaskDelay(pdMS_TO_TICKS((settle_us + 999) / 1000));
+        }
+        else
+        {
+            esp_rom_delay_us(settle_us);
+        }
+    }
+#ifdef CONFIG_LINK_ROLE_MASTER
+    link_stage_remote(prepared->remote_chain, prepared->remote_len);
+#endif
+    bool preshifted = _commit(&frame, flags & MATRIX_PLAN_ROUTE);
+    live = *prepared;
+    return preshifted;
 }
 
 /**
@@ -59,33 +429,230 @@ void matrix_init(void)
  * Retrieves the current patch configuration from the buttons subsystem and
  * updates the shift registers to route the audio signal accordingly.
  * This function will be called by buttons_task when the live_patch_data changes.
+ * The outputs and control outputs of the patch go into the same frame.
+ *
+ * The scenes of the patch are compiled here as well, see _prepare().
+ *
+ * Failed-over loops are dropped from the chain before anything is compiled;
+ * a chain other than the one they were failed over in clears the mask.
  */
 void matrix_update(void)
 {
-    uint8_t current_chain[NUM_PEDALS_MAX]; // NUM_PEDALS_MAX defined in buttons.h
+    uint8_t current_chain[CHAIN_LEN_MAX]; // CHAIN_LEN_MAX defined in buttons.h
     uint8_t chain_len;
+    uint16_t scene_masks[PATCH_SCENES_MAX];
+    uint8_t scene_count;
+    uint8_t scene;
 
     buttons_get_current_patch_for_matrix(current_chain, &chain_len);
+    buttons_get_current_scenes(scene_masks, &scene_count, &scene);
 
-    uint8_t sr_data[5] = {0}; // Placeholder size, adjust to your hardware
-    if (chain_len == 0)
+    power_lock(POWER_LOCK_ROUTE);
+    sr_bus_lock();
+    if (chain_len != failover_len || memcmp(current_chain, failover_chain, chain_len) != 0)
     {
-        // Bypass: Guitar -> Amp
-        // Example: Set DG408 to route input 0 to output 0
-        sr_data[0] = 0x01; // Placeholder for bypass
-        // Add actual bit manipulation for your shift registers and analog switches
+        failover = 0; // New chain, give every loop another chance
+        memcpy(failover_chain, current_chain, chain_len);
+        failover_len = chain_len;
     }
-    else
+    _prepare(current_chain, chain_len, scene_masks, scene_count, scene, buttons_get_current_controls(),
+             buttons_get_current_outputs(), failover, &next);
+    _apply(&next, NULL);
+    sr_bus_unlock();
+    power_unlock(POWER_LOCK_ROUTE);
+}
+
+/**
+ * @brief Compile a patch for a later matrix_apply()
+ *
+ * Compiled without failover; matrix_apply() refuses it if that matters.
+ *
+ * @param chain Pedal numbers (1-based) in signal order
+ * @param len Number of pedals in the chain
+ * @param settings Scenes, outputs and control outputs of the patch
+ * @param[out] prepared Compiled patch
+ */
+void matrix_prepare(const uint8_t *chain, uint8_t len, const patch_settings_t *settings, matrix_prepared_t *prepared)
+{
+    uint16_t scene_masks[PATCH_SCENES_MAX];
+    memcpy(scene_masks, settings->scene_mask, sizeof(scene_masks)); // The record is packed
+    _prepare(chain, len, scene_masks, settings->scene_count, settings->scene, settings->ctl_mask, settings->outputs, 0,
+             prepared);
+}
+
+/**
+ * @brief Latch a patch compiled by matrix_prepare()
+ *
+ * @param prepared Compiled patch
+ * @param plan How to latch it, NULL for one latch at a zero crossing
+ * @param[out] preshifted true if the frame was in the registers already, may be NULL
+ * @return true if the patch was latched, false if loops of its chain are failed over
+ */
+bool matrix_apply(const matrix_prepared_t *prepared, const matrix_plan_t *plan, bool *preshifted)
+{
+    power_lock(POWER_LOCK_ROUTE);
+    sr_bus_lock();
+    bool same_chain = prepared->len == failover_len && memcmp(prepared->chain, failover_chain, prepared->len) == 0;
+    if (same_chain && failover)
+    {
+        sr_bus_unlock();
+        power_unlock(POWER_LOCK_ROUTE);
+        return false; // Compiled with the loops that are failed over
+    }
+    if (!same_chain)
+    {
+        failover = 0;
+        memcpy(failover_chain, prepared->chain, prepared->len);
+        failover_len = prepared->len;
+    }
+    bool ready = _apply(prepared, plan);
+    sr_bus_unlock();
+    power_unlock(POWER_LOCK_ROUTE);
+    if (preshifted)
+    {
+        *preshifted = ready;
+    }
+    return true;
+}
+
+/**
+ * @brief Shift the frame of a prepared patch into the registers ahead of time
+ *
+ * @param prepared Compiled patch
+ */
+void matrix_preshift(const matrix_prepared_t *prepared)
+{
+    sr_bus_lock();
+    sr_frame_t frame;
+    _frame(prepared, &frame);
+    sr_bus_preload(&frame);
+    sr_bus_unlock();
+}
+
+/**
+ * @brief Switch to another scene of the current patch
+ *
+ * The latched frame is updated with the precompiled scene deltas and shifted
+ * out again; nothing is compiled. Only a scene that changes which slave
+ * pedals play on a linked master falls back to matrix_update(), since the
+ * slave has to be sent its new route.
+ *
+ * @param scene Scene index, already made active in the patch settings
+ * @return true if the scene was switched, false if the patch has no such scene
+ */
+bool matrix_select_scene(uint8_t scene)
+{
+    if (scene >= live.scene_count)
+    {
+        return false;
+    }
+    if (scene == live.scene)
+    {
+        return true;
+    }
+    if (live.remote[scene] != live.remote[live.scene])
+    {
+        matrix_update();
+        return true;
+    }
+
+    power_lock(POWER_LOCK_ROUTE);
+    sr_bus_lock();
+    sr_frame_t frame = *sr_bus_current();
+    const uint8_t *from = live.delta[live.scene];
+    const uint8_t *to = live.delta[scene];
+    for (int b = 0; b < MATRIX_ROUTE_BYTES; b++)
     {
-        // Route: Guitar -> patch[0] -> patch[1] -> ... -> Amp
-        // Placeholder: Set DG408 bits for input i to output patch[i]
-        // This requires detailed knowledge of your analog matrix and shift register setup.
-        // For example, if sr_data[0] controls pedal 1 input, sr_data[1] pedal 1 output to pedal 2 input etc.
-        for (int i = 0; i < chain_len; i++)
+        frame.b[b] ^= from[b] ^ to[b];
+        live.route[b] ^= from[b] ^ to[b];
+    }
+    live.scene = scene;
+    _commit(&frame, true); // A linked slave has nothing staged and ignores the sync edge
+    sr_bus_unlock();
+    power_unlock(POWER_LOCK_ROUTE);
+    return true;
+}
+
+/**
+ * @brief Mute or unmute the amp outputs
+ *
+ * Recompiles the current patch with or without the amp sinks inhibited.
+ *
+ * @param mute true to hold the amp outputs in inhibit
+ */
+void matrix_set_mute(bool mute)
+{
+    if (mute != muted)
+    {
+        muted = mute;
+        matrix_update();
+    }
+}
+
+/**
+ * @brief Select the source on the meter tap
+ *
+ * Only the meter select nibble and inhibit bit of the latched frame change.
+ * The meter tap feeds no output, so the frame is latched right away instead
+ * of at a zero crossing.
+ *
+ * @param source Source index, or MATRIX_METER_OFF
+ */
+void matrix_set_meter_tap(uint8_t source)
+{
+    sr_bus_lock();
+    meter_tap = source;
+    sr_frame_t frame = *sr_bus_current();
+    _put_meter_tap(&frame);
+    sr_bus_commit(&frame);
+    sr_bus_unlock();
+}
+
+/**
+ * @brief Take loops out of the current chain
+ *
+ * @param pedal_mask Loops to leave out, bit N = pedal N+1
+ */
+void matrix_set_failover(uint16_t pedal_mask)
+{
+    if (pedal_mask != failover)
+    {
+        failover = pedal_mask;
+        matrix_update();
+    }
+}
+
+/**
+ * @brief Get the loops taken out of the current chain
+ *
+ * @return Failed-over loops, bit N = pedal N+1
+ */
+uint16_t matrix_get_failover(void)
+{
+    return failover;
+}
+
+/**
+ * @brief Get the source feeding each local pedal send
+ *
+ * @param[out] send_source Source per pedal, MATRIX_NO_SOURCE for an inhibited
+ *                         or missing send, NUM_PEDALS_MAX entries
+ */
+void matrix_get_sends(uint8_t *send_source)
+{
+    sr_bus_lock();
+    const sr_frame_t *frame = sr_bus_current();
+    for (int p = 0; p < NUM_PEDALS_MAX; p++)
+    {
+        uint8_t sink = MATRIX_SINK_SEND(p);
+        if (p >= hw_tables.num_pedals || (frame->b[hw_tables.sink_inh_byte[sink]] & hw_tables.sink_inh_mask[sink]))
         {
-            // Example: sr_data[current_chain[i]-1 / 2] |= (1 << ( (current_chain[i]-1 % 2) * 4 ) ); // Highly schematic
+            send_source[p] = MATRIX_NO_SOURCE;
+        }
+        else
+        {
+            send_source[p] = (frame->b[hw_tables.sink_sel_byte[sink]] >> hw_tables.sink_sel_shift[sink]) & 0x0F;
         }
-        // This section is CRITICAL and needs to be filled based on your hardware.
     }
-    shift_out(sr_data, sizeof(sr_data));
-}
\ No newline at end of file
+    sr_bus_unlock();
+}
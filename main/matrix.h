@@ -1,28 +1,260 @@
 /**
  * @file matrix.h
  * @brief Audio signal routing matrix for the ESP32 Patch Bay
- * 
+ *
  * This file provides the interface for the audio signal routing matrix which controls
  * the actual audio path through the pedal effects chain using shift registers.
+ *
+ * Every sink (a pedal send or an output) is fed by one mux whose select
+ * nibble sits in the matrix chain and whose inhibit bit sits in the inhibit
+ * chain. The select value is the source index: 0 is the guitar input and
+ * 1-8 are the pedal returns.
+ *
+ * A patch feeds any set of the outputs (amp A, amp B, tuner out). The amp
+ * outputs take the end of the chain, so feeding both plays the chain into
+ * two amps in parallel; the tuner output always takes the guitar input. The
+ * output sinks are compiled into the same frame as the route, so switching
+ * amps is one latch edge, like any recall. Outputs the board does not wire
+ * are compiled into the scratch byte and cost nothing.
+ *
+ * Control outputs (amp channel or pedal mode switching through relays or
+ * TRS contacts) are spare bits in the same chains. They are compiled into the
+ * same frame as the route, so both change on one latch edge.
+ *
+ * Scenes keep the chain of a patch and only change which of its pedals play.
+ * They are compiled together with the patch, so a scene change is a few
+ * XORs on the latched frame followed by one shift.
+ *
+ * The meter tap is one more mux, wired to the level meter ADC input instead
+ * of a send. Its select nibble and inhibit bit ride along in the routing
+ * chains but are only changed by matrix_set_meter_tap().
+ *
+ * Loops found dead by the level meters are failed over: they are left out
+ * of every route compiled from the current chain, as if they were bypassed
+ * in all its scenes, until a different chain is routed.
+ *
+ * A patch can also be compiled ahead of time with matrix_prepare() and
+ * switched to later with matrix_apply(), which does no compiling at all.
+ * matrix_preshift() goes one step further and leaves the frame of a prepared
+ * patch in the shift registers, so switching to it is just the latch edge.
  */
 
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "buttons.h"
+#include "sr_bus.h"
+#include "patch_settings.h"
+
+#define MATRIX_SOURCE_GUITAR 0                   /**< Source index of the guitar input */
+#define MATRIX_SOURCE_RETURN(pedal_index) ((pedal_index) + 1) /**< Source index of a pedal return (0-based pedal) */
+#define MATRIX_NUM_SOURCES (NUM_PEDALS_MAX + 1)  /**< Guitar input plus pedal returns */
+
+#define MATRIX_OUTPUT_AMP_A 0  /**< Amp output A, the original amp output */
+#define MATRIX_OUTPUT_AMP_B 1  /**< Amp output B */
+#define MATRIX_OUTPUT_TUNER 2  /**< Tuner output, fed from the guitar input */
+#define MATRIX_NUM_OUTPUTS 3   /**< Outputs, one bit each in an output mask */
+#define MATRIX_OUTPUT_BIT(output) (1 << (output))  /**< Bit of an output in an output mask */
+#define MATRIX_OUTPUTS_AMPS (MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_AMP_A) | MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_AMP_B)) /**< Outputs held by matrix_set_mute() */
+#define MATRIX_OUTPUTS_DEFAULT (MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_AMP_A) | MATRIX_OUTPUT_BIT(MATRIX_OUTPUT_TUNER)) /**< Outputs of a patch without a choice stored */
+
+#define MATRIX_SINK_SEND(pedal_index) (pedal_index)           /**< Sink index of a pedal send (0-based pedal) */
+#define MATRIX_SINK_OUTPUT(output) (NUM_PEDALS_MAX + (output)) /**< Sink index of an output (MATRIX_OUTPUT_*) */
+#define MATRIX_SINK_AMP MATRIX_SINK_OUTPUT(MATRIX_OUTPUT_AMP_A) /**< Sink index of amp output A */
+#define MATRIX_NUM_SINKS (NUM_PEDALS_MAX + MATRIX_NUM_OUTPUTS) /**< Pedal sends plus outputs */
+
+#define MATRIX_NUM_CONTROLS 8 /**< Control outputs, one bit each in a control mask */
+#define MATRIX_METER_OFF 0xFF /**< Meter tap source: meter mux inhibited */
+#define MATRIX_NO_SOURCE 0xFF /**< Source of an inhibited sink */
+
+/** @brief Frame bytes holding the routing chains (matrix and inhibit) */
+#define MATRIX_ROUTE_BYTES SR_FRAME_INDEX(SR_CHAIN_INHIBIT + 1, 0)
+
+/**
+ * @brief A patch compiled for the routing chains
+ *
+ * Holds the route of the active scene, and every scene as the routing bits
+ * in which it differs from the full chain, so switching from scene A to
+ * scene B is frame ^= delta[A] ^ delta[B]. The outputs fed are the same in
+ * every scene. The LED chain, meter tap, amp mute and control outputs are
+ * filled in when the patch is latched, so a prepared patch stays valid while
+ * they change.
+ */
+typedef struct
+{
+    uint8_t chain[CHAIN_LEN_MAX];                        /**< Chain compiled, before any failover */
+    uint8_t len;                                         /**< Length of chain */
+    uint8_t controls;                                    /**< Control outputs, bit N = output N */
+    uint8_t outputs;                                     /**< Outputs fed, MATRIX_OUTPUT_BIT() mask */
+    uint8_t route[MATRIX_ROUTE_BYTES];                   /**< Routing chains of the scene prepared as active */
+    uint8_t scene_count;                                 /**< Scenes prepared, 0 if the patch has none */
+    uint8_t scene;                                       /**< Active scene */
+    uint8_t delta[PATCH_SCENES_MAX][MATRIX_ROUTE_BYTES]; /**< Routing bits that differ from the full chain */
+    uint16_t remote[PATCH_SCENES_MAX];                   /**< Slave pedals playing in each scene (linked master) */
+    uint8_t remote_chain[CHAIN_LEN_MAX];                 /**< Slave chain of the active scene (linked master) */
+    uint8_t remote_len;                                  /**< Length of remote_chain */
+} matrix_prepared_t;
+
+#define MATRIX_PLAN_ROUTE 0x01          /**< The audio route changes: latch at a zero crossing */
+#define MATRIX_PLAN_CONTROLS 0x02       /**< The control outputs change */
+#define MATRIX_PLAN_CONTROLS_FIRST 0x04 /**< Latch the control outputs on their own, settle_us before the route */
+
+/**
+ * @brief How a switch to a prepared patch is latched, worked out ahead of time
+ *
+ * Without MATRIX_PLAN_ROUTE only control outputs change, so nothing is heard
+ * and the frame is latched at once instead of at a zero crossing. Relays on
+ * control outputs (amp channels) switch slower than the muxes; with
+ * MATRIX_PLAN_CONTROLS_FIRST they get settle_us to move before the route
+ * follows. Stored as is in show images (see show.h).
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t flags;      /**< MATRIX_PLAN_* */
+    uint8_t reserved;   /**< Must be zero */
+    uint16_t settle_us; /**< Time between the control latch and the route latch */
+} matrix_plan_t;
+
 /**
  * @brief Initialize the matrix hardware
- * 
- * Sets up the GPIO pins used for controlling the shift registers that
- * implement the audio signal routing matrix.
+ *
+ * Sets up the shift register bus used for controlling the audio signal
+ * routing matrix.
  */
 void matrix_init(void);
 
+/**
+ * @brief Compile a pedal chain into the routing part of a frame
+ *
+ * Overwrites the matrix and inhibit chains of @p frame. The LED chain is left
+ * untouched. Sinks that are not used by the chain, and outputs not in
+ * @p outputs, are inhibited.
+ *
+ * @param chain Pedal numbers (1-based) in signal order
+ * @param len Number of pedals in the chain, 0 for bypass
+ * @param outputs Outputs to feed, MATRIX_OUTPUT_BIT() mask
+ * @param[in,out] frame Frame to write
+ */
+void matrix_compile(const uint8_t *chain, uint8_t len, uint8_t outputs, sr_frame_t *frame);
+
+/**
+ * @brief Compile the control output states into a frame
+ *
+ * Call after matrix_compile(), which clears the routing chains.
+ *
+ * @param ctl_mask Bit N set turns control output N on
+ * @param[in,out] frame Frame to write
+ */
+void matrix_compile_controls(uint8_t ctl_mask, sr_frame_t *frame);
+
 /**
  * @brief Update the routing matrix based on current patch configuration
- * 
+ *
  * Retrieves the current patch configuration from the buttons subsystem and
  * updates the shift registers to route the audio signal accordingly.
  */
 void matrix_update(void);
 
-#endif
\ No newline at end of file
+/**
+ * @brief Compile a patch for a later matrix_apply()
+ *
+ * Nothing is latched and the bus is not taken, so this can run well before
+ * the patch is needed.
+ *
+ * @param chain Pedal numbers (1-based) in signal order
+ * @param len Number of pedals in the chain
+ * @param settings Scenes, outputs and control outputs of the patch
+ * @param[out] prepared Compiled patch
+ */
+void matrix_prepare(const uint8_t *chain, uint8_t len, const patch_settings_t *settings, matrix_prepared_t *prepared);
+
+/**
+ * @brief Latch a patch compiled by matrix_prepare()
+ *
+ * Does the same as matrix_update() after the patch was made current, without
+ * compiling. Refused if loops of the same chain are failed over, since the
+ * prepared route still has them; call matrix_update() then.
+ *
+ * @param prepared Compiled patch
+ * @param plan How to latch it, NULL for one latch at a zero crossing as
+ *             matrix_update() does
+ * @param[out] preshifted true if matrix_preshift() had the frame in the
+ *                        registers already, may be NULL
+ * @return true if the patch was latched
+ */
+bool matrix_apply(const matrix_prepared_t *prepared, const matrix_plan_t *plan, bool *preshifted);
+
+/**
+ * @brief Shift the frame of a prepared patch into the registers ahead of time
+ *
+ * The outputs keep the current route. If the next matrix_apply() is for this
+ * patch and nothing has shifted since, it only needs the latch edge. Does
+ * nothing on boards where sr_bus_preload() cannot hold a frame.
+ *
+ * @param prepared Compiled patch
+ */
+void matrix_preshift(const matrix_prepared_t *prepared);
+
+/**
+ * @brief Switch to another scene of the current patch
+ *
+ * Applies the routing delta prepared by the last matrix_update() to the
+ * latched frame, without compiling the chain again. Call matrix_update()
+ * instead after the chain or the scene masks changed.
+ *
+ * @param scene Scene index, already made active in the patch settings
+ * @return true if the scene was switched, false if the patch has no such scene
+ */
+bool matrix_select_scene(uint8_t scene);
+
+/**
+ * @brief Mute or unmute the amp outputs
+ *
+ * Both amp sinks are held in inhibit on top of whatever route is compiled,
+ * so preset and scene changes while muted stay silent. The tuner output
+ * keeps playing.
+ *
+ * @param mute true to hold the amp outputs in inhibit
+ */
+void matrix_set_mute(bool mute);
+
+/**
+ * @brief Select the source on the meter tap
+ *
+ * Latched right away, not at a zero crossing, since the meter tap feeds no
+ * output. On boards without a meter tap only the scratch byte changes.
+ *
+ * @param source Source index, or MATRIX_METER_OFF to inhibit the meter mux
+ */
+void matrix_set_meter_tap(uint8_t source);
+
+/**
+ * @brief Take loops out of the current chain
+ *
+ * The chain is routed again without the failed-over loops. The mask is
+ * cleared when matrix_update() finds a different chain.
+ *
+ * @param pedal_mask Loops to leave out, bit N = pedal N+1
+ */
+void matrix_set_failover(uint16_t pedal_mask);
+
+/**
+ * @brief Get the loops taken out of the current chain
+ *
+ * @return Failed-over loops, bit N = pedal N+1
+ */
+uint16_t matrix_get_failover(void);
+
+/**
+ * @brief Get the source feeding each local pedal send
+ *
+ * Decoded from the latched frame, so it matches what the muxes route.
+ *
+ * @param[out] send_source Source per pedal, MATRIX_NO_SOURCE for an inhibited
+ *                         or missing send, NUM_PEDALS_MAX entries
+ */
+void matrix_get_sends(uint8_t *send_source);
+
+#endif
@@ -0,0 +1,213 @@
+/**
+ * @file meter.c
+ * @brief Implementation of the level meters
+ *
+ * The input listener adds each frame of the meter input to the accumulator
+ * once the tap has settled, and wakes the meter task when the dwell is full.
+ * The meter task switches the tap, turns the sums into levels and publishes
+ * them; the buttons task polls them for the display. Both sides time their
+ * own work, which is the CPU load logged with the levels.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "meter.h"
+#include "level.h"
+#include "input_adc.h"
+#include "hw_profile.h"
+#include "health.h"
+
+#ifdef CONFIG_METER_ENABLE
+
+#define METER_REPORT_US 10000000LL /**< Levels and load logged this often */
+#define METER_FRAME_US ((int64_t)INPUT_ADC_FRAME_SAMPLES * 1000000 / CONFIG_INPUT_SAMPLE_RATE) /**< Input frame length */
+#define METER_DWELL_SAMPLES (CONFIG_INPUT_SAMPLE_RATE / 1000 * CONFIG_METER_DWELL_MS) /**< Samples per measurement */
+
+static const char *TAG = "Meter";
+
+/** @brief Sums of the measurement in progress, owned by the listener while collecting */
+static level_acc_t acc;
+/** @brief The listener adds frames to acc */
+static volatile bool collecting;
+/** @brief Frames starting before this esp_timer time are still settling */
+static int64_t settled_us;
+
+/** @brief Newest level of each tap */
+static meter_level_t levels[MATRIX_NUM_SOURCES];
+/** @brief Full scans completed */
+static uint32_t scan_count;
+/** @brief Protects levels and scan_count */
+static SemaphoreHandle_t meter_mutex;
+
+/** @brief Time spent in the listener since the last report, us */
+static volatile uint32_t listener_us;
+
+/** @brief Meter task, woken when a measurement is complete */
+static TaskHandle_t meter_task_handle;
+
+/**
+ * @brief Input listener: accumulate the settled frames of the meter input
+ */
+static void _on_frame(const uint16_t *samples, size_t n, int64_t frame_end_us)
+{
+    if (!collecting)
+    {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    if (n == 0)
+    {
+        level_reset(&acc); // Samples were dropped, measure the dwell again
+    }
+    else if (frame_end_us - METER_FRAME_US >= settled_us)
+    {
+        level_add(&acc, samples, n);
+        if (acc.n >= METER_DWELL_SAMPLES)
+        {
+            collecting = false;
+            xTaskNotifyGive(meter_task_handle);
+        }
+    }
+    listener_us += esp_timer_get_time() - start;
+}
+
+/**
+ * @brief Log the levels of the last scan and the CPU load since the last report
+ */
+static void _report(int64_t task_us, int64_t elapsed_us)
+{
+    char line[160];
+    int len = snprintf(line, sizeof(line), "rms/peak dBFS:");
+    uint8_t taps = hw_tables.num_pedals + 1;
+    xSemaphoreTake(meter_mutex, portMAX_DELAY);
+    for (uint8_t t = 0; t < taps && len < (int)sizeof(line); t++)
+    {
+        if (t == MATRIX_SOURCE_GUITAR)
+        {
+            len += snprintf(line + len, sizeof(line) - len, " in %d/%d", levels[t].rms_db, levels[t].peak_db);
+        }
+        else
+        {
+            len += snprintf(line + len, sizeof(line) - len, " %d %d/%d", t, levels[t].rms_db, levels[t].peak_db);
+        }
+    }
+    xSemaphoreGive(meter_mutex);
+    ESP_LOGI(TAG, "%s", line);
+
+    uint32_t in_us = listener_us;
+    listener_us = 0;
+    ESP_LOGI(TAG, "CPU load %.2f %% of a core (input task %.2f %%, meter task %.2f %%)",
+             100.0 * (in_us + task_us) / elapsed_us, 100.0 * in_us / elapsed_us, 100.0 * task_us / elapsed_us);
+}
+
+/**
+ * @brief Meter task: step the tap through the sources and measure each one
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _meter_task(void *pvParameters)
+{
+    int64_t task_us = 0;
+    int64_t report_start = esp_timer_get_time();
+    uint8_t taps = hw_tables.num_pedals + 1;
+    int health_id = health_register("meter", CONFIG_HEALTH_DEADLINE_MS);
+
+    while (1)
+    {
+        for (uint8_t tap = 0; tap < taps; tap++)
+        {
+            HEALTH_BEAT(health_id);
+            int64_t start = esp_timer_get_time();
+            matrix_set_meter_tap(tap);
+            level_reset(&acc);
+            ulTaskNotifyTake(pdTRUE, 0); // Drop a completion that raced the last timeout
+            settled_us = esp_timer_get_time() + CONFIG_METER_SETTLE_MS * 1000;
+            collecting = true;
+            task_us += esp_timer_get_time() - start;
+
+            meter_level_t level = {METER_NO_LEVEL, METER_NO_LEVEL};
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(2 * (CONFIG_METER_SETTLE_MS + CONFIG_METER_DWELL_MS) + 20)))
+            {
+                start = esp_timer_get_time();
+                float rms_db, peak_db;
+                level_get(&acc, &rms_db, &peak_db);
+                level.rms_db = (int8_t)lroundf(rms_db);
+                level.peak_db = (int8_t)lroundf(peak_db);
+                task_us += esp_timer_get_time() - start;
+            }
+            else
+            {
+                collecting = false; // No input frames, leave the tap unmeasured
+            }
+
+            xSemaphoreTake(meter_mutex, portMAX_DELAY);
+            levels[tap] = level;
+            xSemaphoreGive(meter_mutex);
+        }
+
+        xSemaphoreTake(meter_mutex, portMAX_DELAY);
+        scan_count++;
+        xSemaphoreGive(meter_mutex);
+
+        int64_t now = esp_timer_get_time();
+        if (now - report_start >= METER_REPORT_US)
+        {
+            _report(task_us, now - report_start);
+            task_us = 0;
+            report_start = now;
+        }
+    }
+}
+
+/**
+ * @brief Register with the input and start the meter task
+ */
+void meter_init(void)
+{
+    for (int t = 0; t < MATRIX_NUM_SOURCES; t++)
+    {
+        levels[t] = (meter_level_t){METER_NO_LEVEL, METER_NO_LEVEL};
+    }
+    meter_mutex = xSemaphoreCreateMutex();
+    if (!input_adc_add_listener(INPUT_ADC_METER, _on_frame))
+    {
+        ESP_LOGI(TAG, "No meter tap, level meters disabled");
+        return;
+    }
+    xTaskCreate(_meter_task, "meter_task", 3072, NULL, 2, &meter_task_handle);
+    ESP_LOGI(TAG, "Scanning %d taps, %d ms each", hw_tables.num_pedals + 1,
+             CONFIG_METER_SETTLE_MS + CONFIG_METER_DWELL_MS);
+}
+
+/**
+ * @brief Get the newest level of every tap
+ *
+ * @param[out] out Levels indexed by source, MATRIX_NUM_SOURCES entries
+ * @param[out] count Taps scanned: the guitar input and the fitted returns
+ * @return Full scans completed, 0 if the meters are not running
+ */
+uint32_t meter_get_levels(meter_level_t *out, uint8_t *count)
+{
+    *count = hw_tables.num_pedals + 1;
+    if (meter_mutex == NULL)
+    {
+        return 0;
+    }
+    xSemaphoreTake(meter_mutex, portMAX_DELAY);
+    for (int t = 0; t < MATRIX_NUM_SOURCES; t++)
+    {
+        out[t] = levels[t];
+    }
+    uint32_t scans = scan_count;
+    xSemaphoreGive(meter_mutex);
+    return scans;
+}
+
+#endif /* CONFIG_METER_ENABLE */
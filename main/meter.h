@@ -0,0 +1,47 @@
+/**
+ * @file meter.h
+ * @brief Level meters on the guitar input and the pedal returns
+ *
+ * One ADC input (input_adc.h) sits behind an extra mux, the meter tap, which
+ * selects any source like a send mux does (matrix_set_meter_tap()). The meter
+ * task steps the tap through the guitar input and the fitted returns, waits
+ * CONFIG_METER_SETTLE_MS after each switch and measures the RMS and peak level
+ * (level.h) over the next CONFIG_METER_DWELL_MS. A pedal with a flat battery
+ * or a broken cable shows up as a return far below its send.
+ *
+ * Every 10 s the levels and the CPU time the meters used are logged.
+ */
+
+#ifndef METER_H
+#define METER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "matrix.h"
+
+#define METER_NO_LEVEL INT8_MIN /**< Level of a tap that has not been measured */
+
+/**
+ * @brief Level of one tap
+ */
+typedef struct
+{
+    int8_t rms_db;  /**< RMS level, dBFS, METER_NO_LEVEL if not measured */
+    int8_t peak_db; /**< Peak level, dBFS, METER_NO_LEVEL if not measured */
+} meter_level_t;
+
+/**
+ * @brief Register with the input and start the meter task
+ */
+void meter_init(void);
+
+/**
+ * @brief Get the newest level of every tap
+ *
+ * @param[out] levels Levels indexed by source, MATRIX_NUM_SOURCES entries
+ * @param[out] count Taps scanned: the guitar input and the fitted returns
+ * @return Full scans completed, 0 if the meters are not running
+ */
+uint32_t meter_get_levels(meter_level_t *levels, uint8_t *count);
+
+#endif /* METER_H */
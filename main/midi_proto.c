@@ -0,0 +1,87 @@
+/**
+ * @file midi_proto.c
+ * @brief Implementation of the USB MIDI event decoder
+ */
+
+#include "midi_proto.h"
+
+#define MIDI_CIN_CONTROL_CHANGE 0x0B /**< Code index number of a control change */
+#define MIDI_CIN_PROGRAM_CHANGE 0x0C /**< Code index number of a program change */
+
+/**
+ * @brief Empty a batch
+ *
+ * @param[out] batch Batch
+ */
+void midi_batch_init(midi_batch_t *batch)
+{
+    batch->program = MIDI_NONE;
+    batch->scene = MIDI_NONE;
+    batch->events = 0;
+    batch->ignored = 0;
+}
+
+/**
+ * @brief Decode event packets into a batch
+ *
+ * A channel message is taken only if its status byte agrees with the code
+ * index number and its data bytes are below 0x80, so a malformed packet
+ * cannot pass for a command.
+ *
+ * @param map Messages to answer
+ * @param packets Event packets, read in place
+ * @param len Bytes in @p packets
+ * @param[in,out] batch Batch the commands are folded into
+ * @return Event packets decoded
+ */
+int midi_decode_usb(const midi_map_t *map, const uint8_t *packets, size_t len, midi_batch_t *batch)
+{
+    int count = (int)(len / MIDI_EVENT_SIZE);
+    for (const uint8_t *p = packets; p < packets + count * MIDI_EVENT_SIZE; p += MIDI_EVENT_SIZE)
+    {
+        uint8_t cin = p[0] & 0x0F;
+        uint8_t status = p[1];
+        batch->events++;
+        if ((status >> 4) != cin || ((p[2] | p[3]) & 0x80) ||
+            (map->channel != MIDI_CHANNEL_ANY && (status & 0x0F) + 1 != map->channel))
+        {
+            batch->ignored++; // System messages, SysEx, notes, other channels and malformed packets
+            continue;
+        }
+        if (cin == MIDI_CIN_PROGRAM_CHANGE)
+        {
+            batch->program = p[2];
+            batch->scene = MIDI_NONE; // The preset brings its own scene
+        }
+        else if (cin == MIDI_CIN_CONTROL_CHANGE && map->scene_cc != MIDI_CC_NONE && p[2] == map->scene_cc)
+        {
+            batch->scene = p[3];
+        }
+        else
+        {
+            batch->ignored++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Fold a later batch into an earlier one
+ *
+ * @param[in,out] into Earlier batch
+ * @param later Later batch
+ */
+void midi_batch_merge(midi_batch_t *into, const midi_batch_t *later)
+{
+    if (later->program != MIDI_NONE)
+    {
+        into->program = later->program;
+        into->scene = later->scene;
+    }
+    else if (later->scene != MIDI_NONE)
+    {
+        into->scene = later->scene;
+    }
+    into->events += later->events;
+    into->ignored += later->ignored;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file midi_proto.h
+ * @brief Decoding of USB MIDI event packets into patch bay commands
+ *
+ * USB MIDI carries MIDI messages as 4-byte event packets: a cable number
+ * and code index number (CIN) byte, then the message bytes padded to three.
+ * One bulk transfer holds up to 16 of them. The decoder reads them in place
+ * from the receive buffer and folds a whole transfer into one batch: the
+ * last program change, and the last scene selected after it. Only the
+ * batch goes on to the buttons task, so a burst of messages from a DAW
+ * costs one wake-up and one route change, not one per message.
+ *
+ * - Program change N recalls preset N + 1, or goes to song N + 1 while a
+ *   show runs.
+ * - Control change midi_map_t.scene_cc with value N selects scene N + 1.
+ * - Everything else, and messages on other channels, is counted and
+ *   ignored.
+ *
+ * A program change drops a scene selected before it in the same batch,
+ * since the recall brings the scene of the preset; a scene selected after it
+ * applies to the new preset. Batches merged with midi_batch_merge() follow
+ * the same rule, so merging batches gives the same commands as decoding
+ * their packets as one.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host.
+ */
+
+#ifndef MIDI_PROTO_H
+#define MIDI_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MIDI_EVENT_SIZE 4      /**< Bytes in one USB MIDI event packet */
+#define MIDI_CHANNEL_ANY 0     /**< midi_map_t.channel: listen on every channel */
+#define MIDI_CC_NONE 0xFF      /**< midi_map_t.scene_cc: no scene control */
+#define MIDI_NONE (-1)         /**< No program or scene in a batch */
+
+/**
+ * @brief Which messages the unit answers
+ */
+typedef struct
+{
+    uint8_t channel;  /**< 1-16, MIDI_CHANNEL_ANY for all */
+    uint8_t scene_cc; /**< Controller selecting a scene by its value, MIDI_CC_NONE for none */
+} midi_map_t;
+
+/**
+ * @brief Commands folded from one or more transfers
+ */
+typedef struct
+{
+    int16_t program; /**< Program to recall, 0-based, MIDI_NONE for none */
+    int16_t scene;   /**< Scene to select after it, 0-based, MIDI_NONE for none */
+    uint16_t events; /**< Event packets decoded */
+    uint16_t ignored; /**< Of those, not for the unit */
+} midi_batch_t;
+
+/**
+ * @brief Empty a batch
+ *
+ * @param[out] batch Batch
+ */
+void midi_batch_init(midi_batch_t *batch);
+
+/**
+ * @brief Decode event packets into a batch
+ *
+ * A trailing partial packet is ignored.
+ *
+ * @param map Messages to answer
+ * @param packets Event packets, read in place
+ * @param len Bytes in @p packets
+ * @param[in,out] batch Batch the commands are folded into
+ * @return Event packets decoded
+ */
+int midi_decode_usb(const midi_map_t *map, const uint8_t *packets, size_t len, midi_batch_t *batch);
+
+/**
+ * @brief Fold a later batch into an earlier one
+ *
+ * @param[in,out] into Earlier batch
+ * @param later Later batch
+ */
+void midi_batch_merge(midi_batch_t *into, const midi_batch_t *later);
+
+#endif /* MIDI_PROTO_H */
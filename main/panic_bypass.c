@@ -0,0 +1,208 @@
+/**
+ * @file panic_bypass.c
+ * @brief Implementation of the panic bypass footswitch
+ *
+ * Both capture channels share one MCPWM capture timer. The footswitch
+ * channel's interrupt (CONFIG_MCPWM_ISR_IRAM_SAFE) latches the bypass frame,
+ * so it runs while the flash cache is disabled for NVS writes. The latch
+ * channel watches the latch pin through the GPIO loop-back and only records
+ * an edge once the bypass has been latched. A low priority task logs the
+ * timing; it is not on the bypass path.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/gpio.h>
+#include <driver/mcpwm_cap.h>
+#include <esp_attr.h>
+#include <esp_cpu.h>
+#include <esp_rom_sys.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "panic_bypass.h"
+#include "matrix.h"
+#include "hw_profile.h"
+#include "sr_bus.h"
+#include "led.h"
+#include "power.h"
+
+#define PANIC_POLL_MS 100 /**< Report task checks for a bypass this often */
+
+static const char *TAG = "Panic";
+
+/** @brief Frame latched by the footswitch, compiled at start-up */
+static DRAM_ATTR sr_frame_t bypass_frame;
+/** @brief Set by the footswitch interrupt once the bypass frame is latched */
+static volatile bool triggered;
+/** @brief The latch edge of the bypass frame was captured */
+static volatile bool latch_seen;
+/** @brief Capture timer count at the footswitch edge */
+static volatile uint32_t edge_ticks;
+/** @brief Capture timer count at the latch edge */
+static volatile uint32_t latch_ticks;
+/** @brief CPU cycles spent in the footswitch handler */
+static volatile uint32_t handler_cycles;
+/** @brief CPU clock in MHz while the handler ran, which frequency scaling may have lowered */
+static volatile uint32_t handler_mhz;
+/** @brief Capture timer resolution */
+static uint32_t capture_hz;
+
+/**
+ * @brief Footswitch edge interrupt: latch the bypass frame
+ *
+ * Only the first edge counts; contact bounce after it is ignored.
+ */
+static bool IRAM_ATTR _on_footswitch(mcpwm_cap_channel_handle_t channel, const mcpwm_capture_event_data_t *edata,
+                                     void *user_ctx)
+{
+    if (triggered)
+    {
+        return false;
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
+    sr_bus_panic(&bypass_frame);
+    handler_cycles = esp_cpu_get_cycle_count() - start;
+    handler_mhz = esp_rom_get_cpu_ticks_per_us();
+    edge_ticks = edata->cap_value;
+    triggered = true;
+    return false;
+}
+
+/**
+ * @brief Latch pin edge interrupt: record the latch edge of the bypass frame
+ *
+ * Runs for every latch; edges before the bypass are ignored, and the bus is
+ * frozen after it, so the first edge seen once triggered is the bypass latch.
+ */
+static bool IRAM_ATTR _on_latch(mcpwm_cap_channel_handle_t channel, const mcpwm_capture_event_data_t *edata,
+                                void *user_ctx)
+{
+    if (triggered && !latch_seen)
+    {
+        latch_ticks = edata->cap_value;
+        latch_seen = true;
+    }
+    return false;
+}
+
+/**
+ * @brief Panic task: log the bypass timing once it happened
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _panic_task(void *pvParameters)
+{
+    panic_bypass_report_t report;
+    while (!panic_bypass_get_report(&report))
+    {
+        vTaskDelay(pdMS_TO_TICKS(PANIC_POLL_MS));
+    }
+    vTaskDelay(pdMS_TO_TICKS(PANIC_POLL_MS)); // Let the latch edge interrupt run
+
+    panic_bypass_get_report(&report);
+    if (report.edge_to_latch_ns == 0)
+    {
+        ESP_LOGW(TAG, "Panic bypass latched, handler %lu ns at %u MHz; latch edge not captured",
+                 (unsigned long)report.handler_ns, report.handler_cpu_mhz);
+    }
+    else if (report.edge_to_latch_ns > PANIC_BYPASS_BUDGET_US * 1000)
+    {
+        ESP_LOGE(TAG, "Panic bypass latched %lu ns after the edge (handler %lu ns at %u MHz), over the %d us budget",
+                 (unsigned long)report.edge_to_latch_ns, (unsigned long)report.handler_ns, report.handler_cpu_mhz,
+                 PANIC_BYPASS_BUDGET_US);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Panic bypass latched %lu ns after the edge (handler %lu ns at %u MHz)",
+                 (unsigned long)report.edge_to_latch_ns, (unsigned long)report.handler_ns, report.handler_cpu_mhz);
+    }
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Compile the bypass frame and arm the footswitch
+ *
+ * The frame routes the guitar straight to amp output A (and the tuner
+ * output) with every control output off and the meter tap inhibited, and
+ * lights only the status LED.
+ */
+void panic_bypass_init(void)
+{
+    if (hw_tables.pin_panic == GPIO_NUM_NC)
+    {
+        return;
+    }
+
+    memset(&bypass_frame, 0, sizeof(bypass_frame));
+    matrix_compile(NULL, 0, MATRIX_OUTPUTS_DEFAULT, &bypass_frame); // The meter tap is still off here, so it is compiled inhibited
+    led_compile(hw_tables.led_status_bit == HW_LANE_NONE ? 0 : 1ULL << hw_tables.led_status_bit, &bypass_frame);
+
+    mcpwm_cap_timer_handle_t cap_timer;
+    mcpwm_capture_timer_config_t timer_conf = {
+        .group_id = 0,
+        .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+    };
+    ESP_ERROR_CHECK(mcpwm_new_capture_timer(&timer_conf, &cap_timer));
+    ESP_ERROR_CHECK(mcpwm_capture_timer_get_resolution(cap_timer, &capture_hz));
+
+    mcpwm_cap_channel_handle_t footswitch;
+    mcpwm_capture_channel_config_t footswitch_conf = {
+        .gpio_num = hw_tables.pin_panic,
+        .prescale = 1,
+        .flags.neg_edge = true, // Active low
+        .flags.pull_up = true,
+    };
+    ESP_ERROR_CHECK(mcpwm_new_capture_channel(cap_timer, &footswitch_conf, &footswitch));
+    mcpwm_capture_event_callbacks_t footswitch_cbs = {
+        .on_cap = _on_footswitch,
+    };
+    ESP_ERROR_CHECK(mcpwm_capture_channel_register_event_callbacks(footswitch, &footswitch_cbs, NULL));
+
+    mcpwm_cap_channel_handle_t latch;
+    mcpwm_capture_channel_config_t latch_conf = {
+        .gpio_num = hw_tables.pin_sr_latch,
+        .prescale = 1,
+        .flags.pos_edge = true, // The rising edge latches
+        .flags.io_loop_back = true,
+        .flags.keep_io_conf_at_exit = true,
+    };
+    ESP_ERROR_CHECK(mcpwm_new_capture_channel(cap_timer, &latch_conf, &latch));
+    gpio_set_direction(hw_tables.pin_sr_latch, GPIO_MODE_INPUT_OUTPUT); // Keep driving the latch
+    mcpwm_capture_event_callbacks_t latch_cbs = {
+        .on_cap = _on_latch,
+    };
+    ESP_ERROR_CHECK(mcpwm_capture_channel_register_event_callbacks(latch, &latch_cbs, NULL));
+
+    ESP_ERROR_CHECK(mcpwm_capture_channel_enable(footswitch));
+    ESP_ERROR_CHECK(mcpwm_capture_channel_enable(latch));
+    ESP_ERROR_CHECK(mcpwm_capture_timer_enable(cap_timer));
+    ESP_ERROR_CHECK(mcpwm_capture_timer_start(cap_timer));
+
+    xTaskCreate(_panic_task, "panic_task", 2048, NULL, 1, NULL);
+    power_stay_awake("the panic bypass capture"); // The capture timer stops in light sleep
+    ESP_LOGI(TAG, "Panic bypass armed on GPIO %d", hw_tables.pin_panic);
+}
+
+/**
+ * @brief Get the timing of the panic bypass
+ *
+ * The handler cycles are converted at the clock recorded with them, not the
+ * configured one.
+ *
+ * @param[out] report Timing, valid if true is returned
+ * @return true once the panic bypass has been latched
+ */
+bool panic_bypass_get_report(panic_bypass_report_t *report)
+{
+    if (!triggered)
+    {
+        return false;
+    }
+    uint32_t mhz = handler_mhz ? handler_mhz : CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+    report->handler_ns = (uint32_t)((uint64_t)handler_cycles * 1000 / mhz);
+    report->handler_cpu_mhz = (uint16_t)mhz;
+    report->edge_to_latch_ns = latch_seen ? (uint32_t)((uint64_t)(latch_ticks - edge_ticks) * 1000000000 / capture_hz) : 0;
+    return true;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file panic_bypass.h
+ * @brief Panic bypass footswitch handled entirely in interrupt context
+ *
+ * A footswitch on its own pin is the way back to a clean guitar-to-amp path
+ * when anything else hangs: the display flush, an NVS commit or a deadlocked
+ * task. Its falling edge is captured by an MCPWM capture channel, whose IRAM
+ * interrupt shifts and latches a bypass frame compiled at start-up
+ * (sr_bus_panic()). The handler uses no task, queue or mutex. After the
+ * latch the bus is frozen, so the bypass stays until the unit is restarted.
+ *
+ * A second capture channel on the same timer watches the latch pin, so the
+ * time from the footswitch edge to the latch edge is measured in hardware.
+ * It is logged and must stay below PANIC_BYPASS_BUDGET_US.
+ *
+ * The handler time is counted in CPU cycles. With frequency scaling the CPU
+ * may be at its low clock when the press lands, so the clock the handler ran
+ * at is recorded with the cycles and the time converted at that clock.
+ */
+
+#ifndef PANIC_BYPASS_H
+#define PANIC_BYPASS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PANIC_BYPASS_BUDGET_US 50 /**< Longest allowed time from footswitch edge to latch edge */
+
+/**
+ * @brief Timing of a panic bypass
+ */
+typedef struct
+{
+    uint32_t edge_to_latch_ns; /**< Footswitch edge to latch edge, 0 if the latch edge was not captured */
+    uint32_t handler_ns;       /**< Time spent in the handler, including the wait for the shift lock */
+    uint16_t handler_cpu_mhz;  /**< CPU clock the handler ran at */
+} panic_bypass_report_t;
+
+/**
+ * @brief Compile the bypass frame and arm the footswitch
+ *
+ * Does nothing if the board has no panic bypass pin (see hw_profile.h).
+ * Must be called after matrix_init() and led_init(), and before the level
+ * meters move the meter tap.
+ */
+void panic_bypass_init(void);
+
+/**
+ * @brief Get the timing of the panic bypass
+ *
+ * @param[out] report Timing, valid if true is returned
+ * @return true once the panic bypass has been latched
+ */
+bool panic_bypass_get_report(panic_bypass_report_t *report);
+
+#endif /* PANIC_BYPASS_H */
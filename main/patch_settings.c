@@ -0,0 +1,122 @@
+/**
+ * @file patch_settings.c
+ * @brief Implementation of the per-patch settings records
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nvs.h>
+#include <esp_log.h>
+
+#include "patch_settings.h"
+#include "matrix.h"
+#include "power.h"
+
+#define NVS_NAMESPACE "patch_bay"     /**< Same namespace as the patch blobs */
+#define NVS_KEY_SETTINGS_PREFIX "s_"  /**< Prefix in front of the patch key */
+#define PATCH_SETTINGS_RECORD_MAX 256 /**< Largest record accepted when loading */
+
+static const char *TAG = "PatchSettings";
+
+/**
+ * @brief Build the settings key of a patch
+ */
+static void _settings_key(const char *patch_key, char *key, size_t size)
+{
+    snprintf(key, size, "%s%s", NVS_KEY_SETTINGS_PREFIX, patch_key);
+}
+
+/**
+ * @brief Fill settings with the defaults used for patches without a record
+ *
+ * @param[out] settings Settings to fill
+ */
+void patch_settings_get_default(patch_settings_t *settings)
+{
+    memset(settings, 0, sizeof(*settings));
+    settings->outputs = MATRIX_OUTPUTS_DEFAULT; // What patches saved before the outputs were stored played into
+}
+
+/**
+ * @brief Load the settings of a patch
+ *
+ * @param patch_key NVS key of the patch
+ * @param[out] settings Loaded settings
+ * @return ESP_OK on success, or an error code (settings hold the defaults)
+ */
+esp_err_t patch_settings_load(const char *patch_key, patch_settings_t *settings)
+{
+    patch_settings_get_default(settings);
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    _settings_key(patch_key, key, sizeof(key));
+    uint8_t stored[PATCH_SETTINGS_RECORD_MAX]; // Room for records from newer firmware
+    size_t size = sizeof(stored);
+    err = nvs_get_blob(nvs_handle, key, stored, &size);
+    nvs_close(nvs_handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return ESP_OK;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Reading settings for %s failed: %s", patch_key, esp_err_to_name(err));
+        return err;
+    }
+    if (size > sizeof(*settings))
+    {
+        size = sizeof(*settings); // Newer layout: keep the fields we know
+    }
+    memcpy(settings, stored, size); // Fields past the stored length keep their defaults
+    if (settings->scene_count > PATCH_SCENES_MAX)
+    {
+        settings->scene_count = PATCH_SCENES_MAX;
+    }
+    if (settings->scene >= settings->scene_count)
+    {
+        settings->scene = 0;
+    }
+    settings->outputs &= (1 << MATRIX_NUM_OUTPUTS) - 1;
+    return ESP_OK;
+}
+
+/**
+ * @brief Store the settings of a patch
+ *
+ * @param patch_key NVS key of the patch
+ * @param settings Settings to store
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t patch_settings_save(const char *patch_key, const patch_settings_t *settings)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        return err;
+    }
+
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    _settings_key(patch_key, key, sizeof(key));
+    power_lock(POWER_LOCK_PERSIST);
+    err = nvs_set_blob(nvs_handle, key, settings, sizeof(*settings));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    power_unlock(POWER_LOCK_PERSIST);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Saving settings for %s failed: %s", patch_key, esp_err_to_name(err));
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
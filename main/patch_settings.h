@@ -0,0 +1,60 @@
+/**
+ * @file patch_settings.h
+ * @brief Settings stored alongside each patch (live config and presets)
+ *
+ * A patch is stored as its chain blob (see buttons.c). Everything else that
+ * belongs to a patch is kept in a separate settings record under the patch
+ * key prefixed with "s_", so chain blobs written by older firmware stay valid.
+ * New fields are only ever appended; a shorter record keeps the defaults for
+ * the missing fields.
+ */
+
+#ifndef PATCH_SETTINGS_H
+#define PATCH_SETTINGS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define PATCH_SCENES_MAX 8 /**< Scenes per patch, selected with pedal buttons 1-8 */
+
+/**
+ * @brief Per-patch settings record
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t tap_period_us; /**< Tap tempo period, 0 for no tap output */
+    uint8_t ctl_mask;       /**< Control output states, bit N set turns control output N on */
+    uint8_t scene_count;    /**< Scenes defined, 0 if every pedal in the chain always plays */
+    uint8_t scene;          /**< Active scene */
+    uint16_t scene_mask[PATCH_SCENES_MAX]; /**< Pedals playing in each scene, bit N = pedal N+1 */
+    uint8_t outputs;        /**< Outputs fed (amp A, amp B, tuner out), MATRIX_OUTPUT_BIT() mask */
+} patch_settings_t;
+
+/**
+ * @brief Fill settings with the defaults used for patches without a record
+ *
+ * @param[out] settings Settings to fill
+ */
+void patch_settings_get_default(patch_settings_t *settings);
+
+/**
+ * @brief Load the settings of a patch
+ *
+ * A missing record is not an error; @p settings then holds the defaults.
+ *
+ * @param patch_key NVS key of the patch
+ * @param[out] settings Loaded settings
+ * @return ESP_OK on success, or an error code (settings hold the defaults)
+ */
+esp_err_t patch_settings_load(const char *patch_key, patch_settings_t *settings);
+
+/**
+ * @brief Store the settings of a patch
+ *
+ * @param patch_key NVS key of the patch
+ * @param settings Settings to store
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t patch_settings_save(const char *patch_key, const patch_settings_t *settings);
+
+#endif /* PATCH_SETTINGS_H */
@@ -0,0 +1,215 @@
+/**
+ * @file pitch.c
+ * @brief Implementation of the YIN pitch detector
+ */
+
+#include <string.h>
+#include <math.h>
+#include "pitch.h"
+
+/**
+ * @brief Dot product with the selected kernel
+ */
+static inline int64_t _dot(pitch_kernel_t kernel, const int16_t *a, const int16_t *b, size_t n)
+{
+#if PITCH_HAVE_SIMD
+    if (kernel == PITCH_KERNEL_SIMD)
+    {
+        return vec_dot_s16_simd(a, b, n);
+    }
+#else
+    (void)kernel;
+#endif
+    return vec_dot_s16_scalar(a, b, n);
+}
+
+/**
+ * @brief Initialize a detector
+ *
+ * @param det Detector
+ * @param cfg Settings
+ */
+void pitch_init(pitch_detector_t *det, const pitch_config_t *cfg)
+{
+    memset(det, 0, sizeof(*det));
+    det->cfg = *cfg;
+    det->kernel = PITCH_KERNEL_SCALAR;
+
+#if PITCH_HAVE_SIMD
+    // Full-scale pseudo-random pattern, both kernels must agree exactly
+    uint32_t seed = 1;
+    for (size_t i = 0; i < PITCH_FRAME; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        det->x[0][i] = (int16_t)(seed >> 16) / 4;
+    }
+    if (vec_dot_s16_simd(det->x[0], det->x[0] + 8, PITCH_WINDOW) ==
+        vec_dot_s16_scalar(det->x[0], det->x[0] + 8, PITCH_WINDOW))
+    {
+        det->kernel = PITCH_KERNEL_SIMD;
+    }
+#endif
+}
+
+/**
+ * @brief Centre and scale the frame into the work buffers
+ *
+ * @return false if the frame is quieter than the quiet level
+ */
+static bool _prepare(pitch_detector_t *det, const uint16_t *samples)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < PITCH_FRAME; i++)
+    {
+        sum += samples[i];
+    }
+    int32_t mean = (int32_t)(sum / PITCH_FRAME);
+
+    int32_t peak = 0;
+    for (size_t i = 0; i < PITCH_FRAME; i++)
+    {
+        int32_t v = (int32_t)samples[i] - mean;
+        if (v < 0)
+        {
+            v = -v;
+        }
+        if (v > peak)
+        {
+            peak = v;
+        }
+    }
+    if (peak < det->cfg.quiet_level || peak == 0)
+    {
+        return false;
+    }
+
+    int32_t scale = (PITCH_FULL_SCALE << 16) / peak;
+    for (size_t i = 0; i < PITCH_FRAME; i++)
+    {
+        det->x[0][i] = (int16_t)((((int32_t)samples[i] - mean) * scale) >> 16);
+    }
+    if (det->kernel == PITCH_KERNEL_SIMD)
+    {
+        for (size_t k = 1; k < PITCH_LANES; k++)
+        {
+            memcpy(det->x[k], det->x[0] + k, (PITCH_FRAME - k) * sizeof(int16_t));
+            memset(det->x[k] + PITCH_FRAME - k, 0, k * sizeof(int16_t));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Estimate the pitch of a frame
+ *
+ * YIN: d(tau) = e(0) + e(tau) - 2 r(tau), where e(tau) is the energy of the
+ * window starting at tau and r(tau) the autocorrelation. The cumulative mean
+ * normalized difference takes the first dip below the threshold, which
+ * avoids picking a multiple of the period, and the dip is refined by a
+ * parabola through d() around it.
+ *
+ * @param det Detector
+ * @param samples PITCH_FRAME unipolar ADC samples, oldest first
+ * @param[out] result Estimate
+ */
+void pitch_detect(pitch_detector_t *det, const uint16_t *samples, pitch_result_t *result)
+{
+    result->hz = 0;
+    result->clarity = 0;
+    if (!_prepare(det, samples))
+    {
+        return;
+    }
+
+    const int16_t *x = det->x[0];
+    uint32_t tau_min = (uint32_t)(det->cfg.sample_rate / det->cfg.max_hz);
+    uint32_t tau_max = (uint32_t)(det->cfg.sample_rate / det->cfg.min_hz) + 1;
+    if (tau_min < 2)
+    {
+        tau_min = 2;
+    }
+    if (tau_max > PITCH_TAU_MAX - 1)
+    {
+        tau_max = PITCH_TAU_MAX - 1;
+    }
+    if (tau_min >= tau_max)
+    {
+        return;
+    }
+
+    int64_t e0 = vec_dot_s16_scalar(x, x, PITCH_WINDOW);
+    int64_t e = e0;
+    float running = 0;
+    det->cmnd[0] = 1.0f;
+    det->diff[0] = 0;
+    for (uint32_t tau = 1; tau <= tau_max + 1; tau++)
+    {
+        e += (int32_t)x[tau + PITCH_WINDOW - 1] * x[tau + PITCH_WINDOW - 1] - (int32_t)x[tau - 1] * x[tau - 1];
+        const int16_t *lag = x + tau;
+        if (det->kernel == PITCH_KERNEL_SIMD)
+        {
+            lag = det->x[tau % PITCH_LANES] + (tau - tau % PITCH_LANES); // Same samples, aligned
+        }
+        int64_t r = _dot(det->kernel, x, lag, PITCH_WINDOW);
+        float d = (float)(e0 + e - 2 * r);
+        running += d;
+        det->diff[tau] = d;
+        det->cmnd[tau] = running > 0 ? d * tau / running : 1.0f;
+    }
+
+    uint32_t best = 0;
+    for (uint32_t tau = tau_min; tau <= tau_max; tau++)
+    {
+        if (det->cmnd[tau] < det->cfg.threshold)
+        {
+            while (tau < tau_max && det->cmnd[tau + 1] < det->cmnd[tau])
+            {
+                tau++;
+            }
+            best = tau;
+            break;
+        }
+    }
+    if (best == 0)
+    {
+        return;
+    }
+
+    float prev = det->diff[best - 1], cur = det->diff[best], next = det->diff[best + 1];
+    float den = prev - 2 * cur + next;
+    float shift = den > 0 ? 0.5f * (prev - next) / den : 0;
+    if (shift > 0.5f || shift < -0.5f)
+    {
+        shift = 0;
+    }
+    result->hz = det->cfg.sample_rate / (best + shift);
+    result->clarity = det->cmnd[best] < 1.0f ? 1.0f - det->cmnd[best] : 0;
+}
+
+/**
+ * @brief Nearest equal-tempered note of a frequency
+ *
+ * @param hz Frequency, > 0
+ * @param ref_hz Frequency of A4
+ * @param[out] midi MIDI note number
+ * @param[out] cents Deviation from the note, -50 to +50
+ */
+void pitch_to_note(float hz, float ref_hz, int *midi, float *cents)
+{
+    float semis = 12.0f * log2f(hz / ref_hz);
+    int n = (int)lroundf(semis);
+    *midi = 69 + n;
+    *cents = 100.0f * (semis - n);
+}
+
+/**
+ * @brief Name of a note without the octave
+ *
+ * @param midi MIDI note number
+ * @return "C" to "B", sharps only
+ */
+const char *pitch_note_name(int midi)
+{
+    static const char *const names[12] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+    return names[((midi % 12) + 12) % 12];
+}
@@ -0,0 +1,112 @@
+/**
+ * @file pitch.h
+ * @brief YIN pitch detector for the tuner
+ *
+ * The frame is centred and scaled to a fixed peak, then the YIN difference
+ * function is built from the frame energies and the autocorrelation at each
+ * lag. The autocorrelation is the hot loop: one 16-bit dot product of
+ * PITCH_WINDOW samples per lag. On the ESP32-S3 it runs on the PIE vector
+ * unit, eight multiply-accumulates per instruction into the 40-bit ACCX
+ * accumulator; elsewhere a scalar loop gives the same exact sums (vec.h).
+ *
+ * This module has no ESP-IDF dependencies besides the target check so it can
+ * be built on a host, see tools/pitch_bench.c.
+ */
+
+#ifndef PITCH_H
+#define PITCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "vec.h"
+
+#define PITCH_HAVE_SIMD VEC_HAVE_SIMD /**< PIE vector kernel compiled in */
+
+#define PITCH_WINDOW 1024                             /**< Samples compared at each lag */
+#define PITCH_TAU_MAX 512                             /**< Longest lag (lowest note), samples */
+#define PITCH_FRAME (PITCH_WINDOW + PITCH_TAU_MAX)    /**< Samples needed per estimate */
+#define PITCH_FULL_SCALE 8191                         /**< Peak after scaling, keeps the sums within 40 bits */
+#define PITCH_LANES (PITCH_HAVE_SIMD ? VEC_LANES : 1) /**< Shifted copies, so every lag is 16-byte aligned */
+
+/**
+ * @brief Dot product implementation
+ */
+typedef enum
+{
+    PITCH_KERNEL_SCALAR = 0, /**< Portable C */
+    PITCH_KERNEL_SIMD,       /**< ESP32-S3 PIE */
+} pitch_kernel_t;
+
+/**
+ * @brief Detector settings
+ */
+typedef struct
+{
+    uint32_t sample_rate; /**< Hz */
+    float min_hz;         /**< Lowest note reported, at least sample_rate / PITCH_TAU_MAX */
+    float max_hz;         /**< Highest note reported */
+    float threshold;      /**< YIN dip threshold, 0.1-0.2 typical */
+    uint16_t quiet_level; /**< Peak in ADC counts below which nothing is reported */
+} pitch_config_t;
+
+/**
+ * @brief Detector state and work buffers
+ */
+typedef struct
+{
+    pitch_config_t cfg;                                              /**< Settings */
+    pitch_kernel_t kernel;                                           /**< Dot product in use */
+    int16_t x[PITCH_LANES][PITCH_FRAME] __attribute__((aligned(VEC_ALIGN))); /**< Scaled frame, row k shifted by k */
+    float diff[PITCH_TAU_MAX + 1];                                   /**< Difference function per lag */
+    float cmnd[PITCH_TAU_MAX + 1];                                   /**< Cumulative mean normalized difference */
+} pitch_detector_t;
+
+/**
+ * @brief One estimate
+ */
+typedef struct
+{
+    float hz;      /**< Fundamental, 0 if none was found */
+    float clarity; /**< 1 - normalized difference at the chosen lag, 0-1 */
+} pitch_result_t;
+
+/**
+ * @brief Initialize a detector
+ *
+ * Picks the SIMD kernel when it is compiled in and gives the same sums as
+ * the scalar one on a test pattern.
+ *
+ * @param det Detector
+ * @param cfg Settings
+ */
+void pitch_init(pitch_detector_t *det, const pitch_config_t *cfg);
+
+/**
+ * @brief Estimate the pitch of a frame
+ *
+ * @param det Detector
+ * @param samples PITCH_FRAME unipolar ADC samples, oldest first
+ * @param[out] result Estimate
+ */
+void pitch_detect(pitch_detector_t *det, const uint16_t *samples, pitch_result_t *result);
+
+/**
+ * @brief Nearest equal-tempered note of a frequency
+ *
+ * @param hz Frequency, > 0
+ * @param ref_hz Frequency of A4
+ * @param[out] midi MIDI note number
+ * @param[out] cents Deviation from the note, -50 to +50
+ */
+void pitch_to_note(float hz, float ref_hz, int *midi, float *cents);
+
+/**
+ * @brief Name of a note without the octave
+ *
+ * @param midi MIDI note number
+ * @return "C" to "B", sharps only
+ */
+const char *pitch_note_name(int midi);
+
+#endif /* PITCH_H */
@@ -0,0 +1,360 @@
+/**
+ * @file power.c
+ * @brief Implementation of power management
+ *
+ * Every lock in power_lock_t is an ESP_PM_CPU_FREQ_MAX lock, which also keeps
+ * the chip out of light sleep while it is held. power_stay_awake() adds to
+ * one shared ESP_PM_NO_LIGHT_SLEEP lock.
+ *
+ * The wake pins use low-level GPIO interrupts, which is what light sleep
+ * wakes on. The interrupt of a pin is only enabled while power_wait() is
+ * idle and the pin is released, and the handler disables it again, so a
+ * held footswitch never floods the CPU.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "power.h"
+#include "buttons.h"
+
+#define POWER_WAKE_PINS_MAX (NUM_PEDALS_MAX + 2) /**< Pedal, program and preset buttons */
+
+static const char *TAG = "Power";
+
+/** @brief Protects the measurement state, shared with the wake interrupt */
+static portMUX_TYPE power_lock_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_POWER_SAVE
+/** @brief Full speed locks, indexed by power_lock_t */
+static esp_pm_lock_handle_t locks[POWER_LOCK_COUNT];
+/** @brief Shared lock of the modules that keep the chip out of light sleep */
+static esp_pm_lock_handle_t awake_lock;
+/** @brief Held for good once the latency budget was exceeded */
+static esp_pm_lock_handle_t pinned_lock;
+/** @brief Modules holding awake_lock */
+static int awake_holds;
+/** @brief Footswitch pins that wake the chip */
+static gpio_num_t wake_pins[POWER_WAKE_PINS_MAX];
+static int wake_pin_count;
+/** @brief Task waiting in power_wait() for a footswitch edge */
+static TaskHandle_t waiter;
+/** @brief Time of the last wake edge, 0 once taken by the waiting task */
+static int64_t wake_us;
+#endif
+
+/** @brief Time of the press being measured, 0 if none */
+static int64_t press_us;
+/** @brief The routing lock is held for the current press */
+static bool route_held;
+/** @brief Frequency scaling was switched off for exceeding the latency budget */
+static bool pinned;
+
+/** @brief Measurements of the current report window */
+static uint32_t stat_presses, stat_latency_sum_us, stat_latency_max_us, stat_wakes, stat_wake_max_us;
+
+#ifdef CONFIG_POWER_SAVE
+/**
+ * @brief Footswitch edge while idle: take the routing lock and wake the task
+ *
+ * @param arg Unused
+ */
+static void IRAM_ATTR _wake_isr(void *arg)
+{
+    for (int i = 0; i < wake_pin_count; i++)
+    {
+        gpio_ll_intr_disable(GPIO_LL_GET_HW(GPIO_PORT_0), wake_pins[i]); // Re-armed by the next idle wait
+    }
+    portENTER_CRITICAL_ISR(&power_lock_mux);
+    if (wake_us == 0)
+    {
+        wake_us = esp_timer_get_time();
+    }
+    bool take = !route_held;
+    route_held = true;
+    portEXIT_CRITICAL_ISR(&power_lock_mux);
+    if (take)
+    {
+        esp_pm_lock_acquire(locks[POWER_LOCK_ROUTE]); // Full speed before the task runs
+    }
+
+    BaseType_t woken = pdFALSE;
+    if (waiter)
+    {
+        vTaskNotifyGiveFromISR(waiter, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+#endif
+
+/**
+ * @brief Report task: log the press-to-latch latency
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _report_task(void *pvParameters)
+{
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(POWER_REPORT_MS));
+        portENTER_CRITICAL(&power_lock_mux);
+        uint32_t presses = stat_presses, sum = stat_latency_sum_us, max = stat_latency_max_us;
+        uint32_t wakes = stat_wakes, wake_max = stat_wake_max_us;
+        stat_presses = stat_latency_sum_us = stat_latency_max_us = stat_wakes = stat_wake_max_us = 0;
+        portEXIT_CRITICAL(&power_lock_mux);
+        if (presses || wakes)
+        {
+            ESP_LOGI(TAG, "%lu presses, press to latch %lu us mean, %lu us max (budget %d us); %lu wakes, edge to task %lu us max%s",
+                     (unsigned long)presses, (unsigned long)(presses ? sum / presses : 0), (unsigned long)max,
+                     CONFIG_POWER_LATENCY_BUDGET_US, (unsigned long)wakes, (unsigned long)wake_max,
+                     pinned ? ", frequency scaling off" : "");
+        }
+#if defined(CONFIG_POWER_SAVE) && defined(CONFIG_PM_PROFILING)
+        esp_pm_dump_locks(stdout); // Time spent in each power mode, for the idle current estimate
+#endif
+    }
+}
+
+/**
+ * @brief Configure frequency scaling and light sleep and create the PM locks
+ */
+void power_init(void)
+{
+#ifdef CONFIG_POWER_SAVE
+    static const char *const names[POWER_LOCK_COUNT] = {"route", "flush", "persist"};
+    for (int i = 0; i < POWER_LOCK_COUNT; i++)
+    {
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, names[i], &locks[i]));
+    }
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake", &awake_lock));
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "pinned", &pinned_lock));
+
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_POWER_MIN_FREQ_MHZ,
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Power management not configured: %s", esp_err_to_name(err));
+        return;
+    }
+    esp_sleep_enable_gpio_wakeup();
+    ESP_LOGI(TAG, "CPU %d-%d MHz, light sleep %s", CONFIG_POWER_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+             pm_config.light_sleep_enable ? "on" : "off");
+#endif
+    xTaskCreate(_report_task, "power_task", 2560, NULL, 1, NULL);
+}
+
+/**
+ * @brief Hold the CPU at full speed for a piece of work
+ *
+ * @param lock Work being done
+ */
+void IRAM_ATTR power_lock(power_lock_t lock)
+{
+#ifdef CONFIG_POWER_SAVE
+    if (locks[lock])
+    {
+        esp_pm_lock_acquire(locks[lock]);
+    }
+#endif
+}
+
+/**
+ * @brief Release a lock taken with power_lock()
+ *
+ * @param lock Work that is done
+ */
+void IRAM_ATTR power_unlock(power_lock_t lock)
+{
+#ifdef CONFIG_POWER_SAVE
+    if (locks[lock])
+    {
+        esp_pm_lock_release(locks[lock]);
+    }
+#endif
+}
+
+/**
+ * @brief Keep the chip out of light sleep for good
+ *
+ * @param who Module name for the log
+ */
+void power_stay_awake(const char *who)
+{
+#ifdef CONFIG_POWER_SAVE
+    if (awake_lock)
+    {
+        esp_pm_lock_acquire(awake_lock);
+        awake_holds++;
+        ESP_LOGI(TAG, "Light sleep off for %s", who);
+    }
+#endif
+}
+
+/**
+ * @brief Make an active-low footswitch GPIO wake the chip from light sleep
+ *
+ * Sets the pin to a low-level interrupt with its interrupt disabled; the
+ * wake works without it, and power_wait() enables it while idle.
+ *
+ * @param pin Footswitch GPIO
+ */
+void power_add_wake_pin(gpio_num_t pin)
+{
+#ifdef CONFIG_POWER_SAVE
+    if (!awake_lock || pin == GPIO_NUM_NC || wake_pin_count >= POWER_WAKE_PINS_MAX)
+    {
+        return;
+    }
+    esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) // Already installed by another module
+    {
+        ESP_LOGE(TAG, "GPIO ISR service failed: %s", esp_err_to_name(err));
+        return;
+    }
+    gpio_intr_disable(pin);
+    gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+    gpio_isr_handler_add(pin, _wake_isr, NULL);
+    wake_pins[wake_pin_count++] = pin;
+#endif
+}
+
+/**
+ * @brief Wait for the next poll of the buttons task
+ *
+ * A level interrupt armed on a released pin fires at once if the pin goes
+ * low before the wait starts, so no press is lost between the check and the
+ * wait.
+ *
+ * @param poll Normal poll period
+ * @param idle true if the caller has nothing to do until the next press
+ */
+void power_wait(TickType_t poll, bool idle)
+{
+#ifdef CONFIG_POWER_SAVE
+    bool released = wake_pin_count > 0;
+    for (int i = 0; i < wake_pin_count && released; i++)
+    {
+        released = gpio_get_level(wake_pins[i]) != 0;
+    }
+    if (idle && released && awake_holds == 0)
+    {
+        waiter = xTaskGetCurrentTaskHandle();
+        for (int i = 0; i < wake_pin_count; i++)
+        {
+            gpio_intr_enable(wake_pins[i]);
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_POWER_IDLE_POLL_MS));
+        for (int i = 0; i < wake_pin_count; i++)
+        {
+            gpio_intr_disable(wake_pins[i]);
+        }
+
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&power_lock_mux);
+        if (wake_us)
+        {
+            uint32_t took = (uint32_t)(now - wake_us);
+            stat_wakes++;
+            if (took > stat_wake_max_us)
+            {
+                stat_wake_max_us = took;
+            }
+            wake_us = 0;
+        }
+        portEXIT_CRITICAL(&power_lock_mux);
+        return;
+    }
+#endif
+    ulTaskNotifyTake(pdTRUE, poll); // A USB MIDI command or an expander press ends the wait early
+}
+
+/**
+ * @brief Note a debounced footswitch press
+ */
+void power_input_seen(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&power_lock_mux);
+    bool take = !route_held;
+    route_held = true;
+    if (press_us == 0)
+    {
+        press_us = now;
+    }
+    portEXIT_CRITICAL(&power_lock_mux);
+    if (take)
+    {
+        power_lock(POWER_LOCK_ROUTE);
+    }
+}
+
+/**
+ * @brief Note that a routing frame is in the shift registers
+ *
+ * Switches frequency scaling off for good the first time the budget is
+ * exceeded.
+ */
+void power_route_ready(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&power_lock_mux);
+    uint32_t took = 0;
+    bool measured = press_us != 0;
+    if (measured)
+    {
+        took = (uint32_t)(now - press_us);
+        press_us = 0;
+        stat_presses++;
+        stat_latency_sum_us += took;
+        if (took > stat_latency_max_us)
+        {
+            stat_latency_max_us = took;
+        }
+    }
+    bool pin = measured && took > CONFIG_POWER_LATENCY_BUDGET_US && !pinned;
+    pinned |= pin;
+    portEXIT_CRITICAL(&power_lock_mux);
+
+    if (pin)
+    {
+#ifdef CONFIG_POWER_SAVE
+        if (pinned_lock)
+        {
+            esp_pm_lock_acquire(pinned_lock);
+        }
+#endif
+        ESP_LOGW(TAG, "Press to latch took %lu us, over the %d us budget; frequency scaling off until restart",
+                 (unsigned long)took, CONFIG_POWER_LATENCY_BUDGET_US);
+    }
+}
+
+/**
+ * @brief Note the end of one pass of the buttons task
+ */
+void power_input_done(void)
+{
+    portENTER_CRITICAL(&power_lock_mux);
+    bool release = route_held;
+    route_held = false;
+    press_us = 0;
+    portEXIT_CRITICAL(&power_lock_mux);
+    if (release)
+    {
+        power_unlock(POWER_LOCK_ROUTE);
+    }
+}
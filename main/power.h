@@ -0,0 +1,124 @@
+/**
+ * @file power.h
+ * @brief Power management: frequency scaling, light sleep and PM locks
+ *
+ * With power saving enabled the CPU runs at CONFIG_POWER_MIN_FREQ_MHZ while
+ * nothing is happening, and the chip goes into light sleep whenever FreeRTOS
+ * has no task to run (tickless idle). PM locks bring it back to full speed
+ * only for the work where speed counts: routing, display flushes and NVS
+ * writes.
+ *
+ * The footswitch GPIOs are light sleep wake sources. While the buttons task
+ * is idle it waits in power_wait() for a footswitch edge instead of polling,
+ * and the edge interrupt takes the routing lock before the task even runs.
+ * Modules that need a running clock or edge interrupts (link UART, panic
+ * capture, tap timing, 1 kHz scans) hold the chip out of light sleep with
+ * power_stay_awake(); frequency scaling still applies then.
+ *
+ * The time from a debounced press to the routing frame being in the shift
+ * registers is measured on every press and logged every POWER_REPORT_MS. If
+ * it ever exceeds CONFIG_POWER_LATENCY_BUDGET_US, frequency scaling is
+ * switched off until restart, so power saving can never make switching
+ * slower than the budget.
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <driver/gpio.h>
+
+#define POWER_REPORT_MS 60000 /**< Latency report interval */
+
+/**
+ * @brief Work that runs at full CPU speed
+ */
+typedef enum
+{
+    POWER_LOCK_ROUTE = 0, /**< From a footswitch press to the latch of its route */
+    POWER_LOCK_FLUSH,     /**< Display flush on the I2C bus */
+    POWER_LOCK_PERSIST,   /**< NVS writes */
+    POWER_LOCK_COUNT
+} power_lock_t;
+
+/**
+ * @brief Configure frequency scaling and light sleep and create the PM locks
+ *
+ * Must be called before any other power_*() function. Without
+ * CONFIG_POWER_SAVE only the latency measurement runs.
+ */
+void power_init(void);
+
+/**
+ * @brief Hold the CPU at full speed for a piece of work
+ *
+ * Locks are counted, so nested calls are fine. Safe to call from an ISR.
+ *
+ * @param lock Work being done
+ */
+void power_lock(power_lock_t lock);
+
+/**
+ * @brief Release a lock taken with power_lock()
+ *
+ * @param lock Work that is done
+ */
+void power_unlock(power_lock_t lock);
+
+/**
+ * @brief Keep the chip out of light sleep for good
+ *
+ * For modules that need a peripheral clock or edge interrupts while idle.
+ * Frequency scaling still applies.
+ *
+ * @param who Module name for the log
+ */
+void power_stay_awake(const char *who);
+
+/**
+ * @brief Make an active-low footswitch GPIO wake the chip from light sleep
+ *
+ * The pin must already be configured as an input with its pull-up.
+ *
+ * @param pin Footswitch GPIO
+ */
+void power_add_wake_pin(gpio_num_t pin);
+
+/**
+ * @brief Wait for the next poll of the buttons task
+ *
+ * If @p idle is set, no wake pin is held and nothing keeps the chip awake,
+ * waits up to CONFIG_POWER_IDLE_POLL_MS for a footswitch edge instead of
+ * @p poll, so the chip can sleep between presses. Otherwise waits @p poll.
+ * Either wait ends early when the task is notified (see usb_midi.h and
+ * expander.h).
+ *
+ * @param poll Normal poll period
+ * @param idle true if the caller has nothing to do until the next press
+ */
+void power_wait(TickType_t poll, bool idle);
+
+/**
+ * @brief Note a debounced footswitch press
+ *
+ * Takes the routing lock and starts the press-to-latch measurement.
+ */
+void power_input_seen(void);
+
+/**
+ * @brief Note that a routing frame is in the shift registers
+ *
+ * Ends the press-to-latch measurement of the last press, if one is running.
+ */
+void power_route_ready(void);
+
+/**
+ * @brief Note the end of one pass of the buttons task
+ *
+ * Releases the routing lock taken for a press. A press that led to no
+ * route change is dropped from the measurement.
+ */
+void power_input_done(void);
+
+#endif /* POWER_H */
@@ -0,0 +1,251 @@
+/**
+ * @file preset_predict.c
+ * @brief Implementation of the next preset prediction
+ *
+ * The table and the statistics are only changed by the buttons task. The
+ * report task reads them under a spinlock and writes the table to NVS when
+ * it changed and the last write is old enough.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <nvs.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "preset_predict.h"
+#include "power.h"
+
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+
+#define NVS_NAMESPACE "patch_bay"      /**< Same namespace as the patch blobs */
+#define NVS_KEY_PREDICT "predict"      /**< NVS key of the transition table */
+#define PREDICT_ROW_CUSTOM NUM_PRESETS /**< Row for recalls made from a custom chain */
+
+static const char *TAG = "PresetPredict";
+
+/** @brief Protects the table and the statistics */
+static portMUX_TYPE predict_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Recall counts: counts[from][to], weighted and aged */
+static uint8_t counts[NUM_PRESETS + 1][NUM_PRESETS];
+/** @brief The table changed since it was last written */
+static bool dirty;
+/** @brief Statistics since boot */
+static preset_predict_stats_t stats;
+
+/**
+ * @brief Table row of the preset a recall is made from
+ */
+static int _row(int from)
+{
+    return from >= 0 && from < NUM_PRESETS ? from : PREDICT_ROW_CUSTOM;
+}
+
+/**
+ * @brief Write the table to NVS
+ *
+ * @param table Copy of the table taken under the lock
+ * @return esp_err_t ESP_OK on success, or an error code
+ */
+static esp_err_t _save(const uint8_t *table)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        return err;
+    }
+    power_lock(POWER_LOCK_PERSIST);
+    err = nvs_set_blob(nvs_handle, NVS_KEY_PREDICT, table, sizeof(counts));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    power_unlock(POWER_LOCK_PERSIST);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Saving the prediction table failed: %s", esp_err_to_name(err));
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+/**
+ * @brief Report task: log the hit rates and write the table when it changed
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _report_task(void *pvParameters)
+{
+    static const char *const path_name[PRESET_PREDICT_PATHS] = {"missed", "compiled", "preshifted"};
+    uint32_t reported = 0;
+    int64_t saved_us = 0;
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(PRESET_PREDICT_REPORT_MS));
+        preset_predict_stats_t now;
+        uint8_t table[sizeof(counts)];
+        portENTER_CRITICAL(&predict_lock);
+        now = stats;
+        bool save = dirty && esp_timer_get_time() - saved_us >= PRESET_PREDICT_SAVE_MS * 1000LL;
+        if (save)
+        {
+            memcpy(table, counts, sizeof(counts));
+            dirty = false;
+        }
+        portEXIT_CRITICAL(&predict_lock);
+
+        if (save)
+        {
+            if (_save(table) == ESP_OK)
+            {
+                saved_us = esp_timer_get_time();
+            }
+            else
+            {
+                portENTER_CRITICAL(&predict_lock);
+                dirty = true; // Try again next time
+                portEXIT_CRITICAL(&predict_lock);
+            }
+        }
+
+        uint32_t recalls = 0;
+        for (int p = 0; p < PRESET_PREDICT_PATHS; p++)
+        {
+            recalls += now.recalls[p];
+        }
+        if (recalls == reported)
+        {
+            continue;
+        }
+        reported = recalls;
+        ESP_LOGI(TAG, "%lu recalls, %lu%% predicted, %lu%% as the top candidate", (unsigned long)recalls,
+                 (unsigned long)(100 * (recalls - now.recalls[PRESET_PREDICT_MISS]) / recalls),
+                 (unsigned long)(100 * now.top_hits / recalls));
+        for (int p = 0; p < PRESET_PREDICT_PATHS; p++)
+        {
+            if (now.recalls[p])
+            {
+                ESP_LOGI(TAG, "  %-10s %5lu, recall to latch %lu us mean, %lu us max", path_name[p],
+                         (unsigned long)now.recalls[p], (unsigned long)(now.route_us_sum[p] / now.recalls[p]),
+                         (unsigned long)now.route_us_max[p]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Load the transition table and start the report task
+ */
+void preset_predict_init(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK)
+    {
+        size_t size = sizeof(counts);
+        err = nvs_get_blob(nvs_handle, NVS_KEY_PREDICT, counts, &size);
+        nvs_close(nvs_handle);
+        if (err == ESP_OK && size != sizeof(counts))
+        {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        }
+    }
+    if (err != ESP_OK)
+    {
+        if (err != ESP_ERR_NVS_NOT_FOUND)
+        {
+            ESP_LOGW(TAG, "Prediction table not loaded (%s), starting without history", esp_err_to_name(err));
+        }
+        memset(counts, 0, sizeof(counts));
+    }
+    xTaskCreate(_report_task, "predict_task", 3072, NULL, 1, NULL);
+}
+
+/**
+ * @brief Rank the presets by how likely they are to be recalled next
+ *
+ * By count, ties by distance above @p from, so with no history the ranking
+ * is the next slots in order.
+ *
+ * @param from Preset the live patch was loaded from, -1 for a custom chain
+ * @param[out] slots All NUM_PRESETS slots, most likely first
+ */
+void preset_predict_rank(int from, uint8_t *slots)
+{
+    int row = _row(from);
+    int start = row == PREDICT_ROW_CUSTOM ? 0 : from + 1;
+    uint8_t score[NUM_PRESETS];
+    portENTER_CRITICAL(&predict_lock);
+    memcpy(score, counts[row], sizeof(score));
+    portEXIT_CRITICAL(&predict_lock);
+
+    for (int i = 0; i < NUM_PRESETS; i++)
+    {
+        slots[i] = (start + i) % NUM_PRESETS;
+    }
+    for (int i = 1; i < NUM_PRESETS; i++) // Stable insertion sort keeps the slot order on ties
+    {
+        uint8_t slot = slots[i];
+        int j = i;
+        for (; j > 0 && score[slots[j - 1]] < score[slot]; j--)
+        {
+            slots[j] = slots[j - 1];
+        }
+        slots[j] = slot;
+    }
+}
+
+/**
+ * @brief Learn from a recall and count it in the statistics
+ *
+ * @param from Preset the live patch was loaded from before, -1 for a custom chain
+ * @param to Preset recalled
+ * @param path How the route got onto the outputs
+ * @param route_us Time from the recall to the latched route
+ */
+void preset_predict_recalled(int from, int to, preset_predict_path_t path, uint32_t route_us)
+{
+    uint8_t ranked[NUM_PRESETS];
+    preset_predict_rank(from, ranked);
+
+    int row = _row(from);
+    portENTER_CRITICAL(&predict_lock);
+    uint8_t *cells = counts[row];
+    if (cells[to] > UINT8_MAX - PRESET_PREDICT_WEIGHT)
+    {
+        for (int i = 0; i < NUM_PRESETS; i++)
+        {
+            cells[i] /= 2; // Age the row, recent recalls count for more
+        }
+    }
+    cells[to] += PRESET_PREDICT_WEIGHT;
+    dirty = true;
+
+    stats.recalls[path]++;
+    stats.route_us_sum[path] += route_us;
+    if (route_us > stats.route_us_max[path])
+    {
+        stats.route_us_max[path] = route_us;
+    }
+    stats.top_hits += ranked[0] == to;
+    portEXIT_CRITICAL(&predict_lock);
+}
+
+/**
+ * @brief Get the statistics since boot
+ *
+ * @param[out] out Statistics
+ */
+void preset_predict_get_stats(preset_predict_stats_t *out)
+{
+    portENTER_CRITICAL(&predict_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&predict_lock);
+}
+
+#endif /* CONFIG_PRESET_PREDICT_ENABLE */
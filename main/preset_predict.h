@@ -0,0 +1,88 @@
+/**
+ * @file preset_predict.h
+ * @brief Online prediction of the next preset recall
+ *
+ * Players recall presets in much the same order every night, set list or
+ * not. A first-order Markov table counts, for every preset, which preset was
+ * recalled after it; the row for a custom chain counts recalls made from
+ * one. The buttons task asks for the most likely next presets after every
+ * recall, keeps them compiled (matrix_prepare()) and preshifts the top one
+ * into the registers (matrix_preshift()), so a correct guess switches on the
+ * latch edge alone.
+ *
+ * Each recall adds PRESET_PREDICT_WEIGHT to its cell. A row that would
+ * overflow is halved first, so old habits fade after a few dozen recalls
+ * from the same preset. Ties, including a table with no history yet, go to
+ * the next slot up, as in a set list stored in order.
+ *
+ * The table (72 bytes) is written to NVS at most every PRESET_PREDICT_SAVE_MS
+ * and only if it changed, so learning costs no flash wear worth counting;
+ * what was learned since the last save is lost on power off. Hit rates and
+ * recall times per path are logged every PRESET_PREDICT_REPORT_MS.
+ */
+
+#ifndef PRESET_PREDICT_H
+#define PRESET_PREDICT_H
+
+#include <stdint.h>
+#include "buttons.h"
+
+#define PRESET_PREDICT_WEIGHT 8            /**< Added to a cell per recall */
+#define PRESET_PREDICT_REPORT_MS 60000     /**< Hit rate report interval */
+#define PRESET_PREDICT_SAVE_MS (5 * 60000) /**< Least time between two table writes */
+
+/**
+ * @brief How a recall got its route onto the outputs
+ */
+typedef enum
+{
+    PRESET_PREDICT_MISS = 0,   /**< Not predicted: loaded from NVS and compiled */
+    PRESET_PREDICT_COMPILED,   /**< Kept compiled, shifted and latched */
+    PRESET_PREDICT_PRESHIFTED, /**< Already in the registers, latched only */
+    PRESET_PREDICT_PATHS
+} preset_predict_path_t;
+
+/**
+ * @brief Prediction statistics since boot
+ */
+typedef struct
+{
+    uint32_t recalls[PRESET_PREDICT_PATHS];     /**< Recalls per path */
+    uint32_t route_us_sum[PRESET_PREDICT_PATHS]; /**< Summed time from recall to latched route, per path */
+    uint32_t route_us_max[PRESET_PREDICT_PATHS]; /**< Longest time from recall to latched route, per path */
+    uint32_t top_hits;                           /**< Recalls of the most likely preset */
+} preset_predict_stats_t;
+
+/**
+ * @brief Load the transition table and start the report task
+ *
+ * Must be called after NVS is initialized and before buttons_init().
+ */
+void preset_predict_init(void);
+
+/**
+ * @brief Rank the presets by how likely they are to be recalled next
+ *
+ * @param from Preset the live patch was loaded from, -1 for a custom chain
+ * @param[out] slots All NUM_PRESETS slots, most likely first
+ */
+void preset_predict_rank(int from, uint8_t *slots);
+
+/**
+ * @brief Learn from a recall and count it in the statistics
+ *
+ * @param from Preset the live patch was loaded from before, -1 for a custom chain
+ * @param to Preset recalled
+ * @param path How the route got onto the outputs
+ * @param route_us Time from the recall to the latched route
+ */
+void preset_predict_recalled(int from, int to, preset_predict_path_t path, uint32_t route_us);
+
+/**
+ * @brief Get the statistics since boot
+ *
+ * @param[out] out Statistics
+ */
+void preset_predict_get_stats(preset_predict_stats_t *out);
+
+#endif /* PRESET_PREDICT_H */
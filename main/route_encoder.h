@@ -0,0 +1,42 @@
+/**
+ * @file route_encoder.h
+ * @brief Routing encoder generated at build time for one board
+ *
+ * With CONFIG_ROUTE_ENCODER_GENERATED the build runs tools/route_encoder_gen.py
+ * on the board description CONFIG_ROUTE_ENCODER_BOARD and compiles the
+ * result. route_encoder_compile() does what matrix_compile() does, but every
+ * frame byte, mask and shift is a constant, the inhibit chain is preset in
+ * whole bytes and the chain slots are unrolled, so there is no table lookup
+ * left.
+ *
+ * The generated code only fits the wiring it was generated from. The matrix
+ * uses it only if the profile running has the CRC recorded with it, and the
+ * table-driven encoder otherwise. tools/route_encoder_bench.c compares both
+ * on every chain.
+ */
+
+#ifndef ROUTE_ENCODER_H
+#define ROUTE_ENCODER_H
+
+#include <stdint.h>
+
+/** @brief Name of the board the encoder was generated for */
+extern const char route_encoder_board[];
+
+/** @brief CRC-32 of that board's profile, compared with hw_tables.profile_crc */
+extern const uint32_t route_encoder_profile_crc;
+
+/**
+ * @brief Compile a pedal chain into the routing chains of a frame
+ *
+ * Overwrites the matrix and inhibit chains, as matrix_compile() does.
+ *
+ * @param chain Pedal numbers (1-based) in signal order
+ * @param len Number of pedals in the chain, 0 for bypass
+ * @param outputs Outputs to feed, MATRIX_OUTPUT_BIT() mask
+ * @param meter_tap Source on the meter tap, MATRIX_METER_OFF if it is inhibited
+ * @param[in,out] frame Frame bytes (sr_frame_t.b)
+ */
+void route_encoder_compile(const uint8_t *chain, uint8_t len, uint8_t outputs, uint8_t meter_tap, uint8_t *frame);
+
+#endif /* ROUTE_ENCODER_H */
@@ -0,0 +1,265 @@
+/**
+ * @file show.c
+ * @brief Implementation of shows run from the show image
+ *
+ * The partition is mapped once and stays mapped. Everything read while a
+ * show runs is read from flash through the cache; a song change touches one
+ * song record and its steps.
+ */
+
+#include <string.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "show.h"
+#include "hw_profile.h"
+
+#ifdef CONFIG_SHOW_ENABLE
+
+static const char *TAG = "Show";
+
+/** @brief Header of the checked image, NULL if there is none */
+static const show_header_t *header;
+/** @brief Song table */
+static const show_song_t *songs;
+/** @brief Step table */
+static const show_step_t *steps;
+/** @brief MIDI block */
+static const uint8_t *midi;
+/** @brief Show name, NUL terminated */
+static char name[SHOW_NAME_LEN + 1];
+
+/**
+ * @brief Steps of a song
+ */
+static int _step_count(const show_song_t *s)
+{
+    return s->scene_count ? s->scene_count : 1;
+}
+
+/**
+ * @brief Check the image layout and every song in it
+ *
+ * @param image Start of the mapped image
+ * @param size Size of the partition
+ * @return true if the image can be run
+ */
+static bool _check(const uint8_t *image, size_t size)
+{
+    const show_header_t *h = (const show_header_t *)image;
+    if (h->magic != SHOW_MAGIC)
+    {
+        return false; // Erased or never written: no show, not an error
+    }
+    if (h->version != SHOW_VERSION)
+    {
+        ESP_LOGE(TAG, "Show image version %d, firmware reads version %d", h->version, SHOW_VERSION);
+        return false;
+    }
+    if (h->length > size - sizeof(*h))
+    {
+        ESP_LOGE(TAG, "Show image of %lu bytes does not fit the partition", (unsigned long)h->length);
+        return false;
+    }
+    if (esp_rom_crc32_le(0, image + sizeof(*h), h->length) != h->crc32)
+    {
+        ESP_LOGE(TAG, "Show image CRC mismatch");
+        return false;
+    }
+    if (h->profile_crc != hw_tables.profile_crc)
+    {
+        ESP_LOGE(TAG, "Show image compiled for another board profile (%08lx, this board %08lx)",
+                 (unsigned long)h->profile_crc, (unsigned long)hw_tables.profile_crc);
+        return false;
+    }
+
+    uint64_t end = sizeof(*h) + (uint64_t)h->length;
+    if (h->songs_offset + (uint64_t)h->song_count * sizeof(show_song_t) > end ||
+        h->steps_offset + (uint64_t)h->step_count * sizeof(show_step_t) > end ||
+        h->midi_offset + (uint64_t)h->midi_length > end)
+    {
+        ESP_LOGE(TAG, "Show image tables out of bounds");
+        return false;
+    }
+
+    const show_song_t *s = (const show_song_t *)(image + h->songs_offset);
+    for (int i = 0; i < h->song_count; i++, s++)
+    {
+        bool ok = s->len <= SHOW_CHAIN_LEN && s->scene_count <= PATCH_SCENES_MAX &&
+                  s->scene < _step_count(s) && s->first_step + _step_count(s) <= h->step_count &&
+                  s->midi_offset + (uint64_t)s->midi_length <= h->midi_length;
+        for (int p = 0; ok && p < s->len; p++)
+        {
+            ok = s->chain[p] >= 1 && s->chain[p] <= hw_tables.num_pedals;
+        }
+        if (!ok)
+        {
+            ESP_LOGE(TAG, "Song %d of the show image is invalid", i + 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Map and check the show image
+ */
+void show_init(void)
+{
+    const esp_partition_t *part =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SHOW_PARTITION_SUBTYPE, SHOW_PARTITION_LABEL);
+    if (part == NULL)
+    {
+        ESP_LOGI(TAG, "No show partition");
+        return;
+    }
+    const void *image;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &image, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Mapping the show partition failed: %s", esp_err_to_name(err));
+        return;
+    }
+    if (part->size < sizeof(show_header_t) || !_check(image, part->size))
+    {
+        esp_partition_munmap(handle);
+        return;
+    }
+
+    header = image;
+    songs = (const show_song_t *)((const uint8_t *)image + header->songs_offset);
+    steps = (const show_step_t *)((const uint8_t *)image + header->steps_offset);
+    midi = (const uint8_t *)image + header->midi_offset;
+    memcpy(name, header->name, SHOW_NAME_LEN);
+    ESP_LOGI(TAG, "Show '%s': %d songs, %d steps, %lu MIDI bytes", name, header->song_count, header->step_count,
+             (unsigned long)header->midi_length);
+}
+
+/**
+ * @brief Get the number of songs in the show
+ *
+ * @return Songs, 0 if there is no valid show image
+ */
+int show_song_count(void)
+{
+    return header ? header->song_count : 0;
+}
+
+/**
+ * @brief Get the name of the show
+ *
+ * @return Show name, NUL terminated
+ */
+const char *show_name(void)
+{
+    return name;
+}
+
+/**
+ * @brief Get a song of the show
+ *
+ * @param song Song index, below show_song_count()
+ * @return Song in the mapped image
+ */
+const show_song_t *show_song(int song)
+{
+    return &songs[song];
+}
+
+/**
+ * @brief Get the chain and settings of a song as a live patch
+ *
+ * @param song Song index
+ * @param[out] chain Chain, CHAIN_LEN_MAX entries
+ * @param[out] len Chain length
+ * @param[out] settings Settings of the song
+ */
+void show_get_patch(int song, uint8_t *chain, uint8_t *len, patch_settings_t *settings)
+{
+    const show_song_t *s = &songs[song];
+    memset(chain, 0, CHAIN_LEN_MAX);
+    memcpy(chain, s->chain, s->len);
+    *len = s->len;
+
+    patch_settings_get_default(settings);
+    settings->tap_period_us = s->tap_period_us;
+    settings->ctl_mask = s->ctl_mask;
+    settings->outputs = s->outputs;
+    settings->scene_count = s->scene_count;
+    settings->scene = s->scene;
+    for (int i = 0; i < s->scene_count; i++)
+    {
+        settings->scene_mask[i] = steps[s->first_step + i].pedal_mask;
+    }
+}
+
+/**
+ * @brief Fill a prepared patch from the compiled steps of a song
+ *
+ * The scene deltas are taken against the first step instead of the full
+ * chain; matrix_select_scene() only ever XORs two of them, so the base
+ * cancels out.
+ *
+ * @param song Song index
+ * @param[out] prepared Patch to pass to matrix_apply() or matrix_preshift()
+ */
+void show_prepare(int song, matrix_prepared_t *prepared)
+{
+    const show_song_t *s = &songs[song];
+    const show_step_t *first = &steps[s->first_step];
+    memcpy(prepared->chain, s->chain, s->len);
+    prepared->len = s->len;
+    prepared->controls = s->ctl_mask;
+    prepared->outputs = s->outputs;
+    prepared->scene_count = s->scene_count;
+    prepared->scene = s->scene;
+    memcpy(prepared->route, first[s->scene].route, MATRIX_ROUTE_BYTES);
+    for (int i = 0; i < s->scene_count; i++)
+    {
+        for (int b = 0; b < MATRIX_ROUTE_BYTES; b++)
+        {
+            prepared->delta[i][b] = first[i].route[b] ^ first[0].route[b];
+        }
+        prepared->remote[i] = 0;
+    }
+    prepared->remote_len = 0;
+}
+
+/**
+ * @brief Get the latch plan of a song change
+ *
+ * @param from Song playing, -1 if none
+ * @param to Song to switch to
+ * @return Plan in the mapped image
+ */
+const matrix_plan_t *show_plan(int from, int to)
+{
+    const show_song_t *s = &songs[to];
+    if (from >= 0 && from == to - 1)
+    {
+        return &s->plan[SHOW_PLAN_FROM_PREV];
+    }
+    if (from >= 0 && from == to + 1)
+    {
+        return &s->plan[SHOW_PLAN_FROM_NEXT];
+    }
+    return &s->plan[SHOW_PLAN_ENTER];
+}
+
+/**
+ * @brief Get the MIDI bytes sent when a song is entered
+ *
+ * @param song Song index
+ * @param[out] len Number of bytes
+ * @return MIDI bytes in the mapped image
+ */
+const uint8_t *show_midi(int song, uint16_t *len)
+{
+    *len = songs[song].midi_length;
+    return midi + songs[song].midi_offset;
+}
+
+#endif /* CONFIG_SHOW_ENABLE */
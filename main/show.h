@@ -0,0 +1,167 @@
+/**
+ * @file show.h
+ * @brief Shows run from a host-compiled image in flash
+ *
+ * A show is a set list compiled on the host by tools/show_compile.py from
+ * the set list, the preset library and the board description. The image
+ * holds, for every song, the compiled routing chains of each of its scenes,
+ * the scene masks, the outputs fed, the control outputs, the tempo, a block
+ * of MIDI bytes to send on entry and the latch plans for arriving from the
+ * song before, from the song after and from anywhere else. It is written to the "show" data
+ * partition and mapped into the address space with esp_partition_mmap(), so
+ * running a show takes no NVS reads, no compiling and no copies beyond the
+ * prepared patch: switching songs is indexing into the image.
+ *
+ * The image is checked once at boot: magic, version, CRC, bounds, and the
+ * CRC of the hardware profile it was compiled for against the one running.
+ * Routes compiled for other wiring are never latched.
+ *
+ * Layout (little endian, packed): show_header_t, then song_count
+ * show_song_t at songs_offset, step_count show_step_t at steps_offset and
+ * midi_length bytes of MIDI at midi_offset. All offsets are from the start
+ * of the image.
+ */
+
+#ifndef SHOW_H
+#define SHOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "matrix.h"
+#include "patch_settings.h"
+
+#define SHOW_MAGIC 0x574F4853  /**< "SHOW" */
+#define SHOW_VERSION 2         /**< Image layout version */
+#define SHOW_PARTITION_SUBTYPE 0x40 /**< Data partition subtype of the show partition */
+#define SHOW_PARTITION_LABEL "show" /**< Label of the show partition */
+#define SHOW_NAME_LEN 16       /**< Show and song names, NUL padded */
+#define SHOW_CHAIN_LEN 8       /**< Chain entries per song, pedals on this unit only */
+#define SHOW_ROUTE_BYTES 16    /**< Routing chain bytes per step, MATRIX_ROUTE_BYTES */
+
+/**
+ * @brief Latch plans stored with each song, by where the show comes from
+ */
+typedef enum
+{
+    SHOW_PLAN_FROM_PREV = 0, /**< From the song before: the next footswitch */
+    SHOW_PLAN_FROM_NEXT,     /**< From the song after: the previous footswitch */
+    SHOW_PLAN_ENTER,         /**< From any other song, or at the start */
+    SHOW_PLANS
+} show_plan_from_t;
+
+/**
+ * @brief Image header
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;         /**< SHOW_MAGIC */
+    uint16_t version;       /**< SHOW_VERSION */
+    uint16_t reserved;      /**< Zero */
+    uint32_t length;        /**< Bytes following the header */
+    uint32_t crc32;         /**< CRC-32 of the bytes following the header */
+    uint32_t profile_crc;   /**< hw_tables.profile_crc of the board compiled for */
+    uint16_t song_count;    /**< Songs in the set list */
+    uint16_t step_count;    /**< Steps of all songs */
+    uint32_t songs_offset;  /**< Offset of the song table */
+    uint32_t steps_offset;  /**< Offset of the step table */
+    uint32_t midi_offset;   /**< Offset of the MIDI block */
+    uint32_t midi_length;   /**< Bytes in the MIDI block */
+    char name[SHOW_NAME_LEN]; /**< Show name */
+} show_header_t;
+
+/**
+ * @brief One song of the set list
+ */
+typedef struct __attribute__((packed))
+{
+    char name[SHOW_NAME_LEN];       /**< Song name */
+    uint8_t chain[SHOW_CHAIN_LEN];  /**< Pedal numbers (1-based) in signal order */
+    uint8_t len;                    /**< Length of chain */
+    uint8_t scene_count;            /**< Scenes, 0 if every pedal in the chain always plays */
+    uint8_t scene;                  /**< Scene active on entry */
+    uint8_t ctl_mask;               /**< Control outputs */
+    uint8_t outputs;                /**< Outputs fed, MATRIX_OUTPUT_BIT() mask */
+    uint32_t tap_period_us;         /**< Tap tempo period, 0 for no tap output */
+    uint16_t first_step;            /**< First step of the song, one step per scene or one if it has none */
+    uint16_t midi_length;           /**< MIDI bytes sent on entry */
+    uint32_t midi_offset;           /**< Offset of those bytes in the MIDI block */
+    matrix_plan_t plan[SHOW_PLANS]; /**< How to latch the song, by show_plan_from_t */
+} show_song_t;
+
+/**
+ * @brief One scene of a song, compiled
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t route[SHOW_ROUTE_BYTES]; /**< Routing chains, meter tap inhibited and control outputs off */
+    uint16_t pedal_mask;             /**< Pedals playing, bit N = pedal N+1 */
+    uint16_t reserved;               /**< Zero */
+} show_step_t;
+
+/**
+ * @brief Map and check the show image
+ *
+ * Must be called after hw_profile_init() and before buttons_init(). Without
+ * a valid image for this board the show has no songs.
+ */
+void show_init(void);
+
+/**
+ * @brief Get the number of songs in the show
+ *
+ * @return Songs, 0 if there is no valid show image
+ */
+int show_song_count(void);
+
+/**
+ * @brief Get the name of the show
+ *
+ * @return Show name, NUL terminated
+ */
+const char *show_name(void);
+
+/**
+ * @brief Get a song of the show
+ *
+ * @param song Song index, below show_song_count()
+ * @return Song in the mapped image
+ */
+const show_song_t *show_song(int song);
+
+/**
+ * @brief Get the chain and settings of a song as a live patch
+ *
+ * @param song Song index
+ * @param[out] chain Chain, CHAIN_LEN_MAX entries
+ * @param[out] len Chain length
+ * @param[out] settings Settings of the song
+ */
+void show_get_patch(int song, uint8_t *chain, uint8_t *len, patch_settings_t *settings);
+
+/**
+ * @brief Fill a prepared patch from the compiled steps of a song
+ *
+ * @param song Song index
+ * @param[out] prepared Patch to pass to matrix_apply() or matrix_preshift()
+ */
+void show_prepare(int song, matrix_prepared_t *prepared);
+
+/**
+ * @brief Get the latch plan of a song change
+ *
+ * @param from Song playing, -1 if none
+ * @param to Song to switch to
+ * @return Plan in the mapped image
+ */
+const matrix_plan_t *show_plan(int from, int to);
+
+/**
+ * @brief Get the MIDI bytes sent when a song is entered
+ *
+ * @param song Song index
+ * @param[out] len Number of bytes
+ * @return MIDI bytes in the mapped image
+ */
+const uint8_t *show_midi(int song, uint16_t *len);
+
+#endif /* SHOW_H */
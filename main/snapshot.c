@@ -0,0 +1,347 @@
+/**
+ * @file snapshot.c
+ * @brief Implementation of snapshot export and restore
+ *
+ * Staged records are kept under their key prefixed with the digit of
+ * their snapshot_ns_t. The commit marker holds one bit per namespace the
+ * image covers; only those namespaces are replaced.
+ */
+
+#include <string.h>
+#include <nvs.h>
+#include <esp_log.h>
+
+#include "snapshot.h"
+#include "snapshot_proto.h"
+#include "hw_profile.h"
+#include "power.h"
+
+#define NVS_NAMESPACE "patch_bay"             /**< Same namespace as the patch blobs */
+#define SNAPSHOT_STAGE_NAMESPACE "snap_stage" /**< Records of an image being restored */
+#define SNAPSHOT_STAGE_KEY_COMMIT "~commit"   /**< Marker of a complete staged image, never a record key */
+
+static const char *TAG = "Snapshot";
+
+/** @brief NVS namespace of each snapshot_ns_t */
+static const char *const ns_names[SNAPSHOT_NS_COUNT] = {
+    [SNAPSHOT_NS_PATCH] = NVS_NAMESPACE,
+    [SNAPSHOT_NS_PROFILE] = HW_PROFILE_NVS_NAMESPACE,
+};
+
+/**
+ * @brief Export in progress
+ */
+typedef struct
+{
+    snapshot_write_fn_t write; /**< Receives the image */
+    void *ctx;                 /**< Passed to write */
+    uint32_t crc;              /**< CRC of the image so far */
+    esp_err_t err;             /**< First error of write */
+} snapshot_export_t;
+
+/** @brief Decoder of the image being restored */
+static snapshot_decoder_t decoder;
+/** @brief Staging namespace, open while a restore is in progress */
+static nvs_handle_t stage_handle;
+/** @brief A restore is in progress */
+static bool staging;
+/** @brief Decoder status of the restore */
+static snapshot_status_t stage_status;
+/** @brief First error writing a staged record */
+static esp_err_t stage_err;
+/** @brief Namespaces the staged records belong to, one bit per snapshot_ns_t */
+static uint8_t stage_ns_mask;
+
+/**
+ * @brief Pass image bytes on and add them to the CRC
+ */
+static void _emit(snapshot_export_t *exp, const uint8_t *data, size_t len)
+{
+    if (exp->err == ESP_OK)
+    {
+        exp->crc = snapshot_crc32(exp->crc, data, len);
+        exp->err = exp->write(data, len, exp->ctx);
+    }
+}
+
+/**
+ * @brief Go through every record that goes into an image
+ *
+ * @param exp Export to stream the records to, NULL to only count them
+ * @return Records found
+ */
+static uint16_t _walk(snapshot_export_t *exp)
+{
+    uint16_t count = 0;
+    uint8_t blob[SNAPSHOT_BLOB_MAX];
+    for (int ns = 0; ns < SNAPSHOT_NS_COUNT; ns++)
+    {
+        nvs_handle_t nvs_handle;
+        if (nvs_open(ns_names[ns], NVS_READONLY, &nvs_handle) != ESP_OK)
+        {
+            continue; // Nothing stored in it yet
+        }
+        nvs_iterator_t it = NULL;
+        esp_err_t res = nvs_entry_find(NVS_DEFAULT_PART_NAME, ns_names[ns], NVS_TYPE_BLOB, &it);
+        while (res == ESP_OK)
+        {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+            size_t len = sizeof(blob);
+            if (strlen(info.key) > SNAPSHOT_KEY_MAX ||
+                nvs_get_blob(nvs_handle, info.key, exp ? blob : NULL, &len) != ESP_OK || len == 0 ||
+                len > SNAPSHOT_BLOB_MAX)
+            {
+                if (exp)
+                {
+                    ESP_LOGW(TAG, "Record %s/%s left out", ns_names[ns], info.key);
+                }
+            }
+            else
+            {
+                count++;
+                if (exp)
+                {
+                    uint8_t head[SNAPSHOT_RECORD_HEAD_MAX];
+                    _emit(exp, head, snapshot_put_record_head(head, ns, info.key, len));
+                    _emit(exp, blob, len);
+                }
+            }
+            res = nvs_entry_next(&it);
+        }
+        nvs_release_iterator(it);
+        nvs_close(nvs_handle);
+    }
+    return count;
+}
+
+/**
+ * @brief Move a complete staged image over the live records
+ *
+ * @return ESP_OK if an image was moved, ESP_ERR_NOT_FOUND if none is
+ *         staged, or an error code
+ */
+static esp_err_t _promote(void)
+{
+    nvs_handle_t stage;
+    uint8_t mask = 0;
+    if (nvs_open(SNAPSHOT_STAGE_NAMESPACE, NVS_READWRITE, &stage) != ESP_OK)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (nvs_get_u8(stage, SNAPSHOT_STAGE_KEY_COMMIT, &mask) != ESP_OK)
+    {
+        nvs_close(stage);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    nvs_handle_t target[SNAPSHOT_NS_COUNT];
+    esp_err_t err = ESP_OK;
+    int opened = 0;
+    while (opened < SNAPSHOT_NS_COUNT && err == ESP_OK)
+    {
+        err = nvs_open(ns_names[opened], NVS_READWRITE, &target[opened]);
+        if (err != ESP_OK)
+        {
+            break;
+        }
+        if (mask & (1 << opened))
+        {
+            err = nvs_erase_all(target[opened]); // Records the image does not have go too
+        }
+        opened++;
+    }
+
+    nvs_iterator_t it = NULL;
+    esp_err_t res = err == ESP_OK ? nvs_entry_find(NVS_DEFAULT_PART_NAME, SNAPSHOT_STAGE_NAMESPACE, NVS_TYPE_BLOB, &it)
+                                  : ESP_ERR_NVS_NOT_FOUND;
+    int moved = 0;
+    while (res == ESP_OK && err == ESP_OK)
+    {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        int ns = info.key[0] - '0';
+        if (ns >= 0 && ns < SNAPSHOT_NS_COUNT)
+        {
+            uint8_t blob[SNAPSHOT_BLOB_MAX];
+            size_t len = sizeof(blob);
+            err = nvs_get_blob(stage, info.key, blob, &len);
+            if (err == ESP_OK)
+            {
+                err = nvs_set_blob(target[ns], &info.key[1], blob, len);
+                moved++;
+            }
+        }
+        res = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+
+    for (int ns = 0; ns < opened; ns++)
+    {
+        if (err == ESP_OK && (mask & (1 << ns)))
+        {
+            err = nvs_commit(target[ns]);
+        }
+        nvs_close(target[ns]);
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_erase_all(stage); // Done: the marker goes with the records
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(stage);
+        }
+    }
+    nvs_close(stage);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Restoring the staged snapshot failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Restored %d records", moved);
+    return ESP_OK;
+}
+
+/**
+ * @brief Decoder callback: write one record to the staging namespace
+ */
+static bool _stage_record(const snapshot_record_t *rec, void *ctx)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    key[0] = '0' + rec->ns;
+    strcpy(&key[1], rec->key); // SNAPSHOT_KEY_MAX leaves room for the prefix
+    stage_err = nvs_set_blob(stage_handle, key, rec->data, rec->len);
+    stage_ns_mask |= 1 << rec->ns;
+    return stage_err == ESP_OK;
+}
+
+/**
+ * @brief Finish a restore that a reset interrupted
+ */
+void snapshot_init(void)
+{
+    // Before the PM locks exist, and nothing else runs yet
+    if (_promote() == ESP_OK)
+    {
+        ESP_LOGW(TAG, "Finished restoring a snapshot that a reset interrupted");
+    }
+}
+
+/**
+ * @brief Stream an image of every stored record
+ *
+ * @param write Called with the image bytes in order
+ * @param ctx Passed to @p write
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t snapshot_export(snapshot_write_fn_t write, void *ctx)
+{
+    snapshot_export_t exp = {
+        .write = write,
+        .ctx = ctx,
+    };
+    uint16_t count = _walk(NULL);
+    uint8_t header[SNAPSHOT_HEADER_SIZE];
+    _emit(&exp, header, snapshot_put_header(header, count));
+    if (_walk(&exp) != count && exp.err == ESP_OK)
+    {
+        exp.err = ESP_ERR_INVALID_STATE; // A record was written or erased in between
+    }
+    uint8_t trailer[4];
+    for (int i = 0; i < 4; i++)
+    {
+        trailer[i] = (uint8_t)(exp.crc >> (8 * i));
+    }
+    _emit(&exp, trailer, sizeof(trailer));
+    if (exp.err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Export failed: %s", esp_err_to_name(exp.err));
+        return exp.err;
+    }
+    ESP_LOGI(TAG, "Exported %d records", count);
+    return ESP_OK;
+}
+
+/**
+ * @brief Start a restore, dropping any image staged before
+ *
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t snapshot_restore_begin(void)
+{
+    if (staging)
+    {
+        nvs_close(stage_handle);
+        staging = false;
+    }
+    esp_err_t err = nvs_open(SNAPSHOT_STAGE_NAMESPACE, NVS_READWRITE, &stage_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+        return err;
+    }
+    err = nvs_erase_all(stage_handle);
+    if (err != ESP_OK)
+    {
+        nvs_close(stage_handle);
+        return err;
+    }
+    snapshot_decoder_init(&decoder);
+    stage_status = SNAPSHOT_MORE;
+    stage_err = ESP_OK;
+    stage_ns_mask = 0;
+    staging = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief Feed the next bytes of the image being restored
+ *
+ * @param data Bytes
+ * @param len Number of bytes
+ * @return ESP_OK if the bytes were taken, ESP_ERR_INVALID_CRC for a
+ *         malformed image, or an error code from staging
+ */
+esp_err_t snapshot_restore_feed(const uint8_t *data, size_t len)
+{
+    if (!staging)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    power_lock(POWER_LOCK_PERSIST);
+    stage_status = snapshot_decode(&decoder, data, len, _stage_record, NULL);
+    power_unlock(POWER_LOCK_PERSIST);
+    if (stage_status == SNAPSHOT_ERROR)
+    {
+        return stage_err != ESP_OK ? stage_err : ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Replace the stored configuration with the staged image
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no complete image
+ *         was fed, or an error code
+ */
+esp_err_t snapshot_restore_commit(void)
+{
+    if (!staging || stage_status != SNAPSHOT_DONE)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    power_lock(POWER_LOCK_PERSIST);
+    esp_err_t err = nvs_set_u8(stage_handle, SNAPSHOT_STAGE_KEY_COMMIT, stage_ns_mask);
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(stage_handle);
+    }
+    nvs_close(stage_handle);
+    staging = false;
+    if (err == ESP_OK)
+    {
+        err = _promote();
+    }
+    power_unlock(POWER_LOCK_PERSIST);
+    return err;
+}
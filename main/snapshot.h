@@ -0,0 +1,77 @@
+/**
+ * @file snapshot.h
+ * @brief Export and restore of the whole stored configuration
+ *
+ * snapshot_export() streams every stored record (see snapshot_proto.h) to
+ * a write function as it reads them, one record at a time.
+ *
+ * A restore is fed the image in pieces of any size. Records are written to
+ * a staging namespace as they arrive, so the whole image is never held in
+ * RAM, and the live records are left alone until the image is complete and
+ * its CRC checked. snapshot_restore_commit() then marks the staged image
+ * complete and moves it over in one batch: the namespaces it covers are
+ * cleared, every record is written, and each namespace is committed once.
+ * If the unit resets during the batch, snapshot_init() finishes it at the
+ * next boot. The restored configuration is used from the next boot on.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/**
+ * @brief Receives the bytes of an exported image
+ *
+ * @param data Bytes
+ * @param len Number of bytes
+ * @param ctx Caller context
+ * @return ESP_OK, or an error code to stop the export
+ */
+typedef esp_err_t (*snapshot_write_fn_t)(const uint8_t *data, size_t len, void *ctx);
+
+/**
+ * @brief Finish a restore that a reset interrupted
+ *
+ * Must be called after the NVS is initialized and before anything loads
+ * its records.
+ */
+void snapshot_init(void);
+
+/**
+ * @brief Stream an image of every stored record
+ *
+ * @param write Called with the image bytes in order
+ * @param ctx Passed to @p write
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t snapshot_export(snapshot_write_fn_t write, void *ctx);
+
+/**
+ * @brief Start a restore, dropping any image staged before
+ *
+ * @return ESP_OK on success, or an error code
+ */
+esp_err_t snapshot_restore_begin(void);
+
+/**
+ * @brief Feed the next bytes of the image being restored
+ *
+ * @param data Bytes
+ * @param len Number of bytes
+ * @return ESP_OK if the bytes were taken, ESP_ERR_INVALID_CRC for a
+ *         malformed image, or an error code from staging
+ */
+esp_err_t snapshot_restore_feed(const uint8_t *data, size_t len);
+
+/**
+ * @brief Replace the stored configuration with the staged image
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no complete image
+ *         was fed, or an error code
+ */
+esp_err_t snapshot_restore_commit(void);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,218 @@
+/**
+ * @file snapshot_proto.c
+ * @brief Implementation of the snapshot image format
+ */
+
+#include <string.h>
+#include "snapshot_proto.h"
+
+/**
+ * @brief Decoder states
+ */
+enum
+{
+    DEC_HEADER = 0,
+    DEC_NS,
+    DEC_KEY_LEN,
+    DEC_KEY,
+    DEC_LEN,
+    DEC_DATA,
+    DEC_CRC,
+    DEC_DONE,
+    DEC_ERROR,
+};
+
+/**
+ * @brief Update a zlib CRC-32
+ *
+ * Four bits at a time from a 16-entry table, small enough for the stack of
+ * any task.
+ *
+ * @param crc CRC so far, 0 to start
+ * @param data Bytes
+ * @param len Number of bytes
+ * @return Updated CRC
+ */
+uint32_t snapshot_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Write the image header
+ *
+ * @param[out] out SNAPSHOT_HEADER_SIZE bytes
+ * @param count Records that follow
+ * @return Bytes written
+ */
+size_t snapshot_put_header(uint8_t *out, uint16_t count)
+{
+    uint32_t magic = SNAPSHOT_MAGIC;
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = (uint8_t)(magic >> (8 * i));
+    }
+    out[4] = SNAPSHOT_VERSION;
+    out[5] = 0; // Flags, none defined
+    out[6] = count & 0xFF;
+    out[7] = count >> 8;
+    return SNAPSHOT_HEADER_SIZE;
+}
+
+/**
+ * @brief Write the head of a record, the bytes in front of its blob
+ *
+ * @param[out] out SNAPSHOT_RECORD_HEAD_MAX bytes
+ * @param ns snapshot_ns_t
+ * @param key Key, at most SNAPSHOT_KEY_MAX characters
+ * @param len Blob length
+ * @return Bytes written, 0 if the key is too long
+ */
+size_t snapshot_put_record_head(uint8_t *out, uint8_t ns, const char *key, uint16_t len)
+{
+    size_t key_len = strlen(key);
+    if (key_len == 0 || key_len > SNAPSHOT_KEY_MAX)
+    {
+        return 0;
+    }
+    size_t n = 0;
+    out[n++] = ns;
+    out[n++] = (uint8_t)key_len;
+    memcpy(&out[n], key, key_len);
+    n += key_len;
+    out[n++] = len & 0xFF;
+    out[n++] = len >> 8;
+    return n;
+}
+
+/**
+ * @brief Start decoding a new image
+ *
+ * @param dec Decoder
+ */
+void snapshot_decoder_init(snapshot_decoder_t *dec)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->state = DEC_HEADER;
+}
+
+/**
+ * @brief Move on to the next record, or to the CRC after the last one
+ */
+static void _next_record(snapshot_decoder_t *dec)
+{
+    dec->pos = 0;
+    dec->state = dec->left ? DEC_NS : DEC_CRC;
+}
+
+/**
+ * @brief Feed image bytes to the decoder
+ *
+ * @param dec Decoder
+ * @param data Bytes
+ * @param len Number of bytes
+ * @param on_record Called for every complete record
+ * @param ctx Passed to @p on_record
+ * @return Decoder status after these bytes
+ */
+snapshot_status_t snapshot_decode(snapshot_decoder_t *dec, const uint8_t *data, size_t len,
+                                  snapshot_record_fn_t on_record, void *ctx)
+{
+    for (size_t i = 0; i < len && dec->state < DEC_DONE; i++)
+    {
+        uint8_t byte = data[i];
+        if (dec->state != DEC_CRC)
+        {
+            dec->crc = snapshot_crc32(dec->crc, &byte, 1);
+        }
+        switch (dec->state)
+        {
+        case DEC_HEADER:
+            dec->field[dec->pos++] = byte;
+            if (dec->pos == SNAPSHOT_HEADER_SIZE)
+            {
+                const uint8_t *h = dec->field;
+                uint32_t magic = h[0] | h[1] << 8 | h[2] << 16 | (uint32_t)h[3] << 24;
+                if (magic != SNAPSHOT_MAGIC || h[4] == 0 || h[4] > SNAPSHOT_VERSION)
+                {
+                    dec->state = DEC_ERROR;
+                    break;
+                }
+                dec->left = h[6] | h[7] << 8;
+                _next_record(dec);
+            }
+            break;
+        case DEC_NS:
+            dec->rec.ns = byte;
+            dec->state = byte < SNAPSHOT_NS_COUNT ? DEC_KEY_LEN : DEC_ERROR;
+            break;
+        case DEC_KEY_LEN:
+            if (byte == 0 || byte > SNAPSHOT_KEY_MAX)
+            {
+                dec->state = DEC_ERROR;
+                break;
+            }
+            dec->field[0] = byte;
+            dec->pos = 0;
+            dec->state = DEC_KEY;
+            break;
+        case DEC_KEY:
+            dec->rec.key[dec->pos++] = (char)byte;
+            if (dec->pos == dec->field[0])
+            {
+                dec->rec.key[dec->pos] = '\0';
+                dec->pos = 0;
+                dec->state = DEC_LEN;
+            }
+            break;
+        case DEC_LEN:
+            dec->field[dec->pos++] = byte;
+            if (dec->pos == 2)
+            {
+                dec->rec.len = dec->field[0] | dec->field[1] << 8;
+                dec->pos = 0;
+                if (dec->rec.len == 0 || dec->rec.len > SNAPSHOT_BLOB_MAX)
+                {
+                    dec->state = DEC_ERROR; // NVS has no empty blobs, and nothing stored is this large
+                    break;
+                }
+                dec->state = DEC_DATA;
+            }
+            break;
+        case DEC_DATA:
+            dec->rec.data[dec->pos++] = byte;
+            if (dec->pos == dec->rec.len)
+            {
+                if (!on_record(&dec->rec, ctx))
+                {
+                    dec->state = DEC_ERROR;
+                    break;
+                }
+                dec->left--;
+                _next_record(dec);
+            }
+            break;
+        case DEC_CRC:
+            dec->field[dec->pos++] = byte;
+            if (dec->pos == 4)
+            {
+                const uint8_t *c = dec->field;
+                uint32_t crc = c[0] | c[1] << 8 | c[2] << 16 | (uint32_t)c[3] << 24;
+                dec->state = crc == dec->crc ? DEC_DONE : DEC_ERROR;
+            }
+            break;
+        }
+    }
+    return dec->state == DEC_DONE ? SNAPSHOT_DONE : dec->state == DEC_ERROR ? SNAPSHOT_ERROR : SNAPSHOT_MORE;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file snapshot_proto.h
+ * @brief Binary snapshot of the stored configuration
+ *
+ * A snapshot holds every stored record of a unit (patch chains, patch
+ * settings with their scenes and tempo, the preset prediction table and the
+ * hardware profile) as its raw blob, so it carries records of newer or
+ * older layouts unchanged. It is written and read as a stream: the header
+ * says how many records follow, each record says how long it is, and a
+ * CRC-32 over everything before it ends the image. Neither side needs the
+ * whole image in RAM, only one record at a time.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host.
+ *
+ * Image layout, all numbers little-endian:
+ * @code
+ * "PBSN" | version | flags | count (u16) | record[count] | crc32
+ * record = ns | key_len | key[key_len] | len (u16) | data[len]
+ * @endcode
+ * ns is a snapshot_ns_t. The CRC is the zlib CRC-32.
+ */
+
+#ifndef SNAPSHOT_PROTO_H
+#define SNAPSHOT_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SNAPSHOT_MAGIC 0x4E534250 /**< "PBSN" read as a little-endian word */
+#define SNAPSHOT_VERSION 1        /**< Image layout version */
+#define SNAPSHOT_HEADER_SIZE 8    /**< Bytes before the first record */
+#define SNAPSHOT_KEY_MAX 14       /**< Longest key, one less than NVS allows so staging can prefix it */
+#define SNAPSHOT_BLOB_MAX 256     /**< Largest record */
+#define SNAPSHOT_RECORD_HEAD_MAX (SNAPSHOT_KEY_MAX + 4) /**< Longest record head */
+
+/**
+ * @brief Storage areas a record belongs to
+ */
+typedef enum
+{
+    SNAPSHOT_NS_PATCH = 0, /**< Patches, their settings and the prediction table */
+    SNAPSHOT_NS_PROFILE,   /**< Hardware profile */
+    SNAPSHOT_NS_COUNT
+} snapshot_ns_t;
+
+/**
+ * @brief One record, as the decoder hands it over
+ */
+typedef struct
+{
+    uint8_t ns;                          /**< snapshot_ns_t */
+    char key[SNAPSHOT_KEY_MAX + 1];      /**< Key, NUL terminated */
+    uint16_t len;                        /**< Blob length */
+    uint8_t data[SNAPSHOT_BLOB_MAX];     /**< Blob */
+} snapshot_record_t;
+
+/**
+ * @brief Result of feeding bytes to the decoder
+ */
+typedef enum
+{
+    SNAPSHOT_MORE = 0, /**< Image not complete yet */
+    SNAPSHOT_DONE,     /**< Image complete and its CRC matches */
+    SNAPSHOT_ERROR,    /**< Malformed image, CRC mismatch or record refused */
+} snapshot_status_t;
+
+/**
+ * @brief Called for each record as soon as it is complete
+ *
+ * Records arrive before the CRC at the end is checked.
+ *
+ * @param rec Record
+ * @param ctx Caller context
+ * @return false to refuse the record and stop decoding
+ */
+typedef bool (*snapshot_record_fn_t)(const snapshot_record_t *rec, void *ctx);
+
+/**
+ * @brief Incremental decoder state
+ */
+typedef struct
+{
+    uint8_t state;                     /**< Parser state */
+    uint16_t pos;                      /**< Bytes of the current field received */
+    uint16_t left;                     /**< Records still to come */
+    uint32_t crc;                      /**< CRC of the image so far */
+    uint8_t field[SNAPSHOT_HEADER_SIZE]; /**< Header, length or CRC being assembled */
+    snapshot_record_t rec;             /**< Record being assembled */
+} snapshot_decoder_t;
+
+/**
+ * @brief Update a zlib CRC-32
+ *
+ * @param crc CRC so far, 0 to start
+ * @param data Bytes
+ * @param len Number of bytes
+ * @return Updated CRC
+ */
+uint32_t snapshot_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Write the image header
+ *
+ * @param[out] out SNAPSHOT_HEADER_SIZE bytes
+ * @param count Records that follow
+ * @return Bytes written
+ */
+size_t snapshot_put_header(uint8_t *out, uint16_t count);
+
+/**
+ * @brief Write the head of a record, the bytes in front of its blob
+ *
+ * @param[out] out SNAPSHOT_RECORD_HEAD_MAX bytes
+ * @param ns snapshot_ns_t
+ * @param key Key, at most SNAPSHOT_KEY_MAX characters
+ * @param len Blob length
+ * @return Bytes written, 0 if the key is too long
+ */
+size_t snapshot_put_record_head(uint8_t *out, uint8_t ns, const char *key, uint16_t len);
+
+/**
+ * @brief Start decoding a new image
+ *
+ * @param dec Decoder
+ */
+void snapshot_decoder_init(snapshot_decoder_t *dec);
+
+/**
+ * @brief Feed image bytes to the decoder
+ *
+ * Bytes past the end of the image are ignored. After SNAPSHOT_ERROR the
+ * decoder stays in error until snapshot_decoder_init().
+ *
+ * @param dec Decoder
+ * @param data Bytes
+ * @param len Number of bytes
+ * @param on_record Called for every complete record
+ * @param ctx Passed to @p on_record
+ * @return Decoder status after these bytes
+ */
+snapshot_status_t snapshot_decode(snapshot_decoder_t *dec, const uint8_t *data, size_t len,
+                                  snapshot_record_fn_t on_record, void *ctx);
+
+#endif /* SNAPSHOT_PROTO_H */
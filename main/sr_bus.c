@@ -0,0 +1,592 @@
+/**
+ * @file sr_bus.c
+ * @brief Implementation of the shared 74HC595 shift register bus
+ *
+ * All chains are bit-banged in parallel: for every clock the data pins of all
+ * chains are set with one write-1-to-set and one write-1-to-clear access per
+ * GPIO bank, using the pin masks precompiled in hw_tables.
+ *
+ * Tasks shift one register at a time under a spinlock, which is also taken
+ * by sr_bus_panic(). A panic interrupt therefore waits for eight clocks at
+ * most, and once it has frozen the bus no task clock or latch gets between
+ * it and the bypass frame.
+ *
+ * A 74HC165 input chain, if fitted, runs on the same clock with its SH/LD
+ * input on the latch line. The latch pulse loads its parallel inputs and the
+ * next frame clocks them out, so sr_bus_scan() reads the footswitches with
+ * the clocks that shift the outputs: one input sample before each rising
+ * clock edge.
+ *
+ * Chains with QH' of their last register wired back to a GPIO are probed at
+ * boot: the chains are cleared, a marker byte is clocked in and the clocks
+ * counted until it comes out of the far end. Each chain has its own marker,
+ * so a feedback wire on the wrong chain is told apart from a missing one.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <driver/gpio.h>
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <esp_rom_sys.h>
+
+#include "sr_bus.h"
+#include "hw_profile.h"
+
+static const char *TAG = "SrBus";
+
+/** @brief Marker clocked through each chain by the boot probe, MSB first and starting with a 1 */
+static const uint8_t probe_marker[SR_CHAIN_COUNT] = {0xB1, 0xD3, 0xE5};
+/** @brief Chain names for the probe log */
+static const char *const chain_name[SR_CHAIN_COUNT] = {"Matrix", "Inhibit", "LED"};
+
+/** @brief Frame currently latched on the register outputs */
+static sr_frame_t current_frame;
+/** @brief Frame currently held in the shift registers, waiting for a latch edge */
+static sr_frame_t staged_frame;
+/** @brief Pins pulsed on every latch edge: the latch plus any companion pins */
+static uint32_t latch_mask[2];
+/** @brief Held by a writer from reading the current frame until its latch */
+static SemaphoreHandle_t bus_mutex;
+/** @brief Held for each register shifted and for each latch, by tasks and the panic interrupt */
+static portMUX_TYPE shift_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Set by sr_bus_panic(): the outputs keep the panic frame until restart */
+static volatile bool frozen;
+/** @brief A frame is staged and waiting for its latch edge */
+static volatile bool stage_pending;
+/** @brief Task that staged the pending frame */
+static TaskHandle_t stage_owner;
+/** @brief staged_frame was shifted in by sr_bus_preload() and is still in the registers */
+static bool preloaded;
+/** @brief GPIO input register holding the input chain pin */
+static uint32_t in_reg;
+/** @brief Bit of the input chain pin in in_reg */
+static uint32_t in_bit;
+
+FORCE_INLINE_ATTR void _pins_high(const uint32_t mask[2])
+{
+    REG_WRITE(GPIO_OUT_W1TS_REG, mask[0]);
+    REG_WRITE(GPIO_OUT1_W1TS_REG, mask[1]);
+}
+
+FORCE_INLINE_ATTR void _pins_low(const uint32_t mask[2])
+{
+    REG_WRITE(GPIO_OUT_W1TC_REG, mask[0]);
+    REG_WRITE(GPIO_OUT1_W1TC_REG, mask[1]);
+}
+
+/**
+ * @brief Clock register @p reg of every chain, MSB (QH) first
+ *
+ * Shorter chains receive zeros until their own registers come up, which fall
+ * off the end of the chain. The input chain comes out nearest register
+ * first, so the bits read during output register @p reg belong to input
+ * register frame_bytes - 1 - @p reg.
+ *
+ * @param frame Frame to shift
+ * @param reg Register index, shifted from the far end down to 0
+ * @param[out] in Input chain registers, NULL to skip reading them
+ */
+static void IRAM_ATTR _shift_reg(const sr_frame_t *frame, int reg, uint8_t *in)
+{
+    uint8_t in_byte = 0;
+    uint8_t bytes[SR_CHAIN_COUNT];
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        bytes[c] = reg < hw_tables.chain_bytes[c] ? frame->b[SR_FRAME_INDEX(c, reg)] : 0;
+    }
+
+    for (int bit = 7; bit >= 0; bit--)
+    {
+        uint32_t set[2] = {0, 0};
+        for (int c = 0; c < SR_CHAIN_COUNT; c++)
+        {
+            if ((bytes[c] >> bit) & 1)
+            {
+                set[0] |= hw_tables.sr_data_mask[c][0];
+                set[1] |= hw_tables.sr_data_mask[c][1];
+            }
+        }
+        uint32_t clear[2] = {hw_tables.sr_data_all_mask[0] & ~set[0], hw_tables.sr_data_all_mask[1] & ~set[1]};
+        _pins_low(clear);
+        _pins_high(set);
+        if (in)
+        {
+            in_byte = (in_byte << 1) | ((REG_READ(in_reg) >> in_bit) & 1); // QH is valid until the rising edge
+        }
+        _pins_high(hw_tables.sr_clock_mask);
+        _pins_low(hw_tables.sr_clock_mask);
+    }
+
+    int in_index = hw_tables.frame_bytes - 1 - reg;
+    if (in && in_index < hw_tables.sr_in_bytes)
+    {
+        in[in_index] = in_byte;
+    }
+}
+
+/**
+ * @brief Clock a frame into all chains without latching it
+ *
+ * Registers are shifted from the far end of the longest chain down to
+ * register 0. Each register is clocked under the shift lock; once the bus is
+ * frozen the rest of the frame is dropped.
+ *
+ * @param frame Frame to shift
+ * @param[out] in Input chain registers, NULL to skip reading them
+ * @return false if the bus was frozen before the whole frame was shifted
+ */
+static bool _shift(const sr_frame_t *frame, uint8_t *in)
+{
+    preloaded = false;
+    for (int reg = hw_tables.frame_bytes - 1; reg >= 0; reg--)
+    {
+        portENTER_CRITICAL(&shift_lock);
+        bool stop = frozen;
+        if (!stop)
+        {
+            _shift_reg(frame, reg, in);
+        }
+        portEXIT_CRITICAL(&shift_lock);
+        if (stop)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Clock one bit into every chain and read the feedback pins
+ *
+ * @param bits Chains that get a 1, bit N = chain N
+ * @return Feedback level after the clock edge, bit N = chain N
+ */
+static uint8_t _probe_clock(uint8_t bits)
+{
+    uint32_t set[2] = {0, 0};
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        if ((bits >> c) & 1)
+        {
+            set[0] |= hw_tables.sr_data_mask[c][0];
+            set[1] |= hw_tables.sr_data_mask[c][1];
+        }
+    }
+    uint32_t clear[2] = {hw_tables.sr_data_all_mask[0] & ~set[0], hw_tables.sr_data_all_mask[1] & ~set[1]};
+    _pins_low(clear);
+    _pins_high(set);
+    _pins_high(hw_tables.sr_clock_mask);
+    esp_rom_delay_us(1); // QH' settles well within this
+    _pins_low(hw_tables.sr_clock_mask);
+
+    uint8_t levels = 0;
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        if (hw_tables.pin_sr_fb[c] != GPIO_NUM_NC && gpio_get_level(hw_tables.pin_sr_fb[c]))
+        {
+            levels |= 1 << c;
+        }
+    }
+    return levels;
+}
+
+/**
+ * @brief Count the registers of every chain that has a feedback pin
+ *
+ * Nothing is latched, so the outputs do not change. Every chain is first
+ * filled with zeros, then its marker is clocked in followed by zeros. The
+ * marker shows up on QH' after 8 clocks per register, and the 7 bits after
+ * its leading 1 must match it.
+ *
+ * @param[out] found Registers found in each chain, 0 if not probed or the probe failed
+ */
+static void _probe(uint8_t found[SR_CHAIN_COUNT])
+{
+    uint8_t probed = 0;
+    uint64_t mask = 0;
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        found[c] = 0;
+        if (hw_tables.pin_sr_fb[c] != GPIO_NUM_NC && hw_tables.pin_sr_data[c] != GPIO_NUM_NC)
+        {
+            probed |= 1 << c;
+            mask |= 1ULL << hw_tables.pin_sr_fb[c];
+        }
+    }
+    if (!probed)
+    {
+        return;
+    }
+    gpio_config_t fb_conf = {
+        .pin_bit_mask = mask,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE, // An open feedback wire reads as no marker
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    gpio_config(&fb_conf);
+
+    for (int i = 0; i < SR_CHAIN_BYTES_MAX * 8; i++)
+    {
+        _probe_clock(0);
+    }
+    uint8_t stuck = _probe_clock(0) & probed;
+
+    int first[SR_CHAIN_COUNT] = {0};
+    uint8_t echo[SR_CHAIN_COUNT] = {0};
+    for (int k = 1; k <= (SR_CHAIN_BYTES_MAX + 1) * 8; k++)
+    {
+        uint8_t bits = 0;
+        for (int c = 0; c < SR_CHAIN_COUNT && k <= 8; c++)
+        {
+            bits |= ((probe_marker[c] >> (8 - k)) & 1) << c;
+        }
+        uint8_t levels = _probe_clock(bits);
+        for (int c = 0; c < SR_CHAIN_COUNT; c++)
+        {
+            int level = (levels >> c) & 1;
+            if (first[c] == 0 && level)
+            {
+                first[c] = k;
+            }
+            if (first[c] != 0 && k - first[c] < 8)
+            {
+                echo[c] = (echo[c] << 1) | level;
+            }
+        }
+    }
+
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        if (!(probed & (1 << c)))
+        {
+            continue;
+        }
+        int other = -1;
+        for (int o = 0; o < SR_CHAIN_COUNT; o++)
+        {
+            if (o != c && echo[c] == probe_marker[o])
+            {
+                other = o;
+            }
+        }
+        if (stuck & (1 << c))
+        {
+            ESP_LOGE(TAG, "%s chain probe: feedback stays high with the chain cleared, check QH' wiring", chain_name[c]);
+        }
+        else if (first[c] == 0)
+        {
+            ESP_LOGE(TAG, "%s chain probe: no marker came back, check the data and feedback wiring (or more than %d registers)",
+                     chain_name[c], SR_CHAIN_BYTES_MAX);
+        }
+        else if (other >= 0)
+        {
+            ESP_LOGE(TAG, "%s chain probe: feedback pin carries the %s chain, feedback wires crossed", chain_name[c],
+                     chain_name[other]);
+        }
+        else if (echo[c] != probe_marker[c] || first[c] % 8 != 0)
+        {
+            ESP_LOGE(TAG, "%s chain probe: marker 0x%02X came back as 0x%02X after %d clocks, check the chain for a bad link",
+                     chain_name[c], probe_marker[c], echo[c], first[c]);
+        }
+        else
+        {
+            found[c] = first[c] / 8;
+            ESP_LOGI(TAG, "%s chain probe: %d registers", chain_name[c], found[c]);
+        }
+    }
+}
+
+/**
+ * @brief Initialize the shift register bus
+ *
+ * Configures the clock, latch and data GPIOs from the hardware profile,
+ * probes the chains that have a feedback pin and sizes the frame to them,
+ * and latches an all-zero frame while the outputs are still disabled.
+ */
+void sr_bus_init(void)
+{
+    uint64_t mask = 0;
+    for (int c = 0; c < SR_CHAIN_COUNT; c++)
+    {
+        if (hw_tables.pin_sr_data[c] != GPIO_NUM_NC)
+        {
+            mask |= 1ULL << hw_tables.pin_sr_data[c];
+        }
+    }
+    mask |= 1ULL << hw_tables.pin_sr_clock;
+    mask |= 1ULL << hw_tables.pin_sr_latch;
+    if (hw_tables.pin_sr_oe != GPIO_NUM_NC)
+    {
+        mask |= 1ULL << hw_tables.pin_sr_oe;
+        gpio_set_level(hw_tables.pin_sr_oe, 1); // Keep outputs off until a valid frame is latched
+    }
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = mask,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    gpio_config(&io_conf);
+
+    if (hw_tables.pin_sr_in != GPIO_NUM_NC)
+    {
+        gpio_config_t in_conf = {
+            .pin_bit_mask = 1ULL << hw_tables.pin_sr_in,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        gpio_config(&in_conf);
+        in_reg = hw_tables.pin_sr_in < 32 ? GPIO_IN_REG : GPIO_IN1_REG;
+        in_bit = hw_tables.pin_sr_in % 32;
+    }
+
+    bus_mutex = xSemaphoreCreateRecursiveMutex();
+    latch_mask[0] = hw_tables.sr_latch_mask[0];
+    latch_mask[1] = hw_tables.sr_latch_mask[1];
+    gpio_set_level(hw_tables.pin_sr_clock, 0);
+    gpio_set_level(hw_tables.pin_sr_latch, 1); // Idle high, the rising edge latches
+
+    uint8_t found[SR_CHAIN_COUNT];
+    _probe(found);
+    hw_profile_fit_chains(found);
+
+    memset(&current_frame, 0, sizeof(current_frame));
+    sr_bus_commit(&current_frame);
+    ESP_LOGI(TAG, "Shift register bus ready, %d clocks per frame", hw_tables.frame_bytes * 8);
+}
+
+/**
+ * @brief Enable or disable the register outputs
+ *
+ * @param enable true to drive the outputs, false to leave them high impedance
+ */
+void sr_bus_output_enable(bool enable)
+{
+    if (hw_tables.pin_sr_oe != GPIO_NUM_NC)
+    {
+        gpio_set_level(hw_tables.pin_sr_oe, enable ? 0 : 1); // Active low
+    }
+}
+
+/**
+ * @brief Add a companion pin that is pulsed together with the latch
+ *
+ * @param pin GPIO already configured as output
+ */
+void sr_bus_add_latch_pin(gpio_num_t pin)
+{
+    latch_mask[pin / 32] |= 1UL << (pin % 32);
+    gpio_set_level(pin, 1);
+}
+
+/**
+ * @brief Wait until a frame staged by another task is latched
+ *
+ * A writer that stages a frame for an edge it does not drive itself keeps
+ * the bus until that edge, so this only waits on a writer that let go of
+ * the bus too early. After SR_BUS_STAGE_WAIT_MS the stage is given up and
+ * shifted over.
+ */
+static void _wait_stage(void)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    TickType_t start = xTaskGetTickCount();
+    while (stage_pending && stage_owner != self && !frozen)
+    {
+        if (xTaskGetTickCount() - start > pdMS_TO_TICKS(SR_BUS_STAGE_WAIT_MS))
+        {
+            ESP_LOGW(TAG, "Frame staged by another task was not latched, shifting over it");
+            break;
+        }
+        vTaskDelay(1);
+    }
+    stage_owner = self;
+}
+
+/**
+ * @brief Shift a frame into the registers without latching it
+ *
+ * Takes the bus for the shift, so it waits for a writer that holds it. A
+ * frame staged by another task and not yet latched is waited for, not
+ * shifted over. Nothing is shifted if sr_bus_preload() already left the same
+ * frame in the registers.
+ *
+ * @param frame Frame to shift
+ * @return true if the frame was already in the registers
+ */
+bool sr_bus_stage(const sr_frame_t *frame)
+{
+    sr_bus_lock();
+    _wait_stage();
+    bool ready = preloaded && !frozen && memcmp(frame->b, staged_frame.b, SR_FRAME_BYTES) == 0;
+    if (!ready)
+    {
+        _shift(frame, NULL);
+        if (frame != &staged_frame && !frozen)
+        {
+            memcpy(&staged_frame, frame, sizeof(staged_frame));
+        }
+    }
+    preloaded = false;
+    stage_pending = true;
+    sr_bus_unlock();
+    return ready;
+}
+
+/**
+ * @brief Shift a frame that may be latched next into the registers
+ *
+ * The outputs keep the current frame. Any other shift, or a stage of a
+ * different frame, replaces it.
+ *
+ * @param frame Frame to shift
+ * @return true if the frame is in the registers
+ */
+bool sr_bus_preload(const sr_frame_t *frame)
+{
+    if (hw_tables.sr_in_bytes || stage_pending || frozen)
+    {
+        return false; // Every scan shifts the current frame over it, or something is waiting to latch
+    }
+    if (preloaded && memcmp(frame->b, staged_frame.b, SR_FRAME_BYTES) == 0)
+    {
+        return true;
+    }
+    if (_shift(frame, NULL))
+    {
+        memcpy(&staged_frame, frame, sizeof(staged_frame));
+        preloaded = true;
+    }
+    return preloaded;
+}
+
+/**
+ * @brief Latch the staged frame onto the outputs
+ *
+ * One write drops the latch and companion pins and the next raises them, so
+ * all of them see the same rising edge. Nothing is latched once the bus is
+ * frozen.
+ */
+void IRAM_ATTR sr_bus_latch(void)
+{
+    portENTER_CRITICAL_SAFE(&shift_lock);
+    if (!frozen)
+    {
+        _pins_low(latch_mask);
+        _pins_high(latch_mask);
+        current_frame = staged_frame;
+        stage_pending = false;
+    }
+    portEXIT_CRITICAL_SAFE(&shift_lock);
+}
+
+/**
+ * @brief Shift and latch a frame from an interrupt and freeze the bus
+ *
+ * Takes only the shift lock, which a task holds for one register at most.
+ * Shifts and latches run from IRAM on the precompiled pin masks.
+ *
+ * @param frame Frame to output, in internal RAM
+ */
+void IRAM_ATTR sr_bus_panic(const sr_frame_t *frame)
+{
+    portENTER_CRITICAL_ISR(&shift_lock);
+    frozen = true;
+    for (int reg = hw_tables.frame_bytes - 1; reg >= 0; reg--)
+    {
+        _shift_reg(frame, reg, NULL);
+    }
+    _pins_low(latch_mask);
+    _pins_high(latch_mask);
+    staged_frame = *frame;
+    current_frame = *frame;
+    portEXIT_CRITICAL_ISR(&shift_lock);
+}
+
+/**
+ * @brief Read the input chain by shifting the current frame out again
+ *
+ * Skipped if another writer holds the bus or a frame is waiting for its
+ * latch edge, so a scan never latches anything but the frame already on the
+ * outputs. The latch edge that ends the scan loads the inputs for the next
+ * one.
+ *
+ * @param[out] in Input chain registers, hw_tables.sr_in_bytes of them
+ * @return true if the inputs were read
+ */
+bool sr_bus_scan(uint8_t *in)
+{
+    if (hw_tables.sr_in_bytes == 0 || xSemaphoreTakeRecursive(bus_mutex, 0) != pdTRUE)
+    {
+        return false;
+    }
+    bool ok = !stage_pending && _shift(&current_frame, in);
+    if (ok)
+    {
+        sr_bus_latch();
+    }
+    xSemaphoreGiveRecursive(bus_mutex);
+    return ok;
+}
+
+/**
+ * @brief Check whether sr_bus_panic() has frozen the bus
+ *
+ * @return true once the panic frame is latched
+ */
+bool sr_bus_is_frozen(void)
+{
+    return frozen;
+}
+
+/**
+ * @brief Shift a frame into all chains and latch it with a single edge
+ *
+ * Holds the bus from the shift to the latch, and waits for a frame staged by
+ * another task like sr_bus_stage().
+ *
+ * @param frame Frame to output
+ */
+void sr_bus_commit(const sr_frame_t *frame)
+{
+    sr_bus_lock();
+    sr_bus_stage(frame);
+    sr_bus_latch();
+    sr_bus_unlock();
+}
+
+/**
+ * @brief Get the frame that is currently latched on the outputs
+ *
+ * @return Pointer to the last committed frame
+ */
+const sr_frame_t *sr_bus_current(void)
+{
+    return &current_frame;
+}
+
+/**
+ * @brief Take the bus for a read-modify-commit of the current frame
+ */
+void sr_bus_lock(void)
+{
+    xSemaphoreTakeRecursive(bus_mutex, portMAX_DELAY);
+}
+
+/**
+ * @brief Release the bus taken with sr_bus_lock()
+ */
+void sr_bus_unlock(void)
+{
+    xSemaphoreGiveRecursive(bus_mutex);
+}
@@ -0,0 +1,196 @@
+/**
+ * @file sr_bus.h
+ * @brief Shared 74HC595 shift register bus for the ESP32 Patch Bay
+ *
+ * The matrix, inhibit and LED shift register chains each have their own data
+ * pin but share one clock and one latch line. Every clock therefore moves all
+ * three chains, and every latch edge updates all of them, so they are always
+ * shifted together as one frame.
+ *
+ * An optional 74HC165 footswitch chain shares the clock, with its SH/LD
+ * input on the latch line, and is read while a frame is shifted out.
+ */
+
+#ifndef SR_BUS_H
+#define SR_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <driver/gpio.h>
+
+/**
+ * @brief Shift register chains driven in parallel on the shared clock
+ */
+typedef enum
+{
+    SR_CHAIN_MATRIX = 0, /**< Mux select nibbles (MATRIX_SR_DS) */
+    SR_CHAIN_INHIBIT,    /**< Mux inhibit bits (INHIBIT_SR_DS) */
+    SR_CHAIN_LED,        /**< Pedal and status LEDs (LED_SR_DS) */
+    SR_CHAIN_COUNT
+} sr_chain_t;
+
+#define SR_CHAIN_BYTES_MAX 8    /**< Max 74HC595 registers per chain */
+#define SR_BUS_STAGE_WAIT_MS 50 /**< Longest wait for a frame staged by another task to be latched */
+#define SR_FRAME_BYTES (SR_CHAIN_COUNT * SR_CHAIN_BYTES_MAX)
+
+/** @brief Flat frame index of register @p reg in chain @p chain */
+#define SR_FRAME_INDEX(chain, reg) ((chain) * SR_CHAIN_BYTES_MAX + (reg))
+
+/**
+ * @brief Frame index of the scratch byte
+ *
+ * Lanes that are not wired on the current board are compiled to point at this
+ * byte. It is never shifted out, so encoders can write every lane without
+ * checking whether it exists.
+ */
+#define SR_FRAME_SCRATCH SR_FRAME_BYTES
+
+/**
+ * @brief One complete image of all shift register chains
+ *
+ * Register 0 of each chain is the one closest to the ESP32, and bit 0 of a
+ * register is its QA output.
+ */
+typedef struct
+{
+    uint8_t b[SR_FRAME_BYTES + 1]; /**< Chain registers followed by the scratch byte */
+} sr_frame_t;
+
+/**
+ * @brief Initialize the shift register bus
+ *
+ * Configures the clock, latch and data GPIOs from the hardware profile and
+ * latches an all-zero frame while the register outputs are still disabled.
+ * Before that, every chain with a feedback pin is probed for its length and
+ * the frame is sized to the registers found (see hw_profile_fit_chains()).
+ * hw_profile_init() must have been called first.
+ */
+void sr_bus_init(void);
+
+/**
+ * @brief Enable or disable the register outputs
+ *
+ * Drives the shared OE pin if the board has one wired.
+ *
+ * @param enable true to drive the outputs, false to leave them high impedance
+ */
+void sr_bus_output_enable(bool enable);
+
+/**
+ * @brief Shift a frame into all chains and latch it with a single edge
+ *
+ * Waits like sr_bus_stage() for a frame staged by another task.
+ *
+ * @param frame Frame to output
+ */
+void sr_bus_commit(const sr_frame_t *frame);
+
+/**
+ * @brief Shift a frame into the registers without latching it
+ *
+ * The outputs keep showing the current frame until sr_bus_latch() is called,
+ * so the shifting time is taken out of the switching moment. If the same
+ * frame was preloaded with sr_bus_preload() and nothing has shifted since,
+ * it is already in the registers and is not shifted again.
+ *
+ * A frame staged by another task stays in the registers until it is
+ * latched: the stage waits for its latch, up to SR_BUS_STAGE_WAIT_MS. A
+ * writer whose latch edge comes from elsewhere (the slave of a link) holds
+ * the bus with sr_bus_lock() from the stage until the latch, so no other
+ * writer shifts in between.
+ *
+ * @param frame Frame to shift
+ * @return true if the frame was already in the registers
+ */
+bool sr_bus_stage(const sr_frame_t *frame);
+
+/**
+ * @brief Shift a frame that may be latched next into the registers
+ *
+ * Used to have a likely next route in the registers before it is asked for,
+ * so staging it costs no clocks. Nothing is latched and nothing is marked as
+ * staged: any other writer or scan may shift over it, and then the frame is
+ * simply shifted again when it is staged. Does nothing on boards with an
+ * input chain, whose 1 kHz scan would shift over it every millisecond.
+ *
+ * The caller must hold the bus (sr_bus_lock()).
+ *
+ * @param frame Frame to shift
+ * @return true if the frame is now in the registers
+ */
+bool sr_bus_preload(const sr_frame_t *frame);
+
+/**
+ * @brief Latch the staged frame onto the outputs
+ *
+ * Safe to call from an ISR.
+ */
+void sr_bus_latch(void);
+
+/**
+ * @brief Shift and latch a frame from an interrupt and freeze the bus
+ *
+ * For the panic bypass: needs no task, queue or mutex, and waits for at most
+ * one register that a task is shifting. From then on every stage and latch is
+ * ignored, so the frame stays on the outputs until restart. Safe to call from
+ * an IRAM ISR.
+ *
+ * @param frame Frame to output, in internal RAM
+ */
+void sr_bus_panic(const sr_frame_t *frame);
+
+/**
+ * @brief Read the input chain by shifting the current frame out again
+ *
+ * The outputs keep their state: the same frame is shifted and latched again,
+ * and that latch edge loads the inputs for the next scan, so every scan
+ * returns the inputs as they were at the previous latch. Returns at once,
+ * without reading, if the board has no input chain, another writer holds the
+ * bus or a frame is staged and waiting for its latch edge.
+ *
+ * @param[out] in Input chain registers, register 0 (nearest the ESP32) first,
+ *                bit 7 is its H input
+ * @return true if the inputs were read
+ */
+bool sr_bus_scan(uint8_t *in);
+
+/**
+ * @brief Check whether sr_bus_panic() has frozen the bus
+ *
+ * @return true once the panic frame is latched
+ */
+bool sr_bus_is_frozen(void);
+
+/**
+ * @brief Add a companion pin that is pulsed together with the latch
+ *
+ * Used to drive a sync line that makes other devices switch on the same
+ * edge as this unit's registers.
+ *
+ * @param pin GPIO already configured as output
+ */
+void sr_bus_add_latch_pin(gpio_num_t pin);
+
+/**
+ * @brief Get the frame that is currently latched on the outputs
+ *
+ * @return Pointer to the last committed frame
+ */
+const sr_frame_t *sr_bus_current(void);
+
+/**
+ * @brief Take the bus for a read-modify-commit of the current frame
+ *
+ * Every writer copies sr_bus_current(), changes its own bits and commits the
+ * copy. Holding the lock from the copy until the latch keeps another writer
+ * from committing a stale copy in between, or from shifting over a frame
+ * that is staged and waiting for its latch edge. The lock is recursive.
+ */
+void sr_bus_lock(void);
+
+/**
+ * @brief Release the bus taken with sr_bus_lock()
+ */
+void sr_bus_unlock(void);
+
+#endif /* SR_BUS_H */
@@ -0,0 +1,156 @@
+/**
+ * @file sr_input.c
+ * @brief Implementation of the 74HC165 footswitch scan
+ *
+ * The scan runs in an esp_timer callback. A scan that finds the bus busy is
+ * skipped rather than waited for: the writer holding it is about to latch,
+ * and the next scan comes a millisecond later. The time each scan takes and
+ * the number skipped are logged every SR_INPUT_REPORT_MS.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sr_input.h"
+#include "sr_bus.h"
+#include "debounce.h"
+#include "hw_profile.h"
+#include "power.h"
+
+#define SR_INPUT_REPORT_MS 10000 /**< Scan cost report interval */
+#define SR_INPUT_FIRST_TRIES 10  /**< Attempts at the first scan */
+
+static const char *TAG = "SrInput";
+
+/** @brief Protects the presses and the statistics */
+static portMUX_TYPE input_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Scan timer */
+static esp_timer_handle_t scan_timer;
+/** @brief Debouncer of all switches in the chain */
+static debounce_t db;
+/** @brief Switches fitted, one bit per 165 input */
+static uint32_t switch_mask;
+/** @brief Presses not yet taken by the buttons task */
+static uint32_t presses;
+
+/** @brief Scan statistics of the current report window */
+static uint32_t stat_scans, stat_skipped, stat_time_sum_us, stat_time_max_us;
+
+/**
+ * @brief Read the input chain as switch bits
+ *
+ * @param[out] pressed Switches pressed, bit N = switch N
+ * @return true if the chain was read
+ */
+static bool _read(uint32_t *pressed)
+{
+    uint8_t in[HW_SR_IN_REGS_MAX];
+    if (!sr_bus_scan(in))
+    {
+        return false;
+    }
+    uint32_t levels = 0;
+    for (int r = 0; r < hw_tables.sr_in_bytes; r++)
+    {
+        levels |= (uint32_t)in[r] << (r * 8);
+    }
+    *pressed = ~levels & switch_mask; // Active low
+    return true;
+}
+
+/**
+ * @brief Scan timer callback: read, debounce and collect presses
+ *
+ * @param arg Unused
+ */
+static void _scan(void *arg)
+{
+    int64_t start = esp_timer_get_time();
+    uint32_t sample;
+    if (!_read(&sample))
+    {
+        portENTER_CRITICAL(&input_lock);
+        stat_skipped++;
+        portEXIT_CRITICAL(&input_lock);
+        return;
+    }
+    uint32_t pressed = debounce_update(&db, sample) & db.state;
+    uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+
+    portENTER_CRITICAL(&input_lock);
+    presses |= pressed;
+    stat_scans++;
+    stat_time_sum_us += took;
+    if (took > stat_time_max_us)
+    {
+        stat_time_max_us = took;
+    }
+    portEXIT_CRITICAL(&input_lock);
+}
+
+/**
+ * @brief Report task: log the scan cost
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _report_task(void *pvParameters)
+{
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(SR_INPUT_REPORT_MS));
+        portENTER_CRITICAL(&input_lock);
+        uint32_t scans = stat_scans, skipped = stat_skipped, sum = stat_time_sum_us, max = stat_time_max_us;
+        stat_scans = stat_skipped = stat_time_sum_us = stat_time_max_us = 0;
+        portEXIT_CRITICAL(&input_lock);
+        ESP_LOGI(TAG, "%lu scans, %lu skipped for a busy bus; scan %lu us mean, %lu us max", (unsigned long)scans,
+                 (unsigned long)skipped, (unsigned long)(scans ? sum / scans : 0), (unsigned long)max);
+    }
+}
+
+/**
+ * @brief Take the first scan and start the scan timer
+ */
+void sr_input_init(void)
+{
+    if (hw_tables.sr_in_bytes == 0)
+    {
+        return;
+    }
+    switch_mask = hw_tables.sr_in_bytes >= 4 ? UINT32_MAX : (1UL << (hw_tables.sr_in_bytes * 8)) - 1;
+
+    uint32_t held = 0;
+    for (int i = 0; i < SR_INPUT_FIRST_TRIES && !_read(&held); i++)
+    {
+        vTaskDelay(1);
+    }
+    debounce_init(&db, held); // Switches held at start-up are not presses
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = _scan,
+        .name = "sr_input",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &scan_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(scan_timer, SR_INPUT_SCAN_US));
+    xTaskCreate(_report_task, "sr_input_task", 2048, NULL, 1, NULL);
+    power_stay_awake("the 1 kHz input chain scan");
+
+    ESP_LOGI(TAG, "%d footswitches on the 74HC165 chain (GPIO %d), scanned every %d us", hw_tables.sr_in_bytes * 8,
+             hw_tables.pin_sr_in, SR_INPUT_SCAN_US);
+}
+
+/**
+ * @brief Take the footswitch presses since the last call
+ *
+ * @return Pressed footswitches, bit N = switch N
+ */
+uint32_t sr_input_take_presses(void)
+{
+    portENTER_CRITICAL(&input_lock);
+    uint32_t taken = presses;
+    presses = 0;
+    portEXIT_CRITICAL(&input_lock);
+    return taken;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file sr_input.h
+ * @brief Footswitches on a 74HC165 chain read with the output frames
+ *
+ * Up to HW_SR_IN_REGS_MAX 74HC165 registers hang off the shift register bus
+ * (see sr_bus.h). Every SR_INPUT_SCAN_US a timer callback shifts the
+ * current frame out again with sr_bus_scan(), which reads the input chain on
+ * the same clocks, and feeds the sample to the vertical counter debouncer
+ * (debounce.h). Presses are collected for the buttons task, which takes them
+ * with sr_input_take_presses().
+ *
+ * The footswitches pull their 165 inputs low against pull-ups, so a 0 bit is
+ * a pressed switch. Switch N is input N % 8 (A-H) of register N / 8, counted
+ * from the register nearest the ESP32.
+ */
+
+#ifndef SR_INPUT_H
+#define SR_INPUT_H
+
+#include <stdint.h>
+
+#define SR_INPUT_SCAN_US 1000 /**< Scan period, 1 kHz */
+
+/**
+ * @brief Take the first scan and start the scan timer
+ *
+ * Does nothing if the board has no input chain (see hw_profile.h). Must be
+ * called after matrix_init().
+ */
+void sr_input_init(void);
+
+/**
+ * @brief Take the footswitch presses since the last call
+ *
+ * @return Pressed footswitches, bit N = switch N
+ */
+uint32_t sr_input_take_presses(void);
+
+#endif /* SR_INPUT_H */
@@ -0,0 +1,365 @@
+/**
+ * @file tap_tempo.c
+ * @brief Implementation of the tap tempo input and timed tap output
+ *
+ * The output edges are scheduled as absolute alarm counts of a free-running
+ * 1 MHz timer: rising edge at rise + period, falling edge at rise + pulse
+ * width. The alarm interrupt and everything it calls are in IRAM
+ * (CONFIG_GPTIMER_ISR_IRAM_SAFE, CONFIG_GPTIMER_CTRL_FUNC_IN_IRAM), so it
+ * keeps running while the flash cache is disabled for NVS writes.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/gpio.h>
+#include <driver/gptimer.h>
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "tap_tempo.h"
+#include "hw_profile.h"
+#include "power.h"
+
+#define TAP_TIMER_RESOLUTION_HZ 1000000                   /**< 1 tick = 1 us */
+#define TAP_PULSE_US (CONFIG_TAP_TEMPO_PULSE_MS * 1000)   /**< Output pulse width */
+#define TAP_START_DELAY_US 1000                           /**< First pulse after a tempo is set */
+#define TAP_QUIET_US 20000                                /**< Footswitch must be quiet this long before a tap */
+#define TAP_INTERVALS (CONFIG_TAP_TEMPO_TAPS - 1)         /**< Intervals averaged */
+#define TAP_REPORT_MS 10000                               /**< Jitter report interval */
+
+static const char *TAG = "TapTempo";
+
+/** @brief Protects the output state shared by the alarm interrupt and tasks */
+static portMUX_TYPE tap_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Output timer, NULL if the board has no tap output */
+static gptimer_handle_t tap_timer;
+/** @brief Handle of the tap task */
+static TaskHandle_t tap_task_handle;
+
+// --- Output state (tap_lock) ---
+/** @brief Current tap period, 0 if none */
+static uint32_t tap_period_us;
+/** @brief An alarm is scheduled */
+static bool output_running;
+/** @brief The output is in the high part of a pulse */
+static bool pulse_high;
+/** @brief Alarm count of the last rising edge */
+static uint64_t rise_count;
+/** @brief Pulses left in the current burst (burst mode only) */
+static uint8_t burst_left;
+/** @brief Timing statistics of the current window */
+static tap_tempo_stats_t stats;
+
+// --- Input state (tap interrupt) ---
+/** @brief Time of the last footswitch edge */
+static int64_t last_edge_us;
+/** @brief Time of the last accepted tap */
+static int64_t last_tap_us;
+/** @brief Most recent tap intervals */
+static uint32_t tap_interval_us[TAP_INTERVALS];
+/** @brief Number of valid entries in tap_interval_us */
+static uint8_t tap_count;
+/** @brief Next entry of tap_interval_us to write */
+static uint8_t tap_pos;
+/** @brief Period computed from the last tap */
+static volatile uint32_t tapped_period_us;
+/** @brief Set when a tapped tempo is waiting to be shown */
+static volatile bool tapped;
+
+/**
+ * @brief Reset the statistics window
+ */
+static void _stats_reset(void)
+{
+    uint32_t jitter_max = stats.jitter_max_us;
+    memset(&stats, 0, sizeof(stats));
+    stats.latency_min_us = UINT32_MAX;
+    stats.jitter_max_us = jitter_max;
+}
+
+/**
+ * @brief Output timer alarm: drive the next edge and schedule the one after
+ *
+ * @return false, no task is woken
+ */
+static bool IRAM_ATTR _on_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+    gptimer_alarm_config_t alarm = {0};
+
+    portENTER_CRITICAL_ISR(&tap_lock);
+    if (!pulse_high)
+    {
+        REG_WRITE(GPIO_OUT_W1TS_REG, hw_tables.tap_out_mask[0]);
+        REG_WRITE(GPIO_OUT1_W1TS_REG, hw_tables.tap_out_mask[1]);
+
+        uint64_t now;
+        gptimer_get_raw_count(timer, &now);
+        uint32_t latency = (uint32_t)(now - edata->alarm_value);
+        stats.pulses++;
+        if (latency < stats.latency_min_us)
+            stats.latency_min_us = latency;
+        if (latency > stats.latency_max_us)
+            stats.latency_max_us = latency;
+        stats.jitter_us = stats.latency_max_us - stats.latency_min_us;
+        if (stats.jitter_us > stats.jitter_max_us)
+            stats.jitter_max_us = stats.jitter_us;
+
+        rise_count = edata->alarm_value; // Schedule from the intended edge, not the late one
+        pulse_high = true;
+        if (burst_left)
+            burst_left--;
+        alarm.alarm_count = rise_count + TAP_PULSE_US;
+        gptimer_set_alarm_action(timer, &alarm);
+    }
+    else
+    {
+        REG_WRITE(GPIO_OUT_W1TC_REG, hw_tables.tap_out_mask[0]);
+        REG_WRITE(GPIO_OUT1_W1TC_REG, hw_tables.tap_out_mask[1]);
+
+        pulse_high = false;
+        if (tap_period_us == 0 || (CONFIG_TAP_TEMPO_BURST && burst_left == 0))
+        {
+            output_running = false;
+            gptimer_set_alarm_action(timer, NULL);
+        }
+        else
+        {
+            alarm.alarm_count = rise_count + tap_period_us;
+            gptimer_set_alarm_action(timer, &alarm);
+        }
+    }
+    portEXIT_CRITICAL_ISR(&tap_lock);
+    return false;
+}
+
+/**
+ * @brief Footswitch edge interrupt: timestamp taps and average the intervals
+ *
+ * Only a falling edge after TAP_QUIET_US without edges counts as a tap, which
+ * rejects contact bounce on both press and release.
+ *
+ * @param arg Unused
+ */
+static void IRAM_ATTR _tap_isr(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t quiet = now - last_edge_us;
+    last_edge_us = now;
+
+    gpio_num_t pin = hw_tables.pin_tap_btn;
+    uint32_t level = pin < 32 ? (REG_READ(GPIO_IN_REG) >> pin) & 1 : (REG_READ(GPIO_IN1_REG) >> (pin - 32)) & 1;
+    if (level || quiet < TAP_QUIET_US)
+    {
+        return; // Release or bounce
+    }
+
+    int64_t interval = now - last_tap_us;
+    last_tap_us = now;
+    if (interval > CONFIG_TAP_TEMPO_RESET_MS * 1000LL)
+    {
+        tap_count = 0; // First tap of a new sequence
+        return;
+    }
+
+    tap_interval_us[tap_pos] = (uint32_t)interval;
+    tap_pos = (tap_pos + 1) % TAP_INTERVALS;
+    if (tap_count < TAP_INTERVALS)
+        tap_count++;
+
+    uint32_t sum = 0;
+    for (int i = 0; i < tap_count; i++)
+        sum += tap_interval_us[i];
+    uint32_t period = sum / tap_count;
+    if (period < TAP_TEMPO_PERIOD_MIN_US)
+        period = TAP_TEMPO_PERIOD_MIN_US;
+    if (period > TAP_TEMPO_PERIOD_MAX_US)
+        period = TAP_TEMPO_PERIOD_MAX_US;
+    tapped_period_us = period;
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(tap_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * @brief Tap task: apply tapped tempos and report the output jitter
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _tap_task(void *pvParameters)
+{
+    TickType_t last_report = xTaskGetTickCount();
+
+    while (1)
+    {
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TAP_REPORT_MS)))
+        {
+            uint32_t period = tapped_period_us;
+            tap_tempo_set_period(period);
+            tapped = true;
+            ESP_LOGI(TAG, "Tapped %lu BPM (%lu us)", (unsigned long)TAP_TEMPO_BPM(period), (unsigned long)period);
+        }
+
+        if (xTaskGetTickCount() - last_report >= pdMS_TO_TICKS(TAP_REPORT_MS))
+        {
+            last_report = xTaskGetTickCount();
+            tap_tempo_stats_t s;
+            tap_tempo_get_stats(&s, true);
+            if (s.pulses)
+            {
+                ESP_LOGI(TAG, "Tap out: %lu pulses, latency %lu-%lu us, jitter %lu us (max %lu us)",
+                         (unsigned long)s.pulses, (unsigned long)s.latency_min_us, (unsigned long)s.latency_max_us,
+                         (unsigned long)s.jitter_us, (unsigned long)s.jitter_max_us);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Initialize the tap input, the output timer and the report task
+ */
+void tap_tempo_init(void)
+{
+    _stats_reset();
+    if (hw_tables.pin_tap_btn == GPIO_NUM_NC && hw_tables.pin_tap_out == GPIO_NUM_NC)
+    {
+        ESP_LOGI(TAG, "No tap tempo pins on this board");
+        return;
+    }
+
+    xTaskCreate(_tap_task, "tap_task", 3072, NULL, 4, &tap_task_handle);
+
+    if (hw_tables.pin_tap_out != GPIO_NUM_NC)
+    {
+        gpio_config_t out_conf = {
+            .pin_bit_mask = 1ULL << hw_tables.pin_tap_out,
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        gpio_config(&out_conf);
+        gpio_set_level(hw_tables.pin_tap_out, 0);
+
+        gptimer_config_t timer_config = {
+            .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+            .direction = GPTIMER_COUNT_UP,
+            .resolution_hz = TAP_TIMER_RESOLUTION_HZ,
+            .intr_priority = 3, // Highest level for C handlers, so other interrupts do not delay the edges
+        };
+        ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &tap_timer));
+        gptimer_event_callbacks_t cbs = {
+            .on_alarm = _on_alarm,
+        };
+        ESP_ERROR_CHECK(gptimer_register_event_callbacks(tap_timer, &cbs, NULL));
+        ESP_ERROR_CHECK(gptimer_enable(tap_timer));
+        ESP_ERROR_CHECK(gptimer_start(tap_timer));
+    }
+
+    if (hw_tables.pin_tap_btn != GPIO_NUM_NC)
+    {
+        gpio_config_t in_conf = {
+            .pin_bit_mask = 1ULL << hw_tables.pin_tap_btn,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_ENABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_ANYEDGE,
+        };
+        gpio_config(&in_conf);
+        esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) // Already installed is fine
+        {
+            ESP_LOGE(TAG, "GPIO ISR service install failed: %s", esp_err_to_name(err));
+        }
+        gpio_isr_handler_add(hw_tables.pin_tap_btn, _tap_isr, NULL);
+    }
+    if (hw_tables.pin_tap_btn != GPIO_NUM_NC || hw_tables.pin_tap_out != GPIO_NUM_NC)
+    {
+        power_stay_awake("tap tempo timing");
+    }
+
+    ESP_LOGI(TAG, "Tap tempo ready: input GPIO %d, output GPIO %d", hw_tables.pin_tap_btn, hw_tables.pin_tap_out);
+}
+
+/**
+ * @brief Set the tempo
+ *
+ * @param period_us Tap period in microseconds, 0 to stop the output
+ */
+void tap_tempo_set_period(uint32_t period_us)
+{
+    if (period_us)
+    {
+        if (period_us < TAP_TEMPO_PERIOD_MIN_US)
+            period_us = TAP_TEMPO_PERIOD_MIN_US;
+        if (period_us > TAP_TEMPO_PERIOD_MAX_US)
+            period_us = TAP_TEMPO_PERIOD_MAX_US;
+    }
+
+    portENTER_CRITICAL(&tap_lock);
+    tap_period_us = period_us;
+    burst_left = CONFIG_TAP_TEMPO_BURST;
+    if (tap_timer && tap_period_us && !output_running)
+    {
+        uint64_t now;
+        gptimer_get_raw_count(tap_timer, &now);
+        gptimer_alarm_config_t alarm = {
+            .alarm_count = now + TAP_START_DELAY_US,
+        };
+        output_running = true;
+        pulse_high = false;
+        gptimer_set_alarm_action(tap_timer, &alarm);
+    }
+    portEXIT_CRITICAL(&tap_lock);
+}
+
+/**
+ * @brief Get the current tempo
+ *
+ * @return Tap period in microseconds, 0 if none is set
+ */
+uint32_t tap_tempo_get_period(void)
+{
+    return tap_period_us;
+}
+
+/**
+ * @brief Check whether the tempo was tapped in since the last call
+ *
+ * @return true once after each tapped tempo change
+ */
+bool tap_tempo_take_tapped(void)
+{
+    if (!tapped)
+    {
+        return false;
+    }
+    tapped = false;
+    return true;
+}
+
+/**
+ * @brief Read the tap output timing statistics
+ *
+ * @param[out] stats_out Statistics
+ * @param reset true to start a new measurement window
+ */
+void tap_tempo_get_stats(tap_tempo_stats_t *stats_out, bool reset)
+{
+    portENTER_CRITICAL(&tap_lock);
+    *stats_out = stats;
+    if (reset)
+    {
+        _stats_reset();
+    }
+    portEXIT_CRITICAL(&tap_lock);
+    if (stats_out->pulses == 0)
+    {
+        stats_out->latency_min_us = 0;
+    }
+}
@@ -0,0 +1,77 @@
+/**
+ * @file tap_tempo.h
+ * @brief Tap tempo input and timed tap output for downstream pedals
+ *
+ * Taps on the tap footswitch are timestamped in the GPIO interrupt and the
+ * last CONFIG_TAP_TEMPO_TAPS taps are averaged into a tempo. The tap output
+ * is driven from a hardware timer alarm interrupt placed in IRAM: each pulse
+ * edge is scheduled at an absolute timer count, so the pulse train does not
+ * drift and flash writes (NVS), display flushes and matrix updates only
+ * affect the edges by the interrupt latency. That latency is measured on
+ * every rising edge and reported as the output jitter.
+ */
+
+#ifndef TAP_TEMPO_H
+#define TAP_TEMPO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TAP_TEMPO_PERIOD_MIN_US 200000  /**< Fastest tempo, 300 BPM */
+#define TAP_TEMPO_PERIOD_MAX_US 2000000 /**< Slowest tempo, 30 BPM */
+
+/** @brief Tempo in BPM of a tap period in microseconds */
+#define TAP_TEMPO_BPM(period_us) ((period_us) ? (60000000UL + (period_us) / 2) / (period_us) : 0)
+
+/**
+ * @brief Tap output timing statistics
+ */
+typedef struct
+{
+    uint32_t pulses;         /**< Pulses emitted since the statistics were last reset */
+    uint32_t latency_min_us; /**< Smallest alarm-to-edge latency */
+    uint32_t latency_max_us; /**< Largest alarm-to-edge latency */
+    uint32_t jitter_us;      /**< latency_max_us - latency_min_us */
+    uint32_t jitter_max_us;  /**< Largest jitter seen since boot */
+} tap_tempo_stats_t;
+
+/**
+ * @brief Initialize the tap input, the output timer and the report task
+ *
+ * Does nothing for pins not fitted on the board (see hw_profile.h).
+ */
+void tap_tempo_init(void);
+
+/**
+ * @brief Set the tempo
+ *
+ * The new period applies from the next pulse. In burst mode a new burst is
+ * started.
+ *
+ * @param period_us Tap period in microseconds, 0 to stop the output
+ */
+void tap_tempo_set_period(uint32_t period_us);
+
+/**
+ * @brief Get the current tempo
+ *
+ * @return Tap period in microseconds, 0 if none is set
+ */
+uint32_t tap_tempo_get_period(void);
+
+/**
+ * @brief Check whether the tempo was tapped in since the last call
+ *
+ * @return true once after each tapped tempo change
+ */
+bool tap_tempo_take_tapped(void);
+
+/**
+ * @brief Read the tap output timing statistics
+ *
+ * @param[out] stats Statistics
+ * @param reset true to start a new measurement window
+ */
+void tap_tempo_get_stats(tap_tempo_stats_t *stats, bool reset);
+
+#endif /* TAP_TEMPO_H */
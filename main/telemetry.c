@@ -0,0 +1,163 @@
+/**
+ * @file telemetry.c
+ * @brief Implementation of the live telemetry stream
+ *
+ * The UART driver is installed with a TX ring buffer, so uart_write_bytes()
+ * only copies the frame and returns; the driver's interrupt refills the
+ * hardware FIFO. The task checks the free ring buffer space first, so it
+ * never blocks on a full buffer either.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/uart.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "telemetry.h"
+#include "telemetry_proto.h"
+#include "power.h"
+
+#ifdef CONFIG_TELEMETRY_ENABLE
+
+#define TELEMETRY_TX_BUF_SIZE 2048                              /**< Driver TX ring buffer */
+#define TELEMETRY_RX_BUF_SIZE 512                               /**< Driver RX buffer, for the host link */
+#define TELEMETRY_FRAME_BYTES (CONFIG_TELEMETRY_BYTES_PER_S / CONFIG_TELEMETRY_RATE_HZ) /**< Budget refill per frame */
+#define TELEMETRY_EVENTS_READ 32                                /**< Trace events read per frame */
+
+_Static_assert(TELEMETRY_METRICS <= TELEMETRY_METRICS_MAX, "Too many telemetry counters");
+
+static const char *TAG = "Telemetry";
+
+/**
+ * @brief Read every counter of the stream
+ *
+ * @param[out] values TELEMETRY_METRICS values
+ * @param skipped Frames skipped so far
+ */
+static void _sample(uint32_t *values, uint32_t skipped)
+{
+    deadline_stats_t d;
+    deadline_get_stats(&d);
+    memcpy(&values[TELEMETRY_CHECKED], d.checked, sizeof(d.checked));
+    memcpy(&values[TELEMETRY_MISSES], d.misses, sizeof(d.misses));
+    memcpy(&values[TELEMETRY_HIST], d.hist, sizeof(d.hist));
+#ifdef CONFIG_PRESET_PREDICT_ENABLE
+    preset_predict_stats_t p;
+    preset_predict_get_stats(&p);
+    memcpy(&values[TELEMETRY_RECALLS], p.recalls, sizeof(p.recalls));
+    values[TELEMETRY_TOP_HITS] = p.top_hits;
+#else
+    memset(&values[TELEMETRY_RECALLS], 0, (TELEMETRY_TOP_HITS + 1 - TELEMETRY_RECALLS) * sizeof(uint32_t));
+#endif
+#ifdef CONFIG_CONTROL_ENABLE
+    control_stats_t c;
+    control_get_stats(&c);
+    values[TELEMETRY_CONTROL_OVERRUNS] = c.overruns;
+    values[TELEMETRY_CONTROL_OVER_BUDGET] = c.over_budget;
+    values[TELEMETRY_CONTROL_JITTER] = c.jitter_max_us;
+#else
+    memset(&values[TELEMETRY_CONTROL_OVERRUNS], 0,
+           (TELEMETRY_CONTROL_JITTER + 1 - TELEMETRY_CONTROL_OVERRUNS) * sizeof(uint32_t));
+#endif
+    values[TELEMETRY_FREE_HEAP] = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    values[TELEMETRY_SKIPPED] = skipped;
+}
+
+/**
+ * @brief Stream task: encode and queue one frame per period
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _telemetry_task(void *pvParameters)
+{
+    static telemetry_state_t sent;
+    static uint8_t out[TELEMETRY_FRAME_MAX];
+    deadline_trace_t trace[TELEMETRY_EVENTS_READ];
+    telemetry_event_t events[TELEMETRY_EVENTS_READ];
+    uint32_t values[TELEMETRY_METRICS];
+    uint32_t cursor = 0, lost = 0, skipped = 0;
+    int pending = 0;
+    size_t tokens = TELEMETRY_FRAME_BYTES;
+    int64_t key_us = 0;
+    TickType_t wake = xTaskGetTickCount();
+
+    while (1)
+    {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(1000 / CONFIG_TELEMETRY_RATE_HZ));
+        tokens += TELEMETRY_FRAME_BYTES;
+        if (tokens > 4 * TELEMETRY_FRAME_BYTES)
+        {
+            tokens = 4 * TELEMETRY_FRAME_BYTES; // A quiet stretch does not buy a burst
+        }
+
+        // Events left over from the frame before go first
+        uint32_t dropped = 0;
+        int n = deadline_trace_read(&cursor, &trace[pending], TELEMETRY_EVENTS_READ - pending, &dropped);
+        lost += dropped;
+        for (int i = pending; i < pending + n; i++)
+        {
+            events[i].t_us = trace[i].t_us;
+            events[i].code = (trace[i].event & 0x0F) | (trace[i].action << 4);
+            events[i].arg = trace[i].arg;
+        }
+        pending += n;
+
+        int64_t now_us = esp_timer_get_time();
+        bool key = key_us == 0 || now_us - key_us >= CONFIG_TELEMETRY_KEY_S * 1000000LL;
+        size_t room = 0;
+        uart_get_tx_buffer_free_size(TELEMETRY_UART, &room);
+        size_t budget = tokens < room ? tokens : room;
+
+        _sample(values, skipped);
+        telemetry_state_t next;
+        int count = pending;
+        size_t len = telemetry_encode(&sent, &next, key, (uint32_t)(now_us / 1000), values, TELEMETRY_METRICS,
+                                      events, &count, lost, budget, out);
+        if (len == 0)
+        {
+            skipped++; // Counters go out as a delta with the next frame that fits
+            continue;
+        }
+        uart_write_bytes(TELEMETRY_UART, out, len);
+        tokens -= len;
+        sent = next;
+        lost = 0;
+        if (key)
+        {
+            key_us = now_us;
+        }
+        pending -= count;
+        memmove(events, &events[count], pending * sizeof(events[0]));
+    }
+}
+
+/**
+ * @brief Install the telemetry UART and start the stream task
+ */
+void telemetry_init(void)
+{
+    const uart_config_t uart_config = {
+        .baud_rate = CONFIG_TELEMETRY_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    ESP_ERROR_CHECK(uart_driver_install(TELEMETRY_UART, TELEMETRY_RX_BUF_SIZE, TELEMETRY_TX_BUF_SIZE, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(TELEMETRY_UART, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(TELEMETRY_UART, CONFIG_TELEMETRY_TX_PIN,
+                                 CONFIG_TELEMETRY_RX_PIN >= 0 ? CONFIG_TELEMETRY_RX_PIN : UART_PIN_NO_CHANGE,
+                                 UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+    xTaskCreate(_telemetry_task, "telemetry_task", 3072, NULL, 1, NULL);
+    power_stay_awake("the telemetry UART");
+    ESP_LOGI(TAG, "Streaming on UART%d TX GPIO %d at %d baud, %d frames/s, %d bytes/s", CONFIG_TELEMETRY_UART_NUM,
+             CONFIG_TELEMETRY_TX_PIN, CONFIG_TELEMETRY_BAUD, CONFIG_TELEMETRY_RATE_HZ, CONFIG_TELEMETRY_BYTES_PER_S);
+}
+
+#endif /* CONFIG_TELEMETRY_ENABLE */
@@ -0,0 +1,54 @@
+/**
+ * @file telemetry.h
+ * @brief Live telemetry stream to a host on its own UART
+ *
+ * With CONFIG_TELEMETRY_ENABLE a low priority task sends a frame every
+ * 1/CONFIG_TELEMETRY_RATE_HZ s on the TX pin of CONFIG_TELEMETRY_UART_NUM:
+ * the counters in telemetry_metric_t (deadline counts and latency histogram,
+ * prediction hits, control executive overruns and jitter, free heap) and the deadline trace events written since
+ * the frame before, in the delta format of telemetry_proto.h. A key frame
+ * goes out every CONFIG_TELEMETRY_KEY_S s. tools/telemetry_view.py shows the
+ * stream as a table or a live plot.
+ *
+ * The stream never holds up a control task. Frames are encoded by a task at
+ * the lowest priority and handed to the UART driver's TX ring buffer, which
+ * the UART interrupt drains into the FIFO, so writing costs no more than a
+ * copy. A byte budget (CONFIG_TELEMETRY_BYTES_PER_S) is refilled every
+ * frame; a frame that does not fit it or the free ring buffer space is
+ * skipped and counted, and its deltas go out with the next one. Events that
+ * do not fit wait for a later frame.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "deadline.h"
+#include "preset_predict.h"
+#include "control.h"
+
+#define TELEMETRY_UART ((uart_port_t)CONFIG_TELEMETRY_UART_NUM) /**< UART port of the stream and the host link */
+
+/**
+ * @brief Counters in the stream, numbered as tools/telemetry_view.py names them
+ */
+typedef enum
+{
+    TELEMETRY_CHECKED = 0,                                         /**< Actions latched, one per deadline_action_t */
+    TELEMETRY_MISSES = TELEMETRY_CHECKED + DEADLINE_ACTIONS,       /**< Deadline misses, one per deadline_action_t */
+    TELEMETRY_HIST = TELEMETRY_MISSES + DEADLINE_ACTIONS,          /**< Press to latch histogram, DEADLINE_HIST_BUCKETS */
+    TELEMETRY_RECALLS = TELEMETRY_HIST + DEADLINE_HIST_BUCKETS,    /**< Preset recalls, one per preset_predict_path_t */
+    TELEMETRY_TOP_HITS = TELEMETRY_RECALLS + PRESET_PREDICT_PATHS, /**< Recalls of the most likely preset */
+    TELEMETRY_CONTROL_OVERRUNS,                                    /**< Control ticks skipped by overrunning cycles */
+    TELEMETRY_CONTROL_OVER_BUDGET,                                 /**< Control stage runs over their budget */
+    TELEMETRY_CONTROL_JITTER,                                      /**< Largest control period jitter in us */
+    TELEMETRY_FREE_HEAP,                                           /**< Free heap in bytes */
+    TELEMETRY_SKIPPED,                                             /**< Frames skipped to stay in the byte budget */
+    TELEMETRY_METRICS
+} telemetry_metric_t;
+
+/**
+ * @brief Install the telemetry UART and start the stream task
+ */
+void telemetry_init(void);
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,194 @@
+/**
+ * @file telemetry_proto.c
+ * @brief Implementation of the telemetry stream wire format
+ */
+
+#include <string.h>
+#include "telemetry_proto.h"
+#include "link_proto.h"
+
+#define TELEMETRY_EVENTS_MAX 127 /**< Events in a frame, so the count is one byte */
+#define TELEMETRY_EVENT_MAX 9    /**< Longest encoded event */
+
+/**
+ * @brief Write a varint
+ *
+ * @param[out] out At least 5 bytes
+ * @param v Value
+ * @return Bytes written
+ */
+size_t telemetry_put_varint(uint8_t *out, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+/**
+ * @brief Zigzag encode a signed delta, so small changes either way stay short
+ */
+static inline uint32_t _zigzag(int32_t d)
+{
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+/**
+ * @brief Bytes a frame of @p len takes on the wire: CRC, COBS overhead and delimiter
+ */
+static inline size_t _wire_size(size_t len)
+{
+    return len + 2 + (len + 2) / 254 + 2;
+}
+
+/**
+ * @brief COBS encode a frame and add the zero delimiter
+ *
+ * @param in Frame bytes
+ * @param len Frame length
+ * @param[out] out At least len + len / 254 + 2 bytes
+ * @return Bytes written
+ */
+size_t telemetry_cobs(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t code_at = 0, n = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (in[i] != 0)
+        {
+            out[n++] = in[i];
+            code++;
+        }
+        if (in[i] == 0 || code == 0xFF)
+        {
+            out[code_at] = code;
+            code_at = n++;
+            code = 1;
+        }
+    }
+    out[code_at] = code;
+    out[n++] = 0;
+    return n;
+}
+
+/**
+ * @brief Decode a COBS encoded frame
+ *
+ * @param in Encoded bytes, without the zero delimiter
+ * @param len Number of encoded bytes
+ * @param[out] out At least @p len bytes
+ * @return Frame length, 0 if @p in is not valid COBS
+ */
+size_t telemetry_uncobs(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t i = 0, n = 0;
+    while (i < len)
+    {
+        uint8_t code = in[i];
+        if (code == 0 || i + code > len)
+        {
+            return 0;
+        }
+        memcpy(&out[n], &in[i + 1], code - 1);
+        n += code - 1;
+        i += code;
+        if (code < 0xFF && i < len)
+        {
+            out[n++] = 0;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Encode one frame, as long as it fits
+ *
+ * @param sent What the viewer has
+ * @param[out] next What the viewer has once this frame arrives
+ * @param key true for a key frame
+ * @param now_ms Time of the frame
+ * @param values Counter values, @p count of them
+ * @param count Number of counters, at most TELEMETRY_METRICS_MAX
+ * @param events Events not sent yet, oldest first
+ * @param[in,out] event_count Events available; set to the events encoded
+ * @param lost Events dropped before @p events
+ * @param budget Most bytes the frame may take on the wire
+ * @param[out] out At least TELEMETRY_FRAME_MAX bytes
+ * @return Bytes to send, 0 if the frame does not fit
+ */
+size_t telemetry_encode(const telemetry_state_t *sent, telemetry_state_t *next, bool key, uint32_t now_ms,
+                        const uint32_t *values, int count, const telemetry_event_t *events, int *event_count,
+                        uint32_t lost, size_t budget, uint8_t *out)
+{
+    static const telemetry_state_t zero;
+    const telemetry_state_t *base = key ? &zero : sent;
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    size_t n = 0;
+
+    if (budget > TELEMETRY_FRAME_MAX)
+    {
+        budget = TELEMETRY_FRAME_MAX;
+    }
+    *next = *sent;
+    next->seq = sent->seq + 1;
+    next->ms = now_ms;
+    frame[n++] = key ? TELEMETRY_KIND_KEY : TELEMETRY_KIND_DELTA;
+    n += telemetry_put_varint(&frame[n], sent->seq);
+    n += telemetry_put_varint(&frame[n], now_ms - base->ms);
+
+    uint32_t changed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (values[i] != base->values[i])
+        {
+            changed |= 1u << i;
+        }
+        next->values[i] = values[i];
+    }
+    n += telemetry_put_varint(&frame[n], changed);
+    for (int i = 0; i < count; i++)
+    {
+        if (changed & (1u << i))
+        {
+            n += telemetry_put_varint(&frame[n], _zigzag((int32_t)(values[i] - base->values[i])));
+        }
+    }
+    n += telemetry_put_varint(&frame[n], lost);
+    if (_wire_size(n + 1) > budget)
+    {
+        *event_count = 0;
+        return 0; // Not even the counters fit
+    }
+
+    size_t count_at = n++;
+    int limit = *event_count < TELEMETRY_EVENTS_MAX ? *event_count : TELEMETRY_EVENTS_MAX;
+    int done = 0;
+    uint32_t event_us = key ? 0 : sent->event_us;
+    for (; done < limit; done++)
+    {
+        uint8_t ev[TELEMETRY_EVENT_MAX];
+        size_t len = telemetry_put_varint(ev, events[done].t_us - event_us);
+        ev[len++] = events[done].code;
+        len += telemetry_put_varint(&ev[len], events[done].arg);
+        if (_wire_size(n + len) > budget)
+        {
+            break;
+        }
+        memcpy(&frame[n], ev, len);
+        n += len;
+        event_us = events[done].t_us;
+    }
+    frame[count_at] = (uint8_t)done;
+    *event_count = done;
+    next->event_us = event_us;
+
+    uint16_t crc = link_crc16(0xFFFF, frame, n);
+    frame[n++] = crc & 0xFF;
+    frame[n++] = crc >> 8;
+    return telemetry_cobs(frame, n, out);
+}
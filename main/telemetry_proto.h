@@ -0,0 +1,113 @@
+/**
+ * @file telemetry_proto.h
+ * @brief Wire format of the telemetry stream
+ *
+ * The stream carries numbered counters and trace events to a host viewer
+ * (tools/telemetry_view.py). Each frame only sends what changed since the
+ * frame before it: counters as zigzag varint deltas, flagged in a bitmap,
+ * and events with their time as a varint delta from the event before. A
+ * key frame sends every counter as a delta from zero, so a viewer that
+ * starts or loses a frame picks the stream up at the next key frame.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host.
+ *
+ * Frame layout, before COBS encoding:
+ * @code
+ * kind | seq | dt_ms | changed | delta[popcount(changed)] | lost | count | event[count] | crc16 (LE)
+ * event = dt_us | code | arg
+ * @endcode
+ * kind and code are bytes, everything else a LEB128 varint; the deltas are
+ * zigzag encoded. seq counts frames, dt_ms is the time since the frame before
+ * (since boot in a key frame), lost counts events dropped before this frame
+ * and code is the event in the low nibble and the action in the high one.
+ * The CRC is link_crc16() over the frame. The frame is COBS encoded and ends
+ * with a zero byte, the only zero on the wire.
+ */
+
+#ifndef TELEMETRY_PROTO_H
+#define TELEMETRY_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TELEMETRY_KIND_KEY 'K'   /**< Key frame: deltas from zero */
+#define TELEMETRY_KIND_DELTA 'D' /**< Deltas from the frame before */
+#define TELEMETRY_METRICS_MAX 32 /**< Counters in a stream, one bit each in the changed bitmap */
+#define TELEMETRY_FRAME_MAX 512  /**< Largest frame on the wire */
+
+/**
+ * @brief One trace event
+ */
+typedef struct
+{
+    uint32_t t_us; /**< Time of the event */
+    uint8_t code;  /**< Event in the low nibble, action in the high one */
+    uint16_t arg;  /**< Event argument */
+} telemetry_event_t;
+
+/**
+ * @brief What the viewer has been sent so far
+ */
+typedef struct
+{
+    uint32_t values[TELEMETRY_METRICS_MAX]; /**< Counter values */
+    uint32_t ms;                            /**< Time of the last frame */
+    uint32_t event_us;                      /**< Time of the last event */
+    uint32_t seq;                           /**< Frames sent */
+} telemetry_state_t;
+
+/**
+ * @brief Write a varint
+ *
+ * @param[out] out At least 5 bytes
+ * @param v Value
+ * @return Bytes written
+ */
+size_t telemetry_put_varint(uint8_t *out, uint32_t v);
+
+/**
+ * @brief COBS encode a frame and add the zero delimiter
+ *
+ * @param in Frame bytes
+ * @param len Frame length
+ * @param[out] out At least len + len / 254 + 2 bytes
+ * @return Bytes written
+ */
+size_t telemetry_cobs(const uint8_t *in, size_t len, uint8_t *out);
+
+/**
+ * @brief Decode a COBS encoded frame
+ *
+ * @param in Encoded bytes, without the zero delimiter
+ * @param len Number of encoded bytes
+ * @param[out] out At least @p len bytes
+ * @return Frame length, 0 if @p in is not valid COBS
+ */
+size_t telemetry_uncobs(const uint8_t *in, size_t len, uint8_t *out);
+
+/**
+ * @brief Encode one frame, as long as it fits
+ *
+ * The counters go in first, then as many events as fit in @p budget bytes
+ * on the wire. Nothing is written if the counters alone do not fit. @p sent
+ * is left alone; if the frame is sent, copy @p next over it.
+ *
+ * @param sent What the viewer has
+ * @param[out] next What the viewer has once this frame arrives
+ * @param key true for a key frame
+ * @param now_ms Time of the frame
+ * @param values Counter values, @p count of them
+ * @param count Number of counters, at most TELEMETRY_METRICS_MAX
+ * @param events Events not sent yet, oldest first
+ * @param[in,out] event_count Events available; set to the events encoded
+ * @param lost Events dropped before @p events
+ * @param budget Most bytes the frame may take on the wire
+ * @param[out] out At least TELEMETRY_FRAME_MAX bytes
+ * @return Bytes to send, 0 if the frame does not fit
+ */
+size_t telemetry_encode(const telemetry_state_t *sent, telemetry_state_t *next, bool key, uint32_t now_ms,
+                        const uint32_t *values, int count, const telemetry_event_t *events, int *event_count,
+                        uint32_t lost, size_t budget, uint8_t *out);
+
+#endif /* TELEMETRY_PROTO_H */
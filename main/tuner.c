@@ -0,0 +1,256 @@
+/**
+ * @file tuner.c
+ * @brief Implementation of the chromatic tuner
+ *
+ * The input listener only copies samples into the ring while the tuner is
+ * active. The tuner task snapshots the newest PITCH_FRAME samples at the
+ * update rate, runs the detector on them and publishes the reading; the
+ * buttons task polls it and draws it, so all display updates stay on one
+ * task.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "tuner.h"
+#include "pitch.h"
+#include "input_adc.h"
+
+#ifdef CONFIG_TUNER_ENABLE
+
+#define TUNER_RING_LEN 2048    /**< Ring samples, a power of two of at least PITCH_FRAME */
+#define TUNER_MIN_HZ 55.0f     /**< Lowest note reported (A1, below drop tunings) */
+#define TUNER_MAX_HZ 1400.0f   /**< Highest note reported (above the 24th fret) */
+#define TUNER_THRESHOLD 0.15f  /**< YIN dip threshold */
+#define TUNER_QUIET_LEVEL 16   /**< Peak in ADC counts below which nothing is shown */
+#define TUNER_BENCH_RUNS 4     /**< Estimates timed per kernel at start-up */
+
+static const char *TAG = "Tuner";
+
+/** @brief Newest input samples, written by the input task */
+static uint16_t ring[TUNER_RING_LEN];
+/** @brief Samples written since the tuner was started */
+static uint32_t ring_count;
+/** @brief Protects the ring and the reading */
+static SemaphoreHandle_t tuner_mutex;
+/** @brief Tuning in progress */
+static volatile bool active;
+/** @brief Input is sampled */
+static bool input_ok;
+
+/** @brief Detector with its work buffers, too big for a stack */
+static pitch_detector_t det;
+/** @brief Frame handed to the detector */
+static uint16_t frame[PITCH_FRAME];
+
+/** @brief Newest reading */
+static tuner_reading_t reading;
+/** @brief Readings published */
+static uint32_t reading_seq;
+/** @brief Reading returned by tuner_get_reading() last */
+static uint32_t reading_seen;
+
+/** @brief Tuner task, woken when tuning starts */
+static TaskHandle_t tuner_task_handle;
+
+/**
+ * @brief Input listener: copy samples into the ring while tuning
+ */
+static void _on_frame(const uint16_t *samples, size_t n, int64_t frame_end_us)
+{
+    if (!active)
+    {
+        return;
+    }
+    xSemaphoreTake(tuner_mutex, portMAX_DELAY);
+    if (n == 0)
+    {
+        ring_count = 0; // Samples were dropped, the ring is no longer continuous
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        ring[(ring_count + i) % TUNER_RING_LEN] = samples[i];
+    }
+    ring_count += n;
+    xSemaphoreGive(tuner_mutex);
+}
+
+/**
+ * @brief Copy the newest PITCH_FRAME samples out of the ring
+ *
+ * @return false if not enough samples arrived yet
+ */
+static bool _snapshot(void)
+{
+    xSemaphoreTake(tuner_mutex, portMAX_DELAY);
+    bool ok = ring_count >= PITCH_FRAME;
+    if (ok)
+    {
+        uint32_t start = ring_count - PITCH_FRAME;
+        for (size_t i = 0; i < PITCH_FRAME; i++)
+        {
+            frame[i] = ring[(start + i) % TUNER_RING_LEN];
+        }
+    }
+    xSemaphoreGive(tuner_mutex);
+    return ok;
+}
+
+/**
+ * @brief Tuner task: estimate the pitch at the update rate while tuning
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _tuner_task(void *pvParameters)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1)
+    {
+        if (!active)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            last_wake = xTaskGetTickCount();
+            continue;
+        }
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(1000 / CONFIG_TUNER_UPDATE_HZ));
+        if (!_snapshot())
+        {
+            continue;
+        }
+
+        pitch_result_t r;
+        pitch_detect(&det, frame, &r);
+        tuner_reading_t next = {.valid = r.hz > 0, .hz = r.hz};
+        if (next.valid)
+        {
+            pitch_to_note(r.hz, CONFIG_TUNER_REF_HZ, &next.midi, &next.cents);
+        }
+
+        xSemaphoreTake(tuner_mutex, portMAX_DELAY);
+        reading = next;
+        reading_seq++;
+        xSemaphoreGive(tuner_mutex);
+    }
+}
+
+/**
+ * @brief Time the detector with each kernel on a low E sawtooth
+ */
+static void _bench(void)
+{
+    uint32_t step = (uint32_t)(82.41f * 65536.0f / CONFIG_INPUT_SAMPLE_RATE * 65536.0f);
+    uint32_t phase = 0;
+    for (size_t i = 0; i < PITCH_FRAME; i++)
+    {
+        frame[i] = (uint16_t)(2048 - 512 + (phase >> 22)); // 1024 counts peak to peak
+        phase += step;
+    }
+
+    pitch_kernel_t best = det.kernel;
+    int64_t us[2] = {0, 0};
+    for (int k = PITCH_KERNEL_SCALAR; k <= best; k++)
+    {
+        det.kernel = (pitch_kernel_t)k;
+        pitch_result_t r;
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < TUNER_BENCH_RUNS; i++)
+        {
+            pitch_detect(&det, frame, &r);
+        }
+        us[k] = (esp_timer_get_time() - start) / TUNER_BENCH_RUNS;
+    }
+    det.kernel = best;
+
+    if (best == PITCH_KERNEL_SIMD)
+    {
+        ESP_LOGI(TAG, "Pitch estimate: %lld us with SIMD, %lld us scalar", us[PITCH_KERNEL_SIMD],
+                 us[PITCH_KERNEL_SCALAR]);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Pitch estimate: %lld us scalar%s", us[PITCH_KERNEL_SCALAR],
+                 PITCH_HAVE_SIMD ? " (SIMD kernel failed its self-check)" : "");
+    }
+}
+
+/**
+ * @brief Register with the input and start the tuner task
+ */
+void tuner_init(void)
+{
+    float min_hz = (float)CONFIG_INPUT_SAMPLE_RATE / (PITCH_TAU_MAX - 2);
+    pitch_config_t cfg = {
+        .sample_rate = CONFIG_INPUT_SAMPLE_RATE,
+        .min_hz = min_hz > TUNER_MIN_HZ ? min_hz : TUNER_MIN_HZ,
+        .max_hz = TUNER_MAX_HZ,
+        .threshold = TUNER_THRESHOLD,
+        .quiet_level = TUNER_QUIET_LEVEL,
+    };
+    pitch_init(&det, &cfg);
+    tuner_mutex = xSemaphoreCreateMutex();
+
+    input_ok = input_adc_add_listener(INPUT_ADC_GUITAR, _on_frame);
+    if (!input_ok)
+    {
+        ESP_LOGI(TAG, "Input not sampled, tuner disabled");
+        return;
+    }
+    _bench();
+    xTaskCreate(_tuner_task, "tuner_task", 3072, NULL, 4, &tuner_task_handle);
+}
+
+/**
+ * @brief Start or stop tuning
+ *
+ * @param on true to start
+ * @return false if the tuner cannot run
+ */
+bool tuner_set_active(bool on)
+{
+    if (!input_ok)
+    {
+        return false;
+    }
+    if (on && !active)
+    {
+        xSemaphoreTake(tuner_mutex, portMAX_DELAY);
+        ring_count = 0;
+        reading.valid = false;
+        xSemaphoreGive(tuner_mutex);
+        active = true;
+        xTaskNotifyGive(tuner_task_handle);
+    }
+    else if (!on)
+    {
+        active = false;
+    }
+    return true;
+}
+
+/**
+ * @brief Get the newest reading
+ *
+ * @param[out] out Newest reading
+ * @return true if it is newer than the one returned last time
+ */
+bool tuner_get_reading(tuner_reading_t *out)
+{
+    if (tuner_mutex == NULL)
+    {
+        return false;
+    }
+    xSemaphoreTake(tuner_mutex, portMAX_DELAY);
+    *out = reading;
+    bool fresh = reading_seq != reading_seen;
+    reading_seen = reading_seq;
+    xSemaphoreGive(tuner_mutex);
+    return fresh;
+}
+
+#endif /* CONFIG_TUNER_ENABLE */
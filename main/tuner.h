@@ -0,0 +1,51 @@
+/**
+ * @file tuner.h
+ * @brief Chromatic tuner on the guitar input
+ *
+ * While active, the tuner keeps the latest input samples (input_adc.h) in a
+ * ring and estimates the pitch (pitch.h) CONFIG_TUNER_UPDATE_HZ times per
+ * second from the newest PITCH_FRAME of them. Muting the output while tuning
+ * is left to the caller (matrix_set_mute()).
+ */
+
+#ifndef TUNER_H
+#define TUNER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief One tuner reading
+ */
+typedef struct
+{
+    bool valid;  /**< A note was found */
+    int midi;    /**< MIDI note number */
+    float cents; /**< Deviation from the note, -50 to +50 */
+    float hz;    /**< Measured frequency */
+} tuner_reading_t;
+
+/**
+ * @brief Register with the input and start the tuner task
+ *
+ * Also measures the pitch kernel speed and logs it.
+ */
+void tuner_init(void);
+
+/**
+ * @brief Start or stop tuning
+ *
+ * @param active true to start
+ * @return false if the tuner cannot run (no input sense pin)
+ */
+bool tuner_set_active(bool active);
+
+/**
+ * @brief Get the newest reading
+ *
+ * @param[out] reading Newest reading
+ * @return true if it is newer than the one returned last time
+ */
+bool tuner_get_reading(tuner_reading_t *reading);
+
+#endif /* TUNER_H */
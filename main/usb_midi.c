@@ -0,0 +1,237 @@
+/**
+ * @file usb_midi.c
+ * @brief Implementation of the USB MIDI device
+ *
+ * tud_midi_rx_cb() runs in the TinyUSB task once a transfer has been taken
+ * from the OUT endpoint. It drains the event packets into one buffer of a
+ * full transfer, decodes them there, and only the resulting batch crosses
+ * to the buttons task.
+ */
+
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_mac.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "usb_midi.h"
+#include "power.h"
+
+#ifdef CONFIG_USB_MIDI_ENABLE
+
+#include "tinyusb.h"
+
+#define USB_MIDI_EP_OUT 0x01  /**< Bulk OUT endpoint */
+#define USB_MIDI_EP_IN 0x81   /**< Bulk IN endpoint */
+#define USB_MIDI_EP_SIZE 64   /**< Full speed bulk packet: 16 event packets */
+#define USB_MIDI_CONFIG_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN) /**< Configuration descriptor length */
+
+/**
+ * @brief Interfaces of the configuration
+ */
+enum
+{
+    ITF_MIDI = 0,        /**< Audio control */
+    ITF_MIDI_STREAMING,  /**< MIDI streaming */
+    ITF_COUNT
+};
+
+static const char *TAG = "UsbMidi";
+
+/** @brief Serial number string, from the chip MAC */
+static char serial[13];
+
+/** @brief String descriptors, in the order the device descriptor refers to them */
+static const char *string_desc[] = {
+    (const char[]){0x09, 0x04}, // Supported language: English
+    "ESP32 Patch Bay",          // Manufacturer
+    "Patch Bay",                // Product
+    serial,                     // Serial number
+    "Patch Bay MIDI",           // MIDI interface
+};
+
+/** @brief Configuration descriptor: one MIDI function with one cable each way */
+static const uint8_t config_desc[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_COUNT, 0, USB_MIDI_CONFIG_LEN, 0, 100),
+    TUD_MIDI_DESCRIPTOR(ITF_MIDI, 4, USB_MIDI_EP_OUT, USB_MIDI_EP_IN, USB_MIDI_EP_SIZE),
+};
+
+/** @brief Messages the unit answers */
+static midi_map_t map;
+/** @brief Task woken when a batch arrives */
+static TaskHandle_t waiter;
+
+/** @brief Protects the pending batch and the counters */
+static portMUX_TYPE midi_lock = portMUX_INITIALIZER_UNLOCKED;
+/** @brief Commands not yet taken by the buttons task */
+static midi_batch_t pending;
+/** @brief When the first of them left the endpoint, 0 if there are none */
+static int64_t pending_us;
+
+/** @brief Counters of the current report window */
+static uint32_t stat_transfers, stat_events, stat_ignored, stat_taken, stat_wait_sum_us, stat_wait_max_us;
+/** @brief Time of the last report */
+static int64_t last_report_us;
+
+/**
+ * @brief Log the counters of the report window and start a new one
+ *
+ * @param now Current time
+ */
+static void _report(int64_t now)
+{
+    portENTER_CRITICAL(&midi_lock);
+    uint32_t transfers = stat_transfers, events = stat_events, ignored = stat_ignored;
+    uint32_t taken = stat_taken, wait_sum = stat_wait_sum_us, wait_max = stat_wait_max_us;
+    stat_transfers = stat_events = stat_ignored = stat_taken = stat_wait_sum_us = stat_wait_max_us = 0;
+    portEXIT_CRITICAL(&midi_lock);
+    last_report_us = now;
+    if (taken)
+    {
+        ESP_LOGI(TAG, "%lu transfers, %lu events (%lu ignored) in %lu batches; endpoint to buttons task %lu us mean, "
+                      "%lu us max",
+                 (unsigned long)transfers, (unsigned long)events, (unsigned long)ignored, (unsigned long)taken,
+                 (unsigned long)(wait_sum / taken), (unsigned long)wait_max);
+    }
+}
+
+/**
+ * @brief TinyUSB callback: event packets arrived on the OUT endpoint
+ *
+ * @param itf MIDI interface
+ */
+void tud_midi_rx_cb(uint8_t itf)
+{
+    int64_t now = esp_timer_get_time();
+    uint8_t packets[USB_MIDI_EP_SIZE];
+    midi_batch_t batch;
+    midi_batch_init(&batch);
+    size_t len;
+    do
+    {
+        len = 0;
+        while (len < sizeof(packets) && tud_midi_n_packet_read(itf, &packets[len]))
+        {
+            len += MIDI_EVENT_SIZE;
+        }
+        midi_decode_usb(&map, packets, len, &batch);
+    } while (len == sizeof(packets)); // More than one transfer waiting
+
+    bool command = batch.program != MIDI_NONE || batch.scene != MIDI_NONE;
+    portENTER_CRITICAL(&midi_lock);
+    stat_transfers++;
+    stat_events += batch.events;
+    stat_ignored += batch.ignored;
+    if (command)
+    {
+        if (!pending_us)
+        {
+            pending_us = now;
+        }
+        midi_batch_merge(&pending, &batch);
+    }
+    portEXIT_CRITICAL(&midi_lock);
+
+    if (command)
+    {
+        xTaskNotifyGive(waiter);
+    }
+    if (now - last_report_us >= USB_MIDI_REPORT_MS * 1000LL)
+    {
+        _report(now);
+    }
+}
+
+/**
+ * @brief Start the USB MIDI device
+ *
+ * @param notify Task woken when a batch arrives, the buttons task
+ */
+void usb_midi_init(TaskHandle_t notify)
+{
+    waiter = notify;
+    map.channel = CONFIG_USB_MIDI_CHANNEL;
+    map.scene_cc = CONFIG_USB_MIDI_SCENE_CC < 0 ? MIDI_CC_NONE : CONFIG_USB_MIDI_SCENE_CC;
+    midi_batch_init(&pending);
+
+    uint8_t mac[6] = {0};
+    esp_efuse_mac_get_default(mac);
+    snprintf(serial, sizeof(serial), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    const tinyusb_config_t tusb_cfg = {
+        .device_descriptor = NULL, // Vendor and product IDs from the TinyUSB menuconfig
+        .string_descriptor = string_desc,
+        .string_descriptor_count = sizeof(string_desc) / sizeof(string_desc[0]),
+        .external_phy = false,
+        .configuration_descriptor = config_desc,
+    };
+    esp_err_t err = tinyusb_driver_install(&tusb_cfg);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "TinyUSB install failed: %s", esp_err_to_name(err));
+        return;
+    }
+    power_stay_awake("USB MIDI"); // The USB peripheral needs its clock while the host polls
+    last_report_us = esp_timer_get_time();
+    if (map.channel == MIDI_CHANNEL_ANY)
+    {
+        ESP_LOGI(TAG, "USB MIDI device on all channels, scene CC %d", CONFIG_USB_MIDI_SCENE_CC);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "USB MIDI device on channel %d, scene CC %d", map.channel, CONFIG_USB_MIDI_SCENE_CC);
+    }
+}
+
+/**
+ * @brief Take the commands received since the last call
+ *
+ * @param[out] batch Commands, merged in the order they arrived
+ * @param[out] arrived_us When the first of them left the endpoint
+ * @return true if anything arrived
+ */
+bool usb_midi_take(midi_batch_t *batch, int64_t *arrived_us)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&midi_lock);
+    bool got = pending_us != 0;
+    if (got)
+    {
+        *batch = pending;
+        *arrived_us = pending_us;
+        uint32_t wait = (uint32_t)(now - pending_us);
+        stat_taken++;
+        stat_wait_sum_us += wait;
+        if (wait > stat_wait_max_us)
+        {
+            stat_wait_max_us = wait;
+        }
+        midi_batch_init(&pending);
+        pending_us = 0;
+    }
+    portEXIT_CRITICAL(&midi_lock);
+    return got;
+}
+
+/**
+ * @brief Send MIDI bytes to the host
+ *
+ * @param data Complete MIDI messages
+ * @param len Number of bytes
+ */
+void usb_midi_send(const uint8_t *data, size_t len)
+{
+    if (len == 0 || !tud_midi_mounted())
+    {
+        return;
+    }
+    uint32_t sent = tud_midi_stream_write(0, data, len);
+    if (sent < len)
+    {
+        ESP_LOGW(TAG, "Sent %lu of %u MIDI bytes, the host is not reading", (unsigned long)sent, (unsigned)len);
+    }
+}
+
+#endif /* CONFIG_USB_MIDI_ENABLE */
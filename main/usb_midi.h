@@ -0,0 +1,65 @@
+/**
+ * @file usb_midi.h
+ * @brief USB MIDI device on the native USB port of the ESP32-S3
+ *
+ * The unit enumerates as a class compliant USB MIDI device (TinyUSB), so a
+ * DAW or a laptop can recall presets, songs and scenes with program and
+ * control changes (see midi_proto.h for the mapping).
+ *
+ * The TinyUSB task stamps every OUT transfer as it leaves the endpoint,
+ * decodes its event packets in place into one batch and merges it into the
+ * batch waiting for the buttons task, which it wakes. The buttons task
+ * takes the batch with usb_midi_take() and hands the stamp to
+ * deadline_input_at(), so the deadline monitor measures every command from
+ * the endpoint to the latch of its route. The time from the endpoint to
+ * the buttons task taking the batch is logged every USB_MIDI_REPORT_MS.
+ *
+ * The MIDI bytes of a show song are sent to the host with usb_midi_send()
+ * when the song is entered.
+ *
+ * The port uses GPIO 19 (D-) and GPIO 20 (D+), so neither may be in the
+ * hardware profile, and the USB Serial/JTAG console is gone while the
+ * device runs.
+ */
+
+#ifndef USB_MIDI_H
+#define USB_MIDI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "midi_proto.h"
+
+#define USB_MIDI_PIN_DM 19        /**< Native USB D- */
+#define USB_MIDI_PIN_DP 20        /**< Native USB D+ */
+#define USB_MIDI_REPORT_MS 60000  /**< Latency report interval */
+
+/**
+ * @brief Start the USB MIDI device
+ *
+ * @param notify Task woken when a batch arrives, the buttons task
+ */
+void usb_midi_init(TaskHandle_t notify);
+
+/**
+ * @brief Take the commands received since the last call
+ *
+ * @param[out] batch Commands, merged in the order they arrived
+ * @param[out] arrived_us When the first of them left the endpoint, from esp_timer_get_time()
+ * @return true if anything arrived
+ */
+bool usb_midi_take(midi_batch_t *batch, int64_t *arrived_us);
+
+/**
+ * @brief Send MIDI bytes to the host
+ *
+ * Does nothing while no host is connected.
+ *
+ * @param data Complete MIDI messages
+ * @param len Number of bytes
+ */
+void usb_midi_send(const uint8_t *data, size_t len);
+
+#endif /* USB_MIDI_H */
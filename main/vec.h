@@ -0,0 +1,79 @@
+/**
+ * @file vec.h
+ * @brief Block kernels over 16-bit sample buffers
+ *
+ * Used by the signal analysis code (pitch.c, level.c). The dot product runs
+ * on the ESP32-S3 PIE vector unit when it is available: eight 16-bit
+ * multiply-accumulates per instruction into the 40-bit ACCX accumulator.
+ * The scalar versions give the same exact results, so the analysis code
+ * behaves the same on the device and on a host.
+ *
+ * This module has no ESP-IDF dependencies besides the target check.
+ */
+
+#ifndef VEC_H
+#define VEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef CONFIG_IDF_TARGET_ESP32S3
+#define VEC_HAVE_SIMD 1 /**< PIE kernels compiled in */
+#else
+#define VEC_HAVE_SIMD 0
+#endif
+
+#define VEC_ALIGN 16 /**< Alignment the SIMD kernels need, in bytes */
+#define VEC_LANES 8  /**< 16-bit lanes per vector register */
+
+/**
+ * @brief Dot product in portable C
+ *
+ * @param a First vector
+ * @param b Second vector
+ * @param n Length
+ * @return Exact sum of the products
+ */
+int64_t vec_dot_s16_scalar(const int16_t *a, const int16_t *b, size_t n);
+
+#if VEC_HAVE_SIMD
+/**
+ * @brief Dot product on the PIE vector unit
+ *
+ * @param a First vector, VEC_ALIGN aligned
+ * @param b Second vector, VEC_ALIGN aligned
+ * @param n Length, a multiple of VEC_LANES
+ * @return Exact sum of the products while it fits in 40 bits
+ */
+int64_t vec_dot_s16_simd(const int16_t *a, const int16_t *b, size_t n);
+#endif
+
+/**
+ * @brief Dot product, on the vector unit when the buffers allow it
+ *
+ * @param a First vector
+ * @param b Second vector
+ * @param n Length
+ * @return Exact sum of the products
+ */
+int64_t vec_dot_s16(const int16_t *a, const int16_t *b, size_t n);
+
+/**
+ * @brief Sum, minimum and maximum of a buffer
+ *
+ * Works on blocks of VEC_LANES samples with one accumulator per lane, so the
+ * lanes are independent and the loop pipelines (or vectorises on a host).
+ *
+ * @param x Samples
+ * @param n Number of samples
+ * @param[out] sum Sum of the samples
+ * @param[out] min Smallest sample, UINT16_MAX if @p n is 0
+ * @param[out] max Largest sample, 0 if @p n is 0
+ */
+void vec_sum_range_u16(const uint16_t *x, size_t n, uint32_t *sum, uint16_t *min, uint16_t *max);
+
+#endif /* VEC_H */
@@ -0,0 +1,244 @@
+/**
+ * @file zc_sync.c
+ * @brief Implementation of zero crossing synchronized route switching
+ *
+ * The input samples arrive from input_adc.c. The listener feeds each frame to
+ * the detector and anchors detector time to esp_timer time at the end of that
+ * frame. A switch request converts the predicted crossing back to esp_timer
+ * time and arms a one-shot alarm on a 1 MHz gptimer, whose IRAM interrupt
+ * pulses the latch.
+ */
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <driver/gptimer.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "sdkconfig.h"
+#include "zc_sync.h"
+#include "input_adc.h"
+#include "sr_bus.h"
+
+#ifdef CONFIG_ZC_SYNC_ENABLE
+
+#define ZC_LOWEST_HZ 40                /**< Lowest note tracked */
+#define ZC_MIN_LEAD_US 200             /**< Time needed to arm the latch alarm */
+#define ZC_TIMER_RESOLUTION_HZ 1000000 /**< 1 tick = 1 us */
+#define ZC_REPORT_MS 10000             /**< Alignment report interval */
+
+static const char *TAG = "ZeroCross";
+
+/** @brief Protects the detector and the time anchor */
+static SemaphoreHandle_t det_mutex;
+/** @brief Detector fed with the input samples */
+static zc_detector_t det;
+/** @brief esp_timer time at the end of the last frame fed */
+static int64_t anchor_us;
+/** @brief Detector time at the end of the last frame fed */
+static zc_time_t anchor_time;
+/** @brief The anchor describes the current sample stream */
+static bool anchor_valid;
+
+/** @brief One-shot latch timer, NULL while switching is not synchronized */
+static gptimer_handle_t latch_timer;
+/** @brief Given by the alarm interrupt once the frame is latched */
+static SemaphoreHandle_t latched_sem;
+/** @brief esp_timer time of the last latch */
+static volatile int64_t latched_us;
+
+/** @brief Microseconds to detector time */
+static inline zc_time_t _us_to_time(int64_t us)
+{
+    return (zc_time_t)(us * CONFIG_INPUT_SAMPLE_RATE * (1 << ZC_TIME_FRAC) / 1000000);
+}
+
+/** @brief Detector time difference to microseconds */
+static inline int64_t _time_to_us(int32_t t)
+{
+    return (int64_t)t * 1000000 / ((int64_t)CONFIG_INPUT_SAMPLE_RATE << ZC_TIME_FRAC);
+}
+
+/**
+ * @brief Input listener: feed a frame to the detector
+ */
+static void _on_frame(const uint16_t *samples, size_t n, int64_t frame_end_us)
+{
+    xSemaphoreTake(det_mutex, portMAX_DELAY);
+    if (n == 0)
+    {
+        anchor_valid = false; // Frames were dropped, wait for the next one
+    }
+    else
+    {
+        zc_feed(&det, samples, n);
+        anchor_time = zc_now(&det);
+        anchor_us = frame_end_us;
+        anchor_valid = true;
+    }
+    xSemaphoreGive(det_mutex);
+}
+
+/**
+ * @brief Latch alarm interrupt: latch the staged frame
+ */
+static bool IRAM_ATTR _on_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+    sr_bus_latch();
+    latched_us = esp_timer_get_time();
+    gptimer_set_alarm_action(timer, NULL);
+
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(latched_sem, &woken);
+    return woken == pdTRUE;
+}
+
+/**
+ * @brief Zc task: report the alignment
+ *
+ * @param pvParameters FreeRTOS task parameters (unused)
+ */
+static void _zc_task(void *pvParameters)
+{
+    uint32_t reported = 0;
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(ZC_REPORT_MS));
+        zc_stats_t s;
+        zc_sync_get_stats(&s);
+        uint32_t total = 0;
+        for (int r = 0; r < ZC_FIRE_REASON_COUNT; r++)
+        {
+            total += s.fires[r];
+        }
+        if (total != reported)
+        {
+            reported = total;
+            ESP_LOGI(TAG, "Switches: %lu predicted, %lu quiet, %lu unstable, %lu timeout; alignment mean %lld us, max %lld us",
+                     (unsigned long)s.fires[ZC_FIRE_PREDICTED], (unsigned long)s.fires[ZC_FIRE_QUIET],
+                     (unsigned long)s.fires[ZC_FIRE_UNSTABLE], (unsigned long)s.fires[ZC_FIRE_TIMEOUT],
+                     s.measured ? _time_to_us((int32_t)(s.err_abs_sum / s.measured)) : 0LL,
+                     _time_to_us((int32_t)s.err_abs_max));
+        }
+    }
+}
+
+/**
+ * @brief Start sampling the input and the latch timer
+ */
+void zc_sync_init(void)
+{
+    zc_config_t cfg = {
+        .hysteresis = CONFIG_ZC_HYSTERESIS,
+        .quiet_level = CONFIG_ZC_QUIET_LEVEL,
+        .max_period = CONFIG_INPUT_SAMPLE_RATE / ZC_LOWEST_HZ,
+    };
+    zc_init(&det, &cfg);
+    det_mutex = xSemaphoreCreateMutex();
+    latched_sem = xSemaphoreCreateBinary();
+    if (!input_adc_add_listener(INPUT_ADC_GUITAR, _on_frame))
+    {
+        ESP_LOGI(TAG, "Input not sampled, routes switch right away");
+        return;
+    }
+
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = ZC_TIMER_RESOLUTION_HZ,
+        .intr_priority = 3, // Same level as the tap output, the latch edge is just as timing critical
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &latch_timer));
+    gptimer_event_callbacks_t timer_cbs = {
+        .on_alarm = _on_alarm,
+    };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(latch_timer, &timer_cbs, NULL));
+    ESP_ERROR_CHECK(gptimer_enable(latch_timer));
+    ESP_ERROR_CHECK(gptimer_start(latch_timer));
+
+    xTaskCreate(_zc_task, "zc_task", 3072, NULL, 3, NULL);
+    ESP_LOGI(TAG, "Zero-crossing switching, max wait %d us", CONFIG_ZC_MAX_WAIT_US);
+}
+
+/**
+ * @brief Latch the staged frame at the next zero crossing
+ *
+ * Blocks until the frame is latched. A quiet input or one without a steady
+ * period is switched right away, since waiting would not make it quieter.
+ */
+void zc_sync_latch(void)
+{
+    if (latch_timer == NULL)
+    {
+        sr_bus_latch();
+        return;
+    }
+
+    xSemaphoreTake(det_mutex, portMAX_DELAY);
+    if (!anchor_valid)
+    {
+        xSemaphoreGive(det_mutex);
+        sr_bus_latch();
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    zc_time_t now = anchor_time + _us_to_time(now_us - anchor_us);
+    zc_fire_reason_t reason;
+    zc_time_t at = zc_schedule(&det, now + _us_to_time(ZC_MIN_LEAD_US), now + _us_to_time(CONFIG_ZC_MAX_WAIT_US), &reason);
+    int64_t fire_us = now_us + _time_to_us((int32_t)(at - now));
+    xSemaphoreGive(det_mutex);
+
+    bool on_timer = false;
+    if (reason == ZC_FIRE_PREDICTED || reason == ZC_FIRE_TIMEOUT)
+    {
+        uint64_t count;
+        gptimer_get_raw_count(latch_timer, &count);
+        int64_t delay = fire_us - esp_timer_get_time();
+        if (delay > 0)
+        {
+            xSemaphoreTake(latched_sem, 0); // Drop a late give from an earlier switch
+            gptimer_alarm_config_t alarm = {
+                .alarm_count = count + delay,
+            };
+            gptimer_set_alarm_action(latch_timer, &alarm);
+            on_timer = xSemaphoreTake(latched_sem, pdMS_TO_TICKS(CONFIG_ZC_MAX_WAIT_US / 1000 + 10)) == pdTRUE;
+            if (!on_timer)
+            {
+                gptimer_set_alarm_action(latch_timer, NULL);
+                ESP_LOGW(TAG, "Latch alarm missed, latching now");
+            }
+        }
+    }
+    if (!on_timer)
+    {
+        sr_bus_latch();
+        latched_us = esp_timer_get_time();
+    }
+
+    xSemaphoreTake(det_mutex, portMAX_DELAY);
+    zc_note_fire(&det, anchor_time + _us_to_time(latched_us - anchor_us), reason);
+    xSemaphoreGive(det_mutex);
+}
+
+/**
+ * @brief Get the alignment statistics
+ *
+ * @param[out] stats Statistics since boot
+ */
+void zc_sync_get_stats(zc_stats_t *stats)
+{
+    if (det_mutex == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(det_mutex, portMAX_DELAY);
+    *stats = det.stats;
+    xSemaphoreGive(det_mutex);
+}
+
+#endif /* CONFIG_ZC_SYNC_ENABLE */
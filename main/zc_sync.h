@@ -0,0 +1,39 @@
+/**
+ * @file zc_sync.h
+ * @brief Route switching synchronized to zero crossings of the guitar input
+ *
+ * The guitar input samples (input_adc.h) are fed to the zero crossing
+ * detector (zero_cross.h). A staged frame is latched from a hardware timer
+ * alarm at the next predicted crossing, at most CONFIG_ZC_MAX_WAIT_US after
+ * the switch was requested.
+ */
+
+#ifndef ZC_SYNC_H
+#define ZC_SYNC_H
+
+#include "zero_cross.h"
+
+/**
+ * @brief Start sampling the input and the latch timer
+ *
+ * Does nothing if the board has no input sense pin (see hw_profile.h). Must be
+ * called after matrix_init().
+ */
+void zc_sync_init(void);
+
+/**
+ * @brief Latch the staged frame at the next zero crossing
+ *
+ * Blocks until the frame is latched, at most CONFIG_ZC_MAX_WAIT_US plus the
+ * timer latency. Latches right away while the input is not being sampled.
+ */
+void zc_sync_latch(void);
+
+/**
+ * @brief Get the alignment statistics
+ *
+ * @param[out] stats Statistics since boot
+ */
+void zc_sync_get_stats(zc_stats_t *stats);
+
+#endif /* ZC_SYNC_H */
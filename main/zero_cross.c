@@ -0,0 +1,285 @@
+/**
+ * @file zero_cross.c
+ * @brief Implementation of the zero crossing detector and switch scheduler
+ */
+
+#include <string.h>
+#include "zero_cross.h"
+
+#define ZC_DC_SHIFT 10 /**< DC tracker time constant, 2^n samples */
+#define ZC_ENV_SHIFT 9 /**< Envelope decay time constant, 2^n samples */
+
+/** @brief Signed distance from @p b to @p a, safe across wraps */
+static inline int32_t _diff(zc_time_t a, zc_time_t b)
+{
+    return (int32_t)(a - b);
+}
+
+/**
+ * @brief Initialize a detector
+ *
+ * @param det Detector
+ * @param cfg Settings
+ */
+void zc_init(zc_detector_t *det, const zc_config_t *cfg)
+{
+    memset(det, 0, sizeof(*det));
+    det->cfg = *cfg;
+}
+
+/**
+ * @brief Get the ring index of the crossing @p age places back (0 = newest)
+ */
+static inline uint8_t _ring_index(const zc_detector_t *det, uint8_t age)
+{
+    return (uint8_t)(det->head + ZC_RING_LEN - 1 - age) % ZC_RING_LEN;
+}
+
+/**
+ * @brief Store a crossing and settle a pending alignment measurement
+ *
+ * @param det Detector
+ * @param t Crossing time
+ * @param dir 1 rising, -1 falling
+ */
+static void _add_crossing(zc_detector_t *det, zc_time_t t, int8_t dir)
+{
+    if (det->eval_pending && _diff(t, det->eval_at) >= 0)
+    {
+        uint32_t err = (uint32_t)_diff(t, det->eval_at);
+        if (det->count)
+        {
+            uint32_t before = (uint32_t)_diff(det->eval_at, det->xing[_ring_index(det, 0)]);
+            if (before < err)
+            {
+                err = before;
+            }
+        }
+        det->stats.measured++;
+        det->stats.err_abs_sum += err;
+        if (err > det->stats.err_abs_max)
+        {
+            det->stats.err_abs_max = err;
+        }
+        det->eval_pending = false;
+    }
+
+    det->xing[det->head] = t;
+    det->xing_dir[det->head] = dir;
+    det->head = (det->head + 1) % ZC_RING_LEN;
+    if (det->count < ZC_RING_LEN)
+    {
+        det->count++;
+    }
+}
+
+/**
+ * @brief Feed a block of samples
+ *
+ * A crossing is the last sign change before the signal gets past the
+ * hysteresis on the other side, so noise around zero does not add crossings.
+ * Its time is interpolated between the two samples around the sign change.
+ *
+ * @param det Detector
+ * @param samples Unipolar ADC samples
+ * @param n Number of samples
+ */
+void zc_feed(zc_detector_t *det, const uint16_t *samples, size_t n)
+{
+    int32_t hyst = det->cfg.hysteresis;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int32_t raw = samples[i];
+        if (!det->primed)
+        {
+            det->dc = raw << 8;
+            det->primed = true;
+        }
+        det->dc += ((raw << 8) - det->dc) >> ZC_DC_SHIFT;
+        int32_t x = raw - (det->dc >> 8);
+
+        int32_t mag = (x < 0 ? -x : x) << 8;
+        det->env -= det->env >> ZC_ENV_SHIFT;
+        if (mag > det->env)
+        {
+            det->env = mag;
+        }
+
+        if ((x < 0) != (det->prev < 0))
+        {
+            // Interpolate the zero between the previous sample and this one
+            int32_t span = det->prev - x;
+            det->cand = ZC_TIME(det->n - 1) + (zc_time_t)(((int64_t)det->prev << ZC_TIME_FRAC) / span);
+            det->cand_valid = true;
+        }
+
+        if (x > hyst && det->side <= 0)
+        {
+            if (det->side < 0 && det->cand_valid)
+            {
+                _add_crossing(det, det->cand, 1);
+            }
+            det->side = 1;
+            det->cand_valid = false;
+        }
+        else if (x < -hyst && det->side >= 0)
+        {
+            if (det->side > 0 && det->cand_valid)
+            {
+                _add_crossing(det, det->cand, -1);
+            }
+            det->side = -1;
+            det->cand_valid = false;
+        }
+
+        det->prev = x;
+        det->n++;
+    }
+
+    if (det->eval_pending && _diff(zc_now(det), det->eval_at) > (int32_t)ZC_TIME(det->cfg.max_period))
+    {
+        det->eval_pending = false; // No crossing followed, nothing to measure against
+    }
+}
+
+/**
+ * @brief Time just after the last sample fed
+ *
+ * @param det Detector
+ * @return Current detector time
+ */
+zc_time_t zc_now(const zc_detector_t *det)
+{
+    return ZC_TIME(det->n);
+}
+
+/**
+ * @brief Estimate the period of the note from the rising crossings
+ *
+ * @param det Detector
+ * @param[out] last_rising Time of the newest rising crossing
+ * @return Period in zc_time_t units, 0 if there is no steady period
+ */
+static uint32_t _period(const zc_detector_t *det, zc_time_t *last_rising)
+{
+    zc_time_t rising[ZC_PERIOD_INTERVALS + 1];
+    int found = 0;
+
+    for (int age = 0; age < det->count && found <= ZC_PERIOD_INTERVALS; age++)
+    {
+        uint8_t idx = _ring_index(det, age);
+        if (det->xing_dir[idx] > 0)
+        {
+            rising[found++] = det->xing[idx];
+        }
+    }
+    if (found < 3)
+    {
+        return 0; // Need at least two intervals to call it steady
+    }
+
+    uint32_t sum = 0;
+    uint32_t max_period = ZC_TIME(det->cfg.max_period);
+    for (int i = 0; i < found - 1; i++)
+    {
+        uint32_t interval = (uint32_t)_diff(rising[i], rising[i + 1]);
+        if (interval > max_period)
+        {
+            found = i + 1; // Older crossings belong to an earlier note
+            break;
+        }
+        sum += interval;
+    }
+    if (found < 3)
+    {
+        return 0;
+    }
+
+    uint32_t period = sum / (found - 1);
+    for (int i = 0; i < found - 1; i++)
+    {
+        int32_t dev = _diff(rising[i], rising[i + 1]) - (int32_t)period;
+        if ((uint32_t)(dev < 0 ? -dev : dev) > period / 8)
+        {
+            return 0; // Intervals disagree by more than 12.5 %
+        }
+    }
+    *last_rising = rising[0];
+    return period;
+}
+
+/**
+ * @brief Pick the time for a pending switch
+ *
+ * The crossings within the last period repeat one period later as long as
+ * the note sustains, so each of them is projected forward by whole periods
+ * and the first projection at or after @p earliest is taken.
+ *
+ * @param det Detector
+ * @param earliest Earliest time the switch can happen
+ * @param deadline Latest time the switch may happen
+ * @param[out] reason Why this time was picked
+ * @return Switch time, between @p earliest and @p deadline
+ */
+zc_time_t zc_schedule(const zc_detector_t *det, zc_time_t earliest, zc_time_t deadline, zc_fire_reason_t *reason)
+{
+    if (det->env < ((int32_t)det->cfg.quiet_level << 8))
+    {
+        *reason = ZC_FIRE_QUIET;
+        return earliest;
+    }
+
+    zc_time_t last_rising;
+    uint32_t period = _period(det, &last_rising);
+    if (period == 0 || _diff(zc_now(det), last_rising) > (int32_t)(2 * period))
+    {
+        *reason = ZC_FIRE_UNSTABLE;
+        return earliest;
+    }
+
+    bool have_best = false;
+    zc_time_t best = deadline;
+    for (int age = 0; age < det->count; age++)
+    {
+        zc_time_t c = det->xing[_ring_index(det, age)];
+        if (_diff(last_rising, c) >= (int32_t)period)
+        {
+            break; // Older than one period
+        }
+        int32_t ahead = _diff(earliest, c);
+        uint32_t periods = ahead <= 0 ? 0 : ((uint32_t)ahead + period - 1) / period;
+        zc_time_t t = c + periods * period;
+        if (!have_best || _diff(t, best) < 0)
+        {
+            best = t;
+            have_best = true;
+        }
+    }
+
+    if (!have_best || _diff(best, deadline) > 0)
+    {
+        *reason = ZC_FIRE_TIMEOUT;
+        return deadline;
+    }
+    *reason = ZC_FIRE_PREDICTED;
+    return best;
+}
+
+/**
+ * @brief Record a switch so its alignment is measured
+ *
+ * @param det Detector
+ * @param at Time the switch actually happened
+ * @param reason Reason returned by zc_schedule()
+ */
+void zc_note_fire(zc_detector_t *det, zc_time_t at, zc_fire_reason_t reason)
+{
+    if (reason < ZC_FIRE_REASON_COUNT)
+    {
+        det->stats.fires[reason]++;
+    }
+    // A quiet input has no crossings to measure against
+    det->eval_pending = reason != ZC_FIRE_QUIET;
+    det->eval_at = at;
+}
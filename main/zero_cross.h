@@ -0,0 +1,141 @@
+/**
+ * @file zero_cross.h
+ * @brief Zero crossing detector and switch scheduler for click-free routing
+ *
+ * Switching the analog muxes while the signal is far from zero clicks. The
+ * input is sampled continuously and this detector keeps the times of the
+ * latest zero crossings in a small ring. Samples arrive in blocks, so by the
+ * time a crossing is seen it is already in the past; the scheduler therefore
+ * projects the crossings of the last period of the note one period ahead and
+ * picks the first one after the earliest possible switch time, bounded by a
+ * deadline.
+ *
+ * After a switch the detector measures how far it landed from the nearest
+ * real crossing and keeps the statistics.
+ *
+ * This module has no ESP-IDF dependencies so it can be built on a host, see
+ * tools/zc_replay.c.
+ *
+ * Times are sample counts with ZC_TIME_FRAC fractional bits. They wrap, so
+ * compare them through differences only.
+ */
+
+#ifndef ZERO_CROSS_H
+#define ZERO_CROSS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ZC_TIME_FRAC 8                                    /**< Fractional bits of a zc_time_t */
+#define ZC_TIME(samples) ((zc_time_t)(samples) << ZC_TIME_FRAC) /**< Whole samples to zc_time_t */
+#define ZC_RING_LEN 16                                    /**< Crossings remembered */
+#define ZC_PERIOD_INTERVALS 4                             /**< Period intervals averaged */
+
+typedef uint32_t zc_time_t; /**< Sample time in 1/256 samples, wraps */
+
+/**
+ * @brief Why a switch was scheduled when it was
+ */
+typedef enum
+{
+    ZC_FIRE_PREDICTED = 0, /**< At a predicted zero crossing */
+    ZC_FIRE_QUIET,         /**< Input silent, switched right away */
+    ZC_FIRE_UNSTABLE,      /**< No steady period to predict from, switched right away */
+    ZC_FIRE_TIMEOUT,       /**< Next crossing too late, switched at the deadline */
+    ZC_FIRE_REASON_COUNT
+} zc_fire_reason_t;
+
+/**
+ * @brief Detector settings
+ */
+typedef struct
+{
+    uint16_t hysteresis;  /**< ADC counts a half-wave must reach past the DC level to count */
+    uint16_t quiet_level; /**< Envelope in ADC counts below which the input counts as silent */
+    uint32_t max_period;  /**< Longest period tracked, in samples (lowest note) */
+} zc_config_t;
+
+/**
+ * @brief Alignment statistics of scheduled switches
+ */
+typedef struct
+{
+    uint32_t fires[ZC_FIRE_REASON_COUNT]; /**< Switches per reason */
+    uint32_t measured;                    /**< Switches whose alignment was measured */
+    uint64_t err_abs_sum;                 /**< Sum of |alignment error|, zc_time_t units */
+    uint32_t err_abs_max;                 /**< Largest |alignment error|, zc_time_t units */
+} zc_stats_t;
+
+/**
+ * @brief Detector state
+ */
+typedef struct
+{
+    zc_config_t cfg;               /**< Settings */
+    bool primed;                   /**< DC level initialized */
+    int32_t dc;                    /**< DC level, ADC counts << 8 */
+    int32_t env;                   /**< Peak envelope, ADC counts << 8 */
+    int32_t prev;                  /**< Previous sample, centred */
+    int8_t side;                   /**< Half-wave past the hysteresis: 1 above, -1 below, 0 none yet */
+    bool cand_valid;               /**< A sign change was seen since the last crossing */
+    zc_time_t cand;                /**< Time of the latest sign change */
+    uint32_t n;                    /**< Samples fed */
+    zc_time_t xing[ZC_RING_LEN];   /**< Crossing times, newest at head - 1 */
+    int8_t xing_dir[ZC_RING_LEN];  /**< 1 rising, -1 falling */
+    uint8_t head;                  /**< Next ring slot */
+    uint8_t count;                 /**< Crossings in the ring */
+    bool eval_pending;             /**< A switch waits for its alignment to be measured */
+    zc_time_t eval_at;             /**< Time of that switch */
+    zc_stats_t stats;              /**< Alignment statistics */
+} zc_detector_t;
+
+/**
+ * @brief Initialize a detector
+ *
+ * @param det Detector
+ * @param cfg Settings
+ */
+void zc_init(zc_detector_t *det, const zc_config_t *cfg);
+
+/**
+ * @brief Feed a block of samples
+ *
+ * @param det Detector
+ * @param samples Unipolar ADC samples (the signal is centred on its own DC level)
+ * @param n Number of samples
+ */
+void zc_feed(zc_detector_t *det, const uint16_t *samples, size_t n);
+
+/**
+ * @brief Time just after the last sample fed
+ *
+ * @param det Detector
+ * @return Current detector time
+ */
+zc_time_t zc_now(const zc_detector_t *det);
+
+/**
+ * @brief Pick the time for a pending switch
+ *
+ * @param det Detector
+ * @param earliest Earliest time the switch can happen
+ * @param deadline Latest time the switch may happen
+ * @param[out] reason Why this time was picked
+ * @return Switch time, between @p earliest and @p deadline
+ */
+zc_time_t zc_schedule(const zc_detector_t *det, zc_time_t earliest, zc_time_t deadline, zc_fire_reason_t *reason);
+
+/**
+ * @brief Record a switch so its alignment is measured
+ *
+ * The error against the nearest real crossing is known once the first
+ * crossing after the switch has been fed.
+ *
+ * @param det Detector
+ * @param at Time the switch actually happened
+ * @param reason Reason returned by zc_schedule()
+ */
+void zc_note_fire(zc_detector_t *det, zc_time_t at, zc_fire_reason_t reason);
+
+#endif /* ZERO_CROSS_H */
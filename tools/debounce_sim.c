@@ -0,0 +1,234 @@
+/**
+ * @file debounce_sim.c
+ * @brief The footswitch debouncer on simulated contact bounce, on a host
+ *
+ * Simulates 32 footswitches scanned at the firmware rate. Each press and
+ * release bounces for a random time with random chatter, and some presses
+ * also drop out for a scan while held. Every scan goes through the
+ * vertical counter debouncer (debounce.c) and through a scalar reference
+ * with one counter per switch; the two must agree on every scan.
+ *
+ * Reports, per bounce profile, how many presses were reported against how
+ * many were made and the delay from the first contact to the report, and
+ * the time per scan of both implementations.
+ *
+ * Build and run:
+ * @code
+ * cc -O2 -I main -o debounce_sim tools/debounce_sim.c main/debounce.c
+ * ./debounce_sim [presses]
+ * @endcode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "debounce.h"
+
+#define SCAN_US 1000 /**< As SR_INPUT_SCAN_US */
+#define SWITCHES 32
+
+/**
+ * @brief How the contacts of one scenario bounce
+ */
+typedef struct
+{
+    const char *name;
+    int bounce_max_us; /**< Longest bounce after each edge */
+    int chatter_pct;   /**< Chance of an open contact in each bounce scan */
+    int glitch_pm;     /**< Chance of a one-scan dropout in each held scan, per mille */
+} scenario_t;
+
+/**
+ * @brief One switch being pressed and released
+ */
+typedef struct
+{
+    int64_t press_us;   /**< First contact */
+    int64_t release_us; /**< First break */
+    int bounce_us;      /**< Bounce after the press */
+    int release_bounce_us;
+    int reports;        /**< Presses reported for this press */
+} press_t;
+
+static uint32_t seed = 12345;
+
+/** @brief Uniform in 0..n-1 */
+static int _rand(int n)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (int)((seed >> 8) % (uint32_t)n);
+}
+
+/**
+ * @brief Scalar reference: the same 2-bit counter, one switch at a time
+ */
+static uint32_t _reference(uint32_t *state, uint8_t *count, uint32_t sample)
+{
+    uint32_t toggle = 0;
+    for (int i = 0; i < SWITCHES; i++)
+    {
+        uint32_t bit = 1UL << i;
+        if ((sample ^ *state) & bit)
+        {
+            if (++count[i] == DEBOUNCE_SAMPLES)
+            {
+                count[i] = 0;
+                toggle |= bit;
+            }
+        }
+        else
+        {
+            count[i] = 0;
+        }
+    }
+    *state ^= toggle;
+    return toggle;
+}
+
+/**
+ * @brief Contact level of a switch at time t
+ */
+static int _closed(const press_t *p, int64_t t, const scenario_t *sc)
+{
+    if (t < p->press_us || t >= p->release_us + p->release_bounce_us)
+    {
+        return 0;
+    }
+    if (t < p->press_us + p->bounce_us || t >= p->release_us)
+    {
+        return _rand(100) >= sc->chatter_pct; // Bouncing
+    }
+    return _rand(1000) >= sc->glitch_pm; // Held, with the odd dropout
+}
+
+/**
+ * @brief Run one scenario and print its line
+ */
+static int _scenario(const scenario_t *sc, int presses)
+{
+    static press_t plan[SWITCHES];
+    debounce_t db;
+    debounce_init(&db, 0);
+    uint32_t ref_state = 0;
+    uint8_t ref_count[SWITCHES] = {0};
+
+    int made = 0, reported = 0, extra = 0, missed = 0;
+    int64_t delay_sum = 0, delay_max = 0;
+    int64_t t = 0;
+
+    for (int i = 0; i < SWITCHES; i++)
+    {
+        plan[i].press_us = -1;
+    }
+
+    while (made < presses)
+    {
+        uint32_t sample = 0;
+        for (int i = 0; i < SWITCHES; i++)
+        {
+            press_t *p = &plan[i];
+            if (p->press_us < 0 || t >= p->release_us + p->release_bounce_us + 20000)
+            {
+                if (p->press_us >= 0) // Count the press just finished
+                {
+                    made++;
+                    reported += p->reports > 0;
+                    missed += p->reports == 0;
+                    extra += p->reports > 1 ? p->reports - 1 : 0;
+                }
+                p->press_us = t + 1000 * (1 + _rand(400)); // Next press of this switch
+                p->bounce_us = _rand(sc->bounce_max_us + 1);
+                p->release_us = p->press_us + p->bounce_us + 1000 * (40 + _rand(300));
+                p->release_bounce_us = _rand(sc->bounce_max_us + 1);
+                p->reports = 0;
+            }
+            sample |= (uint32_t)_closed(p, t, sc) << i;
+        }
+
+        uint32_t changed = debounce_update(&db, sample);
+        uint32_t ref_changed = _reference(&ref_state, ref_count, sample);
+        if (changed != ref_changed || db.state != ref_state)
+        {
+            printf("  %-24s MISMATCH with the reference at t=%lld us\n", sc->name, (long long)t);
+            return 1;
+        }
+        uint32_t pressed = changed & db.state;
+        for (int i = 0; pressed; i++, pressed >>= 1)
+        {
+            if (!(pressed & 1))
+            {
+                continue;
+            }
+            press_t *p = &plan[i];
+            if (p->reports++ == 0)
+            {
+                int64_t delay = t - p->press_us;
+                delay_sum += delay;
+                delay_max = delay > delay_max ? delay : delay_max;
+            }
+        }
+        t += SCAN_US;
+    }
+
+    printf("  %-24s %6d presses %6d reported %4d missed %4d extra  first contact to report %5.1f ms mean, %5.1f ms max\n",
+           sc->name, made, reported, missed, extra, reported ? delay_sum / 1000.0 / reported : 0.0, delay_max / 1000.0);
+    return 0;
+}
+
+/**
+ * @brief Time both implementations over random samples
+ */
+static void _bench(void)
+{
+    enum
+    {
+        SCANS = 1 << 22
+    };
+    static uint32_t samples[4096];
+    for (int i = 0; i < 4096; i++)
+    {
+        samples[i] = (uint32_t)_rand(1 << 16) << 16 | (uint32_t)_rand(1 << 16);
+    }
+
+    debounce_t db;
+    debounce_init(&db, 0);
+    uint32_t sink = 0;
+    clock_t c0 = clock();
+    for (int i = 0; i < SCANS; i++)
+    {
+        sink ^= debounce_update(&db, samples[i & 4095]);
+    }
+    clock_t c1 = clock();
+    uint32_t ref_state = 0;
+    uint8_t ref_count[SWITCHES] = {0};
+    for (int i = 0; i < SCANS; i++)
+    {
+        sink ^= _reference(&ref_state, ref_count, samples[i & 4095]);
+    }
+    clock_t c2 = clock();
+
+    printf("Per scan of %d switches: vertical counters %.1f ns, one counter per switch %.1f ns (%u)\n", SWITCHES,
+           1e9 * (c1 - c0) / CLOCKS_PER_SEC / SCANS, 1e9 * (c2 - c1) / CLOCKS_PER_SEC / SCANS, (unsigned)(sink & 1));
+}
+
+int main(int argc, char **argv)
+{
+    int presses = argc > 1 ? atoi(argv[1]) : 20000;
+    static const scenario_t scenarios[] = {
+        {"clean contacts", 0, 0, 0},
+        {"bounce up to 2 ms", 2000, 50, 0},
+        {"bounce up to 8 ms", 8000, 50, 0},
+        {"worn, 15 ms and dropouts", 15000, 70, 20},
+    };
+
+    printf("Scan every %d us, %d equal samples to switch\n", SCAN_US, DEBOUNCE_SAMPLES);
+    int fail = 0;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        fail |= _scenario(&scenarios[i], presses);
+    }
+    _bench();
+    return fail;
+}
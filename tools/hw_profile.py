@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Build hardware profile records for the ESP32 Patch Bay.
+
+Reads a board description (see boards/*.json) and writes the binary profile
+record that the firmware loads from NVS (namespace "hw_profile", key
+"profile"). The layout must match hw_profile_header_t and hw_profile_t in
+main/hw_profile.h.
+
+Examples:
+    python tools/hw_profile.py boards/rev_a.json -o build/hw_profile.bin
+    python tools/hw_profile.py boards/rev_a.json -o build/hw_profile.bin --nvs-csv build/hw_profile.csv
+    python $IDF_PATH/components/nvs_flash/nvs_partition_generator/nvs_partition_gen.py \\
+        generate build/hw_profile.csv build/hw_profile_nvs.bin 0x6000
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+import zlib
+
+NUM_PEDALS_MAX = 8
+NUM_SINKS = NUM_PEDALS_MAX + 1  # Sinks in lanes.sink_sel and lanes.sink_inh: pedal sends and amp output A
+OUTPUTS = ("amp_a", "amp_b", "tuner")  # MATRIX_OUTPUT_*; amp B and the tuner have lanes of their own
+NUM_CONTROLS = 8
+CTL_NAME_LEN = 8
+EXPANDERS_MAX = 2
+
+MAGIC = 0x4250
+VERSION = 10
+
+PIN_NONE = 0xFF
+LANE_NONE = 0xFF
+
+CHAINS = {"matrix": 0, "inhibit": 1, "led": 2}
+DISPLAYS = {"none": 0, "ssd1306_128x64": 1, "ssd1306_128x32": 2, "sh1107_64x128": 3}
+
+
+def _pin(value):
+    return PIN_NONE if value is None else int(value)
+
+
+def _lane(value):
+    """Parse a lane written as "chain:bit" (or null) into the firmware encoding."""
+    if value is None:
+        return LANE_NONE
+    chain, bit = value.split(":")
+    bit = int(bit)
+    if chain not in CHAINS or not 0 <= bit < 64:
+        raise ValueError("bad lane %r" % value)
+    return (CHAINS[chain] << 6) | bit
+
+
+def lane_chain(lane):
+    return lane >> 6
+
+
+def lane_bit(lane):
+    return lane & 0x3F
+
+
+def load(path):
+    """Load a board description and resolve it to firmware encodings.
+
+    Returns a dict with the same field names as hw_profile_t.
+    """
+    with open(path) as f:
+        desc = json.load(f)
+    pins = desc["pins"]
+    lanes = desc["lanes"]
+    pedal_pins = list(pins["pedal_btn"]) + [None] * NUM_PEDALS_MAX
+    led_lanes = list(lanes["led_pedal"]) + [None] * NUM_PEDALS_MAX
+    controls = list(desc.get("controls", []))
+    if len(controls) > NUM_CONTROLS:
+        raise ValueError("at most %d control outputs" % NUM_CONTROLS)
+    controls += [{"name": "", "lane": None}] * (NUM_CONTROLS - len(controls))
+    if len(lanes["sink_sel"]) != NUM_SINKS or len(lanes["sink_inh"]) != NUM_SINKS:
+        raise ValueError("sink_sel and sink_inh need %d entries" % NUM_SINKS)
+    expanders = list(desc.get("expanders", []))
+    if len(expanders) > EXPANDERS_MAX:
+        raise ValueError("at most %d expanders" % EXPANDERS_MAX)
+    return {
+        "name": desc["name"],
+        "num_pedals": int(desc["num_pedals"]),
+        "display_type": DISPLAYS[desc.get("display", "ssd1306_128x64")],
+        "display_i2c_addr": int(str(desc.get("display_i2c_addr", "0x3D")), 0),
+        "led_active_low": 1 if desc.get("led_active_low", True) else 0,
+        "pin_i2c_sda": _pin(pins.get("i2c_sda")),
+        "pin_i2c_scl": _pin(pins.get("i2c_scl")),
+        "pin_program_btn": _pin(pins["program_btn"]),
+        "pin_preset_btn": _pin(pins["preset_btn"]),
+        "pin_pedal_btn": [_pin(p) for p in pedal_pins[:NUM_PEDALS_MAX]],
+        "pin_sr_clock": _pin(pins["sr_clock"]),
+        "pin_sr_latch": _pin(pins["sr_latch"]),
+        "pin_sr_oe": _pin(pins.get("sr_oe")),
+        "pin_led_oe": _pin(pins.get("led_oe")),
+        "pin_sr_data": [_pin(pins["sr_data"].get(c)) for c in ("matrix", "inhibit", "led")],
+        "sink_sel_lane": [_lane(l) for l in lanes["sink_sel"]],
+        "sink_inh_lane": [_lane(l) for l in lanes["sink_inh"]],
+        "led_pedal_lane": [_lane(l) for l in led_lanes[:NUM_PEDALS_MAX]],
+        "led_status_lane": _lane(lanes.get("led_status")),
+        "pin_tap_btn": _pin(pins.get("tap_btn")),
+        "pin_tap_out": _pin(pins.get("tap_out")),
+        "ctl_lane": [_lane(c["lane"]) for c in controls],
+        "ctl_name": [c.get("name", "") for c in controls],
+        "pin_zc_adc": _pin(pins.get("zc_adc")),
+        "meter_sel_lane": _lane(lanes.get("meter_sel")),
+        "meter_inh_lane": _lane(lanes.get("meter_inh")),
+        "pin_meter_adc": _pin(pins.get("meter_adc")),
+        "pin_panic": _pin(pins.get("panic")),
+        "pin_exp_int": _pin(pins.get("exp_int")),
+        "exp_addr": [int(str(a), 0) for a in expanders] + [0] * (EXPANDERS_MAX - len(expanders)),
+        "pin_sr_in": _pin(pins.get("sr_in")),
+        "sr_in_regs": int(desc.get("sr_in_regs", 0)),
+        "pin_sr_fb": [_pin(pins.get("sr_feedback", {}).get(c)) for c in ("matrix", "inhibit", "led")],
+        "out_sel_lane": [_lane(lanes.get(o + "_sel")) for o in OUTPUTS[1:]],
+        "out_inh_lane": [_lane(lanes.get(o + "_inh")) for o in OUTPUTS[1:]],
+    }
+
+
+def sink_lanes(p):
+    """Select and inhibit lanes of every sink: the pedal sends, then the outputs in OUTPUTS order."""
+    return p["sink_sel_lane"] + p["out_sel_lane"], p["sink_inh_lane"] + p["out_inh_lane"]
+
+
+def pack_payload(p):
+    """Pack a profile dict into the hw_profile_t payload."""
+    out = bytearray()
+    out += p["name"].encode()[:15].ljust(16, b"\0")
+    out += bytes([p["num_pedals"], p["display_type"], p["display_i2c_addr"], p["led_active_low"]])
+    out += bytes([p["pin_i2c_sda"], p["pin_i2c_scl"], p["pin_program_btn"], p["pin_preset_btn"]])
+    out += bytes(p["pin_pedal_btn"])
+    out += bytes([p["pin_sr_clock"], p["pin_sr_latch"], p["pin_sr_oe"], p["pin_led_oe"]])
+    out += bytes(p["pin_sr_data"])
+    out += bytes(p["sink_sel_lane"])
+    out += bytes(p["sink_inh_lane"])
+    out += bytes(p["led_pedal_lane"])
+    out += bytes([p["led_status_lane"]])
+    out += bytes([p["pin_tap_btn"], p["pin_tap_out"]])  # version 2
+    out += bytes(p["ctl_lane"])  # version 3
+    for name in p["ctl_name"]:
+        out += name.encode()[:CTL_NAME_LEN - 1].ljust(CTL_NAME_LEN, b"\0")
+    out += bytes([p["pin_zc_adc"]])  # version 4
+    out += bytes([p["meter_sel_lane"], p["meter_inh_lane"], p["pin_meter_adc"]])  # version 5
+    out += bytes([p["pin_panic"]])  # version 6
+    out += bytes([p["pin_exp_int"]]) + bytes(p["exp_addr"])  # version 7
+    out += bytes([p["pin_sr_in"], p["sr_in_regs"]])  # version 8
+    out += bytes(p["pin_sr_fb"])  # version 9
+    out += bytes(p["out_sel_lane"]) + bytes(p["out_inh_lane"])  # version 10
+    return bytes(out)
+
+
+def pack_record(p):
+    """Pack a profile dict into the full NVS record (header + payload)."""
+    payload = pack_payload(p)
+    header = struct.pack("<HBBHI", MAGIC, VERSION, 0, len(payload), zlib.crc32(payload) & 0xFFFFFFFF)
+    return header + payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("board", help="board description JSON")
+    parser.add_argument("-o", "--output", required=True, help="binary profile record to write")
+    parser.add_argument("--nvs-csv", help="also write an nvs_partition_gen CSV referencing the record")
+    args = parser.parse_args()
+
+    record = pack_record(load(args.board))
+    with open(args.output, "wb") as f:
+        f.write(record)
+    if args.nvs_csv:
+        with open(args.nvs_csv, "w") as f:
+            f.write("key,type,encoding,value\n")
+            f.write("hw_profile,namespace,,\n")
+            f.write("profile,file,binary,%s\n" % os.path.abspath(args.output))
+    print("%s: %d byte profile record" % (args.output, len(record)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,510 @@
+/**
+ * @file link_sim.c
+ * @brief The unit link protocol between two processes over a pty pair, on a
+ *        Linux host
+ *
+ * The pty pair stands in for the link UART: the master process writes and
+ * reads the pty master, the slave process the pty slave, both in raw mode.
+ * The sync line is a pipe from master to slave, and a second pipe from slave
+ * to master is a probe on the slave outputs: the slave writes every route it
+ * latches there.
+ *
+ * Both processes run the firmware logic of link.c on link_proto.c:
+ * - The slave announces itself with HELLO, answers HELLO with HELLO, stages
+ *   each ROUTE, acknowledges it with STAGED and its sequence number unless
+ *   the sequence number is 0, and latches the staged route on a sync edge.
+ *   Sync edges with nothing staged are ignored.
+ * - The master splits random combined chains with link_split_route(), sends
+ *   the slave part with the next sequence number (1-255, 0 is skipped),
+ *   waits for STAGED with that number and pulses the sync line. It answers
+ *   HELLO with the last route under sequence number 0.
+ *
+ * Checked: every route latched on the slave is the slave part of the chain
+ * the master switched to; STAGED never carries a stale or unsolicited
+ * number; the HELLO exchange at start and after a slave restart (midway
+ * through the run) brings the slave onto the master's route; routes sent
+ * with a corrupted byte are dropped (no STAGED, one CRC error each) and line
+ * noise between packets is skipped. Spare sync edges, as the master sends
+ * on LED updates, are sent between routes.
+ *
+ * Reports the time from writing ROUTE to reading STAGED over the pty.
+ *
+ * Build and run:
+ * @code
+ * cc -O2 -I main -o link_sim tools/link_sim.c main/link_proto.c -lutil
+ * ./link_sim [routes] [tie_loop]
+ * @endcode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+#include "link_proto.h"
+
+#define ACK_TIMEOUT_MS 200   /**< Longest wait for STAGED, generous for a loaded host */
+#define RESYNC_DRAIN_MS 50   /**< Time given to HELLO exchanges before checking the route */
+#define PROBE_TIMEOUT_MS 500 /**< Longest wait for the slave to report a latch */
+#define CORRUPT_ONE_IN 16    /**< Routes sent with a corrupted byte first */
+#define CHAIN_MAX 12         /**< Longest random combined chain */
+#define SLAVE_PEDALS 8       /**< Pedals the simulated slave reports fitted */
+#define PROBE_END 0xFF       /**< Probe record: the slave exits, followed by its CRC error count */
+
+static uint32_t seed = 4242;
+
+/** @brief Uniform in 0..n-1 */
+static int _rand(int n)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (int)((seed >> 8) % (uint32_t)n);
+}
+
+/** @brief Monotonic time in microseconds */
+static int64_t _now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** @brief Write all of @p len bytes */
+static void _write_all(int fd, const uint8_t *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            perror("write");
+            exit(2);
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+/**
+ * @brief Read up to @p len bytes, waiting at most @p timeout_ms for the first
+ *
+ * @return Bytes read, 0 on timeout, -1 once the other end is closed
+ */
+static int _read_some(int fd, uint8_t *buf, size_t len, int timeout_ms)
+{
+    struct pollfd p = {.fd = fd, .events = POLLIN};
+    int r = poll(&p, 1, timeout_ms);
+    if (r <= 0)
+    {
+        return 0;
+    }
+    ssize_t n = read(fd, buf, len);
+    return n > 0 ? (int)n : -1; // A closed pty slave reads as EIO
+}
+
+/** @brief Read exactly @p len bytes within @p timeout_ms */
+static bool _read_exact(int fd, uint8_t *buf, size_t len, int timeout_ms)
+{
+    int64_t end = _now_us() + timeout_ms * 1000LL;
+    while (len)
+    {
+        int left = (int)((end - _now_us()) / 1000);
+        int n = _read_some(fd, buf, len, left > 0 ? left : 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/** @brief Encode and write one packet */
+static void _send(int fd, uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t len)
+{
+    uint8_t buf[LINK_PACKET_MAX];
+    _write_all(fd, buf, link_encode(type, seq, payload, len, buf));
+}
+
+/**
+ * @brief Slave process: stage routes, latch them on sync edges, report them
+ *        on the probe
+ *
+ * @param uart pty slave
+ * @param sync Read end of the sync pipe
+ * @param probe Write end of the probe pipe
+ * @param restart_at Latches after which the slave restarts
+ */
+static int _slave(int uart, int sync, int probe, int restart_at)
+{
+    static link_decoder_t dec;
+    uint8_t staged[LINK_UNIT_PEDALS], staged_len = 0;
+    bool frame_staged = false;
+    int latched = 0;
+    uint8_t pedals = SLAVE_PEDALS;
+
+    link_decoder_reset(&dec);
+    _send(uart, LINK_MSG_HELLO, 0, &pedals, 1);
+    while (1)
+    {
+        struct pollfd p[2] = {{.fd = uart, .events = POLLIN}, {.fd = sync, .events = POLLIN}};
+        poll(p, 2, -1);
+        if (p[0].revents & POLLIN)
+        {
+            uint8_t buf[64];
+            ssize_t n = read(uart, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; i++)
+            {
+                const link_packet_t *pkt = link_decoder_feed(&dec, buf[i]);
+                if (!pkt)
+                {
+                    continue;
+                }
+                if (pkt->type == LINK_MSG_HELLO)
+                {
+                    _send(uart, LINK_MSG_HELLO, 0, &pedals, 1);
+                }
+                else if (pkt->type == LINK_MSG_ROUTE && pkt->len <= LINK_UNIT_PEDALS)
+                {
+                    frame_staged = false; // Ignore sync edges while shifting
+                    memcpy(staged, pkt->payload, pkt->len);
+                    staged_len = pkt->len;
+                    frame_staged = true;
+                    if (pkt->seq != 0)
+                    {
+                        _send(uart, LINK_MSG_STAGED, pkt->seq, NULL, 0);
+                    }
+                }
+            }
+        }
+        if (p[1].revents & (POLLIN | POLLHUP))
+        {
+            uint8_t edge;
+            if (read(sync, &edge, 1) <= 0)
+            {
+                break; // Master done
+            }
+            if (!frame_staged)
+            {
+                continue; // LED update on the master
+            }
+            frame_staged = false;
+            uint8_t rec[1 + LINK_UNIT_PEDALS] = {staged_len};
+            memcpy(&rec[1], staged, staged_len);
+            _write_all(probe, rec, 1 + staged_len);
+            if (++latched == restart_at)
+            {
+                link_decoder_reset(&dec); // Power cycle: announce again, nothing staged
+                _send(uart, LINK_MSG_HELLO, 0, &pedals, 1);
+            }
+        }
+    }
+    uint8_t end[5] = {PROBE_END};
+    memcpy(&end[1], &dec.crc_errors, 4);
+    _write_all(probe, end, sizeof(end));
+    return 0;
+}
+
+/** @brief Master state */
+typedef struct
+{
+    int uart, sync, probe;
+    link_decoder_t dec;
+    uint8_t seq;                           /**< Last sequence number used */
+    uint8_t last_route[LINK_UNIT_PEDALS];  /**< Resent on HELLO */
+    uint8_t last_len;
+    int hellos, stale, failures;
+} master_t;
+
+/**
+ * @brief Read and handle packets until STAGED for @p seq or the timeout
+ *
+ * @param m Master
+ * @param seq Sequence number waited for, 0 to only drain
+ * @param timeout_ms Time to wait
+ * @return true if STAGED for @p seq arrived
+ */
+static bool _master_poll(master_t *m, uint8_t seq, int timeout_ms)
+{
+    int64_t end = _now_us() + timeout_ms * 1000LL;
+    while (1)
+    {
+        int left = (int)((end - _now_us()) / 1000);
+        if (left < 0)
+        {
+            return false;
+        }
+        uint8_t buf[64];
+        int n = _read_some(m->uart, buf, sizeof(buf), left);
+        for (int i = 0; i < n; i++)
+        {
+            const link_packet_t *pkt = link_decoder_feed(&m->dec, buf[i]);
+            if (!pkt)
+            {
+                continue;
+            }
+            if (pkt->type == LINK_MSG_HELLO)
+            {
+                if (pkt->len != 1 || pkt->payload[0] != SLAVE_PEDALS)
+                {
+                    printf("HELLO with a bad pedal count\n");
+                    m->failures++;
+                }
+                m->hellos++;
+                _send(m->uart, LINK_MSG_ROUTE, 0, m->last_route, m->last_len);
+            }
+            else if (pkt->type == LINK_MSG_STAGED)
+            {
+                if (seq != 0 && pkt->seq == seq)
+                {
+                    return true;
+                }
+                m->stale++; // An acknowledge for a route no longer waited for
+            }
+        }
+        if (n < 0)
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Pulse the sync line and check the route the slave latched
+ *
+ * @param m Master
+ * @param what For the failure message
+ * @return true if the slave latched last_route
+ */
+static bool _master_latch(master_t *m, const char *what)
+{
+    uint8_t edge = 1;
+    _write_all(m->sync, &edge, 1);
+    uint8_t rec[1 + LINK_UNIT_PEDALS];
+    if (!_read_exact(m->probe, rec, 1, PROBE_TIMEOUT_MS) || rec[0] > LINK_UNIT_PEDALS ||
+        !_read_exact(m->probe, &rec[1], rec[0], PROBE_TIMEOUT_MS))
+    {
+        printf("%s: the slave latched nothing\n", what);
+        m->failures++;
+        return false;
+    }
+    if (rec[0] != m->last_len || memcmp(&rec[1], m->last_route, m->last_len) != 0)
+    {
+        printf("%s: the slave latched a route of %d pedals, expected %d\n", what, rec[0], m->last_len);
+        m->failures++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Let HELLO exchanges settle, then latch and check the resent route
+ *
+ * @param m Master
+ * @param what For the failure message
+ */
+static void _master_resync(master_t *m, const char *what)
+{
+    int hellos = m->hellos;
+    _master_poll(m, 0, RESYNC_DRAIN_MS); // Every HELLO is answered with the route
+    if (m->hellos == hellos)
+    {
+        printf("%s: no HELLO from the slave\n", what);
+        m->failures++;
+        return;
+    }
+    _master_latch(m, what);
+}
+
+/**
+ * @brief Make a random combined chain that splits for @p tie_loop
+ */
+static void _random_route(uint8_t tie_loop, uint8_t *slave, uint8_t *slave_len)
+{
+    uint8_t chain[CHAIN_MAX], master[CHAIN_MAX + 1], master_len;
+    do
+    {
+        uint16_t used = 0;
+        int len = _rand(CHAIN_MAX + 1);
+        for (int i = 0; i < len; i++)
+        {
+            int p;
+            do
+            {
+                p = 1 + _rand(2 * LINK_UNIT_PEDALS);
+            } while (used & (1 << p) || p == tie_loop);
+            used |= 1 << p;
+            chain[i] = p;
+        }
+        if (link_split_route(chain, len, tie_loop, master, &master_len, slave, slave_len))
+        {
+            return;
+        }
+    } while (1);
+}
+
+/**
+ * @brief Master process
+ *
+ * @return Failures
+ */
+static int _master(int uart, int sync, int probe, int routes, uint8_t tie_loop, int restart_at)
+{
+    static master_t m;
+    m.uart = uart;
+    m.sync = sync;
+    m.probe = probe;
+    link_decoder_reset(&m.dec);
+    m.last_route[0] = 1; // Already playing a route when the slave comes up
+    m.last_route[1] = 2;
+    m.last_len = 2;
+
+    _send(uart, LINK_MSG_HELLO, 0, NULL, 0);
+    _master_resync(&m, "Start");
+
+    int corrupted = 0, latched = 0;
+    int64_t rtt_sum = 0, rtt_max = 0;
+    for (int r = 0; r < routes; r++)
+    {
+        _random_route(tie_loop, m.last_route, &m.last_len);
+        bool staged = false;
+        while (!staged)
+        {
+            m.seq = (m.seq == 0xFF) ? 1 : m.seq + 1;
+            uint8_t buf[LINK_PACKET_MAX + 4];
+            size_t n = link_encode(LINK_MSG_ROUTE, m.seq, m.last_route, m.last_len, buf);
+            bool corrupt = _rand(CORRUPT_ONE_IN) == 0;
+            if (corrupt)
+            {
+                buf[4 + _rand(n - 4)] ^= 1 + _rand(255); // Payload or CRC: a CRC mismatch, not a framing error
+                corrupted++;
+            }
+            if (_rand(4) == 0)
+            {
+                uint8_t noise[3] = {0x00, 0x55, 0xA5}; // No start byte, skipped between packets
+                _write_all(uart, noise, 1 + _rand(3));
+            }
+            int64_t t0 = _now_us();
+            _write_all(uart, buf, n);
+            staged = _master_poll(&m, m.seq, corrupt ? ACK_TIMEOUT_MS / 4 : ACK_TIMEOUT_MS);
+            if (staged != !corrupt)
+            {
+                printf("Route %d, seq %d: %s\n", r, m.seq, corrupt ? "corrupted route was staged" : "no STAGED");
+                m.failures++;
+            }
+            if (staged)
+            {
+                int64_t rtt = _now_us() - t0;
+                rtt_sum += rtt;
+                rtt_max = rtt > rtt_max ? rtt : rtt_max;
+            }
+            else if (!corrupt)
+            {
+                break;
+            }
+        }
+        if (_rand(4) == 0)
+        {
+            uint8_t edge = 1; // LED update before the route: nothing is latched
+            _write_all(sync, &edge, 1);
+        }
+        if (staged && _master_latch(&m, "Route"))
+        {
+            latched++;
+        }
+        if (latched == restart_at)
+        {
+            _master_resync(&m, "Slave restart");
+            restart_at = -1;
+        }
+    }
+    close(sync);
+
+    uint8_t end[5];
+    uint32_t crc_errors = 0;
+    if (!_read_exact(probe, end, sizeof(end), PROBE_TIMEOUT_MS) || end[0] != PROBE_END)
+    {
+        printf("Slave did not report at the end\n");
+        m.failures++;
+    }
+    else
+    {
+        memcpy(&crc_errors, &end[1], 4);
+    }
+    if ((int)crc_errors != corrupted)
+    {
+        printf("Slave counted %u CRC errors for %d corrupted routes\n", (unsigned)crc_errors, corrupted);
+        m.failures++;
+    }
+    if (m.stale)
+    {
+        printf("%d stale STAGED\n", m.stale);
+        m.failures++;
+    }
+
+    printf("Tie loop %d: %d routes latched (seq wrapped %d times), %d corrupted and rejected, %d HELLO\n", tie_loop,
+           latched, (latched + corrupted) / 255, corrupted, m.hellos);
+    if (latched)
+    {
+        printf("ROUTE to STAGED over the pty: %.0f us mean, %lld us max\n", (double)rtt_sum / latched,
+               (long long)rtt_max);
+    }
+    printf("%s\n", m.failures ? "FAILED" : "passed");
+    return m.failures;
+}
+
+int main(int argc, char **argv)
+{
+    int routes = argc > 1 ? atoi(argv[1]) : 1000;
+    uint8_t tie_loop = argc > 2 ? (uint8_t)atoi(argv[2]) : 8;
+
+    int pty_master, pty_slave;
+    if (openpty(&pty_master, &pty_slave, NULL, NULL, NULL) < 0)
+    {
+        perror("openpty");
+        return 2;
+    }
+    struct termios raw;
+    tcgetattr(pty_slave, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(pty_slave, TCSANOW, &raw); // Byte for byte, both ways
+    int sync[2], probe[2];
+    if (pipe(sync) < 0 || pipe(probe) < 0)
+    {
+        perror("pipe");
+        return 2;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return 2;
+    }
+    if (pid == 0)
+    {
+        close(pty_master);
+        close(sync[1]);
+        close(probe[0]);
+        return _slave(pty_slave, sync[0], probe[1], routes / 2 + 1); // The start counts as a latch
+    }
+    close(pty_slave);
+    close(sync[0]);
+    close(probe[1]);
+    int fail = _master(pty_master, sync[1], probe[0], routes, tie_loop, routes / 2);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return fail || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
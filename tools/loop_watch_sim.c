@@ -0,0 +1,323 @@
+/**
+ * @file loop_watch_sim.c
+ * @brief Dead loop detection on simulated pedal chains, on a host
+ *
+ * Builds a random chain of pedals, each with its own gain, hiss and soft
+ * clipping, and plays synthetic guitar phrases into it. The meter scan is
+ * simulated the way the firmware runs it: the tap steps through the guitar
+ * input and every return, and each one is measured with the level kernel
+ * (level.c) over the dwell after the settling time. After every scan the
+ * levels go to the detector (loop_watch.c); a loop it reports is taken out
+ * of the route as the firmware would, and the run goes on.
+ *
+ * Fault scenarios report how many faults were found and how long after the
+ * fault the detector reported them; healthy scenarios report every loop
+ * that was wrongly taken out.
+ *
+ * Build and run:
+ * @code
+ * cc -O2 -I main -o loop_watch_sim tools/loop_watch_sim.c main/loop_watch.c main/level.c main/vec.c -lm
+ * ./loop_watch_sim [window_ms] [active_db] [drop_db] [runs]
+ * @endcode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "loop_watch.h"
+#include "level.h"
+
+#define SAMPLE_RATE 20000 /**< Input rate, as CONFIG_INPUT_SAMPLE_RATE */
+#define DWELL_MS 40       /**< As CONFIG_METER_DWELL_MS */
+#define SETTLE_MS 2       /**< As CONFIG_METER_SETTLE_MS */
+#define BLOCK_SAMPLES 64  /**< Samples per ADC frame, as in input_adc.h */
+#define LOOPS LOOP_WATCH_LOOPS
+#define TAPS (LOOPS + 1)
+#define NOTES_MAX 512     /**< Notes in one simulated run */
+#define NOISE_COUNTS 3.0  /**< Hiss at every return, ADC counts peak */
+
+/**
+ * @brief One plucked note
+ */
+typedef struct
+{
+    double start; /**< s */
+    double hz;    /**< Fundamental */
+    double amp;   /**< Peak, ADC counts */
+    double tau;   /**< Decay time constant, s */
+} note_t;
+
+/**
+ * @brief How a scenario plays and what goes wrong in it
+ */
+typedef struct
+{
+    const char *name;
+    double rest_chance;   /**< Chance of a rest after each note */
+    double rest_s;        /**< Longest rest */
+    double min_gain_db;   /**< Pedal gain range */
+    double max_gain_db;
+    int fault;            /**< 0 none, 1 dead at once, 2 fading out */
+    double fade_db_per_s; /**< Fade rate of a fading fault */
+    double length_s;      /**< Run length */
+} scenario_t;
+
+/**
+ * @brief State of one run
+ */
+typedef struct
+{
+    note_t notes[NOTES_MAX];
+    int note_count;
+    int first_note;          /**< Oldest note still ringing */
+    double gain[LOOPS];      /**< Linear gain of each pedal */
+    uint8_t send[LOOPS];     /**< Source feeding each send, LOOP_WATCH_NO_SEND if none */
+    int faulty;              /**< Loop with the fault, -1 if none */
+    double fault_s;          /**< Time the fault starts */
+    const scenario_t *sc;
+} run_t;
+
+static uint32_t seed = 12345;
+
+/** @brief Uniform in 0..1 */
+static double _rand(void)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0;
+}
+
+/**
+ * @brief Guitar input at time t, ADC counts around zero
+ */
+static double _guitar(run_t *r, double t)
+{
+    while (r->first_note < r->note_count - 1 && t - r->notes[r->first_note].start > 6 * r->notes[r->first_note].tau &&
+           r->notes[r->first_note + 1].start <= t)
+    {
+        r->first_note++;
+    }
+    double v = 0;
+    for (int i = r->first_note; i < r->note_count && r->notes[i].start <= t; i++)
+    {
+        const note_t *n = &r->notes[i];
+        double age = t - n->start;
+        double w = 2 * M_PI * n->hz * age;
+        v += n->amp * exp(-age / n->tau) * (sin(w) + 0.4 * sin(2 * w)) / 1.4;
+    }
+    return v + (_rand() - 0.5) * 2; // Input buffer noise
+}
+
+/**
+ * @brief Signal of a source at time t, ADC counts around zero
+ */
+static double _source(run_t *r, uint8_t source, double t)
+{
+    if (source == 0)
+    {
+        return _guitar(r, t);
+    }
+    int loop = source - 1;
+    double hiss = (_rand() - 0.5) * 2 * NOISE_COUNTS;
+    if (r->send[loop] == LOOP_WATCH_NO_SEND)
+    {
+        return hiss;
+    }
+    double gain = r->gain[loop];
+    if (loop == r->faulty && t >= r->fault_s)
+    {
+        if (r->sc->fault == 1)
+        {
+            return hiss;
+        }
+        gain *= pow(10, -r->sc->fade_db_per_s * (t - r->fault_s) / 20);
+    }
+    double x = gain * _source(r, r->send[loop], t);
+    return 2000 * tanh(x / 2000) + hiss; // Pedal output stage clips softly
+}
+
+/**
+ * @brief Route the chain the way matrix_compile() does, skipping removed loops
+ */
+static void _route(run_t *r, const uint8_t *chain, int len, uint16_t removed)
+{
+    memset(r->send, LOOP_WATCH_NO_SEND, sizeof(r->send));
+    uint8_t source = 0;
+    for (int i = 0; i < len; i++)
+    {
+        if (!(removed & (1 << chain[i])))
+        {
+            r->send[chain[i]] = source;
+            source = chain[i] + 1;
+        }
+    }
+}
+
+/**
+ * @brief Make up the guitar part of a run
+ */
+static void _phrase(run_t *r)
+{
+    double t = 0.2 + _rand();
+    r->note_count = 0;
+    r->first_note = 0;
+    while (t < r->sc->length_s && r->note_count < NOTES_MAX)
+    {
+        note_t *n = &r->notes[r->note_count++];
+        n->start = t;
+        n->hz = 82.41 * pow(2, floor(_rand() * 30) / 12);
+        n->amp = 150 + _rand() * 1400;
+        n->tau = 0.3 + _rand() * 1.2;
+        t += 0.15 + _rand() * 0.8;
+        if (_rand() < r->sc->rest_chance)
+        {
+            t += _rand() * r->sc->rest_s;
+        }
+    }
+}
+
+/**
+ * @brief Run one scenario several times and print its line
+ */
+static void _scenario(const scenario_t *sc, const loop_watch_config_t *cfg, int runs)
+{
+    static run_t r;
+    int found = 0, missed = 0, wrong = 0;
+    double latency_sum = 0, latency_max = 0;
+
+    for (int n = 0; n < runs; n++)
+    {
+        memset(&r, 0, sizeof(r));
+        r.sc = sc;
+        _phrase(&r);
+
+        uint8_t chain[LOOPS];
+        int len = 2 + (int)(_rand() * (LOOPS - 1));
+        for (int i = 0; i < LOOPS; i++)
+        {
+            chain[i] = i;
+        }
+        for (int i = LOOPS - 1; i > 0; i--) // Shuffle
+        {
+            int j = (int)(_rand() * (i + 1));
+            uint8_t tmp = chain[i];
+            chain[i] = chain[j];
+            chain[j] = tmp;
+        }
+        for (int i = 0; i < LOOPS; i++)
+        {
+            double db = sc->min_gain_db + _rand() * (sc->max_gain_db - sc->min_gain_db);
+            r.gain[i] = pow(10, db / 20);
+        }
+        r.faulty = sc->fault ? chain[(int)(_rand() * len)] : -1;
+        r.fault_s = 4 + _rand() * (sc->length_s - 12);
+
+        uint16_t removed = 0;
+        _route(&r, chain, len, removed);
+        loop_watch_t watch;
+        loop_watch_init(&watch, cfg, 0);
+        double detected_s = -1;
+
+        double t = 0;
+        while (t < sc->length_s)
+        {
+            int8_t levels[TAPS];
+            for (uint8_t tap = 0; tap < TAPS; tap++)
+            {
+                t += SETTLE_MS / 1000.0;
+                level_acc_t acc;
+                level_reset(&acc);
+                uint16_t block[BLOCK_SAMPLES];
+                int samples = SAMPLE_RATE * DWELL_MS / 1000;
+                for (int i = 0; i < samples; i += BLOCK_SAMPLES)
+                {
+                    for (int k = 0; k < BLOCK_SAMPLES; k++)
+                    {
+                        double v = 2048 + _source(&r, tap, t + (double)(i + k) / SAMPLE_RATE);
+                        block[k] = (uint16_t)(v < 0 ? 0 : (v > 4095 ? 4095 : v));
+                    }
+                    level_add(&acc, block, BLOCK_SAMPLES);
+                }
+                t += DWELL_MS / 1000.0;
+                float rms_db, peak_db;
+                level_get(&acc, &rms_db, &peak_db);
+                levels[tap] = (int8_t)lroundf(rms_db);
+            }
+
+            uint16_t dead = loop_watch_update(&watch, r.send, levels, (uint32_t)(t * 1000));
+            for (int loop = 0; loop < LOOPS; loop++)
+            {
+                if (!(dead & (1 << loop)))
+                {
+                    continue;
+                }
+                if (loop == r.faulty && t >= r.fault_s && detected_s < 0)
+                {
+                    detected_s = t;
+                }
+                else
+                {
+                    wrong++;
+                }
+                removed |= 1 << loop; // Failover: route around it
+                _route(&r, chain, len, removed);
+            }
+        }
+
+        if (r.faulty >= 0)
+        {
+            if (detected_s < 0)
+            {
+                missed++;
+            }
+            else
+            {
+                found++;
+                double latency = detected_s - r.fault_s;
+                latency_sum += latency;
+                latency_max = latency > latency_max ? latency : latency_max;
+            }
+        }
+    }
+
+    if (sc->fault)
+    {
+        printf("  %-26s %4d runs %4d found %3d missed %3d wrong loop  latency mean %5.0f ms, max %5.0f ms\n", sc->name,
+               runs, found, missed, wrong, found ? 1000 * latency_sum / found : 0, 1000 * latency_max);
+    }
+    else
+    {
+        printf("  %-26s %4d runs of %2.0f s   %3d loops wrongly taken out\n", sc->name, runs, sc->length_s, wrong);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    loop_watch_config_t cfg = {
+        .window_ms = argc > 1 ? atoi(argv[1]) : 2000,
+        .active_db = argc > 2 ? atoi(argv[2]) : -40,
+        .drop_db = argc > 3 ? atoi(argv[3]) : 30,
+    };
+    int runs = argc > 4 ? atoi(argv[4]) : 20;
+
+    static const scenario_t scenarios[] = {
+        {"cable pulled", 0.1, 2.0, -6, 12, 1, 0, 30},
+        {"cable pulled, sparse", 0.5, 4.0, -6, 12, 1, 0, 40},
+        {"battery fading 6 dB/s", 0.1, 2.0, -6, 12, 2, 6, 40},
+        {"healthy", 0.1, 2.0, -6, 12, 0, 0, 30},
+        {"healthy, sparse", 0.5, 4.0, -6, 12, 0, 0, 30},
+        {"healthy, quiet pedals", 0.1, 2.0, -20, -10, 0, 0, 30},
+        {"healthy, high gain", 0.1, 2.0, 20, 30, 0, 0, 30},
+    };
+
+    printf("Window %lu ms, send at least %d dBFS, return %d dB below it\n", (unsigned long)cfg.window_ms,
+           cfg.active_db, cfg.drop_db);
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        _scenario(&scenarios[i], &cfg, runs);
+    }
+    printf("One scan of %d taps takes %d ms\n", TAPS, TAPS * (SETTLE_MS + DWELL_MS));
+    return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file midi_sim.c
+ * @brief The USB MIDI decoder and its batching on random traffic, on a host
+ *
+ * First a set of hand-made transfers with known results: channel filtering,
+ * malformed packets, the scene controller, and the order of a program change
+ * and a scene selection. Then random streams of event packets (program and
+ * control changes on any channel, notes, SysEx and malformed packets) are
+ * cut into transfers of 1 to 16 packets, as a host sends them. Every
+ * transfer is decoded into its own batch (midi_decode_usb()) and the
+ * batches are merged in order (midi_batch_merge()), as the TinyUSB task
+ * does while the buttons task is busy. The result must equal a scalar
+ * reference that applies the messages one at a time, and decoding the
+ * whole stream as one transfer.
+ *
+ * Reports the time to decode a full transfer of 16 packets.
+ *
+ * Build and run:
+ * @code
+ * cc -O2 -I main -o midi_sim tools/midi_sim.c main/midi_proto.c
+ * ./midi_sim [streams]
+ * @endcode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "midi_proto.h"
+
+#define TRANSFER_EVENTS 16 /**< Event packets in a full speed bulk transfer */
+#define STREAM_EVENTS 200  /**< Event packets in one random stream */
+
+/**
+ * @brief One hand-made transfer and what it must decode to
+ */
+typedef struct
+{
+    const char *name;
+    midi_map_t map;
+    int count;                          /**< Event packets */
+    uint8_t packets[8][MIDI_EVENT_SIZE];
+    int program;                        /**< Expected midi_batch_t.program */
+    int scene;                          /**< Expected midi_batch_t.scene */
+    int ignored;                        /**< Expected midi_batch_t.ignored */
+} case_t;
+
+static uint32_t seed = 12345;
+
+/** @brief Uniform in 0..n-1 */
+static int _rand(int n)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (int)((seed >> 8) % (uint32_t)n);
+}
+
+/**
+ * @brief Scalar reference: the messages applied one at a time
+ */
+static void _reference(const midi_map_t *map, const uint8_t *p, int count, int *program, int *scene)
+{
+    for (int i = 0; i < count; i++, p += MIDI_EVENT_SIZE)
+    {
+        int cin = p[0] & 0x0F, type = p[1] >> 4, channel = (p[1] & 0x0F) + 1;
+        if (type != cin || p[2] > 127 || p[3] > 127 || (map->channel != 0 && channel != map->channel))
+        {
+            continue;
+        }
+        if (type == 0xC)
+        {
+            *program = p[2];
+            *scene = -1;
+        }
+        else if (type == 0xB && map->scene_cc != MIDI_CC_NONE && p[2] == map->scene_cc)
+        {
+            *scene = p[3];
+        }
+    }
+}
+
+/**
+ * @brief Make a random event packet
+ */
+static void _random_event(uint8_t *p)
+{
+    int channel = _rand(3) ? 0 : _rand(16); // Mostly channel 1
+    int cable = _rand(8) ? 0 : _rand(16);
+    switch (_rand(8))
+    {
+    case 0:
+    case 1: // Program change
+        p[0] = cable << 4 | 0xC;
+        p[1] = 0xC0 | channel;
+        p[2] = _rand(128);
+        p[3] = 0;
+        break;
+    case 2:
+    case 3: // Control change, often the scene controller
+        p[0] = cable << 4 | 0xB;
+        p[1] = 0xB0 | channel;
+        p[2] = _rand(2) ? 69 : _rand(128);
+        p[3] = _rand(128);
+        break;
+    case 4: // Note on
+        p[0] = cable << 4 | 0x9;
+        p[1] = 0x90 | channel;
+        p[2] = _rand(128);
+        p[3] = _rand(128);
+        break;
+    case 5: // SysEx continuing
+        p[0] = cable << 4 | 0x4;
+        p[1] = 0xF0;
+        p[2] = _rand(128);
+        p[3] = _rand(128);
+        break;
+    default: // Anything, malformed included
+        for (int i = 0; i < MIDI_EVENT_SIZE; i++)
+        {
+            p[i] = _rand(256);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Check the hand-made transfers
+ *
+ * @return Failures
+ */
+static int _cases(void)
+{
+    static const case_t cases[] = {
+        {"program change", {0, 69}, 1, {{0x0C, 0xC0, 5, 0}}, 5, MIDI_NONE, 0},
+        {"other channel", {1, 69}, 2, {{0x0C, 0xC1, 5, 0}, {0x0C, 0xC0, 6, 0}}, 6, MIDI_NONE, 1},
+        {"any channel", {0, 69}, 1, {{0x0C, 0xCF, 7, 0}}, 7, MIDI_NONE, 0},
+        {"CIN disagrees with status", {0, 69}, 2, {{0x0B, 0xC0, 5, 0}, {0x0C, 0xB0, 69, 2}}, MIDI_NONE, MIDI_NONE, 2},
+        {"scene controller", {0, 69}, 2, {{0x0B, 0xB0, 69, 2}, {0x0B, 0xB0, 7, 100}}, MIDI_NONE, 2, 1},
+        {"no scene controller", {0, MIDI_CC_NONE}, 1, {{0x0B, 0xB0, 69, 2}}, MIDI_NONE, MIDI_NONE, 1},
+        {"scene before program", {0, 69}, 2, {{0x0B, 0xB0, 69, 2}, {0x0C, 0xC0, 3, 0}}, 3, MIDI_NONE, 0},
+        {"scene after program", {0, 69}, 2, {{0x0C, 0xC0, 3, 0}, {0x0B, 0xB0, 69, 1}}, 3, 1, 0},
+        {"last program wins", {0, 69}, 3, {{0x0C, 0xC0, 1, 0}, {0x0C, 0xC0, 2, 0}, {0x0C, 0xC0, 3, 0}}, 3, MIDI_NONE, 0},
+        {"notes and SysEx", {0, 69}, 3, {{0x09, 0x90, 60, 100}, {0x04, 0xF0, 1, 2}, {0x07, 0x03, 0xF7, 0}}, MIDI_NONE,
+         MIDI_NONE, 3},
+        {"cable number ignored", {0, 69}, 1, {{0x3C, 0xC0, 9, 0}}, 9, MIDI_NONE, 0},
+        {"data byte over 127", {0, 69}, 2, {{0x0C, 0xC0, 0x85, 0}, {0x0B, 0xB0, 69, 0x81}}, MIDI_NONE, MIDI_NONE, 2},
+    };
+    int fail = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        const case_t *c = &cases[i];
+        midi_batch_t batch;
+        midi_batch_init(&batch);
+        int n = midi_decode_usb(&c->map, &c->packets[0][0], c->count * MIDI_EVENT_SIZE + 3, &batch); // Partial tail
+        int ok = n == c->count && batch.events == c->count && batch.program == c->program &&
+                 batch.scene == c->scene && batch.ignored == c->ignored;
+        if (!ok)
+        {
+            printf("  %-28s FAILED: program %d scene %d ignored %d, expected %d %d %d\n", c->name, batch.program,
+                   batch.scene, batch.ignored, c->program, c->scene, c->ignored);
+            fail = 1;
+        }
+    }
+    printf("%zu hand-made transfers %s\n", sizeof(cases) / sizeof(cases[0]), fail ? "FAILED" : "passed");
+    return fail;
+}
+
+/**
+ * @brief Check random streams cut into transfers
+ *
+ * @return Failures
+ */
+static int _streams(int streams)
+{
+    static uint8_t stream[STREAM_EVENTS * MIDI_EVENT_SIZE];
+    int transfers = 0;
+    long events = 0, ignored = 0;
+    for (int s = 0; s < streams; s++)
+    {
+        midi_map_t map = {_rand(4) ? 1 : MIDI_CHANNEL_ANY, _rand(4) ? 69 : MIDI_CC_NONE};
+        for (int i = 0; i < STREAM_EVENTS; i++)
+        {
+            _random_event(&stream[i * MIDI_EVENT_SIZE]);
+        }
+
+        int ref_program = MIDI_NONE, ref_scene = MIDI_NONE;
+        _reference(&map, stream, STREAM_EVENTS, &ref_program, &ref_scene);
+
+        midi_batch_t merged, whole;
+        midi_batch_init(&merged);
+        for (int at = 0; at < STREAM_EVENTS;)
+        {
+            int n = 1 + _rand(TRANSFER_EVENTS);
+            n = at + n > STREAM_EVENTS ? STREAM_EVENTS - at : n;
+            midi_batch_t batch;
+            midi_batch_init(&batch);
+            midi_decode_usb(&map, &stream[at * MIDI_EVENT_SIZE], n * MIDI_EVENT_SIZE, &batch);
+            midi_batch_merge(&merged, &batch);
+            at += n;
+            transfers++;
+        }
+        midi_batch_init(&whole);
+        midi_decode_usb(&map, stream, sizeof(stream), &whole);
+
+        if (merged.program != ref_program || merged.scene != ref_scene || merged.events != STREAM_EVENTS ||
+            whole.program != ref_program || whole.scene != ref_scene || whole.ignored != merged.ignored)
+        {
+            printf("Stream %d MISMATCH: merged %d/%d, whole %d/%d, reference %d/%d\n", s, merged.program,
+                   merged.scene, whole.program, whole.scene, ref_program, ref_scene);
+            return 1;
+        }
+        events += merged.events;
+        ignored += merged.ignored;
+    }
+    printf("%d random streams, %d transfers, %ld events (%ld ignored): merged batches match the reference\n", streams,
+           transfers, events, ignored);
+    return 0;
+}
+
+/**
+ * @brief Time the decoding of full transfers
+ */
+static void _bench(void)
+{
+    enum
+    {
+        ROUNDS = 1 << 20
+    };
+    static uint8_t transfers[64][TRANSFER_EVENTS * MIDI_EVENT_SIZE];
+    for (int t = 0; t < 64; t++)
+    {
+        for (int i = 0; i < TRANSFER_EVENTS; i++)
+        {
+            _random_event(&transfers[t][i * MIDI_EVENT_SIZE]);
+        }
+    }
+    const midi_map_t map = {1, 69};
+    midi_batch_t batch;
+    midi_batch_init(&batch);
+    clock_t c0 = clock();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        midi_decode_usb(&map, transfers[r & 63], sizeof(transfers[0]), &batch);
+    }
+    clock_t c1 = clock();
+    printf("Per transfer of %d event packets: %.1f ns (%d)\n", TRANSFER_EVENTS,
+           1e9 * (c1 - c0) / CLOCKS_PER_SEC / ROUNDS, batch.program & 1);
+}
+
+int main(int argc, char **argv)
+{
+    int streams = argc > 1 ? atoi(argv[1]) : 20000;
+    int fail = _cases();
+    fail |= _streams(streams);
+    _bench();
+    return fail;
+}
@@ -0,0 +1,383 @@
+/**
+ * @file pitch_bench.c
+ * @brief Accuracy and speed of the tuner pitch detector on a host
+ *
+ * Without arguments, runs the detector on synthetic plucked strings across
+ * the guitar range, each detuned by a few cents and given harmonics, a weak
+ * fundamental or noise, and reports the error in cents against the true
+ * frequency together with the time per estimate.
+ *
+ * With WAV files, slides the detector over each recording at the tuner
+ * update rate. A file given as name.wav:HZ is checked against that
+ * frequency; otherwise the notes found are listed.
+ *
+ * Build and run:
+ * @code
+ * cc -O2 -I main -o pitch_bench tools/pitch_bench.c main/pitch.c main/vec.c -lm
+ * ./pitch_bench [guitar.wav[:HZ] ...]
+ * @endcode
+ *
+ * WAVs must be 16-bit PCM; only the first channel is used. They are
+ * resampled to the firmware input rate and scaled to the 12-bit unipolar
+ * range of the ESP32-S3 ADC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "pitch.h"
+
+#define SAMPLE_RATE 20000 /**< Input rate, as CONFIG_INPUT_SAMPLE_RATE */
+#define UPDATE_HZ 25      /**< Estimates per second, as CONFIG_TUNER_UPDATE_HZ */
+#define REF_HZ 440.0f     /**< A4 */
+#define GROSS_CENTS 50.0f /**< Errors beyond this are a wrong note */
+
+static pitch_detector_t det;
+
+/**
+ * @brief Detector settings used by the tuner
+ */
+static void _init(void)
+{
+    pitch_config_t cfg = {
+        .sample_rate = SAMPLE_RATE,
+        .min_hz = 55.0f,
+        .max_hz = 1400.0f,
+        .threshold = 0.15f,
+        .quiet_level = 16,
+    };
+    pitch_init(&det, &cfg);
+}
+
+/** @brief Uniform noise in -1..1 */
+static double _noise(void)
+{
+    return 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+/**
+ * @brief Synthesize a plucked string
+ *
+ * @param out Samples
+ * @param n Number of samples
+ * @param hz Fundamental
+ * @param fundamental Level of the fundamental relative to the second harmonic
+ * @param noise Noise level relative to the peak
+ */
+static void _string(uint16_t *out, size_t n, double hz, double fundamental, double noise)
+{
+    static const double harmonics[] = {1.0, 0.7, 0.45, 0.3, 0.2, 0.12, 0.08};
+    double phase[sizeof(harmonics) / sizeof(harmonics[0])];
+    for (size_t h = 0; h < sizeof(phase) / sizeof(phase[0]); h++)
+    {
+        phase[h] = 2 * M_PI * rand() / RAND_MAX;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        double t = (double)i / SAMPLE_RATE;
+        double v = 0;
+        for (size_t h = 0; h < sizeof(harmonics) / sizeof(harmonics[0]); h++)
+        {
+            double level = h == 0 ? harmonics[1] * fundamental : harmonics[h];
+            // Upper harmonics die out faster, as on a real string
+            v += level * exp(-t * (1.5 + h)) * sin(2 * M_PI * hz * (h + 1) * t + phase[h]);
+        }
+        v = v * 0.4 + noise * _noise() * 0.4;
+        out[i] = (uint16_t)lrint(2048 + 1500 * v);
+    }
+}
+
+/**
+ * @brief Error statistics of one test set
+ */
+typedef struct
+{
+    unsigned runs;
+    unsigned missed;
+    unsigned gross;
+    double abs_sum;
+    double abs_max;
+} score_t;
+
+/** @brief Add one estimate against the true frequency */
+static void _score(score_t *s, const pitch_result_t *r, double hz)
+{
+    s->runs++;
+    if (r->hz <= 0)
+    {
+        s->missed++;
+        return;
+    }
+    double err = fabs(1200.0 * log2(r->hz / hz));
+    if (err > GROSS_CENTS)
+    {
+        s->gross++;
+        return;
+    }
+    s->abs_sum += err;
+    if (err > s->abs_max)
+    {
+        s->abs_max = err;
+    }
+}
+
+/** @brief Print a score line */
+static void _print(const char *what, const score_t *s)
+{
+    unsigned good = s->runs - s->missed - s->gross;
+    printf("  %-28s %4u runs  %3u missed  %3u wrong note  error mean %.2f cents, max %.2f cents\n", what, s->runs,
+           s->missed, s->gross, good ? s->abs_sum / good : 0.0, s->abs_max);
+}
+
+/**
+ * @brief Synthetic strings across the range
+ *
+ * @return Number of wrong notes
+ */
+static unsigned _synthetic(void)
+{
+    static const double detune[] = {-37, -11, 0, 4, 23, 45};
+    static const struct
+    {
+        const char *what;
+        double fundamental;
+        double noise;
+    } sets[] = {
+        {"clean harmonics", 1.0, 0.0},
+        {"weak fundamental", 0.2, 0.0},
+        {"noise at -26 dB", 1.0, 0.05},
+    };
+    uint16_t frame[PITCH_FRAME];
+    unsigned wrong = 0;
+
+    printf("Synthetic strings, MIDI 38 (D2) to 76 (E5):\n");
+    for (size_t set = 0; set < sizeof(sets) / sizeof(sets[0]); set++)
+    {
+        score_t s = {0};
+        for (int midi = 38; midi <= 76; midi++)
+        {
+            for (size_t d = 0; d < sizeof(detune) / sizeof(detune[0]); d++)
+            {
+                double hz = REF_HZ * pow(2.0, (midi - 69 + detune[d] / 100.0) / 12.0);
+                _string(frame, PITCH_FRAME, hz, sets[set].fundamental, sets[set].noise);
+                pitch_result_t r;
+                pitch_detect(&det, frame, &r);
+                _score(&s, &r, hz);
+            }
+        }
+        _print(sets[set].what, &s);
+        wrong += s.missed + s.gross;
+    }
+
+    // Too quiet to tune, must not report anything
+    uint16_t quiet[PITCH_FRAME];
+    for (size_t i = 0; i < PITCH_FRAME; i++)
+    {
+        quiet[i] = (uint16_t)(2048 + lrint(4 * _noise()));
+    }
+    pitch_result_t r;
+    pitch_detect(&det, quiet, &r);
+    printf("  %-28s %s\n", "silence", r.hz > 0 ? "FALSE NOTE" : "nothing reported");
+    if (r.hz > 0)
+    {
+        wrong++;
+    }
+    return wrong;
+}
+
+/**
+ * @brief Time the detector on a low E, the longest useful lag range
+ */
+static void _bench(void)
+{
+    uint16_t frame[PITCH_FRAME];
+    _string(frame, PITCH_FRAME, 82.41, 1.0, 0.01);
+    pitch_result_t r;
+    const int runs = 2000;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < runs; i++)
+    {
+        pitch_detect(&det, frame, &r);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double us = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e3 / runs;
+    double lags = SAMPLE_RATE / det.cfg.min_hz + 2;
+    printf("Speed (%s kernel): %.1f us per estimate, %.0f M multiply-accumulates/s, %.2f %% of a host core at %d Hz\n",
+           det.kernel == PITCH_KERNEL_SIMD ? "SIMD" : "scalar", us, lags * PITCH_WINDOW / us, us * UPDATE_HZ / 1e4,
+           UPDATE_HZ);
+}
+
+/**
+ * @brief Read a 16-bit PCM WAV file, resampled to SAMPLE_RATE
+ *
+ * @param path File name
+ * @param[out] count Samples read
+ * @return First channel as 12-bit unipolar samples, or NULL
+ */
+static uint16_t *_read_wav(const char *path, size_t *count)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    uint8_t riff[12];
+    if (fread(riff, 1, sizeof(riff), f) != sizeof(riff) || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4))
+    {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    uint16_t channels = 0, bits = 0;
+    uint32_t rate = 0;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, sizeof(chunk), f) == sizeof(chunk))
+    {
+        uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+        if (!memcmp(chunk, "fmt ", 4))
+        {
+            uint8_t fmt[16];
+            if (size < sizeof(fmt) || fread(fmt, 1, sizeof(fmt), f) != sizeof(fmt))
+                break;
+            channels = fmt[2] | fmt[3] << 8;
+            rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | (uint32_t)fmt[7] << 24;
+            bits = fmt[14] | fmt[15] << 8;
+            fseek(f, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+        }
+        else if (!memcmp(chunk, "data", 4))
+        {
+            if (channels == 0 || bits != 16 || rate == 0)
+                break;
+            size_t frames = size / (2 * channels);
+            int16_t *pcm = malloc(size);
+            size_t n = (size_t)((double)frames * SAMPLE_RATE / rate);
+            uint16_t *out = malloc(n * sizeof(uint16_t) + 1);
+            if (!pcm || !out || fread(pcm, 2 * channels, frames, f) != frames)
+            {
+                free(pcm);
+                free(out);
+                break;
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                // Linear interpolation is enough below a few kHz
+                double pos = (double)i * rate / SAMPLE_RATE;
+                size_t j = (size_t)pos;
+                double frac = pos - j;
+                double a = pcm[j * channels];
+                double b = j + 1 < frames ? pcm[(j + 1) * channels] : a;
+                out[i] = (uint16_t)lrint((a + (b - a) * frac) / 16 + 2048);
+            }
+            free(pcm);
+            fclose(f);
+            *count = n;
+            return out;
+        }
+        else
+        {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+
+    fprintf(stderr, "%s: need 16-bit PCM\n", path);
+    fclose(f);
+    return NULL;
+}
+
+/**
+ * @brief Run the detector over a recording
+ *
+ * @param arg name.wav or name.wav:HZ
+ * @return Number of wrong notes against HZ, 0 without one
+ */
+static unsigned _recording(const char *arg)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s", arg);
+    double expect = 0;
+    char *colon = strrchr(path, ':');
+    if (colon && strstr(path, ".wav") < colon)
+    {
+        expect = atof(colon + 1);
+        *colon = '\0';
+    }
+
+    size_t count;
+    uint16_t *samples = _read_wav(path, &count);
+    if (!samples)
+    {
+        return 1;
+    }
+
+    score_t s = {0};
+    unsigned notes[128] = {0};
+    for (size_t pos = 0; pos + PITCH_FRAME <= count; pos += SAMPLE_RATE / UPDATE_HZ)
+    {
+        pitch_result_t r;
+        pitch_detect(&det, &samples[pos], &r);
+        if (expect > 0)
+        {
+            _score(&s, &r, expect);
+        }
+        else if (r.hz > 0)
+        {
+            int midi;
+            float cents;
+            pitch_to_note(r.hz, REF_HZ, &midi, &cents);
+            if (midi >= 0 && midi < 128)
+            {
+                notes[midi]++;
+            }
+            s.runs++;
+        }
+        else
+        {
+            s.runs++;
+            s.missed++;
+        }
+    }
+    free(samples);
+
+    printf("%s, %.1f s:\n", path, (double)count / SAMPLE_RATE);
+    if (expect > 0)
+    {
+        _print("against expected pitch", &s);
+        return s.gross;
+    }
+    printf("  %u estimates, %u without a note\n", s.runs, s.missed);
+    for (int m = 0; m < 128; m++)
+    {
+        if (notes[m])
+        {
+            printf("  %-3s%d %u\n", pitch_note_name(m), m / 12 - 1, notes[m]);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    _init();
+    srand(1);
+
+    unsigned wrong = 0;
+    if (argc < 2)
+    {
+        wrong = _synthetic();
+        _bench();
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        wrong += _recording(argv[i]);
+    }
+    return wrong ? 1 : 0;
+}
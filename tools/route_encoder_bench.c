@@ -0,0 +1,188 @@
+/**
+ * @file route_encoder_bench.c
+ * @brief The generated routing encoder against the table-driven one, on a host
+ *
+ * Enumerates every chain the board can route: every ordered selection of
+ * distinct fitted pedals, bypass included. Each chain is compiled with the
+ * generated encoder (route_encoder_compile()) and with a copy of the
+ * table-driven matrix_compile() reading the tables hw_profile.c builds for
+ * the same board; the routing chains must be equal for every chain, with the
+ * meter tap off and on and every set of outputs. Reports the time per chain
+ * of both, per chain length, with the default outputs.
+ *
+ * Build and run:
+ * @code
+ * python tools/route_encoder_gen.py boards/rev_a.json -o build/route_encoder_gen.c --tables build/route_encoder_tables.h
+ * cc -O2 -I main -I build -o route_encoder_bench tools/route_encoder_bench.c build/route_encoder_gen.c
+ * ./route_encoder_bench [rounds]
+ * @endcode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "route_encoder.h"
+#include "route_encoder_tables.h"
+
+#define PEDALS_MAX 8      /**< NUM_PEDALS_MAX */
+#define SINK_OUTPUT 8     /**< MATRIX_SINK_OUTPUT(0) */
+#define OUTPUT_TUNER 2    /**< MATRIX_OUTPUT_TUNER */
+#define OUTPUT_SETS 8     /**< Output masks, 1 << MATRIX_NUM_OUTPUTS */
+#define OUTPUTS_DEFAULT 0x05 /**< MATRIX_OUTPUTS_DEFAULT */
+#define FRAME_BYTES 24    /**< SR_FRAME_BYTES */
+#define ROUTE_BYTES 16    /**< MATRIX_ROUTE_BYTES */
+#define METER_OFF 0xFF    /**< MATRIX_METER_OFF */
+#define CHAINS_MAX 109601 /**< Ordered selections of up to 8 of 8 pedals */
+
+/**
+ * @brief One chain to compile
+ */
+typedef struct
+{
+    uint8_t pedal[PEDALS_MAX];
+    uint8_t len;
+} chain_t;
+
+static chain_t chains[CHAINS_MAX];
+static int chain_count;
+
+/**
+ * @brief Table-driven encoder, as matrix_compile()
+ */
+static void _compile_tables(const uint8_t *chain, uint8_t len, uint8_t outputs, uint8_t meter_tap, uint8_t *f)
+{
+    memset(f, 0, ROUTE_BYTES);
+    for (int s = 0; s < TABLE_NUM_SINKS; s++)
+    {
+        f[table_sink_inh_byte[s]] |= table_sink_inh_mask[s];
+    }
+    uint8_t source = 0;
+    for (int i = 0; i < len; i++)
+    {
+        uint8_t pedal_index = chain[i] - 1;
+        if (pedal_index >= TABLE_NUM_PEDALS)
+        {
+            continue;
+        }
+        f[table_sink_sel_byte[pedal_index]] |= source << table_sink_sel_shift[pedal_index];
+        f[table_sink_inh_byte[pedal_index]] &= ~table_sink_inh_mask[pedal_index];
+        source = pedal_index + 1;
+    }
+    for (int o = 0; SINK_OUTPUT + o < TABLE_NUM_SINKS; o++)
+    {
+        if (outputs & (1 << o))
+        {
+            int s = SINK_OUTPUT + o;
+            f[table_sink_sel_byte[s]] |= (o == OUTPUT_TUNER ? 0 : source) << table_sink_sel_shift[s];
+            f[table_sink_inh_byte[s]] &= ~table_sink_inh_mask[s];
+        }
+    }
+    if (meter_tap == METER_OFF)
+    {
+        f[table_meter_inh_byte] |= table_meter_inh_mask;
+    }
+    else
+    {
+        f[table_meter_sel_byte] |= meter_tap << table_meter_sel_shift;
+    }
+}
+
+/**
+ * @brief Add every chain that starts with @p prefix
+ */
+static void _enumerate(chain_t *prefix, unsigned used)
+{
+    chains[chain_count++] = *prefix;
+    if (prefix->len == TABLE_NUM_PEDALS)
+    {
+        return;
+    }
+    for (int p = 1; p <= TABLE_NUM_PEDALS; p++)
+    {
+        if (!(used & (1u << p)))
+        {
+            prefix->pedal[prefix->len++] = p;
+            _enumerate(prefix, used | (1u << p));
+            prefix->len--;
+        }
+    }
+}
+
+static double _now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+typedef void (*encoder_t)(const uint8_t *, uint8_t, uint8_t, uint8_t, uint8_t *);
+
+/**
+ * @brief Time an encoder on the chains of one length
+ *
+ * @return Nanoseconds per chain
+ */
+static double _time(encoder_t encode, const chain_t *set, int count, int rounds, unsigned *sink)
+{
+    uint8_t f[FRAME_BYTES + 1];
+    double t0 = _now_ns();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            encode(set[i].pedal, set[i].len, OUTPUTS_DEFAULT, METER_OFF, f);
+            *sink += f[i % ROUTE_BYTES];
+        }
+    }
+    return count ? (_now_ns() - t0) / ((double)count * rounds) : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    chain_t prefix = {0};
+    _enumerate(&prefix, 0);
+    printf("Board '%s', %d pedals: %d chains\n", route_encoder_board, TABLE_NUM_PEDALS, chain_count);
+
+    int mismatches = 0;
+    for (int i = 0; i < chain_count; i++)
+    {
+        for (int run = 0; run < 2 * OUTPUT_SETS; run++)
+        {
+            uint8_t meter_tap = (run & 1) ? chains[i].len : METER_OFF;
+            uint8_t outputs = run >> 1;
+            uint8_t a[FRAME_BYTES + 1] = {0}, b[FRAME_BYTES + 1] = {0};
+            _compile_tables(chains[i].pedal, chains[i].len, outputs, meter_tap, a);
+            route_encoder_compile(chains[i].pedal, chains[i].len, outputs, meter_tap, b);
+            if (memcmp(a, b, ROUTE_BYTES) != 0 && mismatches++ < 5)
+            {
+                printf("Mismatch on a chain of %d pedals, outputs 0x%02X, meter tap %d\n", chains[i].len, outputs,
+                       meter_tap);
+            }
+        }
+    }
+    printf("%d mismatches\n", mismatches);
+
+    static chain_t set[CHAINS_MAX];
+    unsigned sink = 0;
+    printf("len  chains  tables ns  generated ns\n");
+    for (int len = 0; len <= TABLE_NUM_PEDALS; len++)
+    {
+        int count = 0;
+        for (int i = 0; i < chain_count; i++)
+        {
+            if (chains[i].len == len)
+            {
+                set[count++] = chains[i];
+            }
+        }
+        int reps = rounds * (1 + CHAINS_MAX / (count * 8)); // Short lengths have few chains, repeat them more
+        double t = _time(_compile_tables, set, count, reps, &sink);
+        double g = _time(route_encoder_compile, set, count, reps, &sink);
+        printf("%3d  %6d  %9.1f  %12.1f\n", len, count, t, g);
+    }
+    return mismatches || sink == 1 ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+"""Generate the routing encoder of one board as unrolled C.
+
+Reads a board description (see boards/*.json) and writes a C source file
+with route_encoder_compile() (see main/route_encoder.h): matrix_compile()
+specialised for that wiring. The two routing chains are held as 64-bit
+words preset with every sink inhibited, every shift and mask is a constant
+and the chain slots are unrolled, so no table is read. Only the outputs the
+board wires get code. The build runs it
+when CONFIG_ROUTE_ENCODER_GENERATED is set.
+
+With --tables it also writes the lookup tables of the same board as a
+header, for the generic encoder in tools/route_encoder_bench.c.
+
+Examples:
+    python tools/route_encoder_gen.py boards/rev_a.json -o build/route_encoder_gen.c
+    python tools/route_encoder_gen.py boards/rev_a.json -o build/route_encoder_gen.c --tables build/route_encoder_tables.h
+"""
+
+import argparse
+import os
+import sys
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import hw_profile  # noqa: E402
+
+CHAIN_BYTES_MAX = 8  # SR_CHAIN_BYTES_MAX
+FRAME_SCRATCH = 3 * CHAIN_BYTES_MAX  # SR_FRAME_SCRATCH
+ROUTE_BYTES = 2 * CHAIN_BYTES_MAX  # Matrix and inhibit chains
+SINK_OUTPUT = hw_profile.NUM_PEDALS_MAX  # MATRIX_SINK_OUTPUT(0)
+METER_OFF = 0xFF
+
+
+def _place(lane):
+    """Frame byte and bit of a lane, as _compile_bit() and _compile_nibble() work them out."""
+    if lane == hw_profile.LANE_NONE:
+        return None
+    chain = hw_profile.lane_chain(lane)
+    if chain not in (hw_profile.CHAINS["matrix"], hw_profile.CHAINS["inhibit"]):
+        raise ValueError("routing lane 0x%02X is not in the matrix or inhibit chain" % lane)
+    bit = hw_profile.lane_bit(lane)
+    return chain * CHAIN_BYTES_MAX + bit // 8, bit % 8
+
+
+def _pedal_lanes(board):
+    """Lanes of the fitted pedal sinks if each kind sits in one chain, else None.
+
+    Returns (select chain, select bits, inhibit chain, inhibit bits), one bit
+    per fitted pedal.
+    """
+    sel = board["sink_sel_lane"][:board["num_pedals"]]
+    inh = board["sink_inh_lane"][:board["num_pedals"]]
+    if hw_profile.LANE_NONE in sel + inh:
+        return None
+    for lanes in (sel, inh):
+        for lane in lanes:
+            _place(lane)  # In the routing chains
+            if hw_profile.lane_chain(lane) != hw_profile.lane_chain(lanes[0]):
+                return None
+    return (hw_profile.lane_chain(sel[0]), [hw_profile.lane_bit(l) for l in sel],
+            hw_profile.lane_chain(inh[0]), [hw_profile.lane_bit(l) for l in inh])
+
+
+def _evenly_stepped(bits, step):
+    return all(bit == bits[0] + step * i for i, bit in enumerate(bits))
+
+
+def _word_feed(board, sink, source):
+    """C statements that feed a sink from a source expression, on the chain words."""
+    lines = []
+    sel_lanes, inh_lanes = hw_profile.sink_lanes(board)
+    sel = sel_lanes[sink]
+    if sel != hw_profile.LANE_NONE and source != "0":  # Source 0 leaves the cleared nibble as it is
+        _place(sel)
+        lines.append("w[%d] |= (uint64_t)%s << %d;" % (hw_profile.lane_chain(sel), source, hw_profile.lane_bit(sel)))
+    inh = inh_lanes[sink]
+    if inh != hw_profile.LANE_NONE:
+        _place(inh)
+        lines.append("w[%d] &= ~(1ULL << %d);" % (hw_profile.lane_chain(inh), hw_profile.lane_bit(inh)))
+    return lines
+
+
+def generate(board, board_path):
+    """Return the C source of the encoder.
+
+    Each chain slot is a few shifts on the two routing chains held as 64-bit
+    words. On evenly stepped wiring the shifts are worked out from the pedal
+    number; otherwise they come from a constant array, or, if a kind of lane
+    is spread over both chains, from a switch on the pedal.
+    """
+    crc = zlib.crc32(hw_profile.pack_payload(board)) & 0xFFFFFFFF
+    preset = [0] * ROUTE_BYTES
+    for lane in hw_profile.sink_lanes(board)[1]:
+        inh = _place(lane)
+        if inh:
+            preset[inh[0]] |= 1 << inh[1]
+    lanes = _pedal_lanes(board)
+
+    out = []
+    out.append("/* Generated by tools/route_encoder_gen.py from %s. Do not edit. */" % os.path.basename(board_path))
+    out.append("")
+    out.append("#include \"route_encoder.h\"")
+    out.append("")
+    out.append("const char route_encoder_board[] = \"%s\";" % board["name"])
+    out.append("const uint32_t route_encoder_profile_crc = 0x%08X;" % crc)
+    out.append("")
+    if lanes:
+        sel_chain, sel_bits, inh_chain, inh_bits = lanes
+        if _evenly_stepped(sel_bits, 4) and _evenly_stepped(inh_bits, 1):
+            sel_shift = "%d + 4 * index" % sel_bits[0]
+            inh_shift = "%d + index" % inh_bits[0]
+        else:
+            out.append("/** @brief Bit of each pedal's select nibble and inhibit bit in its chain word */")
+            out.append("static const uint8_t sel_bit[%d] = {%s};" % (len(sel_bits), ", ".join(map(str, sel_bits))))
+            out.append("static const uint8_t inh_bit[%d] = {%s};" % (len(inh_bits), ", ".join(map(str, inh_bits))))
+            out.append("")
+            sel_shift = "sel_bit[index]"
+            inh_shift = "inh_bit[index]"
+        out.append("/** @brief Feed the send of a pedal from a source, return the source its return gives */")
+        out.append("static inline uint8_t _send(uint64_t *w, uint8_t pedal, uint8_t source)")
+        out.append("{")
+        out.append("    unsigned index = pedal - 1u;")
+        out.append("    if (index >= %d)" % board["num_pedals"])
+        out.append("    {")
+        out.append("        return source; // Not fitted on this board")
+        out.append("    }")
+        out.append("    w[%d] |= (uint64_t)source << (%s);" % (sel_chain, sel_shift))
+        out.append("    w[%d] &= ~(1ULL << (%s));" % (inh_chain, inh_shift))
+        out.append("    return pedal;")
+        out.append("}")
+    else:
+        out.append("/** @brief Feed the send of a pedal from a source, return the source its return gives */")
+        out.append("static inline uint8_t _send(uint64_t *w, uint8_t pedal, uint8_t source)")
+        out.append("{")
+        out.append("    switch (pedal)")
+        out.append("    {")
+        for pedal in range(1, board["num_pedals"] + 1):
+            out.append("    case %d:" % pedal)
+            for line in _word_feed(board, pedal - 1, "source"):
+                out.append("        " + line)
+            out.append("        return %d;" % pedal)
+        out.append("    default:")
+        out.append("        return source; // Not fitted on this board")
+        out.append("    }")
+        out.append("}")
+    out.append("")
+    out.append("void route_encoder_compile(const uint8_t *chain, uint8_t len, uint8_t outputs, uint8_t meter_tap, "
+               "uint8_t *f)")
+    out.append("{")
+    words = [sum(preset[c * CHAIN_BYTES_MAX + j] << (8 * j) for j in range(CHAIN_BYTES_MAX)) for c in range(2)]
+    out.append("    uint64_t w[2] = {0x%016XULL, 0x%016XULL}; // Every sink inhibited" % tuple(words))
+    out.append("    uint8_t source = 0;")
+    for slot in range(hw_profile.NUM_PEDALS_MAX):
+        out.append("    if (len > %d)" % slot)
+        out.append("    {")
+        out.append("        source = _send(w, chain[%d], source);" % slot)
+        out.append("    }")
+    out.append("    for (int i = %d; i < len; i++)" % hw_profile.NUM_PEDALS_MAX)
+    out.append("    {")
+    out.append("        source = _send(w, chain[i], source);")
+    out.append("    }")
+    for i, output in enumerate(hw_profile.OUTPUTS):
+        lines = _word_feed(board, SINK_OUTPUT + i, "0" if output == "tuner" else "source")
+        if not lines:
+            continue  # Not wired on this board
+        out.append("    if (outputs & 0x%02X)" % (1 << i))
+        out.append("    {")
+        for line in lines:
+            out.append("        " + line)
+        out.append("    }")
+    sel = board["meter_sel_lane"]
+    inh = board["meter_inh_lane"]
+    if sel != hw_profile.LANE_NONE or inh != hw_profile.LANE_NONE:
+        out.append("    if (meter_tap == 0x%02X)" % METER_OFF)
+        out.append("    {")
+        if inh != hw_profile.LANE_NONE:
+            _place(inh)
+            out.append("        w[%d] |= 1ULL << %d;" % (hw_profile.lane_chain(inh), hw_profile.lane_bit(inh)))
+        out.append("    }")
+        out.append("    else")
+        out.append("    {")
+        if sel != hw_profile.LANE_NONE:
+            _place(sel)
+            out.append("        w[%d] |= (uint64_t)meter_tap << %d;" % (hw_profile.lane_chain(sel), hw_profile.lane_bit(sel)))
+        out.append("    }")
+    else:
+        out.append("    (void)meter_tap; // No meter tap on this board")
+    out.append("")
+    for c in range(2):
+        for j in range(CHAIN_BYTES_MAX):
+            out.append("    f[%d] = (uint8_t)(w[%d] >> %d);" % (c * CHAIN_BYTES_MAX + j, c, 8 * j))
+    out.append("}")
+    return "\n".join(out) + "\n"
+
+
+def generate_tables(board):
+    """Return a header with the lookup tables hw_profile.c compiles for the board."""
+    def nibble(lane):
+        place = _place(lane)
+        return place if place else (FRAME_SCRATCH, 0)
+
+    def bit(lane):
+        place = _place(lane)
+        return (place[0], 1 << place[1]) if place else (FRAME_SCRATCH, 0)
+
+    sel_lanes, inh_lanes = hw_profile.sink_lanes(board)
+    sel = [nibble(l) for l in sel_lanes]
+    inh = [bit(l) for l in inh_lanes]
+    meter_sel = nibble(board["meter_sel_lane"])
+    meter_inh = bit(board["meter_inh_lane"])
+
+    def row(values):
+        return "{" + ", ".join(str(v) for v in values) + "}"
+
+    out = []
+    out.append("/* Generated by tools/route_encoder_gen.py. Do not edit. */")
+    out.append("#define TABLE_NUM_PEDALS %d" % board["num_pedals"])
+    out.append("#define TABLE_NUM_SINKS %d" % len(sel))
+    out.append("static const uint8_t table_sink_sel_byte[] = %s;" % row(s[0] for s in sel))
+    out.append("static const uint8_t table_sink_sel_shift[] = %s;" % row(s[1] for s in sel))
+    out.append("static const uint8_t table_sink_inh_byte[] = %s;" % row(i[0] for i in inh))
+    out.append("static const uint8_t table_sink_inh_mask[] = %s;" % row(i[1] for i in inh))
+    out.append("static const uint8_t table_meter_sel_byte = %d, table_meter_sel_shift = %d;" % meter_sel)
+    out.append("static const uint8_t table_meter_inh_byte = %d, table_meter_inh_mask = %d;" % meter_inh)
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("board", help="board description JSON")
+    parser.add_argument("-o", "--output", required=True, help="C source to write")
+    parser.add_argument("--tables", help="also write the lookup tables of the board as a header")
+    args = parser.parse_args()
+
+    board = hw_profile.load(args.board)
+    with open(args.output, "w") as f:
+        f.write(generate(board, args.board))
+    if args.tables:
+        with open(args.tables, "w") as f:
+            f.write(generate_tables(board))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+"""Compile a set list into a show image for the ESP32 Patch Bay.
+
+Takes a set list, the preset library it refers to and the board description
+(see boards/*.json), and writes the binary show image that the firmware maps
+from the "show" partition. Every route is compiled here, the way
+matrix_compile() does on the board, so the firmware only indexes into the
+image. The layout must match show_header_t, show_song_t and show_step_t in
+main/show.h and matrix_plan_t in main/matrix.h.
+
+Examples:
+    python tools/show_compile.py shows/example_setlist.json shows/example_presets.json \\
+        boards/rev_a.json -o build/show.bin
+    esptool.py write_flash 0x190000 build/show.bin
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import hw_profile  # noqa: E402
+
+MAGIC = 0x574F4853
+VERSION = 2
+NAME_LEN = 16
+CHAIN_LEN = 8
+SCENES_MAX = 8
+CHAIN_BYTES_MAX = 8  # SR_CHAIN_BYTES_MAX
+ROUTE_BYTES = 2 * CHAIN_BYTES_MAX  # Matrix and inhibit chains
+PARTITION_SIZE = 0x40000  # partitions.csv
+
+SINK_OUTPUT = hw_profile.NUM_PEDALS_MAX  # Sink of the first output, MATRIX_SINK_OUTPUT(0)
+SOURCE_GUITAR = 0
+OUTPUTS_DEFAULT = ("amp_a", "tuner")  # MATRIX_OUTPUTS_DEFAULT
+
+PLAN_ROUTE = 0x01
+PLAN_CONTROLS = 0x02
+PLAN_CONTROLS_FIRST = 0x04
+
+HEADER = struct.Struct("<IHHIIIHHIIII16s")
+SONG = struct.Struct("<16s8sBBBBBIHHI4s4s4s")
+STEP = struct.Struct("<16sHH")
+PLAN = struct.Struct("<BBH")
+
+
+class ShowError(Exception):
+    pass
+
+
+def _frame_byte(lane):
+    """Frame byte and bit of a lane, as _compile_bit() and _compile_nibble() work them out."""
+    chain = hw_profile.lane_chain(lane)
+    if chain not in (hw_profile.CHAINS["matrix"], hw_profile.CHAINS["inhibit"]):
+        raise ShowError("routing lane 0x%02X is not in the matrix or inhibit chain" % lane)
+    bit = hw_profile.lane_bit(lane)
+    return chain * CHAIN_BYTES_MAX + bit // 8, bit % 8
+
+
+def compile_route(board, chain, outputs):
+    """Compile a chain into the routing chain bytes, as matrix_compile() does with the meter tap off."""
+    route = bytearray(ROUTE_BYTES)
+    sel_lanes, inh_lanes = hw_profile.sink_lanes(board)
+
+    def inhibit(lane, on):
+        if lane == hw_profile.LANE_NONE:
+            return
+        byte, bit = _frame_byte(lane)
+        if on:
+            route[byte] |= 1 << bit
+        else:
+            route[byte] &= ~(1 << bit) & 0xFF
+
+    def feed(sink, source):
+        lane = sel_lanes[sink]
+        if lane != hw_profile.LANE_NONE:
+            byte, shift = _frame_byte(lane)
+            route[byte] |= source << shift
+        inhibit(inh_lanes[sink], False)
+
+    for lane in inh_lanes:
+        inhibit(lane, True)
+    source = SOURCE_GUITAR
+    for pedal in chain:
+        feed(pedal - 1, source)
+        source = pedal
+    for i, output in enumerate(hw_profile.OUTPUTS):
+        if outputs & (1 << i):
+            feed(SINK_OUTPUT + i, SOURCE_GUITAR if output == "tuner" else source)
+    inhibit(board["meter_inh_lane"], True)
+    return bytes(route)
+
+
+def _mask(pedals):
+    mask = 0
+    for pedal in pedals:
+        mask |= 1 << (pedal - 1)
+    return mask
+
+
+def _controls(board, names, where):
+    """Control mask from control output names or numbers (1-based)."""
+    mask = 0
+    for name in names:
+        if isinstance(name, int):
+            index = name - 1
+        elif name in board["ctl_name"]:
+            index = board["ctl_name"].index(name)
+        else:
+            raise ShowError("%s: no control output named %r" % (where, name))
+        if not 0 <= index < hw_profile.NUM_CONTROLS or board["ctl_lane"][index] == hw_profile.LANE_NONE:
+            raise ShowError("%s: control output %r is not wired" % (where, name))
+        mask |= 1 << index
+    return mask
+
+
+def _outputs(board, names, where):
+    """Output mask from output names (amp_a, amp_b, tuner)."""
+    sel_lanes = hw_profile.sink_lanes(board)[0]
+    mask = 0
+    for name in names:
+        if name not in hw_profile.OUTPUTS:
+            raise ShowError("%s: no output named %r, use %s" % (where, name, ", ".join(hw_profile.OUTPUTS)))
+        index = hw_profile.OUTPUTS.index(name)
+        if sel_lanes[SINK_OUTPUT + index] == hw_profile.LANE_NONE and name not in OUTPUTS_DEFAULT:
+            raise ShowError("%s: output %r is not wired" % (where, name))
+        mask |= 1 << index
+    return mask
+
+
+def _midi(entries, channel, where):
+    """MIDI bytes from program changes, control changes and raw hex strings."""
+    out = bytearray()
+    for entry in entries:
+        if "pc" in entry:
+            out += bytes([0xC0 | channel, int(entry["pc"]) & 0x7F])
+        elif "cc" in entry:
+            number, value = entry["cc"]
+            out += bytes([0xB0 | channel, int(number) & 0x7F, int(value) & 0x7F])
+        elif "raw" in entry:
+            out += bytes.fromhex(entry["raw"])
+        else:
+            raise ShowError("%s: MIDI entry needs pc, cc or raw: %r" % (where, entry))
+    return bytes(out)
+
+
+def compile_song(board, presets, song, channel):
+    """Resolve a set list entry against the preset library and compile its scenes."""
+    where = "song %r" % song.get("name", "?")
+    if song["preset"] not in presets:
+        raise ShowError("%s: no preset %r in the library" % (where, song["preset"]))
+    preset = dict(presets[song["preset"]])
+    preset.update({k: v for k, v in song.items() if k in ("chain", "scenes", "controls", "outputs", "tempo_bpm")})
+
+    chain = [int(p) for p in preset.get("chain", [])]
+    if len(chain) > CHAIN_LEN or len(set(chain)) != len(chain):
+        raise ShowError("%s: chain %r is too long or repeats a pedal" % (where, chain))
+    for pedal in chain:
+        if not 1 <= pedal <= board["num_pedals"]:
+            raise ShowError("%s: pedal %d is not fitted on board %r" % (where, pedal, board["name"]))
+
+    scenes = preset.get("scenes", [])
+    if len(scenes) > SCENES_MAX:
+        raise ShowError("%s: at most %d scenes" % (where, SCENES_MAX))
+    scene = int(song.get("scene", 1)) - 1
+    if not 0 <= scene < max(1, len(scenes)):
+        raise ShowError("%s: no scene %d" % (where, scene + 1))
+    outputs = _outputs(board, preset.get("outputs", OUTPUTS_DEFAULT), where)
+    steps = []
+    for pedals in scenes or [chain]:
+        playing = [p for p in chain if p in pedals]  # As _scene_chain() reduces the chain
+        steps.append((compile_route(board, playing, outputs), _mask(pedals)))
+
+    tempo = preset.get("tempo_bpm")
+    return {
+        "name": song.get("name", song["preset"]),
+        "chain": chain,
+        "scene_count": len(scenes),
+        "scene": scene,
+        "ctl_mask": _controls(board, preset.get("controls", []), where),
+        "outputs": outputs,
+        "tap_period_us": int(round(60e6 / tempo)) if tempo else 0,
+        "steps": steps,
+        "midi": _midi(song.get("midi", []), channel, where),
+    }
+
+
+def plan(board, frm, to, settle_us):
+    """Latch plan for switching from song frm (None if unknown) to song to."""
+    active = to["steps"][to["scene"]][0]
+    if frm is None:
+        route = True
+        controls = any(lane != hw_profile.LANE_NONE for lane in board["ctl_lane"])
+    else:
+        route = any(step[0] != active for step in frm["steps"])  # Any scene may be playing
+        controls = frm["ctl_mask"] != to["ctl_mask"]
+    flags = (PLAN_ROUTE if route else 0) | (PLAN_CONTROLS if controls else 0)
+    if route and controls and settle_us:
+        flags |= PLAN_CONTROLS_FIRST
+    return PLAN.pack(flags, 0, settle_us if flags & PLAN_CONTROLS_FIRST else 0)
+
+
+def build_image(board, setlist, presets):
+    """Compile the whole show and return the image bytes."""
+    channel = int(setlist.get("midi_channel", 1)) - 1
+    if not 0 <= channel < 16:
+        raise ShowError("midi_channel must be 1-16")
+    settle_us = min(int(round(float(setlist.get("control_settle_ms", 0)) * 1000)), 0xFFFF)
+    songs = [compile_song(board, presets, song, channel) for song in setlist["songs"]]
+    if not songs:
+        raise ShowError("the set list has no songs")
+
+    song_table = bytearray()
+    step_table = bytearray()
+    midi = bytearray()
+    step_count = 0
+    for i, s in enumerate(songs):
+        plans = [
+            plan(board, songs[i - 1] if i > 0 else None, s, settle_us),
+            plan(board, songs[i + 1] if i + 1 < len(songs) else None, s, settle_us),
+            plan(board, None, s, settle_us),
+        ]
+        song_table += SONG.pack(s["name"].encode()[:NAME_LEN - 1].ljust(NAME_LEN, b"\0"),
+                                bytes(s["chain"]).ljust(CHAIN_LEN, b"\0"), len(s["chain"]),
+                                s["scene_count"], s["scene"], s["ctl_mask"], s["outputs"], s["tap_period_us"],
+                                step_count, len(s["midi"]), len(midi), *plans)
+        for route, mask in s["steps"]:
+            step_table += STEP.pack(route, mask, 0)
+        step_count += len(s["steps"])
+        midi += s["midi"]
+    if len(songs) > 0xFFFF or step_count > 0xFFFF:
+        raise ShowError("too many songs or steps")
+
+    songs_offset = HEADER.size
+    steps_offset = songs_offset + len(song_table)
+    midi_offset = steps_offset + len(step_table)
+    body = bytes(song_table + step_table + midi)
+    header = HEADER.pack(MAGIC, VERSION, 0, len(body), zlib.crc32(body) & 0xFFFFFFFF,
+                         zlib.crc32(hw_profile.pack_payload(board)) & 0xFFFFFFFF, len(songs), step_count,
+                         songs_offset, steps_offset, midi_offset, len(midi),
+                         setlist.get("name", "show").encode()[:NAME_LEN - 1].ljust(NAME_LEN, b"\0"))
+    return header + body, songs, step_count
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("setlist", help="set list JSON")
+    parser.add_argument("presets", help="preset library JSON")
+    parser.add_argument("board", help="board description JSON")
+    parser.add_argument("-o", "--output", required=True, help="show image to write")
+    parser.add_argument("--partition-size", type=lambda v: int(v, 0), default=PARTITION_SIZE,
+                        help="size of the show partition (default 0x%X)" % PARTITION_SIZE)
+    args = parser.parse_args()
+
+    with open(args.setlist) as f:
+        setlist = json.load(f)
+    with open(args.presets) as f:
+        presets = json.load(f)["presets"]
+    try:
+        image, songs, step_count = build_image(hw_profile.load(args.board), setlist, presets)
+    except (ShowError, KeyError, ValueError) as e:
+        print("error: %s" % e, file=sys.stderr)
+        return 1
+    if len(image) > args.partition_size:
+        print("error: %d byte image does not fit the %d byte partition" % (len(image), args.partition_size),
+              file=sys.stderr)
+        return 1
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print("%s: %d songs, %d steps, %d MIDI bytes, %d bytes" % (args.output, len(songs), step_count,
+                                                              sum(len(s["midi"]) for s in songs), len(image)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
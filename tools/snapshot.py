@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+"""Export, restore and inspect configuration snapshots of the ESP32 Patch Bay.
+
+A snapshot holds every stored record of a unit: patch chains, their
+settings (scenes, tempo, control outputs), the preset prediction table and
+the hardware profile. It moves a whole setup from one unit to another.
+The unit must be built with CONFIG_TELEMETRY_ENABLE and a Host link RX pin;
+the image format is described in main/snapshot_proto.h and the commands in
+main/host_link.h.
+
+Examples:
+    python tools/snapshot.py export /dev/ttyUSB0 rig.pbsn
+    python tools/snapshot.py show rig.pbsn
+    python tools/snapshot.py restore /dev/ttyUSB1 rig.pbsn
+    python tools/snapshot.py restore /dev/ttyUSB1 rig.pbsn --no-profile
+"""
+
+import argparse
+import binascii
+import os
+import struct
+import sys
+import time
+
+MAGIC = b"PBSN"
+VERSION = 1
+NAMESPACES = ["patch", "profile"]  # snapshot_ns_t
+CHUNK = 192  # HOST_LINK_CHUNK
+TIMEOUT_S = 1.0
+RETRIES = 5
+
+
+class SnapshotError(Exception):
+    pass
+
+
+# --- Image format ---
+
+def parse(image):
+    """Check an image and return its records as (ns, key, data) tuples."""
+    if len(image) < 12 or image[:4] != MAGIC:
+        raise SnapshotError("not a snapshot")
+    if image[4] == 0 or image[4] > VERSION:
+        raise SnapshotError("snapshot version %d not supported" % image[4])
+    if binascii.crc32(image[:-4]) != struct.unpack("<I", image[-4:])[0]:
+        raise SnapshotError("CRC mismatch")
+    count = struct.unpack("<H", image[6:8])[0]
+    records = []
+    pos = 8
+    for _ in range(count):
+        if pos + 2 > len(image) - 4:
+            raise SnapshotError("snapshot ends inside a record")
+        ns, key_len = image[pos], image[pos + 1]
+        key = image[pos + 2:pos + 2 + key_len].decode("ascii")
+        pos += 2 + key_len
+        length = struct.unpack("<H", image[pos:pos + 2])[0]
+        pos += 2
+        records.append((ns, key, image[pos:pos + length]))
+        pos += length
+    if pos != len(image) - 4:
+        raise SnapshotError("%d bytes after the last record" % (len(image) - 4 - pos))
+    return records
+
+
+def build(records):
+    """Make an image from (ns, key, data) tuples."""
+    out = bytearray(MAGIC + struct.pack("<BBH", VERSION, 0, len(records)))
+    for ns, key, data in records:
+        out += struct.pack("<BB", ns, len(key)) + key.encode("ascii") + struct.pack("<H", len(data)) + data
+    out += struct.pack("<I", binascii.crc32(out))
+    return bytes(out)
+
+
+# --- Framing, as main/telemetry_proto.h ---
+
+def crc16(data):
+    return binascii.crc_hqx(data, 0xFFFF)  # link_crc16(), CRC-16/CCITT-FALSE
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+        else:
+            block.append(b)
+            if len(block) == 0xFE:
+                out += b"\xff" + block
+                block = bytearray()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out) + b"\x00"
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+
+def read_varint(data, pos=0):
+    """Read a varint at pos and return (value, position after it)."""
+    v, shift = 0, 0
+    while pos < len(data):
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, pos
+    raise SnapshotError("frame ends inside a varint")
+
+
+def read_status(payload):
+    """Read the offset or length and the status of a unit frame."""
+    at, pos = read_varint(payload)
+    status, _ = read_varint(payload, pos)
+    return at, status
+
+
+class Link:
+    """Frames to and from a unit on its telemetry UART."""
+
+    def __init__(self, path, baud):
+        import termios
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        speed = getattr(termios, "B%d" % baud, None)
+        if speed is None:
+            raise SystemExit("baud rate %d not supported by termios" % baud)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[0] = attrs[1] = attrs[3] = 0  # Raw, no translation or flow control
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        attrs[4] = attrs[5] = speed
+        attrs[6][termios.VMIN] = 0
+        attrs[6][termios.VTIME] = 1
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+        self.buf = bytearray()
+
+    def send(self, kind, payload=b""):
+        frame = kind.encode("ascii") + payload
+        os.write(self.fd, b"\x00" + cobs_encode(frame + struct.pack("<H", crc16(frame))))
+
+    def receive(self, kinds, timeout=TIMEOUT_S):
+        """Next frame of one of the kinds as (kind, payload), None on timeout. Telemetry frames are skipped."""
+        end = time.monotonic() + timeout
+        while time.monotonic() < end:
+            cut = self.buf.find(0)
+            if cut < 0:
+                self.buf += os.read(self.fd, 4096)
+                continue
+            raw = bytes(self.buf[:cut])
+            del self.buf[:cut + 1]
+            frame = cobs_decode(raw) if raw else None
+            if not frame or len(frame) < 3 or crc16(frame[:-2]) != struct.unpack("<H", frame[-2:])[0]:
+                continue
+            kind = chr(frame[0])
+            if kind in kinds:
+                return kind, frame[1:-2]
+        return None
+
+
+# --- Commands ---
+
+def export(link):
+    image = bytearray()
+    link.send("E")
+    while True:
+        got = link.receive("SF", timeout=5.0)
+        if got is None:
+            raise SnapshotError("no answer from the unit; is the host link RX pin set?")
+        kind, payload = got
+        if kind == "S":
+            offset, pos = read_varint(payload)
+            if offset != len(image):
+                raise SnapshotError("data frame lost at offset %d" % len(image))
+            image += payload[pos:]
+            continue
+        length, status = read_status(payload)
+        if status:
+            raise SnapshotError("unit reported error 0x%x" % status)
+        if length != len(image):
+            raise SnapshotError("received %d of %d bytes" % (len(image), length))
+        return bytes(image)
+
+
+def restore(link, image):
+    offset = 0
+    tries = 0
+    while offset < len(image):
+        chunk = image[offset:offset + CHUNK]
+        link.send("R", varint(offset) + chunk)
+        got = link.receive("A")
+        if got is None:
+            tries += 1
+            if tries > RETRIES:
+                raise SnapshotError("no acknowledge at offset %d" % offset)
+            continue
+        tries = 0
+        at, status = read_status(got[1])
+        if status:
+            raise SnapshotError("unit refused the image at offset %d: error 0x%x" % (offset, status))
+        offset = at
+        print("\r%d / %d bytes" % (offset, len(image)), end="", file=sys.stderr)
+    print(file=sys.stderr)
+    link.send("C")
+    got = link.receive("A", timeout=5.0)
+    if got is None:
+        raise SnapshotError("no acknowledge of the commit")
+    _, status = read_status(got[1])
+    if status:
+        raise SnapshotError("unit could not store the snapshot: error 0x%x" % status)
+
+
+def show(image):
+    for ns, key, data in parse(image):
+        name = NAMESPACES[ns] if ns < len(NAMESPACES) else "ns %d" % ns
+        text = "%-8s %-14s %4d bytes" % (name, key, len(data))
+        if ns == 0 and key.startswith("preset_") and data:
+            text += "  chain %s" % (" ".join(str(p) for p in data[1:1 + data[0]]) or "(empty)")
+        print(text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("export", help="read a snapshot from a unit")
+    p.add_argument("port")
+    p.add_argument("file")
+    p = sub.add_parser("restore", help="write a snapshot to a unit, which then restarts")
+    p.add_argument("port")
+    p.add_argument("file")
+    p.add_argument("--no-profile", action="store_true", help="keep the unit's own hardware profile")
+    p = sub.add_parser("show", help="list the records of a snapshot")
+    p.add_argument("file")
+    for p in sub.choices.values():
+        if "port" in [a.dest for a in p._actions]:
+            p.add_argument("--baud", type=int, default=921600, help="baud rate (default 921600, CONFIG_TELEMETRY_BAUD)")
+    args = parser.parse_args()
+
+    try:
+        if args.command == "export":
+            image = export(Link(args.port, args.baud))
+            records = parse(image)
+            with open(args.file, "wb") as f:
+                f.write(image)
+            print("%d records, %d bytes" % (len(records), len(image)))
+        elif args.command == "restore":
+            with open(args.file, "rb") as f:
+                records = parse(f.read())
+            if args.no_profile:
+                records = [r for r in records if r[0] != NAMESPACES.index("profile")]
+            restore(Link(args.port, args.baud), build(records))
+            print("%d records restored, the unit restarts" % len(records))
+        else:
+            with open(args.file, "rb") as f:
+                show(f.read())
+    except SnapshotError as e:
+        print("error: %s" % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,330 @@
+#!/usr/bin/env python3
+"""Show the telemetry stream of the ESP32 Patch Bay live.
+
+Reads the stream the firmware sends with CONFIG_TELEMETRY_ENABLE from a
+serial port (or a capture file) and shows it as a table of counters, rates,
+the press to latch histogram and the latest trace events, or as a scrolling
+plot of one counter. The wire format is described in main/telemetry_proto.h;
+the counter numbers are telemetry_metric_t in main/telemetry.h.
+
+Examples:
+    python tools/telemetry_view.py /dev/ttyUSB0
+    python tools/telemetry_view.py /dev/ttyUSB0 --plot checked.preset
+    python tools/telemetry_view.py /dev/ttyUSB0 --capture set.bin
+    python tools/telemetry_view.py set.bin --dump
+"""
+
+import argparse
+import binascii
+import collections
+import os
+import sys
+import time
+
+ACTIONS = ["edit", "preset", "scene", "song"]  # deadline_action_t
+EVENTS = ["input", "action", "staged", "latched", "miss"]  # deadline_event_t
+HIST_BUCKETS = 12  # DEADLINE_HIST_BUCKETS
+PATHS = ["missed", "compiled", "preshifted"]  # preset_predict_path_t
+
+METRICS = (["checked." + a for a in ACTIONS] + ["misses." + a for a in ACTIONS] +
+           ["hist.%d" % i for i in range(HIST_BUCKETS)] + ["recalls." + p for p in PATHS] +
+           ["top_hits", "control.overruns", "control.over_budget", "control.jitter_us", "free_heap", "skipped"])
+LEVELS = {"control.jitter_us", "free_heap"}  # Not counters: shown as values, not rates
+HOST_LINK_KINDS = {ord(k) for k in "SFA"}  # HOST_LINK_KIND_DATA, _END, _ACK
+
+
+def hist_label(bucket):
+    """Range of a histogram bucket, as deadline.c fills them."""
+    if bucket == 0:
+        return "< 128 us"
+    if bucket == HIST_BUCKETS - 1:
+        return ">= %d us" % (64 << bucket)
+    return "< %d us" % (128 << bucket)
+
+
+class FrameError(Exception):
+    pass
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise FrameError("bad COBS block")
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class Reader:
+    """Walks one frame."""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise FrameError("frame too short")
+        self.pos += 1
+        return self.data[self.pos - 1]
+
+    def varint(self):
+        value = shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value & 0xFFFFFFFF
+
+
+def zigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+class Stream:
+    """Viewer side of telemetry_state_t: the values the frames so far add up to."""
+
+    def __init__(self):
+        self.synced = False
+        self.values = [0] * len(METRICS)
+        self.ms = 0
+        self.event_us = 0
+        self.seq = None
+        self.frames = self.bad = self.gaps = self.lost = 0
+
+    def feed(self, raw):
+        """Decode one frame (without its delimiter). Returns the events in it, None if it was dropped."""
+        try:
+            data = cobs_decode(raw)
+            if len(data) < 3 or binascii.crc_hqx(data[:-2], 0xFFFF) != data[-2] | data[-1] << 8:
+                raise FrameError("CRC mismatch")
+            r = Reader(data[:-2])
+            kind = r.byte()
+            if kind in HOST_LINK_KINDS:
+                return None  # Answers to tools/snapshot.py, not telemetry
+            if kind not in (ord("K"), ord("D")):
+                raise FrameError("unknown frame kind %r" % kind)
+            seq = r.varint()
+            key = kind == ord("K")
+            if not key and (not self.synced or seq != (self.seq + 1) & 0xFFFFFFFF):
+                self.synced = False  # Deltas against a frame we do not have: wait for a key frame
+                self.gaps += 1
+                return None
+            values = [0] * len(METRICS) if key else list(self.values)
+            ms = (0 if key else self.ms) + r.varint()
+            changed = r.varint()
+            for i in range(32):
+                if changed & (1 << i):
+                    delta = zigzag(r.varint())
+                    if i < len(values):
+                        values[i] = (values[i] + delta) & 0xFFFFFFFF
+            lost = r.varint()
+            events = []
+            event_us = 0 if key else self.event_us
+            for _ in range(r.byte()):
+                event_us = (event_us + r.varint()) & 0xFFFFFFFF
+                code = r.byte()
+                events.append((event_us, code & 0x0F, code >> 4, r.varint()))
+        except FrameError:
+            self.bad += 1
+            return None
+        self.synced = True
+        self.seq, self.values, self.ms, self.event_us = seq, values, ms, event_us
+        self.frames += 1
+        self.lost += lost
+        return events
+
+
+def open_source(path, baud):
+    """Open a serial port in raw mode at the baud rate, or a capture file."""
+    if path == "-":
+        return sys.stdin.buffer.raw, False
+    fd = os.open(path, os.O_RDONLY | os.O_NOCTTY)
+    if not os.isatty(fd):
+        return os.fdopen(fd, "rb", buffering=0), False
+    import termios
+    speed = getattr(termios, "B%d" % baud, None)
+    if speed is None:
+        raise SystemExit("baud rate %d not supported by termios" % baud)
+    attrs = termios.tcgetattr(fd)
+    attrs[0] = 0  # iflag: no translation, no flow control
+    attrs[1] = 0  # oflag
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0  # lflag: raw
+    attrs[4] = attrs[5] = speed
+    attrs[6][termios.VMIN] = 0
+    attrs[6][termios.VTIME] = 1  # Return after 0.1 s without bytes, to keep the screen moving
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return os.fdopen(fd, "rb", buffering=0), True
+
+
+def frames(src, tty, capture):
+    """Yield the raw frames of the stream, or None when the port has been quiet for a moment."""
+    buf = bytearray()
+    while True:
+        chunk = src.read(4096)
+        if capture:
+            capture.write(chunk)
+        if not chunk:
+            if tty:
+                yield None
+                continue
+            return
+        buf += chunk
+        while True:
+            end = buf.find(0)
+            if end < 0:
+                break
+            if end:
+                yield bytes(buf[:end])
+            del buf[:end + 1]
+
+
+def event_text(event):
+    t_us, ev, action, arg = event
+    name = EVENTS[ev] if ev < len(EVENTS) else "event %d" % ev
+    text = "%10.3f ms  %-8s %-7s" % (t_us / 1000.0, name, ACTIONS[action] if action < len(ACTIONS) else action)
+    if name in ("latched", "miss"):
+        text += " %d us%s" % (arg, " over" if name == "miss" else "")
+    elif name == "staged":
+        text += " preshifted" if arg else ""
+    return text
+
+
+class Table:
+    """Full screen table, redrawn a few times a second."""
+
+    def __init__(self, stream):
+        self.stream = stream
+        self.events = collections.deque(maxlen=12)
+        self.history = collections.deque()  # (ms, values) of the last seconds, for the rates
+        self.drawn = 0.0
+
+    def add(self, events):
+        self.events.extend(events)
+        self.history.append((self.stream.ms, list(self.stream.values)))
+        while self.history and self.stream.ms - self.history[0][0] > 5000:
+            self.history.popleft()
+
+    def rate(self, i):
+        if len(self.history) < 2:
+            return 0.0
+        (ms0, v0), (ms1, v1) = self.history[0], self.history[-1]
+        return ((v1[i] - v0[i]) & 0xFFFFFFFF) * 1000.0 / (ms1 - ms0) if ms1 > ms0 else 0.0
+
+    def draw(self, force=False):
+        now = time.monotonic()
+        if not force and now - self.drawn < 0.25:
+            return
+        self.drawn = now
+        s, v = self.stream, self.stream.values
+        out = ["\x1b[H\x1b[2J"]
+        out.append("up %.1f s  frames %d  bad %d  gaps %d  events lost %d%s" %
+                   (s.ms / 1000.0, s.frames, s.bad, s.gaps, s.lost, "" if s.synced else "  (waiting for a key frame)"))
+        out.append("")
+        out.append("%-8s %10s %8s %10s" % ("action", "latched", "/s", "misses"))
+        for a, name in enumerate(ACTIONS):
+            out.append("%-8s %10d %8.2f %10d" % (name, v[a], self.rate(a), v[len(ACTIONS) + a]))
+        out.append("")
+        hist = v[2 * len(ACTIONS):2 * len(ACTIONS) + HIST_BUCKETS]
+        top = max(hist) or 1
+        out.append("press to latch")
+        for b, n in enumerate(hist):
+            out.append("%12s %8d %s" % (hist_label(b), n, "#" * (40 * n // top)))
+        out.append("")
+        for name in METRICS[2 * len(ACTIONS) + HIST_BUCKETS:]:
+            i = METRICS.index(name)
+            if name in LEVELS:
+                out.append("%-20s %10d" % (name, v[i]))
+            else:
+                out.append("%-20s %10d %8.2f/s" % (name, v[i], self.rate(i)))
+        out.append("")
+        out.append("latest events")
+        out.extend("  " + event_text(e) for e in self.events)
+        sys.stdout.write("\n".join(out) + "\n")
+        sys.stdout.flush()
+
+
+class Plot:
+    """One line per frame: a bar of the rate (or level) of one counter."""
+
+    def __init__(self, stream, name, width):
+        self.stream = stream
+        self.index = METRICS.index(name)
+        self.level = name in LEVELS
+        self.width = width
+        self.last = None
+        self.peak = 1.0
+
+    def add(self, events):
+        value = self.stream.values[self.index]
+        ms = self.stream.ms
+        if self.level:
+            y = float(value)
+        elif self.last is None or ms <= self.last[0]:
+            self.last = (ms, value)
+            return
+        else:
+            y = ((value - self.last[1]) & 0xFFFFFFFF) * 1000.0 / (ms - self.last[0])
+        self.last = (ms, value)
+        self.peak = max(self.peak, y)
+        print("%10.2f s %12.2f |%s" % (ms / 1000.0, y, "#" * int(self.width * y / self.peak)))
+
+    def draw(self, force=False):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="serial port, capture file or - for stdin")
+    parser.add_argument("--baud", type=int, default=921600, help="baud rate (default 921600, CONFIG_TELEMETRY_BAUD)")
+    parser.add_argument("--plot", metavar="COUNTER", choices=METRICS,
+                        help="plot one counter instead of the table: %s" % ", ".join(METRICS))
+    parser.add_argument("--width", type=int, default=60, help="width of the plot bars")
+    parser.add_argument("--capture", metavar="FILE", help="also write the raw stream to a file, to replay later")
+    parser.add_argument("--dump", action="store_true", help="print every frame and event instead")
+    args = parser.parse_args()
+
+    src, tty = open_source(args.source, args.baud)
+    capture = open(args.capture, "wb") if args.capture else None
+    stream = Stream()
+    if args.dump:
+        view = None
+    elif args.plot:
+        view = Plot(stream, args.plot, args.width)
+    else:
+        view = Table(stream)
+    try:
+        for raw in frames(src, tty, capture):
+            events = stream.feed(raw) if raw is not None else None
+            if events is not None:
+                if view:
+                    view.add(events)
+                else:
+                    changed = {METRICS[i]: v for i, v in enumerate(stream.values) if v}
+                    print("seq %d  %.3f s  %s" % (stream.seq, stream.ms / 1000.0,
+                                                  " ".join("%s=%d" % kv for kv in changed.items())))
+                    for e in events:
+                        print("    " + event_text(e))
+            if view:
+                view.draw()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if capture:
+            capture.close()
+    if view:
+        view.draw(force=True)
+    else:
+        print("%d frames, %d bad, %d gaps, %d events lost" % (stream.frames, stream.bad, stream.gaps, stream.lost))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
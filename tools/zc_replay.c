@@ -0,0 +1,182 @@
+/**
+ * @file zc_replay.c
+ * @brief Replay a WAV recording through the zero crossing scheduler on a host
+ *
+ * Feeds the recording to the detector in the same block size the firmware
+ * reads from the ADC, requests a route switch at pseudo-random times and
+ * reports how far the scheduled switches landed from the nearest real zero
+ * crossing, next to what switching right away would have given.
+ *
+ * Build and run:
+ * @code
+ * cc -O2 -I main -o zc_replay tools/zc_replay.c main/zero_cross.c
+ * ./zc_replay guitar.wav [max_wait_us] [hysteresis] [quiet_level]
+ * @endcode
+ *
+ * The WAV must be 16-bit PCM; only the first channel is used. Samples are
+ * scaled to the 12-bit unipolar range of the ESP32-S3 ADC and processed at
+ * the sample rate of the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "zero_cross.h"
+
+#define BLOCK_SAMPLES 64      /**< Samples per ADC frame, as in input_adc.h */
+#define MIN_LEAD_US 200       /**< Time to arm the latch timer, as in zc_sync.c */
+#define REQUEST_SPACING_MS 97 /**< Average time between switch requests */
+
+/**
+ * @brief Read a 16-bit PCM WAV file
+ *
+ * @param path File name
+ * @param[out] rate Sample rate
+ * @param[out] count Samples read
+ * @return First channel as 12-bit unipolar samples, or NULL
+ */
+static uint16_t *_read_wav(const char *path, uint32_t *rate, size_t *count)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    uint8_t riff[12];
+    if (fread(riff, 1, sizeof(riff), f) != sizeof(riff) || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4))
+    {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    uint16_t channels = 0, bits = 0;
+    *rate = 0;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, sizeof(chunk), f) == sizeof(chunk))
+    {
+        uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+        if (!memcmp(chunk, "fmt ", 4))
+        {
+            uint8_t fmt[16];
+            if (size < sizeof(fmt) || fread(fmt, 1, sizeof(fmt), f) != sizeof(fmt))
+                break;
+            channels = fmt[2] | fmt[3] << 8;
+            *rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | (uint32_t)fmt[7] << 24;
+            bits = fmt[14] | fmt[15] << 8;
+            fseek(f, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+        }
+        else if (!memcmp(chunk, "data", 4))
+        {
+            if (channels == 0 || bits != 16 || *rate == 0)
+                break;
+            size_t frames = size / (2 * channels);
+            int16_t *pcm = malloc(size);
+            uint16_t *out = malloc(frames * sizeof(uint16_t));
+            if (!pcm || !out || fread(pcm, 2 * channels, frames, f) != frames)
+            {
+                free(pcm);
+                free(out);
+                break;
+            }
+            for (size_t i = 0; i < frames; i++)
+            {
+                out[i] = (uint16_t)((pcm[i * channels] >> 4) + 2048);
+            }
+            free(pcm);
+            fclose(f);
+            *count = frames;
+            return out;
+        }
+        else
+        {
+            fseek(f, size + (size & 1), SEEK_CUR);
+        }
+    }
+
+    fprintf(stderr, "%s: need 16-bit PCM\n", path);
+    fclose(f);
+    return NULL;
+}
+
+/**
+ * @brief Print the statistics of one detector
+ */
+static void _report(const char *what, const zc_detector_t *det, uint32_t rate)
+{
+    static const char *reasons[ZC_FIRE_REASON_COUNT] = {"predicted", "quiet", "unstable", "timeout"};
+    double us_per_unit = 1e6 / ((double)rate * (1 << ZC_TIME_FRAC));
+
+    printf("%s:\n", what);
+    for (int r = 0; r < ZC_FIRE_REASON_COUNT; r++)
+    {
+        printf("  %-10s %u\n", reasons[r], det->stats.fires[r]);
+    }
+    if (det->stats.measured)
+    {
+        printf("  alignment error over %u switches: mean %.1f us, max %.1f us\n", det->stats.measured,
+               det->stats.err_abs_sum * us_per_unit / det->stats.measured, det->stats.err_abs_max * us_per_unit);
+    }
+    else
+    {
+        printf("  no switch could be measured\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s file.wav [max_wait_us] [hysteresis] [quiet_level]\n", argv[0]);
+        return 2;
+    }
+
+    uint32_t rate;
+    size_t count;
+    uint16_t *samples = _read_wav(argv[1], &rate, &count);
+    if (!samples)
+    {
+        return 1;
+    }
+    uint32_t max_wait_us = argc > 2 ? strtoul(argv[2], NULL, 0) : 5000;
+
+    zc_config_t cfg = {
+        .hysteresis = argc > 3 ? strtoul(argv[3], NULL, 0) : 24,
+        .quiet_level = argc > 4 ? strtoul(argv[4], NULL, 0) : 48,
+        .max_period = rate / 40, // Lowest note tracked, as in zc_sync.c
+    };
+    zc_detector_t scheduled, immediate;
+    zc_init(&scheduled, &cfg);
+    zc_init(&immediate, &cfg);
+
+#define US_TO_TIME(us) ((zc_time_t)((uint64_t)(us) * rate * (1 << ZC_TIME_FRAC) / 1000000))
+    srand(1);
+    size_t next_request = rate * REQUEST_SPACING_MS / 1000;
+    for (size_t pos = 0; pos + BLOCK_SAMPLES <= count; pos += BLOCK_SAMPLES)
+    {
+        zc_feed(&scheduled, &samples[pos], BLOCK_SAMPLES);
+        zc_feed(&immediate, &samples[pos], BLOCK_SAMPLES);
+
+        if (pos + BLOCK_SAMPLES >= next_request)
+        {
+            // The request comes in somewhere during the next block
+            zc_time_t now = zc_now(&scheduled) + (zc_time_t)(rand() % ZC_TIME(BLOCK_SAMPLES));
+            zc_fire_reason_t reason;
+            zc_time_t at = zc_schedule(&scheduled, now + US_TO_TIME(MIN_LEAD_US), now + US_TO_TIME(max_wait_us), &reason);
+            zc_note_fire(&scheduled, at, reason);
+            zc_note_fire(&immediate, now, ZC_FIRE_UNSTABLE);
+
+            next_request += rate * (REQUEST_SPACING_MS / 2 + rand() % REQUEST_SPACING_MS) / 1000;
+        }
+    }
+
+    printf("%s: %zu samples at %u Hz, max wait %u us\n", argv[1], count, rate, max_wait_us);
+    _report("zero-crossing scheduled", &scheduled, rate);
+    _report("switched immediately", &immediate, rate);
+    free(samples);
+    return 0;
+}